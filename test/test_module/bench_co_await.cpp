@@ -0,0 +1,259 @@
+/**
+ * C++20协程前端与有栈协程的对比基准
+ * 同一种IOManager上分别运行：
+ *     fiber : HttpServer，每个连接一个执行handleClient的有栈协程
+ *     co    : co_await实现的HTTP服务，每个连接一个CoTask
+ * 两者使用同样的HttpRequestParser与ServletDispatch，只有连接的执行方式不同
+ * 统计保持N个空闲keep-alive连接时每个连接的内存(RSS增量)，以及并发客户端的每秒请求数
+ * 每种方式在单独的子进程中运行，避免前一轮释放的内存被后一轮复用
+ */
+#include "../../webs/webs.h"
+#include "../../webs/http_module/http_server.h"
+#include "../../webs/http_module/http_parser.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <future>
+#include <thread>
+
+static webs::Logger::ptr g_logger = WEBS_LOG_ROOT();
+
+// 空闲连接数量
+static const size_t s_idle_conns = 2000;
+// 压测的客户端线程数量与时长
+static const size_t s_clients = 8;
+static const uint64_t s_duration_ms = 2000;
+
+static const char s_request[] = "GET /hello HTTP/1.1\r\nHost: bench\r\nConnection: keep-alive\r\n\r\n";
+
+/* 当前进程的RSS(字节) */
+static size_t GetRss() {
+    FILE *fp = fopen("/proc/self/statm", "r");
+    if (!fp) {
+        return 0;
+    }
+    long size = 0;
+    long resident = 0;
+    if (fscanf(fp, "%ld %ld", &size, &resident) != 2) {
+        resident = 0;
+    }
+    fclose(fp);
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+static webs::http::ServletDispatch::ptr CreateDispatch(webs::http::ServletDispatch::ptr sd) {
+    sd->addServlet("/hello", [](webs::http::HttpRequest::ptr req, webs::http::HttpResponse::ptr rsp, webs::http::HttpSession::ptr session) {
+        rsp->setBody("hello");
+        return 0;
+    });
+    return sd;
+}
+
+/* co_await版本的handleClient：与HttpSession::recvRequest/sendResponse相同的解析与发送流程 */
+static webs::CoTask<> CoHandleClient(int fd, webs::http::ServletDispatch::ptr dispatch) {
+    uint64_t buff_size = webs::http::HttpRequestParser::GetHttpRequestBufferSize();
+    while (true) {
+        webs::http::HttpRequestParser::ptr parser(new webs::http::HttpRequestParser());
+        std::unique_ptr<char[]> buffer(new char[buff_size]);
+        char *data = buffer.get();
+        size_t offset = 0;
+        bool ok = false;
+        while (true) {
+            ssize_t len = co_await webs::CoRead(fd, data + offset, buff_size - offset);
+            if (len <= 0) {
+                break;
+            }
+            len += offset;
+            size_t nparse = parser->execute(data, len);
+            if (parser->hasError()) {
+                break;
+            }
+            offset = len - nparse;
+            if (offset == buff_size) {
+                break;
+            }
+            if (parser->isFinished()) {
+                ok = true;
+                break;
+            }
+        }
+        if (!ok) {
+            break;
+        }
+        webs::http::HttpRequest::ptr request = parser->getData();
+        request->init();
+        webs::http::HttpResponse::ptr response(new webs::http::HttpResponse(request->getVersion(), request->isClose()));
+        response->setHeader("Server", "co_await");
+        dispatch->handle(request, response, nullptr);
+        std::string rsp = response->toString();
+        if (co_await webs::CoWriteAll(fd, rsp.c_str(), rsp.size()) <= 0 || request->isClose()) {
+            break;
+        }
+    }
+    close(fd);
+}
+
+static webs::CoTask<> CoAcceptLoop(int listen_fd, webs::http::ServletDispatch::ptr dispatch) {
+    while (true) {
+        int fd = co_await webs::CoAccept(listen_fd);
+        if (fd < 0) {
+            break;
+        }
+        webs::CoSpawn(CoHandleClient(fd, dispatch));
+    }
+}
+
+/* 连接服务端(阻塞socket，客户端线程不hook) */
+static int Connect(uint16_t port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(fd, (sockaddr *)&addr, sizeof(addr))) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* 发送一个请求并读完响应 */
+static bool Request(int fd) {
+    if (write(fd, s_request, sizeof(s_request) - 1) != (ssize_t)sizeof(s_request) - 1) {
+        return false;
+    }
+    char buf[1024];
+    size_t len = 0;
+    while (true) {
+        ssize_t n = read(fd, buf + len, sizeof(buf) - len - 1);
+        if (n <= 0) {
+            return false;
+        }
+        len += n;
+        buf[len] = '\0';
+        const char *end = strstr(buf, "\r\n\r\n");
+        if (!end) {
+            continue;
+        }
+        const char *cl = strcasestr(buf, "content-length:");
+        size_t body = cl && cl < end ? strtoul(cl + 15, nullptr, 10) : 0;
+        if (len >= (size_t)(end + 4 - buf) + body) {
+            return true;
+        }
+    }
+}
+
+/* 一种方式的完整测试；在子进程中执行 */
+static void Bench(bool co) {
+    webs::IOManager iom(1, false, co ? "co" : "fiber");
+    uint16_t port = 0;
+    webs::http::HttpServer::ptr server;
+    int listen_fd = -1;
+    if (co) {
+        listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+        int val = 1;
+        setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &val, sizeof(val));
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t len = sizeof(addr);
+        WEBS_ASSERT(bind(listen_fd, (sockaddr *)&addr, len) == 0 && listen(listen_fd, 4096) == 0);
+        getsockname(listen_fd, (sockaddr *)&addr, &len);
+        port = ntohs(addr.sin_port);
+        webs::FdMgr::GetInstance()->get(listen_fd, true);
+        webs::CoSpawn(CoAcceptLoop(listen_fd, CreateDispatch(std::make_shared<webs::http::ServletDispatch>())), &iom);
+    } else {
+        // 监听socket需要在hook的线程中创建(非阻塞)
+        std::promise<uint16_t> bound;
+        iom.schedule([&]() {
+            server.reset(new webs::http::HttpServer(true, &iom, &iom, &iom));
+            CreateDispatch(server->getServletDispatch());
+            webs::Address::ptr addr = webs::Address::LookupAnyIPAddress("127.0.0.1:0");
+            WEBS_ASSERT(server->bind(addr));
+            server->start();
+            bound.set_value(std::static_pointer_cast<webs::IPAddress>(server->getSocks()[0]->getLocalAddress())->getPort());
+        });
+        port = bound.get_future().get();
+    }
+
+    // 预热：分配器与协程池进入稳定状态
+    std::vector<int> fds;
+    for (size_t i = 0; i < 64; ++i) {
+        int fd = Connect(port);
+        WEBS_ASSERT(fd >= 0 && Request(fd));
+        fds.push_back(fd);
+    }
+    for (int fd : fds) {
+        close(fd);
+    }
+    fds.clear();
+    usleep(100 * 1000);
+
+    // 空闲连接：每个连接完成一次请求后停在读下一个请求
+    size_t rss_before = GetRss();
+    for (size_t i = 0; i < s_idle_conns; ++i) {
+        int fd = Connect(port);
+        WEBS_ASSERT(fd >= 0 && Request(fd));
+        fds.push_back(fd);
+    }
+    usleep(100 * 1000);
+    size_t rss_after = GetRss();
+
+    // 每秒请求数
+    std::atomic<uint64_t> requests{0};
+    std::atomic<bool> stop{false};
+    std::vector<std::thread> clients;
+    uint64_t start = webs::GetCurrentMS();
+    for (size_t i = 0; i < s_clients; ++i) {
+        clients.emplace_back([&]() {
+            int fd = Connect(port);
+            while (fd >= 0 && !stop && Request(fd)) {
+                ++requests;
+            }
+            close(fd);
+        });
+    }
+    usleep(s_duration_ms * 1000);
+    stop = true;
+    for (auto &i : clients) {
+        i.join();
+    }
+    uint64_t elapsed = webs::GetCurrentMS() - start;
+    for (int fd : fds) {
+        close(fd);
+    }
+
+    std::cout << (co ? "co_await" : "fiber   ")
+              << " idle_conns = " << s_idle_conns
+              << " rss/conn = " << (rss_after > rss_before ? (rss_after - rss_before) / s_idle_conns : 0) << "B"
+              << " clients = " << s_clients
+              << " rps = " << requests * 1000 / (elapsed ? elapsed : 1)
+              << std::endl;
+
+    if (co) {
+        // 在调度器线程中关闭，唤醒并结束accept协程
+        iom.schedule([listen_fd]() { close(listen_fd); });
+    } else {
+        server->stop();
+    }
+}
+
+int main(int argc, char **argv) {
+    g_logger->setLevel(webs::LogLevel::ERROR);
+    WEBS_LOG_NAME("system")->setLevel(webs::LogLevel::ERROR);
+    for (int i = 0; i < 2; ++i) {
+        for (bool co : {false, true}) {
+            pid_t pid = fork();
+            if (pid == 0) {
+                Bench(co);
+                return 0;
+            }
+            waitpid(pid, nullptr, 0);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,105 @@
+/**
+ * 协程上下文切换基准测试
+ * 分别测试 ucontext(swapcontext) 与 汇编实现(webs_switch_context) 每秒能完成的切换次数，
+ * 以及当前编译选择的实现下 Fiber::call/back 的切换次数
+ */
+#include "../../webs/webs.h"
+
+#include <time.h>
+#include <stdlib.h>
+
+static webs::Logger::ptr g_logger = WEBS_LOG_ROOT();
+
+// 每种实现的往返次数(一次往返 = 两次切换)
+static const uint64_t s_rounds = 5000000;
+static const size_t s_stack_size = 64 * 1024;
+
+static uint64_t NowNS() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void report(const char *name, uint64_t switches, uint64_t ns) {
+    std::cout << name << " switches = " << switches
+              << " ns/switch = " << (double)ns / switches
+              << " switches/s = " << (uint64_t)(switches * 1e9 / ns) << std::endl;
+}
+
+static ucontext_t s_main_uc;
+static ucontext_t s_fiber_uc;
+
+static void UcontextFunc() {
+    while (true) {
+        swapcontext(&s_fiber_uc, &s_main_uc);
+    }
+}
+
+static void bench_ucontext() {
+    void *stack = malloc(s_stack_size);
+    getcontext(&s_fiber_uc);
+    s_fiber_uc.uc_link = nullptr;
+    s_fiber_uc.uc_stack.ss_sp = stack;
+    s_fiber_uc.uc_stack.ss_size = s_stack_size;
+    makecontext(&s_fiber_uc, &UcontextFunc, 0);
+
+    uint64_t start = NowNS();
+    for (uint64_t i = 0; i < s_rounds; ++i) {
+        swapcontext(&s_main_uc, &s_fiber_uc);
+    }
+    report("ucontext", s_rounds * 2, NowNS() - start);
+    free(stack);
+}
+
+#ifdef WEBS_HAS_ASM_CONTEXT
+static void *s_main_sp = nullptr;
+static void *s_fiber_sp = nullptr;
+
+static void AsmFunc() {
+    while (true) {
+        webs_switch_context(&s_fiber_sp, s_main_sp);
+    }
+}
+
+static void bench_asm() {
+    void *stack = malloc(s_stack_size);
+    s_fiber_sp = webs::MakeAsmContext(stack, s_stack_size, &AsmFunc);
+
+    uint64_t start = NowNS();
+    for (uint64_t i = 0; i < s_rounds; ++i) {
+        webs_switch_context(&s_main_sp, s_fiber_sp);
+    }
+    report("asm     ", s_rounds * 2, NowNS() - start);
+    free(stack);
+}
+#endif
+
+/* 当前编译选择的实现下 Fiber::call / back 的开销 */
+static void bench_fiber() {
+    webs::Fiber::GetThis();
+    webs::Fiber::ptr fiber(new webs::Fiber([]() {
+        webs::Fiber *cur = webs::Fiber::GetThis().get();
+        while (true) {
+            cur->back();
+        }
+    },
+                                           s_stack_size, true));
+    uint64_t start = NowNS();
+    for (uint64_t i = 0; i < s_rounds; ++i) {
+        fiber->call();
+    }
+    std::string name = std::string("Fiber(") + webs::ContextBackendName() + ")";
+    report(name.c_str(), s_rounds * 2, NowNS() - start);
+}
+
+int main(int argc, char **argv) {
+    g_logger->setLevel(webs::LogLevel::ERROR);
+    WEBS_LOG_NAME("system")->setLevel(webs::LogLevel::ERROR);
+    bench_ucontext();
+#ifdef WEBS_HAS_ASM_CONTEXT
+    bench_asm();
+#endif
+    bench_fiber();
+    // 测试协程没有执行完，直接退出
+    _exit(0);
+}
@@ -0,0 +1,94 @@
+/**
+ * NUMA亲和性基准测试
+ * 工作窃取模式下，每个工作线程不均匀地产生子任务，子任务读取产生者first touch的缓冲区
+ * 统计子任务在其他NUMA节点执行的比例(跨节点访问缓冲区)以及吞吐
+ * 对比：不绑定CPU 与 按 scheduler.cpus 绑定CPU(同节点优先窃取)
+ * 只有一个NUMA节点的机器上跨节点比例恒为0，只能对比吞吐
+ */
+#include "../../webs/webs.h"
+
+#include <time.h>
+
+static webs::Logger::ptr g_logger = WEBS_LOG_ROOT();
+
+// 每个产生者的子任务数量基数；第i个产生者产生 (i + 1) * s_base 个
+static const size_t s_base = 20000;
+// 子任务读取的缓冲区大小
+static const size_t s_buffer_size = 64 * 1024;
+
+static uint64_t NowNS() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* 一轮测试；cpus为空时不绑定 */
+static void bench(const std::vector<std::string> &cpus, size_t workers) {
+    std::map<std::string, std::vector<std::string>> conf;
+    if (!cpus.empty()) {
+        conf["bench_numa"] = cpus;
+    }
+    webs::Config::Lookup<std::map<std::string, std::vector<std::string>>>("scheduler.cpus")->setValue(conf);
+
+    std::atomic<uint64_t> tasks{0};
+    std::atomic<uint64_t> cross_node{0};
+    std::atomic<uint64_t> checksum{0};
+    uint64_t local_steals = 0;
+    uint64_t remote_steals = 0;
+    uint64_t start = NowNS();
+    {
+        webs::IOManager iom(workers, false, "bench_numa");
+        for (size_t p = 0; p < workers; ++p) {
+            iom.schedule([&, p]() {
+                // 缓冲区由产生者写入，页分配在产生者所在的节点
+                std::shared_ptr<std::vector<uint64_t>> buffer(new std::vector<uint64_t>(s_buffer_size / sizeof(uint64_t), p));
+                int node = webs::GetThreadNode();
+                size_t n = (p + 1) * s_base;
+                for (size_t i = 0; i < n; ++i) {
+                    webs::Scheduler::GetThis()->schedule([&, buffer, node, i]() {
+                        if (webs::GetThreadNode() != node) {
+                            ++cross_node;
+                        }
+                        // 读取一个cache line
+                        const std::vector<uint64_t> &buf = *buffer;
+                        size_t off = (i * 8) % buf.size();
+                        uint64_t sum = 0;
+                        for (size_t j = 0; j < 8; ++j) {
+                            sum += buf[off + j];
+                        }
+                        checksum += sum;
+                        ++tasks;
+                    });
+                }
+            });
+        }
+        iom.stop();
+        local_steals = iom.getLocalStealCount();
+        remote_steals = iom.getRemoteStealCount();
+    }
+    uint64_t elapsed = NowNS() - start;
+    std::cout << (cpus.empty() ? "unpinned" : "pinned  ")
+              << " nodes = " << webs::GetNumaNodeCount()
+              << " workers = " << workers
+              << " tasks = " << tasks
+              << " cross_node = " << cross_node
+              << " (" << (tasks ? cross_node * 100.0 / tasks : 0) << "%)"
+              << " local_steals = " << local_steals
+              << " remote_steals = " << remote_steals
+              << " throughput = " << tasks * 1000000000ull / elapsed << "/s"
+              << std::endl;
+}
+
+int main(int argc, char **argv) {
+    g_logger->setLevel(webs::LogLevel::ERROR);
+    WEBS_LOG_NAME("system")->setLevel(webs::LogLevel::ERROR);
+    webs::Config::Lookup<bool>("scheduler.work_stealing")->setValue(true);
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t workers = ncpu > 1 ? ncpu : 2;
+    std::vector<std::string> cpus = {"0-" + std::to_string(ncpu > 0 ? ncpu - 1 : 0)};
+    for (int i = 0; i < 3; ++i) {
+        bench({}, workers);
+        bench(cpus, workers);
+    }
+    return 0;
+}
@@ -0,0 +1,81 @@
+/**
+ * 调度延迟基准测试
+ * 多个外部生产者线程向IOManager调度任务，统计从schedule到任务开始执行的延迟
+ * 对比：全局队列(std::list + 互斥锁) 与 工作窃取模式(每个线程一个无锁收件箱)
+ */
+#include "../../webs/webs.h"
+
+#include <time.h>
+#include <algorithm>
+
+static webs::Logger::ptr g_logger = WEBS_LOG_ROOT();
+
+// 工作线程数量
+static const size_t s_workers = 4;
+// 每轮调度的任务总数
+static const size_t s_total = 200000;
+
+static uint64_t NowNS() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* 一轮测试：producers个线程一共调度s_total个任务 */
+static void bench(bool work_stealing, size_t producers) {
+    webs::Config::Lookup<bool>("scheduler.work_stealing")->setValue(work_stealing);
+    std::vector<uint64_t> latency(s_total);
+    std::atomic<size_t> done{0};
+    uint64_t start = 0;
+    uint64_t end = 0;
+    {
+        webs::IOManager iom(s_workers, false, "bench");
+        size_t per = s_total / producers;
+        std::vector<webs::Thread::ptr> thrs;
+        start = NowNS();
+        for (size_t p = 0; p < producers; ++p) {
+            thrs.push_back(std::make_shared<webs::Thread>([&iom, &latency, &done, p, per]() {
+                for (size_t i = p * per; i < (p + 1) * per; ++i) {
+                    uint64_t ts = NowNS();
+                    iom.schedule([&latency, &done, i, ts]() {
+                        latency[i] = NowNS() - ts;
+                        ++done;
+                    });
+                }
+            },
+                                                          "producer_" + std::to_string(p)));
+        }
+        for (auto &i : thrs) {
+            i->join();
+        }
+        while (done != per * producers) {
+            usleep(100);
+        }
+        end = NowNS();
+        latency.resize(per * producers);
+    }
+    std::sort(latency.begin(), latency.end());
+    uint64_t sum = 0;
+    for (auto &i : latency) {
+        sum += i;
+    }
+    std::cout << (work_stealing ? "inbox" : "list ")
+              << " producers = " << producers
+              << " tasks = " << latency.size()
+              << " avg_us = " << sum / latency.size() / 1000.0
+              << " p50_us = " << latency[latency.size() / 2] / 1000.0
+              << " p99_us = " << latency[latency.size() * 99 / 100] / 1000.0
+              << " throughput = " << latency.size() * 1000000000ull / (end - start) << "/s"
+              << std::endl;
+}
+
+int main(int argc, char **argv) {
+    g_logger->setLevel(webs::LogLevel::ERROR);
+    WEBS_LOG_NAME("system")->setLevel(webs::LogLevel::ERROR);
+    size_t producers[] = {1, 8, 32};
+    for (auto p : producers) {
+        bench(false, p);
+        bench(true, p);
+    }
+    return 0;
+}
@@ -0,0 +1,165 @@
+#include "../../webs/webs.h"
+
+#include <stdlib.h>
+#include <new>
+
+static webs::Logger::ptr g_logger = WEBS_LOG_ROOT();
+
+// 统计operator new的调用次数，验证缓冲区有空间时push/pop不分配内存
+static std::atomic<uint64_t> s_allocs{0};
+
+void *operator new(size_t size) {
+    ++s_allocs;
+    void *p = malloc(size ? size : 1);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void *p) noexcept {
+    free(p);
+}
+
+/* 有界通道：多个消费者，关闭后消费者退出 */
+void test_bounded() {
+    webs::Channel<int> ch(4);
+    std::atomic<int64_t> sum{0};
+    std::atomic<int> exited{0};
+    {
+        webs::IOManager iom(4, false, "bounded");
+        for (int i = 0; i < 4; ++i) {
+            iom.schedule([&]() {
+                int v = 0;
+                while (ch.pop(v)) {
+                    sum += v;
+                }
+                ++exited;
+            });
+        }
+        iom.schedule([&]() {
+            for (int i = 1; i <= 10000; ++i) {
+                WEBS_ASSERT(ch.push(i));
+            }
+            ch.close();
+            WEBS_ASSERT(!ch.push(0));
+        });
+    }
+    WEBS_LOG_INFO(g_logger) << "bounded sum = " << sum << " exited = " << exited;
+    WEBS_ASSERT(sum == 10000ll * 10001 / 2 && exited == 4);
+}
+
+/* 无界通道按顺序取出；超时返回false */
+void test_unbounded_and_timeout() {
+    webs::Channel<std::string> ch;
+    webs::Channel<int> full(1);
+    bool ordered = true;
+    bool pop_timeout = false;
+    bool push_timeout = false;
+    uint64_t elapsed = 0;
+    {
+        webs::IOManager iom(1, false, "unbounded");
+        iom.schedule([&]() {
+            for (int i = 0; i < 1000; ++i) {
+                ch.push(std::to_string(i));
+            }
+            std::string v;
+            for (int i = 0; i < 1000; ++i) {
+                if (!ch.tryPop(v) || v != std::to_string(i)) {
+                    ordered = false;
+                }
+            }
+            uint64_t start = webs::GetCurrentMS();
+            pop_timeout = !ch.popFor(v, 50);
+            elapsed = webs::GetCurrentMS() - start;
+            full.push(1);
+            push_timeout = !full.pushFor(2, 20);
+        });
+    }
+    WEBS_LOG_INFO(g_logger) << "unbounded ordered = " << ordered << " pop_timeout = " << pop_timeout
+                            << " elapsed = " << elapsed << " push_timeout = " << push_timeout;
+    WEBS_ASSERT(ordered && pop_timeout && elapsed >= 45 && push_timeout);
+}
+
+/* 在两个通道上select，直到两个通道都关闭 */
+void test_select() {
+    webs::Channel<int> a(8);
+    webs::Channel<int> b;
+    // 分别统计两个通道，避免a和b的和互相抵消
+    int64_t sum_a = 0, sum_b = 0;
+    int count_a = 0, count_b = 0;
+    int timeouts = 0;
+    {
+        webs::IOManager iom(2, false, "select");
+        iom.schedule([&]() {
+            for (int i = 1; i <= 1000; ++i) {
+                a.push(i);
+            }
+            a.close();
+        });
+        iom.schedule([&]() {
+            for (int i = 1; i <= 1000; ++i) {
+                b.push(-i);
+                if (i % 100 == 0) {
+                    webs::Fiber::YieldToTeady();
+                }
+            }
+            b.close();
+        });
+        iom.schedule([&]() {
+            bool a_open = true;
+            bool b_open = true;
+            while (a_open || b_open) {
+                int va = 0;
+                int vb = 0;
+                bool ok = false;
+                webs::ChannelSelect sel;
+                int ia = a_open ? sel.recv(a, va, &ok) : -1;
+                if (b_open) {
+                    sel.recv(b, vb, &ok);
+                }
+                int idx = sel.select(1000);
+                if (idx == -1) {
+                    ++timeouts;
+                } else if (!ok) {
+                    // 通道已关闭
+                    (idx == ia ? a_open : b_open) = false;
+                } else if (idx == ia) {
+                    sum_a += va;
+                    ++count_a;
+                } else {
+                    sum_b += vb;
+                    ++count_b;
+                }
+            }
+        });
+    }
+    WEBS_LOG_INFO(g_logger) << "select a = " << count_a << "/" << sum_a << " b = " << count_b << "/" << sum_b
+                            << " timeouts = " << timeouts;
+    WEBS_ASSERT(count_a == 1000 && sum_a == 500500);
+    WEBS_ASSERT(count_b == 1000 && sum_b == -500500);
+    WEBS_ASSERT(timeouts == 0);
+}
+
+/* 缓冲区有空间时不分配内存 */
+void test_no_alloc() {
+    webs::Channel<int> ch(64);
+    int v = 0;
+    uint64_t before = s_allocs;
+    for (int i = 0; i < 10000; ++i) {
+        ch.tryPush(i);
+        ch.tryPop(v);
+    }
+    uint64_t allocs = s_allocs - before;
+    WEBS_LOG_INFO(g_logger) << "channel allocs = " << allocs;
+    WEBS_ASSERT(allocs == 0);
+}
+
+int main(int argc, char **argv) {
+    WEBS_LOG_NAME("system")->setLevel(webs::LogLevel::ERROR);
+    test_bounded();
+    test_unbounded_and_timeout();
+    test_select();
+    test_no_alloc();
+    return 0;
+}
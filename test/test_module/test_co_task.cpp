@@ -0,0 +1,151 @@
+#include "../../webs/webs.h"
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+static webs::Logger::ptr g_logger = WEBS_LOG_ROOT();
+
+static webs::CoTask<int> Square(int x) {
+    co_await webs::CoSleep(1);
+    co_return x * x;
+}
+
+static webs::CoTask<int> Throw() {
+    co_await webs::CoSleep(1);
+    throw std::logic_error("co task failed");
+    co_return 0;
+}
+
+/* 嵌套的CoTask、sleep以及从有栈协程等待CoTask */
+void test_task() {
+    int sum = 0;
+    bool caught = false;
+    uint64_t elapsed = 0;
+    {
+        webs::IOManager iom(2, false, "co_task");
+        iom.schedule([&]() {
+            uint64_t start = webs::GetCurrentMS();
+            sum = webs::CoSyncWait([]() -> webs::CoTask<int> {
+                int s = 0;
+                for (int i = 0; i < 10; ++i) {
+                    s += co_await Square(i);
+                }
+                co_await webs::CoSleep(50);
+                co_return s;
+            }());
+            elapsed = webs::GetCurrentMS() - start;
+            try {
+                webs::CoSyncWait(Throw());
+            } catch (const std::logic_error &e) {
+                caught = true;
+            }
+        });
+    }
+    WEBS_LOG_INFO(g_logger) << "co task sum = " << sum << " elapsed = " << elapsed << " caught = " << caught;
+    WEBS_ASSERT(sum == 285 && elapsed >= 50 && caught);
+}
+
+/* 有栈协程与无栈协程通过同一个Channel交换数据 */
+void test_channel() {
+    const int n = 10000;
+    int64_t co_sum = 0;
+    int64_t fiber_sum = 0;
+    {
+        webs::IOManager iom(2, false, "co_channel");
+        webs::Channel<int> to_co(8);
+        webs::Channel<int> to_fiber(8);
+        webs::CoSpawn([](webs::Channel<int> &in, webs::Channel<int> &out, int64_t &sum) -> webs::CoTask<> {
+            int v = 0;
+            while (co_await webs::CoPop(in, v)) {
+                sum += v;
+                co_await webs::CoPush(out, v * 2);
+            }
+            out.close();
+        }(to_co, to_fiber, co_sum), &iom);
+        iom.schedule([&]() {
+            for (int i = 1; i <= n; ++i) {
+                to_co.push(i);
+            }
+            to_co.close();
+        });
+        iom.schedule([&]() {
+            int v = 0;
+            while (to_fiber.pop(v)) {
+                fiber_sum += v;
+            }
+        });
+    }
+    WEBS_LOG_INFO(g_logger) << "co channel co_sum = " << co_sum << " fiber_sum = " << fiber_sum;
+    WEBS_ASSERT(co_sum == (int64_t)n * (n + 1) / 2 && fiber_sum == co_sum * 2);
+}
+
+/* socket读写、读超时，以及在有栈协程中执行阻塞代码 */
+void test_socket() {
+    int sv[2];
+    WEBS_ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+    std::string received;
+    int timeout_errno = 0;
+    int fiber_result = 0;
+    {
+        webs::IOManager iom(2, false, "co_socket");
+        webs::CoSpawn([](int rfd, std::string &out, int &err, int &fr) -> webs::CoTask<> {
+            webs::FdMgr::GetInstance()->get(rfd, true);
+            char buf[64];
+            uint64_t start = webs::GetCurrentMS();
+            ssize_t n = co_await webs::CoRead(rfd, buf, sizeof(buf), 20);
+            if (n == -1 && webs::GetCurrentMS() - start < 1000) {
+                err = errno;
+            }
+            // 阻塞代码(hook的usleep)交给有栈协程执行
+            fr = co_await webs::CoInFiber([rfd]() {
+                usleep(1000);
+                return 42;
+            });
+            n = co_await webs::CoRead(rfd, buf, sizeof(buf));
+            if (n > 0) {
+                out.assign(buf, n);
+            }
+        }(sv[0], received, timeout_errno, fiber_result), &iom);
+        iom.schedule([&]() {
+            webs::FdMgr::GetInstance()->get(sv[1], true);
+            sleep(1);
+            WEBS_ASSERT(write(sv[1], "hello", 5) == 5);
+        });
+    }
+    close(sv[0]);
+    close(sv[1]);
+    WEBS_LOG_INFO(g_logger) << "co socket received = " << received << " timeout_errno = " << timeout_errno
+                            << " fiber_result = " << fiber_result;
+    WEBS_ASSERT(received == "hello" && timeout_errno == ETIMEDOUT && fiber_result == 42);
+}
+
+/* 超时为0/1ms时定时器可能在登记事件的同时到期，每次等待都要返回ETIMEDOUT，不会一直挂起 */
+void test_short_timeout() {
+    int sv[2];
+    WEBS_ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+    const int rounds = 1000;
+    std::atomic<int> timeouts{0};
+    {
+        webs::IOManager iom(2, false, "co_timeout");
+        webs::CoSpawn([](int fd, int n, std::atomic<int> &count) -> webs::CoTask<> {
+            webs::FdMgr::GetInstance()->get(fd, true);
+            for (int i = 0; i < n; ++i) {
+                int rt = co_await webs::CoWaitEvent(fd, webs::IOManager::READ, i % 2);
+                count += rt == ETIMEDOUT;
+            }
+        }(sv[0], rounds, timeouts), &iom);
+    }
+    close(sv[0]);
+    close(sv[1]);
+    WEBS_LOG_INFO(g_logger) << "co short timeout = " << timeouts;
+    WEBS_ASSERT(timeouts == rounds);
+}
+
+int main(int argc, char **argv) {
+    WEBS_LOG_NAME("system")->setLevel(webs::LogLevel::ERROR);
+    test_task();
+    test_channel();
+    test_socket();
+    test_short_timeout();
+    return 0;
+}
@@ -0,0 +1,24 @@
+#include "../../webs/webs.h"
+
+static webs::Logger::ptr g_logger = WEBS_LOG_ROOT();
+
+static webs::ConfigVar<int>::ptr g_int = webs::Config::Lookup("test_config.int", 1, "test int");
+static webs::ConfigVar<std::vector<int>>::ptr g_vec = webs::Config::Lookup("test_config.vec", std::vector<int>{1}, "test vec");
+
+/* LoadFromYaml：已经注册的配置项(标量和非标量)被修改，没有注册的配置项被忽略 */
+void test_load_from_yaml() {
+    YAML::Node node = YAML::Load("test_config:\n"
+                                 "  int: 42\n"
+                                 "  vec: [3, 4, 5]\n"
+                                 "  unknown: 7\n");
+    webs::Config::LoadFromYaml(node);
+    WEBS_LOG_INFO(g_logger) << "load from yaml int = " << g_int->getValue() << " vec = " << g_vec->toString();
+    WEBS_ASSERT(g_int->getValue() == 42);
+    WEBS_ASSERT(g_vec->getValue() == std::vector<int>({3, 4, 5}));
+    WEBS_ASSERT(!webs::Config::LookupBase("test_config.unknown"));
+}
+
+int main() {
+    test_load_from_yaml();
+    return 0;
+}
@@ -0,0 +1,152 @@
+#include "../../webs/webs.h"
+
+static webs::Logger::ptr g_logger = WEBS_LOG_ROOT();
+
+/* 临界区中让出执行权，其他协程不能同时进入 */
+void test_mutex() {
+    webs::FiberMutex mutex;
+    std::atomic<int> inside{0};
+    std::atomic<int> overlap{0};
+    int count = 0;
+    {
+        webs::IOManager iom(4, false, "mutex");
+        for (int i = 0; i < 100; ++i) {
+            iom.schedule([&]() {
+                for (int j = 0; j < 100; ++j) {
+                    webs::FiberMutex::Lock lock(mutex);
+                    if (++inside != 1) {
+                        ++overlap;
+                    }
+                    ++count;
+                    if (j % 10 == 0) {
+                        webs::Fiber::YieldToTeady();
+                    }
+                    --inside;
+                }
+            });
+        }
+    }
+    WEBS_LOG_INFO(g_logger) << "mutex count = " << count << " overlap = " << overlap;
+    WEBS_ASSERT(count == 10000 && overlap == 0);
+}
+
+/* 生产者消费者 */
+void test_condvar() {
+    webs::FiberMutex mutex;
+    webs::FiberCondVar cond;
+    std::list<int> items;
+    int sum = 0;
+    {
+        webs::IOManager iom(2, false, "cond");
+        for (int i = 0; i < 4; ++i) {
+            iom.schedule([&]() {
+                for (int j = 0; j < 250; ++j) {
+                    webs::FiberMutex::Lock lock(mutex);
+                    while (items.empty()) {
+                        cond.wait(mutex);
+                    }
+                    sum += items.front();
+                    items.pop_front();
+                }
+            });
+        }
+        iom.schedule([&]() {
+            for (int i = 1; i <= 1000; ++i) {
+                {
+                    webs::FiberMutex::Lock lock(mutex);
+                    items.push_back(i);
+                }
+                cond.notifyOne();
+                if (i % 50 == 0) {
+                    webs::Fiber::YieldToTeady();
+                }
+            }
+        });
+    }
+    WEBS_LOG_INFO(g_logger) << "condvar sum = " << sum;
+    WEBS_ASSERT(sum == 1000 * 1001 / 2);
+}
+
+/* 单线程调度器上等待超时期间，其他协程可以继续执行 */
+void test_timed_wait() {
+    webs::FiberSemaphore sem;
+    webs::FiberMutex mutex;
+    webs::FiberCondVar cond;
+    std::atomic<int> progress{0};
+    bool sem_timeout = false;
+    bool sem_ok = false;
+    bool mutex_timeout = false;
+    bool cond_timeout = false;
+    uint64_t elapsed = 0;
+    {
+        webs::IOManager iom(1, false, "timed");
+        iom.schedule([&]() {
+            uint64_t start = webs::GetCurrentMS();
+            sem_timeout = !sem.waitFor(100);
+            elapsed = webs::GetCurrentMS() - start;
+            iom.schedule([&]() {
+                sem.notify();
+            });
+            sem_ok = sem.waitFor(1000);
+
+            mutex.lock();
+            iom.schedule([&]() {
+                mutex_timeout = !mutex.tryLockFor(50);
+                webs::FiberMutex::Lock lock(mutex);
+                cond_timeout = !cond.waitFor(mutex, 50);
+            });
+            webs::Fiber::YieldToTeady();
+            // 持有锁等待，让对方超时
+            sem.waitFor(100);
+            mutex.unlock();
+        });
+        iom.schedule([&]() {
+            for (int i = 0; i < 10; ++i) {
+                ++progress;
+                webs::Fiber::YieldToTeady();
+            }
+        });
+    }
+    WEBS_LOG_INFO(g_logger) << "timed wait elapsed = " << elapsed << " progress = " << progress
+                            << " sem_timeout = " << sem_timeout << " sem_ok = " << sem_ok
+                            << " mutex_timeout = " << mutex_timeout << " cond_timeout = " << cond_timeout;
+    WEBS_ASSERT(sem_timeout && elapsed >= 90 && progress == 10 && sem_ok);
+    WEBS_ASSERT(mutex_timeout && cond_timeout);
+}
+
+/* 等待所有任务完成 */
+void test_wait_group() {
+    webs::FiberWaitGroup wg;
+    std::atomic<int> finished{0};
+    int seen = -1;
+    bool timeout = false;
+    {
+        webs::IOManager iom(4, false, "wg");
+        iom.schedule([&]() {
+            wg.add(100);
+            for (int i = 0; i < 100; ++i) {
+                webs::IOManager::GetThis()->schedule([&]() {
+                    webs::Fiber::YieldToTeady();
+                    ++finished;
+                    wg.done();
+                });
+            }
+            wg.wait();
+            seen = finished;
+            wg.add();
+            timeout = !wg.waitFor(30);
+            wg.done();
+        });
+    }
+    WEBS_LOG_INFO(g_logger) << "wait group seen = " << seen << " timeout = " << timeout;
+    WEBS_ASSERT(seen == 100 && timeout);
+}
+
+int main(int argc, char **argv) {
+    WEBS_LOG_NAME("system")->setLevel(webs::LogLevel::ERROR);
+    test_mutex();
+    test_condvar();
+    test_timed_wait();
+    test_wait_group();
+    return 0;
+}
@@ -0,0 +1,204 @@
+#include "../../webs/webs.h"
+
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <new>
+
+static webs::Logger::ptr g_logger = WEBS_LOG_ROOT();
+
+/* 统计打开期间的operator new次数；所有线程共用 */
+static std::atomic<bool> s_counting{false};
+static std::atomic<size_t> s_allocs{0};
+
+void *operator new(size_t size) {
+    if (s_counting) {
+        ++s_allocs;
+    }
+    void *p = malloc(size ? size : 1);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void *p) noexcept {
+    free(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+    free(p);
+}
+
+/* 在fiber中执行，返回期间的分配次数 */
+template <class Func>
+static size_t CountAllocs(Func func) {
+    s_allocs = 0;
+    s_counting = true;
+    func();
+    s_counting = false;
+    return s_allocs;
+}
+
+/* 两个协程在socketpair上往返rounds次，读写都带(或者不带)超时；返回往返期间的分配次数 */
+static size_t PingPong(bool with_timeout, int rounds) {
+    size_t allocs = 0;
+    webs::IOManager iom(1, false, "io_alloc");
+    iom.schedule([&]() {
+        int sv[2];
+        WEBS_ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+        webs::FdMgr::GetInstance()->get(sv[0], true);
+        webs::FdMgr::GetInstance()->get(sv[1], true);
+        if (with_timeout) {
+            struct timeval tv = {1, 0};
+            for (int i = 0; i < 2; ++i) {
+                setsockopt(sv[i], SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+                setsockopt(sv[i], SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+            }
+        }
+        webs::FiberSemaphore done;
+        webs::IOManager::GetThis()->schedule([&]() {
+            char c;
+            while (read(sv[1], &c, 1) == 1 && write(sv[1], &c, 1) == 1) {
+            }
+            done.notify();
+        });
+        char c = 'x';
+        auto round = [&]() {
+            WEBS_ASSERT(write(sv[0], &c, 1) == 1 && read(sv[0], &c, 1) == 1);
+        };
+        // 先让各个队列、数组达到稳定的容量
+        for (int i = 0; i < rounds; ++i) {
+            round();
+        }
+        allocs = CountAllocs([&]() {
+            for (int i = 0; i < rounds; ++i) {
+                round();
+            }
+        });
+        close(sv[0]);
+        done.wait();
+        close(sv[1]);
+    });
+    return allocs;
+}
+
+/* 数据已经就绪的读：不进入等待，不分配内存 */
+void test_ready_read() {
+    const int rounds = 1000;
+    size_t allocs = 0;
+    {
+        webs::IOManager iom(1, false, "io_alloc_ready");
+        iom.schedule([&]() {
+            int sv[2];
+            WEBS_ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+            webs::FdMgr::GetInstance()->get(sv[0], true);
+            webs::FdMgr::GetInstance()->get(sv[1], true);
+            struct timeval tv = {1, 0};
+            setsockopt(sv[0], SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+            char c = 'x';
+            allocs = CountAllocs([&]() {
+                for (int i = 0; i < rounds; ++i) {
+                    WEBS_ASSERT(write(sv[1], &c, 1) == 1 && read(sv[0], &c, 1) == 1);
+                }
+            });
+            close(sv[0]);
+            close(sv[1]);
+        });
+    }
+    WEBS_LOG_INFO(g_logger) << "ready read allocs = " << allocs;
+    WEBS_ASSERT(allocs == 0);
+}
+
+/* 需要等待的读写：带超时与不带超时一样，稳定之后不分配内存 */
+void test_wait_read() {
+    const int rounds = 2000;
+    size_t plain = PingPong(false, rounds);
+    size_t timed = PingPong(true, rounds);
+    WEBS_LOG_INFO(g_logger) << "wait read allocs without timeout = " << plain << " with timeout = " << timed;
+    WEBS_ASSERT(plain == 0 && timed == 0);
+}
+
+/* 到期的超时：返回ETIMEDOUT，到期的回调放在std::function的内部缓冲区中 */
+void test_timeout_read() {
+    const int rounds = 20;
+    int timeouts = 0;
+    size_t allocs = 0;
+    {
+        webs::IOManager iom(1, false, "io_alloc_timeout");
+        iom.schedule([&]() {
+            int sv[2];
+            WEBS_ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+            webs::FdMgr::GetInstance()->get(sv[0], true);
+            webs::FdMgr::GetInstance()->get(sv[1], true);
+            struct timeval tv = {0, 5 * 1000};
+            setsockopt(sv[0], SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+            char c;
+            auto round = [&]() {
+                if (read(sv[0], &c, 1) == -1 && errno == ETIMEDOUT) {
+                    ++timeouts;
+                }
+            };
+            round();
+            allocs = CountAllocs([&]() {
+                for (int i = 0; i < rounds; ++i) {
+                    round();
+                }
+            });
+            close(sv[0]);
+            close(sv[1]);
+        });
+    }
+    WEBS_LOG_INFO(g_logger) << "timeout read timeouts = " << timeouts << " allocs = " << allocs;
+    WEBS_ASSERT(timeouts == rounds + 1);
+    // 原来的实现每次至少4次(timer_info、Timer、两个std::function)
+    WEBS_ASSERT(allocs == 0);
+}
+
+/* 共享栈上两个等待读的协程：超时的结果不写在等待者的栈上，切出之后栈被另一个协程使用也能正确返回ETIMEDOUT */
+void test_shared_stack_timeout() {
+    std::atomic<int> timeouts{0};
+    std::atomic<int> bad{0};
+    {
+        webs::IOManager iom(1, false, "io_alloc_shared");
+        iom.setSharedStack(true);
+        for (int i = 0; i < 2; ++i) {
+            iom.schedule([i, &timeouts, &bad]() {
+                int sv[2];
+                WEBS_ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+                webs::FdMgr::GetInstance()->get(sv[0], true);
+                webs::FdMgr::GetInstance()->get(sv[1], true);
+                // 第一个先到期，到期时共享栈属于第二个协程
+                struct timeval tv = {0, (i + 1) * 20 * 1000};
+                setsockopt(sv[0], SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+                int canary[16];
+                for (int j = 0; j < 16; ++j) {
+                    canary[j] = i * 100 + j;
+                }
+                char c;
+                if (read(sv[0], &c, 1) == -1 && errno == ETIMEDOUT) {
+                    ++timeouts;
+                }
+                for (int j = 0; j < 16; ++j) {
+                    if (canary[j] != i * 100 + j) {
+                        ++bad;
+                        break;
+                    }
+                }
+                close(sv[0]);
+                close(sv[1]);
+            });
+        }
+    }
+    WEBS_LOG_INFO(g_logger) << "shared stack timeout timeouts = " << timeouts << " bad = " << bad;
+    WEBS_ASSERT(timeouts == 2 && bad == 0);
+}
+
+int main() {
+    WEBS_LOG_NAME("system")->setLevel(webs::LogLevel::ERROR);
+    test_ready_read();
+    test_wait_read();
+    test_timeout_read();
+    test_shared_stack_timeout();
+    return 0;
+}
@@ -0,0 +1,243 @@
+#include "../../webs/webs.h"
+#include "../../webs/io_module/io_uring.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+static webs::Logger::ptr g_logger = WEBS_LOG_ROOT();
+
+/* 当前IOManager是否真正使用了io_uring；内核不支持时退回epoll，测试同样要通过 */
+static bool UsingUring(webs::IOManager &iom) {
+#ifdef WEBS_HAVE_IO_URING
+    return iom.isUringSupported(IORING_OP_READ);
+#else
+    return false;
+#endif
+}
+
+/**
+ * 停止调度器后检查io确实经过了io_uring：提交过请求，并且全部完成
+ * 内核不支持io_uring时测试走epoll，明确跳过这项检查
+ */
+static void CheckUringCounters(webs::IOManager &iom, const char *name) {
+    iom.stop();
+    if (!UsingUring(iom)) {
+        WEBS_LOG_INFO(g_logger) << name << " io_uring not supported, skip uring counters";
+        return;
+    }
+    uint64_t submitted = iom.getUringSubmitCount();
+    uint64_t completed = iom.getUringCompleteCount();
+    WEBS_LOG_INFO(g_logger) << name << " uring submitted = " << submitted << " completed = " << completed;
+    WEBS_ASSERT(submitted > 0 && completed == submitted);
+}
+
+/* 读写：读方先阻塞，写方稍后写入
+ * 测试中的fd都在hook的协程中关闭，否则FdManager会保留旧的FdCtx给后面复用同一个fd的测试 */
+void test_read_write() {
+    int sv[2];
+    WEBS_ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+    std::string received;
+    bool uring = false;
+    {
+        webs::IOManager iom(2, false, "uring_rw");
+        uring = UsingUring(iom);
+        iom.schedule([&]() {
+            webs::FdMgr::GetInstance()->get(sv[0], true);
+            char buf[64];
+            ssize_t n = read(sv[0], buf, sizeof(buf));
+            if (n > 0) {
+                received.assign(buf, n);
+            }
+            // readv
+            char a[3], b[16];
+            struct iovec iov[2] = {{a, sizeof(a)}, {b, sizeof(b)}};
+            n = readv(sv[0], iov, 2);
+            if (n > 3) {
+                received += "|" + std::string(a, 3) + std::string(b, n - 3);
+            }
+            close(sv[0]);
+        });
+        iom.schedule([&]() {
+            webs::FdMgr::GetInstance()->get(sv[1], true);
+            usleep(10 * 1000);
+            WEBS_ASSERT(write(sv[1], "hello", 5) == 5);
+            usleep(10 * 1000);
+            const char *x = "uring";
+            struct iovec iov[1] = {{(void *)x, 5}};
+            WEBS_ASSERT(writev(sv[1], iov, 1) == 5);
+            close(sv[1]);
+        });
+        CheckUringCounters(iom, "read write");
+    }
+    WEBS_LOG_INFO(g_logger) << "read write uring = " << uring << " received = " << received;
+    WEBS_ASSERT(received == "hello|uring");
+}
+
+/* SO_RCVTIMEO超时 */
+void test_timeout() {
+    int sv[2];
+    WEBS_ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+    int err = 0;
+    uint64_t elapsed = 0;
+    {
+        webs::IOManager iom(1, false, "uring_timeout");
+        iom.schedule([&]() {
+            webs::FdMgr::GetInstance()->get(sv[0], true);
+            struct timeval tv = {0, 50 * 1000};
+            setsockopt(sv[0], SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+            char buf[16];
+            uint64_t start = webs::GetCurrentMS();
+            if (recv(sv[0], buf, sizeof(buf), 0) == -1) {
+                err = errno;
+            }
+            elapsed = webs::GetCurrentMS() - start;
+            close(sv[0]);
+            close(sv[1]);
+        });
+        CheckUringCounters(iom, "timeout");
+    }
+    WEBS_LOG_INFO(g_logger) << "timeout errno = " << err << " elapsed = " << elapsed;
+    WEBS_ASSERT(err == ETIMEDOUT && elapsed >= 40 && elapsed < 1000);
+}
+
+/* accept与多个连接的回显 */
+void test_accept_echo() {
+    const int conns = 50;
+    std::atomic<int> echoed{0};
+    {
+        webs::IOManager iom(2, false, "uring_echo");
+        iom.schedule([&]() {
+            int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+            sockaddr_in addr;
+            memset(&addr, 0, sizeof(addr));
+            addr.sin_family = AF_INET;
+            addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            socklen_t len = sizeof(addr);
+            WEBS_ASSERT(bind(listen_fd, (sockaddr *)&addr, len) == 0 && listen(listen_fd, 128) == 0);
+            getsockname(listen_fd, (sockaddr *)&addr, &len);
+            for (int i = 0; i < conns; ++i) {
+                webs::IOManager::GetThis()->schedule([addr, &echoed]() {
+                    int fd = socket(AF_INET, SOCK_STREAM, 0);
+                    WEBS_ASSERT(connect(fd, (const sockaddr *)&addr, sizeof(addr)) == 0);
+                    WEBS_ASSERT(send(fd, "ping", 4, 0) == 4);
+                    char buf[4];
+                    if (recv(fd, buf, sizeof(buf), MSG_WAITALL) == 4 && memcmp(buf, "ping", 4) == 0) {
+                        ++echoed;
+                    }
+                    close(fd);
+                });
+            }
+            for (int i = 0; i < conns; ++i) {
+                int fd = accept(listen_fd, nullptr, nullptr);
+                WEBS_ASSERT(fd >= 0);
+                webs::IOManager::GetThis()->schedule([fd]() {
+                    char buf[64];
+                    ssize_t n = 0;
+                    while ((n = read(fd, buf, sizeof(buf))) > 0) {
+                        write(fd, buf, n);
+                    }
+                    close(fd);
+                });
+            }
+            close(listen_fd);
+        });
+        CheckUringCounters(iom, "accept echo");
+    }
+    WEBS_LOG_INFO(g_logger) << "accept echo = " << echoed;
+    WEBS_ASSERT(echoed == conns);
+}
+
+/* 取消阻塞中的IO；关闭fd唤醒阻塞在它上面的IO */
+void test_cancel_close() {
+    int sv[2];
+    WEBS_ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+    int cancel_errno = 0;
+    ssize_t close_rt = 0;
+    uint64_t elapsed = 0;
+    {
+        webs::IOManager iom(2, false, "uring_cancel");
+        iom.schedule([&]() {
+            webs::FdMgr::GetInstance()->get(sv[0], true);
+            webs::FdMgr::GetInstance()->get(sv[1], true);
+            uint64_t start = webs::GetCurrentMS();
+            webs::TaskGroup group;
+            group.spawn([&]() {
+                char buf[16];
+                if (read(sv[0], buf, sizeof(buf)) == -1) {
+                    cancel_errno = errno;
+                }
+            });
+            usleep(10 * 1000);
+            group.cancel();
+            group.joinAll();
+
+            webs::FiberSemaphore done;
+            webs::IOManager::GetThis()->schedule([&]() {
+                char buf[16];
+                close_rt = read(sv[1], buf, sizeof(buf));
+                done.notify();
+            });
+            usleep(10 * 1000);
+            close(sv[1]);
+            done.wait();
+            elapsed = webs::GetCurrentMS() - start;
+            close(sv[0]);
+        });
+        CheckUringCounters(iom, "cancel close");
+    }
+    WEBS_LOG_INFO(g_logger) << "cancel errno = " << cancel_errno << " close_rt = " << close_rt << " elapsed = " << elapsed;
+    WEBS_ASSERT(cancel_errno == ECANCELED && close_rt <= 0 && elapsed < 1000);
+}
+
+/* 共享栈的协程不使用io_uring：请求在协程栈上，切出之后栈会被其他协程使用；两个协程等待超时，一个读到数据 */
+void test_shared_stack() {
+    std::atomic<int> timeouts{0};
+    std::atomic<int> received{0};
+    uint64_t submitted = 0;
+    {
+        webs::IOManager iom(1, false, "uring_shared");
+        iom.setSharedStack(true);
+        for (int i = 0; i < 3; ++i) {
+            iom.schedule([i, &timeouts, &received]() {
+                int sv[2];
+                WEBS_ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+                webs::FdMgr::GetInstance()->get(sv[0], true);
+                webs::FdMgr::GetInstance()->get(sv[1], true);
+                struct timeval tv = {0, (i + 1) * 20 * 1000};
+                setsockopt(sv[0], SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+                if (i == 2) {
+                    webs::IOManager::GetThis()->addTimer(10, [sv]() {
+                        WEBS_ASSERT(write(sv[1], "x", 1) == 1);
+                    });
+                }
+                char buf[16];
+                ssize_t n = recv(sv[0], buf, sizeof(buf), 0);
+                if (n == -1 && errno == ETIMEDOUT) {
+                    ++timeouts;
+                } else if (n == 1 && buf[0] == 'x') {
+                    ++received;
+                }
+                close(sv[0]);
+                close(sv[1]);
+            });
+        }
+        iom.stop();
+        submitted = iom.getUringSubmitCount();
+    }
+    WEBS_LOG_INFO(g_logger) << "shared stack timeouts = " << timeouts << " received = " << received << " submitted = " << submitted;
+    WEBS_ASSERT(timeouts == 2 && received == 1 && submitted == 0);
+}
+
+int main(int argc, char **argv) {
+    WEBS_LOG_NAME("system")->setLevel(webs::LogLevel::ERROR);
+    webs::Config::Lookup<std::string>("iomanager.backend")->setValue("io_uring");
+    test_read_write();
+    test_timeout();
+    test_accept_echo();
+    test_cancel_close();
+    test_shared_stack();
+    return 0;
+}
@@ -1,6 +1,9 @@
 #include "../../webs/webs.h"
 #include "../../webs/http_module/http.h"
 
+#include <sys/socket.h>
+#include <thread>
+
 static webs::Logger::ptr g_logger = WEBS_LOG_ROOT();
 
 void test_fiber() {
@@ -13,11 +16,671 @@ void test_fiber() {
     // }
 }
 
+/* 工作窃取模式：任务分散到各线程的本地队列，指定线程的任务只能在该线程执行 */
+void test_work_stealing() {
+    webs::Config::Lookup<bool>("scheduler.work_stealing")->setValue(true);
+    std::atomic<int> count{0};
+    std::atomic<int> pinned_miss{0};
+    {
+        webs::IOManager iom(4, true, "steal");
+        for (int i = 0; i < 10000; ++i) {
+            iom.schedule([&count]() {
+                if (++count % 100 == 0) {
+                    webs::Fiber::YieldToTeady();
+                }
+            });
+        }
+        for (int i = 0; i < 100; ++i) {
+            iom.schedule([&iom, &pinned_miss]() {
+                int tid = webs::GetThreadId();
+                iom.schedule([tid, &pinned_miss]() {
+                    if (tid != webs::GetThreadId()) {
+                        ++pinned_miss;
+                    }
+                },
+                             tid);
+            });
+        }
+    }
+    WEBS_LOG_INFO(g_logger) << "work stealing count = " << count << " pinned_miss = " << pinned_miss;
+    WEBS_ASSERT(count == 10000 && pinned_miss == 0);
+    webs::Config::Lookup<bool>("scheduler.work_stealing")->setValue(false);
+}
+
+/* start还在创建线程时，已经启动的线程调度的指定线程任务也不会丢失指定的线程 */
+void test_pin_during_start() {
+    webs::Config::Lookup<bool>("scheduler.work_stealing")->setValue(true);
+    std::atomic<int> count{0};
+    std::atomic<int> pinned_miss{0};
+    {
+        webs::Scheduler sc(8, false, "pin_start");
+        for (int i = 0; i < 2000; ++i) {
+            sc.schedule([&sc, &count, &pinned_miss]() {
+                int tid = webs::GetThreadId();
+                sc.schedule([tid, &count, &pinned_miss]() {
+                    if (tid != webs::GetThreadId()) {
+                        ++pinned_miss;
+                    }
+                    ++count;
+                },
+                            tid);
+                // 占住线程，让其他线程有机会窃取本地队列中的任务；普通调度器没有IOManager，使用未hook的usleep
+                usleep_f(100);
+            });
+        }
+        sc.start();
+        sc.stop();
+    }
+    WEBS_LOG_INFO(g_logger) << "pin during start count = " << count << " pinned_miss = " << pinned_miss;
+    WEBS_ASSERT(count == 2000 && pinned_miss == 0);
+    webs::Config::Lookup<bool>("scheduler.work_stealing")->setValue(false);
+}
+
+/* 协程反复创建销毁时，运行栈应该从线程缓存中复用 */
+void test_stack_pool() {
+    webs::Fiber::GetThis();
+    uint64_t hits = webs::PooledStackAllocator::GetHits();
+    for (int i = 0; i < 1000; ++i) {
+        webs::Fiber::ptr fiber(new webs::Fiber([]() {}, 0, true));
+        fiber->call();
+    }
+    WEBS_LOG_INFO(g_logger) << "stack pool hits = " << webs::PooledStackAllocator::GetHits() - hits
+                            << " misses = " << webs::PooledStackAllocator::GetMisses();
+    WEBS_ASSERT(webs::PooledStackAllocator::GetHits() - hits >= 999);
+}
+
+/* 共享栈协程：切出后只保存用到的栈，恢复后局部变量不变，并且只在绑定的线程上恢复 */
+void test_shared_stack() {
+    std::atomic<int> bad{0};
+    std::vector<webs::Fiber::ptr> fibers;
+    for (int i = 0; i < 1000; ++i) {
+        fibers.push_back(webs::Fiber::ptr(new webs::Fiber([i, &bad]() {
+            char buf[256];
+            memset(buf, i & 0xff, sizeof(buf));
+            webs::Fiber::GetThis()->back();
+            for (size_t j = 0; j < sizeof(buf); ++j) {
+                if (buf[j] != (char)(i & 0xff)) {
+                    ++bad;
+                    break;
+                }
+            }
+        },
+                                                          0, true, true)));
+    }
+    for (auto &i : fibers) {
+        i->call();
+    }
+    size_t saved = 0;
+    for (auto &i : fibers) {
+        saved += i->getSavedStackSize();
+    }
+    for (auto &i : fibers) {
+        i->call();
+        WEBS_ASSERT(i->getState() == webs::Fiber::TERM);
+    }
+    WEBS_LOG_INFO(g_logger) << "shared stack fibers = " << fibers.size() << " saved bytes = " << saved;
+    WEBS_ASSERT(bad == 0 && saved < fibers.size() * 4096);
+
+    std::atomic<int> count{0};
+    {
+        webs::IOManager iom(2, false, "shared");
+        iom.setSharedStack(true);
+        for (int i = 0; i < 1000; ++i) {
+            iom.schedule([i, &count, &bad]() {
+                int buf[64];
+                for (int j = 0; j < 64; ++j) {
+                    buf[j] = i + j;
+                }
+                int tid = webs::GetThreadId();
+                for (int k = 0; k < 3; ++k) {
+                    webs::Fiber::YieldToTeady();
+                    if (tid != webs::GetThreadId() || buf[k] != i + k || buf[63] != i + 63) {
+                        ++bad;
+                    }
+                }
+                ++count;
+            });
+        }
+    }
+    WEBS_LOG_INFO(g_logger) << "shared stack scheduler count = " << count << " bad = " << bad;
+    WEBS_ASSERT(count == 1000 && bad == 0);
+}
+
+/* 任务零散到来时每次只唤醒一个线程；停止时依次唤醒所有线程，不需要等待epoll超时 */
+void test_idle_wakeup() {
+    std::atomic<int> count{0};
+    uint64_t tickles = 0;
+    uint64_t empty_wakeups = 0;
+    uint64_t stop_ms = 0;
+    {
+        webs::IOManager iom(4, false, "idle");
+        for (int i = 0; i < 200; ++i) {
+            iom.schedule([&]() {
+                ++count;
+            });
+            // 主线程不在调度器中，使用未hook的usleep
+            usleep_f(500);
+        }
+        uint64_t start = webs::GetCurrentMS();
+        iom.stop();
+        stop_ms = webs::GetCurrentMS() - start;
+        tickles = iom.getTickleCount();
+        empty_wakeups = iom.getEmptyWakeupCount();
+    }
+    WEBS_LOG_INFO(g_logger) << "idle wakeup count = " << count << " tickles = " << tickles
+                            << " empty_wakeups = " << empty_wakeups << " stop_ms = " << stop_ms;
+    WEBS_ASSERT(count == 200 && stop_ms < 1000 && empty_wakeups < 100);
+}
+
+/* 记录析构次数的协程局部变量 */
+static std::atomic<int> s_local_dtors{0};
+struct LocalValue {
+    ~LocalValue() {
+        ++s_local_dtors;
+    }
+    int value = -1;
+};
+static webs::FiberLocal<LocalValue> s_local;
+
+/* 协程局部变量：切换线程后不变，协程结束或者reset时析构 */
+void test_fiber_local() {
+    std::atomic<int> bad{0};
+    {
+        webs::IOManager iom(4, false, "local");
+        for (int i = 0; i < 1000; ++i) {
+            iom.schedule([i, &bad]() {
+                s_local->value = i;
+                webs::SetTraceId("trace-" + std::to_string(i));
+                for (int k = 0; k < 5; ++k) {
+                    webs::Fiber::YieldToTeady();
+                    if (s_local->value != i || webs::GetTraceId() != "trace-" + std::to_string(i)) {
+                        ++bad;
+                    }
+                }
+            });
+        }
+    }
+    int dtors = s_local_dtors;
+    WEBS_LOG_INFO(g_logger) << "fiber local bad = " << bad << " dtors = " << dtors;
+    WEBS_ASSERT(bad == 0 && dtors == 1000);
+
+    webs::Fiber::GetThis();
+    webs::Fiber::ptr fiber(new webs::Fiber([]() {
+        s_local->value = 1;
+        webs::Fiber::GetThis()->back();
+    },
+                                           0, true));
+    fiber->call();
+    WEBS_ASSERT(s_local_dtors == 1000 && s_local.peek() == nullptr);
+    fiber->call();
+    WEBS_ASSERT(s_local_dtors == 1001 && fiber->getState() == webs::Fiber::TERM);
+
+    // 日志事件保存追踪id的拷贝：协程结束之后交给其他协程输出仍然有效
+    webs::LogEvent::ptr event;
+    fiber.reset(new webs::Fiber([&event]() {
+        webs::SetTraceId("trace-event");
+        event.reset(new webs::LogEvent(__FILE__, __LINE__, 0, webs::GetThreadId(), webs::GetFiberId(), time(0), "", g_logger,
+                                       webs::LogLevel::INFO));
+        webs::SetTraceId("trace-changed");
+    },
+                                0, true));
+    fiber->call();
+    fiber.reset();
+    WEBS_ASSERT(event->getTraceId() == "trace-event");
+}
+
+/* 忙等us微秒，模拟计算任务 */
+static void busy_us(uint64_t us) {
+    uint64_t end = webs::GetCurrentUS() + us;
+    while (webs::GetCurrentUS() < end) {
+    }
+}
+
+/* 混合负载：大量批处理任务积压时，延迟敏感的任务仍然很快开始执行，批处理任务不会饿死 */
+void test_priority() {
+    std::atomic<int> batch{0};
+    std::atomic<int> latency{0};
+    std::atomic<int> deadline{0};
+    uint64_t latency_p99 = 0;
+    uint64_t batch_p99 = 0;
+    {
+        webs::IOManager iom(2, false, "priority");
+        for (int i = 0; i < 5000; ++i) {
+            iom.schedule([&]() {
+                busy_us(10);
+                ++batch;
+            },
+                         -1, webs::Scheduler::PRIORITY_BATCH);
+        }
+        for (int i = 0; i < 100; ++i) {
+            iom.schedule([&]() {
+                ++latency;
+            },
+                         -1, webs::Scheduler::PRIORITY_LATENCY);
+            iom.schedule([&]() {
+                ++deadline;
+            },
+                         -1, webs::Scheduler::PRIORITY_BATCH, 1);
+            usleep_f(100);
+        }
+        iom.stop();
+        latency_p99 = iom.getWaitPercentileUs(webs::Scheduler::PRIORITY_LATENCY, 99);
+        batch_p99 = iom.getWaitPercentileUs(webs::Scheduler::PRIORITY_BATCH, 99);
+        std::stringstream ss;
+        iom.dump(ss);
+        WEBS_LOG_INFO(g_logger) << ss.str();
+        WEBS_ASSERT(iom.getQueueDepth(webs::Scheduler::PRIORITY_BATCH) == 0);
+    }
+    WEBS_LOG_INFO(g_logger) << "priority latency_p99_us = " << latency_p99 << " batch_p99_us = " << batch_p99;
+    WEBS_ASSERT(batch == 5000 && latency == 100 && deadline == 100);
+    WEBS_ASSERT(latency_p99 < batch_p99);
+}
+
+/* 批量提交：一次入队，按任务数量唤醒线程；小的可调用对象不分配内存 */
+void test_task_batch() {
+    int a = 1;
+    int b = 2;
+    webs::Task small([a, b]() { (void)(a + b); });
+    char big[128] = {0};
+    webs::Task large([big]() { (void)big; });
+    webs::Task moved(std::move(small));
+    WEBS_ASSERT(moved.isInline() && !small && !large.isInline());
+    WEBS_ASSERT(!webs::Task(std::function<void()>()));
+
+    std::atomic<int> count{0};
+    uint64_t tickles = 0;
+    {
+        webs::IOManager iom(4, false, "batch");
+        webs::Scheduler::TaskBatch batch(&iom);
+        for (int n = 0; n < 10; ++n) {
+            for (int i = 0; i < 1000; ++i) {
+                batch.add([&count]() { ++count; });
+            }
+            batch.submit();
+            WEBS_ASSERT(batch.empty());
+            usleep_f(1000);
+        }
+        std::vector<std::function<void()>> cbs(100, [&count]() { ++count; });
+        iom.schedule(cbs.begin(), cbs.end());
+        iom.stop();
+        tickles = iom.getTickleCount();
+    }
+    WEBS_LOG_INFO(g_logger) << "batch count = " << count << " tickles = " << tickles;
+    WEBS_ASSERT(count == 10100);
+    // 每批最多唤醒所有睡眠的线程
+    WEBS_ASSERT(tickles <= 11 * 4 + 4);
+}
+
+/* CPU列表解析；按scheduler.cpus配置绑定工作线程 */
+void test_affinity() {
+    std::vector<int> cpus = webs::ParseCpuList(std::vector<std::string>{"0-3", "8", "x", "5-4"});
+    WEBS_ASSERT(cpus == std::vector<int>({0, 1, 2, 3, 8}));
+    WEBS_ASSERT(webs::ParseCpuList("0-1,4") == std::vector<int>({0, 1, 4}));
+
+    std::map<std::string, std::vector<std::string>> conf;
+    conf["pinned"] = {"0"};
+    auto var = webs::Config::Lookup<std::map<std::string, std::vector<std::string>>>("scheduler.cpus");
+    var->setValue(conf);
+    std::atomic<int> on_cpu0{0};
+    {
+        webs::IOManager iom(2, false, "pinned");
+        WEBS_ASSERT(iom.getCpus() == std::vector<int>({0}));
+        for (int i = 0; i < 100; ++i) {
+            iom.schedule([&on_cpu0]() {
+                if (sched_getcpu() == 0) {
+                    ++on_cpu0;
+                }
+            });
+        }
+    }
+    var->setValue({});
+    WEBS_LOG_INFO(g_logger) << "affinity on_cpu0 = " << on_cpu0;
+    WEBS_ASSERT(on_cpu0 == 100);
+}
+
+/* 让出过的function协程结束后放回协程池，之后的任务复用 */
+void test_fiber_pool() {
+    std::atomic<int> count{0};
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    {
+        webs::IOManager iom(2, false, "pool");
+        for (int n = 0; n < 10; ++n) {
+            for (int i = 0; i < 100; ++i) {
+                iom.schedule([&count]() {
+                    webs::Fiber::YieldToTeady();
+                    ++count;
+                });
+            }
+            usleep_f(5000);
+        }
+        // 没有让出的任务复用上一个任务的协程，不经过协程池，不计入命中和未命中
+        for (int i = 0; i < 100; ++i) {
+            iom.schedule([]() {});
+        }
+        iom.stop();
+        hits = iom.getFiberPoolHits();
+        misses = iom.getFiberPoolMisses();
+        std::stringstream ss;
+        iom.dump(ss);
+        WEBS_LOG_INFO(g_logger) << ss.str();
+    }
+    WEBS_LOG_INFO(g_logger) << "fiber pool hits = " << hits << " misses = " << misses;
+    // 没有让出的任务每个线程最多从协程池取一次
+    WEBS_ASSERT(count == 1000 && hits + misses >= 1000 && hits + misses <= 1002);
+    // 没有协程池时每个任务都要创建协程；有协程池时主要是第一批需要创建
+    WEBS_ASSERT(misses < 500);
+}
+
+/* 两个协程在socketpair上往返rounds次，返回期间epoll_ctl的调用次数；每一轮关闭后重建，验证复用的fd重新注册 */
+static uint64_t PingPong(bool persistent, int rounds) {
+    webs::Config::Lookup<bool>("iomanager.epoll_persistent")->setValue(persistent);
+    std::atomic<int> pongs{0};
+    uint64_t ctls = 0;
+    {
+        webs::IOManager iom(1, false, "ping_pong");
+        iom.schedule([&]() {
+            for (int n = 0; n < 2; ++n) {
+                int sv[2];
+                WEBS_ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+                webs::FdMgr::GetInstance()->get(sv[0], true);
+                webs::FdMgr::GetInstance()->get(sv[1], true);
+                webs::FiberSemaphore done;
+                webs::IOManager::GetThis()->schedule([&]() {
+                    char c;
+                    while (read(sv[1], &c, 1) == 1 && write(sv[1], &c, 1) == 1) {
+                    }
+                    done.notify();
+                });
+                char c = 'x';
+                for (int i = 0; i < rounds; ++i) {
+                    if (write(sv[0], &c, 1) == 1 && read(sv[0], &c, 1) == 1) {
+                        ++pongs;
+                    }
+                }
+                close(sv[0]);
+                done.wait();
+                close(sv[1]);
+            }
+        });
+        iom.stop();
+        ctls = iom.getEpollCtlCount();
+    }
+    webs::Config::Lookup<bool>("iomanager.epoll_persistent")->setValue(false);
+    WEBS_LOG_INFO(g_logger) << "ping pong persistent = " << persistent << " pongs = " << pongs << " epoll_ctl = " << ctls;
+    WEBS_ASSERT(pongs == rounds * 2);
+    return ctls;
+}
+
+/* 持久注册：每个fd只注册一次，之后的等待不需要epoll_ctl */
+void test_persistent_epoll() {
+    const int rounds = 1000;
+    uint64_t persistent = PingPong(true, rounds);
+    uint64_t oneshot = PingPong(false, rounds);
+    // 每一轮两个fd各注册、删除一次
+    WEBS_ASSERT(persistent <= 8);
+    WEBS_ASSERT(oneshot >= (uint64_t)rounds * 2);
+}
+
+/**
+ * fd绕过hook被dup2替换：内核删除了旧文件的注册，之后的EPOLL_CTL_MOD返回ENOENT，需要退回EPOLL_CTL_ADD
+ * 读等待在替换之前登记，写等待在替换之后登记；两者都要被新文件的就绪事件唤醒
+ */
+void test_epoll_raw_close() {
+    char got = 0;
+    int add_rt = -1;
+    std::atomic<bool> writable{false};
+    {
+        webs::IOManager iom(1, false, "raw_close");
+        iom.schedule([&]() {
+            int sv[2], tv[2];
+            WEBS_ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+            WEBS_ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, tv) == 0);
+            webs::FdMgr::GetInstance()->get(sv[0], true);
+            webs::FdMgr::GetInstance()->get(sv[1], true);
+            // 没有退回ADD时读等待不会被唤醒，超时返回
+            struct timeval tv_timeout = {1, 0};
+            setsockopt(sv[0], SOL_SOCKET, SO_RCVTIMEO, &tv_timeout, sizeof(tv_timeout));
+            webs::FiberSemaphore done;
+            webs::IOManager::GetThis()->schedule([&]() {
+                char c;
+                if (read(sv[0], &c, 1) == 1) {
+                    got = c;
+                }
+                done.notify();
+            });
+            usleep(10 * 1000);
+            WEBS_ASSERT(write(tv[1], "y", 1) == 1);
+            WEBS_ASSERT(dup2(tv[0], sv[0]) == sv[0]);
+            add_rt = webs::IOManager::GetThis()->addEvent(sv[0], webs::IOManager::WRITE, [&]() { writable = true; });
+            done.wait();
+            close(sv[0]);
+            close(sv[1]);
+            close(tv[0]);
+            close(tv[1]);
+        });
+    }
+    WEBS_LOG_INFO(g_logger) << "raw close add = " << add_rt << " got = " << got << " writable = " << writable;
+    WEBS_ASSERT(add_rt == 0 && got == 'y' && writable);
+}
+
+/* 分段fd表：多个线程并发创建同一批槽位，每个fd只得到一个槽位，并且初始化过 */
+void test_fd_table() {
+    webs::FdTable<int, 4> table([](int &slot, int fd) { slot = fd; });
+    const int fds = 5000;
+    std::vector<std::vector<int *>> seen(4, std::vector<int *>(fds));
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([&, t]() {
+            for (int fd = 0; fd < fds; ++fd) {
+                seen[t][fd] = table.getOrCreate(fd);
+            }
+        });
+    }
+    for (auto &i : threads) {
+        i.join();
+    }
+    int mismatch = 0;
+    for (int fd = 0; fd < fds; ++fd) {
+        for (int t = 0; t < 4; ++t) {
+            if (seen[t][fd] != table.get(fd) || *seen[t][fd] != fd) {
+                ++mismatch;
+            }
+        }
+    }
+    WEBS_LOG_INFO(g_logger) << "fd table mismatch = " << mismatch;
+    WEBS_ASSERT(mismatch == 0 && !table.get(fds + 1000) && !table.get(-1));
+    // FdManager使用同样的表：不存在的fd不创建，删除后重新创建
+    int fd = 100000;
+    WEBS_ASSERT(!webs::FdMgr::GetInstance()->get(fd));
+    webs::FdCtx::ptr ctx = webs::FdMgr::GetInstance()->get(fd, true);
+    WEBS_ASSERT(ctx && webs::FdMgr::GetInstance()->get(fd) == ctx);
+    webs::FdMgr::GetInstance()->del(fd);
+    WEBS_ASSERT(!webs::FdMgr::GetInstance()->get(fd));
+}
+
+/* 多reactor：每个fd的事件都在它所属的线程恢复，连接分散在多个线程上；switchTo不受影响 */
+void test_multi_reactor() {
+    webs::Config::Lookup<bool>("iomanager.multi_reactor")->setValue(true);
+    const int conns = 8;
+    const int rounds = 100;
+    std::vector<std::vector<int>> threads(conns);
+    std::atomic<int> pongs{0};
+    int switched = -1, target = -1;
+    {
+        webs::IOManager iom(4, false, "multi_reactor");
+        WEBS_ASSERT(iom.isMultiReactor());
+        for (int n = 0; n < conns; ++n) {
+            iom.schedule([&, n]() {
+                int sv[2];
+                WEBS_ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+                webs::FdMgr::GetInstance()->get(sv[0], true);
+                webs::FdMgr::GetInstance()->get(sv[1], true);
+                webs::FiberSemaphore done;
+                webs::IOManager::GetThis()->schedule([&]() {
+                    char c;
+                    while (read(sv[1], &c, 1) == 1) {
+                        threads[n].push_back(webs::GetThreadId());
+                        write(sv[1], &c, 1);
+                    }
+                    done.notify();
+                });
+                char c = 'x';
+                for (int i = 0; i < rounds; ++i) {
+                    if (write(sv[0], &c, 1) == 1 && read(sv[0], &c, 1) == 1) {
+                        ++pongs;
+                    }
+                }
+                close(sv[0]);
+                done.wait();
+                close(sv[1]);
+                if (n == 0) {
+                    // 切换到读端所在的线程
+                    target = threads[0].back();
+                    webs::Scheduler::GetThis()->switchTo(target);
+                    switched = webs::GetThreadId();
+                }
+            });
+        }
+    }
+    webs::Config::Lookup<bool>("iomanager.multi_reactor")->setValue(false);
+    // 第一次等待之后，读端一直在所属reactor的线程上恢复
+    std::set<int> homes;
+    int moved = 0;
+    for (auto &t : threads) {
+        WEBS_ASSERT(t.size() == (size_t)rounds);
+        for (size_t i = rounds / 2; i < t.size(); ++i) {
+            moved += t[i] != t.back();
+        }
+        homes.insert(t.back());
+    }
+    WEBS_LOG_INFO(g_logger) << "multi reactor pongs = " << pongs << " homes = " << homes.size()
+                            << " moved = " << moved << " switched = " << (switched == target);
+    WEBS_ASSERT(pongs == conns * rounds && moved == 0 && homes.size() >= 2 && switched == target);
+}
+
+/* epoll批量：就绪的fd很多时批量增大，每个线程统计每次唤醒的事件数、epoll_wait耗时与就绪到恢复的延迟 */
+void test_epoll_batch() {
+    // 之前use_caller的测试在主线程上开启了hook；这里的写入、睡眠不经过IOManager
+    webs::set_hook_enable(false);
+    webs::Config::Lookup<uint32_t>("iomanager.epoll_batch_min")->setValue(4);
+    webs::Config::Lookup<uint32_t>("iomanager.epoll_batch_max")->setValue(64);
+    const int conns = 64;
+    const int rounds = 20;
+    std::atomic<int> reads{0};
+    uint32_t max_batch = 0;
+    uint64_t wakeups = 0, waits = 0, resumes = 0, p99_resume = 0;
+    {
+        webs::IOManager iom(1, false, "epoll_batch");
+        std::vector<int> writers(conns);
+        std::atomic<int> ready{0};
+        for (int n = 0; n < conns; ++n) {
+            iom.schedule([&, n]() {
+                int sv[2];
+                WEBS_ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+                webs::FdMgr::GetInstance()->get(sv[0], true);
+                writers[n] = sv[1];
+                ++ready;
+                char c;
+                while (read(sv[0], &c, 1) == 1) {
+                    ++reads;
+                }
+                close(sv[0]);
+            });
+        }
+        while (ready < conns) {
+            usleep(1000);
+        }
+        usleep(10 * 1000);
+        // 每轮所有fd同时就绪；第0个连接额外一直就绪，是热点fd
+        for (int i = 0; i < rounds; ++i) {
+            for (int n = 0; n < conns; ++n) {
+                WEBS_ASSERT(::write(writers[n], "x", 1) == 1);
+            }
+            for (int j = 0; j < 10; ++j) {
+                WEBS_ASSERT(::write(writers[0], "x", 1) == 1);
+                usleep_f(100);
+            }
+            usleep(2 * 1000);
+            const webs::IOManager::WorkerStats &stats = iom.getWorkerStats(0);
+            max_batch = std::max(max_batch, stats.batchSize.load());
+        }
+        usleep(10 * 1000);
+        const webs::IOManager::WorkerStats &stats = iom.getWorkerStats(0);
+        wakeups = stats.eventsPerWakeup.count();
+        waits = stats.epollWaitUs.count();
+        resumes = stats.readyToResumeUs.count();
+        p99_resume = stats.readyToResumeUs.percentile(99);
+        WEBS_ASSERT(iom.getWorkerCount() == 1);
+        for (int n = 0; n < conns; ++n) {
+            ::close(writers[n]);
+        }
+    }
+    webs::Config::Lookup<uint32_t>("iomanager.epoll_batch_min")->setValue(32);
+    webs::Config::Lookup<uint32_t>("iomanager.epoll_batch_max")->setValue(256);
+    WEBS_LOG_INFO(g_logger) << "epoll batch reads = " << reads << " max batch = " << max_batch << " wakeups = " << wakeups
+                            << " resumes = " << resumes << " p99 resume us = " << p99_resume;
+    WEBS_ASSERT(reads == conns * rounds + 10 * rounds);
+    WEBS_ASSERT(max_batch > 4 && max_batch <= 64);
+    WEBS_ASSERT(wakeups > 0 && waits >= wakeups && resumes > 0);
+}
+
+/* 热点fd排在后面：上一次唤醒刚分发过的fd与新就绪的fd在同一次唤醒中返回时，新就绪的fd先执行 */
+void test_hot_fd_order() {
+    int a[2], b[2];
+    WEBS_ASSERT(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, a) == 0);
+    WEBS_ASSERT(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, b) == 0);
+    std::string order;
+    {
+        webs::IOManager iom(1, false, "hot_fd");
+        iom.schedule([&]() {
+            webs::IOManager *self = webs::IOManager::GetThis();
+            // 第一次唤醒只有a就绪，a成为热点
+            self->addEvent(a[0], webs::IOManager::READ, [&, self]() {
+                char c;
+                while (read(a[0], &c, 1) == 1) {
+                }
+                self->addEvent(a[0], webs::IOManager::READ, [&]() {
+                    order += 'a';
+                });
+                self->addEvent(b[0], webs::IOManager::READ, [&]() {
+                    order += 'b';
+                });
+                // 下一次唤醒中a与b同时就绪，a在epoll就绪列表的前面
+                WEBS_ASSERT(write(a[1], "x", 1) == 1 && write(b[1], "x", 1) == 1);
+            });
+            WEBS_ASSERT(write(a[1], "x", 1) == 1);
+        });
+    }
+    for (int i = 0; i < 2; ++i) {
+        ::close(a[i]);
+        ::close(b[i]);
+    }
+    WEBS_LOG_INFO(g_logger) << "hot fd order = " << order;
+    WEBS_ASSERT(order == "ba");
+}
+
 int main() {
     webs::Scheduler sc(1, false, "test");
     WEBS_LOG_INFO(g_logger) << "main thread ";
     sc.start();
     sc.schedule(&test_fiber);
     sc.stop();
+    test_work_stealing();
+    test_stack_pool();
+    test_shared_stack();
+    test_pin_during_start();
+    test_idle_wakeup();
+    test_fiber_local();
+    test_priority();
+    test_task_batch();
+    test_affinity();
+    test_fiber_pool();
+    test_persistent_epoll();
+    test_epoll_raw_close();
+    test_fd_table();
+    test_multi_reactor();
+    test_epoll_batch();
+    test_hot_fd_order();
     return 0;
-}
\ No newline at end of file
+}
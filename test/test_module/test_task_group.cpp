@@ -0,0 +1,187 @@
+#include "../../webs/webs.h"
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+static webs::Logger::ptr g_logger = WEBS_LOG_ROOT();
+
+/* 等待全部任务，取回结果 */
+void test_join_all() {
+    int64_t sum = 0;
+    {
+        webs::IOManager iom(2, false, "join_all");
+        iom.schedule([&]() {
+            webs::TaskGroup group;
+            std::vector<webs::Future<int>> futures;
+            for (int i = 0; i < 100; ++i) {
+                futures.push_back(group.spawn([i]() {
+                    usleep(1000);
+                    return i * i;
+                }));
+            }
+            group.joinAll();
+            for (auto &i : futures) {
+                sum += i.get();
+            }
+            WEBS_ASSERT(group.getFinishedCount() == 100);
+        });
+    }
+    WEBS_LOG_INFO(g_logger) << "join all sum = " << sum;
+    WEBS_ASSERT(sum == 328350);
+}
+
+/* 第一个完成后取消其他任务：sleep、hook的IO、带超时的等待都会立即返回 */
+void test_join_any_and_cancel() {
+    int first = -2;
+    int sleep_errno = 0;
+    int read_errno = 0;
+    bool sem_timeout = false;
+    uint64_t cancel_ms = 0;
+    int sv[2];
+    WEBS_ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+    {
+        webs::IOManager iom(2, false, "join_any");
+        iom.schedule([&]() {
+            webs::FdMgr::GetInstance()->get(sv[0], true);
+            webs::FiberSemaphore sem;
+            webs::TaskGroup group;
+            group.spawn([&]() {
+                if (usleep(5000 * 1000) == -1) {
+                    sleep_errno = errno;
+                }
+            });
+            group.spawn([&]() {
+                char buf[16];
+                if (read(sv[0], buf, sizeof(buf)) == -1) {
+                    read_errno = errno;
+                }
+            });
+            group.spawn([&]() {
+                sem_timeout = !sem.waitFor(5000);
+            });
+            group.spawn([]() {
+                usleep(10 * 1000);
+            });
+            first = group.joinAny();
+            uint64_t start = webs::GetCurrentMS();
+            group.cancel();
+            group.joinAll();
+            cancel_ms = webs::GetCurrentMS() - start;
+            WEBS_ASSERT(group.joinAny() != -1);
+        });
+    }
+    close(sv[0]);
+    close(sv[1]);
+    WEBS_LOG_INFO(g_logger) << "join any first = " << first << " cancel_ms = " << cancel_ms
+                            << " sleep_errno = " << sleep_errno << " read_errno = " << read_errno
+                            << " sem_timeout = " << sem_timeout;
+    WEBS_ASSERT(first == 3 && cancel_ms < 1000);
+    WEBS_ASSERT(sleep_errno == ECANCELED && read_errno == ECANCELED && sem_timeout);
+}
+
+/* 第一个异常取消其他任务，joinAll重新抛出该异常；取消后spawn的任务不会执行 */
+void test_error_cancels() {
+    bool caught = false;
+    bool cancelled_get = false;
+    std::atomic<int> ran{0};
+    uint64_t elapsed = 0;
+    {
+        webs::IOManager iom(2, false, "error");
+        iom.schedule([&]() {
+            uint64_t start = webs::GetCurrentMS();
+            webs::TaskGroup group;
+            for (int i = 0; i < 10; ++i) {
+                group.spawn([]() {
+                    usleep(5000 * 1000);
+                });
+            }
+            group.spawn([]() {
+                usleep(10 * 1000);
+                throw std::logic_error("upstream failed");
+            });
+            try {
+                group.joinAll();
+            } catch (const std::logic_error &e) {
+                caught = true;
+            }
+            elapsed = webs::GetCurrentMS() - start;
+            WEBS_ASSERT(group.isCancelled());
+            webs::Future<int> late = group.spawn([&ran]() {
+                ++ran;
+                return 1;
+            });
+            try {
+                late.get();
+            } catch (const webs::TaskCancelled &e) {
+                cancelled_get = true;
+            }
+        });
+    }
+    WEBS_LOG_INFO(g_logger) << "error caught = " << caught << " elapsed = " << elapsed
+                            << " cancelled_get = " << cancelled_get;
+    WEBS_ASSERT(caught && elapsed < 1000 && cancelled_get && ran == 0);
+}
+
+/* TaskGroup析构时取消并等待还在执行的任务；还没有开始的任务不再执行 */
+void test_scope_exit() {
+    std::atomic<int> started{0};
+    std::atomic<int> finished{0};
+    uint64_t elapsed = 0;
+    {
+        webs::IOManager iom(2, false, "scope");
+        iom.schedule([&]() {
+            uint64_t start = webs::GetCurrentMS();
+            {
+                webs::TaskGroup group;
+                for (int i = 0; i < 10; ++i) {
+                    group.spawn([&started, &finished]() {
+                        ++started;
+                        sleep(5);
+                        ++finished;
+                    });
+                }
+                usleep(10 * 1000);
+            }
+            elapsed = webs::GetCurrentMS() - start;
+            WEBS_ASSERT(started > 0 && started == finished);
+        });
+    }
+    WEBS_LOG_INFO(g_logger) << "scope exit started = " << started << " elapsed = " << elapsed;
+    WEBS_ASSERT(elapsed < 1000);
+}
+
+/* 在协程之外析构：取消并分离任务，不等待也不断言 */
+void test_detach() {
+    std::atomic<int> started{0};
+    std::atomic<int> finished{0};
+    uint64_t elapsed = 0;
+    {
+        webs::IOManager iom(2, false, "detach");
+        uint64_t start = webs::GetMonotonicMS();
+        {
+            webs::TaskGroup group(&iom);
+            for (int i = 0; i < 10; ++i) {
+                group.spawn([&started, &finished]() {
+                    ++started;
+                    sleep(5);
+                    ++finished;
+                });
+            }
+            usleep(10 * 1000);
+        }
+        elapsed = webs::GetMonotonicMS() - start;
+    }
+    WEBS_LOG_INFO(g_logger) << "detach started = " << started << " finished = " << finished << " elapsed = " << elapsed;
+    // 分离的任务被取消，调度器停止之前都已经结束
+    WEBS_ASSERT(elapsed < 1000 && started > 0 && started == finished);
+}
+
+int main(int argc, char **argv) {
+    WEBS_LOG_NAME("system")->setLevel(webs::LogLevel::ERROR);
+    test_join_all();
+    test_join_any_and_cancel();
+    test_error_cancels();
+    test_scope_exit();
+    test_detach();
+    return 0;
+}
@@ -0,0 +1,158 @@
+#include "../../webs/webs.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sched.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+
+static webs::Logger::ptr g_logger = WEBS_LOG_ROOT();
+
+/* 记录连接在哪个线程上被接收，以及读写之后在哪个线程上恢复 */
+class EchoServer : public webs::TcpServer {
+public:
+    typedef std::shared_ptr<EchoServer> ptr;
+
+    EchoServer(webs::IOManager *iom) :
+        webs::TcpServer(iom, iom, iom) {
+    }
+
+    std::atomic<int> handled{0};
+    std::atomic<int> moved{0};
+    webs::Mutex mutex;
+    std::set<int> threads;
+    // 客户端端口 -> 处理连接的线程
+    std::map<uint32_t, int> portThreads;
+
+    /* 每个监听socket执行accept的线程 */
+    const std::vector<int> &getSockThreads() const {
+        return m_sockThreads;
+    }
+
+protected:
+    void handleClient(webs::Socket::ptr client) override {
+        int thread = webs::GetThreadId();
+        char buf[16];
+        while (client->recv(buf, sizeof(buf)) > 0) {
+            client->send(buf, 1);
+            moved += webs::GetThreadId() != thread;
+        }
+        {
+            webs::Mutex::Lock lock(mutex);
+            threads.insert(thread);
+            portThreads[std::dynamic_pointer_cast<webs::IPAddress>(client->getRemoteAddress())->getPort()] = thread;
+        }
+        client->close();
+        ++handled;
+    }
+};
+
+/* SO_REUSEPORT：每个io线程一个监听socket，连接在接收的线程上处理，不会转移到其他线程；
+ * cbpf为是否按CPU分配连接：客户端线程绑定到CPU上，连接必须由CPU对应的监听socket(cpu % 线程数)的线程处理 */
+void test_reuseport(bool cbpf) {
+    webs::Config::Lookup<bool>("iomanager.multi_reactor")->setValue(true);
+    webs::Config::Lookup<bool>("tcp_server.reuseport_cbpf")->setValue(cbpf);
+    const int threads = 4;
+    const int conns = 64;
+    int listeners = 0;
+    uint32_t port = 0;
+    std::vector<int> sock_threads;
+    // 客户端端口 -> 发起连接时所在的CPU
+    webs::Mutex client_mutex;
+    std::map<uint32_t, int> port_cpus;
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    WEBS_ASSERT(sched_getaffinity(0, sizeof(allowed), &allowed) == 0);
+    std::vector<int> cpus;
+    for (int i = 0; i < CPU_SETSIZE; ++i) {
+        if (CPU_ISSET(i, &allowed)) {
+            cpus.push_back(i);
+        }
+    }
+    EchoServer::ptr server;
+    {
+        webs::IOManager iom(threads, false, "reuseport");
+        server.reset(new EchoServer(&iom));
+        // 在hook的线程中创建监听socket，accept不会阻塞线程
+        std::atomic<bool> started{false};
+        iom.schedule([&]() {
+            webs::Address::ptr addr = webs::Address::LookupAnyIPAddress("127.0.0.1:0");
+            WEBS_ASSERT(server->bind(addr, false, true));
+            listeners = server->getSocks().size();
+            sock_threads = server->getSockThreads();
+            port = std::dynamic_pointer_cast<webs::IPAddress>(server->getSocks()[0]->getLocalAddress())->getPort();
+            for (auto &i : server->getSocks()) {
+                WEBS_ASSERT(std::dynamic_pointer_cast<webs::IPAddress>(i->getLocalAddress())->getPort() == port);
+            }
+            server->start();
+            started = true;
+        });
+        while (!started) {
+            usleep(1000);
+        }
+
+        // 客户端在调度器之外的线程上使用阻塞的socket
+        std::vector<std::thread> clients;
+        for (int t = 0; t < 4; ++t) {
+            clients.emplace_back([&, t]() {
+                int cpu = cpus[t % cpus.size()];
+                cpu_set_t set;
+                CPU_ZERO(&set);
+                CPU_SET(cpu, &set);
+                WEBS_ASSERT(sched_setaffinity(0, sizeof(set), &set) == 0);
+                for (int i = 0; i < conns / 4; ++i) {
+                    int fd = socket(AF_INET, SOCK_STREAM, 0);
+                    sockaddr_in sin;
+                    memset(&sin, 0, sizeof(sin));
+                    sin.sin_family = AF_INET;
+                    sin.sin_port = htons(port);
+                    sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+                    WEBS_ASSERT(connect(fd, (sockaddr *)&sin, sizeof(sin)) == 0);
+                    sockaddr_in local;
+                    socklen_t len = sizeof(local);
+                    WEBS_ASSERT(getsockname(fd, (sockaddr *)&local, &len) == 0);
+                    {
+                        webs::Mutex::Lock lock(client_mutex);
+                        port_cpus[ntohs(local.sin_port)] = cpu;
+                    }
+                    char c = 'x';
+                    for (int j = 0; j < 10; ++j) {
+                        WEBS_ASSERT(write(fd, &c, 1) == 1 && read(fd, &c, 1) == 1);
+                    }
+                    close(fd);
+                }
+            });
+        }
+        for (auto &i : clients) {
+            i.join();
+        }
+        while (server->handled < conns) {
+            usleep(1000);
+        }
+        server->stop();
+    }
+    webs::Config::Lookup<bool>("iomanager.multi_reactor")->setValue(false);
+    webs::Config::Lookup<bool>("tcp_server.reuseport_cbpf")->setValue(false);
+    WEBS_LOG_INFO(g_logger) << "reuseport cbpf = " << cbpf << " listeners = " << listeners << " handled = " << server->handled
+                            << " threads = " << server->threads.size() << " moved = " << server->moved;
+    WEBS_ASSERT(listeners == threads && (int)sock_threads.size() == threads);
+    WEBS_ASSERT(server->handled == conns && server->moved == 0 && server->portThreads.size() == (size_t)conns);
+    if (!cbpf) {
+        WEBS_ASSERT(server->threads.size() >= 2);
+        return;
+    }
+    // 回环连接的SYN在客户端所在的CPU上处理，过滤器按cpu % 线程数选择监听socket
+    for (auto &i : server->portThreads) {
+        auto it = port_cpus.find(i.first);
+        WEBS_ASSERT(it != port_cpus.end());
+        WEBS_ASSERT(i.second == sock_threads[it->second % threads]);
+    }
+}
+
+int main() {
+    WEBS_LOG_NAME("system")->setLevel(webs::LogLevel::ERROR);
+    test_reuseport(false);
+    test_reuseport(true);
+    return 0;
+}
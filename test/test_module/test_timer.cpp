@@ -1,15 +1,213 @@
 #include "../../webs/webs.h"
 
+#include <stdlib.h>
+#include <set>
+
 static webs::Logger::ptr g_logger = WEBS_LOG_ROOT();
 
 void test_timer() {
     WEBS_LOG_INFO(g_logger) << " test in timer";
     webs::IOManager iom(1);
-    iom.addTimer(
-        500, []() { WEBS_LOG_INFO(g_logger) << "  hello timer"; }, true);
+    std::atomic<int> count{0};
+    webs::Timer::ptr timer;
+    timer = iom.addTimer(
+        50, [&]() {
+            WEBS_LOG_INFO(g_logger) << "  hello timer";
+            if (++count == 3) {
+                timer->cancel();
+            }
+        },
+        true);
+}
+
+/* 时间轮：跨越第0层与第1层的定时器按时触发，取消的不触发，重置后按新的时间触发 */
+void test_timer_wheel() {
+    const int timers = 300;
+    std::vector<uint64_t> expect(timers), fired(timers, 0);
+    std::atomic<int> fired_count{0}, cancelled_fired{0};
+    uint64_t reset_expect = 0, reset_fired = 0;
+    {
+        webs::IOManager iom(2, false, "timer_wheel");
+        std::vector<webs::Timer::ptr> handles;
+        for (int i = 0; i < timers; ++i) {
+            // 0~700ms，覆盖第0层(256ms以内)与第1层
+            uint64_t ms = rand() % 700;
+            expect[i] = webs::GetMonotonicMS() + ms;
+            handles.push_back(iom.addTimer(ms, [&, i]() {
+                fired[i] = webs::GetMonotonicMS();
+                ++fired_count;
+                if (i % 3 == 0) {
+                    ++cancelled_fired;
+                }
+            }));
+        }
+        // 取消下标为3的倍数的定时器
+        for (int i = 0; i < timers; i += 3) {
+            if (expect[i] > webs::GetMonotonicMS() + 5) {
+                WEBS_ASSERT(handles[i]->cancel());
+                WEBS_ASSERT(!handles[i]->cancel());
+            } else {
+                expect[i] = 0;
+            }
+        }
+        webs::Timer::ptr reset = iom.addTimer(50, [&]() { reset_fired = webs::GetMonotonicMS(); });
+        reset_expect = webs::GetMonotonicMS() + 300;
+        WEBS_ASSERT(reset->reset(300, true));
+    }
+    int early = 0, late = 0, cancelled = 0;
+    for (int i = 0; i < timers; ++i) {
+        if (i % 3 == 0) {
+            cancelled += expect[i] != 0;
+            continue;
+        }
+        early += fired[i] + 1 < expect[i];
+        late += fired[i] > expect[i] + 100;
+    }
+    WEBS_LOG_INFO(g_logger) << "timer wheel fired = " << fired_count << " early = " << early << " late = " << late
+                            << " cancelled = " << cancelled << " cancelled fired = " << cancelled_fired
+                            << " reset delay = " << (int64_t)(reset_fired - reset_expect);
+    WEBS_ASSERT(early == 0 && late == 0);
+    WEBS_ASSERT(fired_count == timers - cancelled && cancelled_fired == timers / 3 - cancelled);
+    WEBS_ASSERT(reset_fired + 1 >= reset_expect && reset_fired < reset_expect + 100);
+}
+
+/* 每个线程一个时间轮：协程添加到自己线程的时间轮，所有定时器都触发，IOManager能正常停止 */
+void test_timer_per_thread() {
+    webs::Config::Lookup<bool>("iomanager.timer_per_thread")->setValue(true);
+    const int fibers = 8;
+    const int per_fiber = 100;
+    std::atomic<int> fired{0};
+    {
+        webs::IOManager iom(4, false, "timer_per_thread");
+        for (int i = 0; i < fibers; ++i) {
+            iom.schedule([&]() {
+                for (int j = 0; j < per_fiber; ++j) {
+                    webs::IOManager::GetThis()->addTimer(rand() % 300, [&]() { ++fired; });
+                }
+            });
+        }
+        // 不属于调度器的线程添加到共享的时间轮
+        iom.addTimer(100, [&]() { ++fired; });
+    }
+    webs::Config::Lookup<bool>("iomanager.timer_per_thread")->setValue(false);
+    WEBS_LOG_INFO(g_logger) << "timer per thread fired = " << fired;
+    WEBS_ASSERT(fired == fibers * per_fiber + 1);
+}
+
+/* IO超时的使用方式：添加条件定时器随后取消；时间轮的插入与删除都是O(1) */
+void test_timer_add_cancel() {
+    const int count = 100000;
+    webs::IOManager iom(1, false, "timer_add_cancel");
+    std::shared_ptr<int> cond(new int(0));
+    std::vector<webs::Timer::ptr> timers;
+    timers.reserve(count);
+    uint64_t start = webs::GetCurrentUS();
+    for (int i = 0; i < count; ++i) {
+        timers.push_back(iom.addConditionTimer(5000 + i % 60000, []() {}, cond));
+    }
+    uint64_t added = webs::GetCurrentUS();
+    for (auto &i : timers) {
+        WEBS_ASSERT(i->cancel());
+    }
+    uint64_t cancelled = webs::GetCurrentUS();
+    WEBS_LOG_INFO(g_logger) << "timer add " << count << " in " << (added - start) << "us, cancel in "
+                            << (cancelled - added) << "us";
+    WEBS_ASSERT(!iom.hasTimer());
+}
+
+/* slack：窗口内的定时器合并到少数几个tick上到期，不早于设定的时间，不晚于slack */
+void test_timer_slack() {
+    const int timers = 100;
+    const uint64_t slack = 64;
+    std::vector<uint64_t> expect(timers), fired(timers, 0);
+    uint64_t avoided = 0;
+    {
+        webs::IOManager iom(1, false, "timer_slack");
+        for (int i = 0; i < timers; ++i) {
+            uint64_t ms = 200 + i;
+            expect[i] = webs::GetMonotonicMS() + ms;
+            iom.addTimer(ms, [&, i]() { fired[i] = webs::GetMonotonicMS(); }, false, slack);
+        }
+        iom.addTimer(500, [&]() { avoided = webs::IOManager::GetThis()->getAvoidedWakeups(); });
+    }
+    std::set<uint64_t> times;
+    int early = 0, late = 0;
+    for (int i = 0; i < timers; ++i) {
+        times.insert(fired[i]);
+        early += fired[i] + 1 < expect[i];
+        late += fired[i] > expect[i] + slack + 50;
+    }
+    // 同一次唤醒中依次执行的回调可能跨过毫秒边界，相隔不超过5ms的时间算作同一个tick
+    std::vector<uint64_t> ticks;
+    for (auto i : times) {
+        if (ticks.empty() || i > ticks.back() + 5) {
+            ticks.push_back(i);
+        }
+    }
+    WEBS_LOG_INFO(g_logger) << "timer slack ticks = " << ticks.size() << " early = " << early << " late = " << late
+                            << " avoided wakeups = " << avoided;
+    WEBS_ASSERT(early == 0 && late == 0);
+    // 100ms的范围按64ms对齐，最多落在3个tick上
+    WEBS_ASSERT(ticks.size() <= 3 && avoided >= timers - 3);
+}
+
+/* 粗粒度时钟：idle线程中读取缓存的时间，与精确的时钟相差不超过一个tick加一次epoll_wait */
+void test_coarse_clock() {
+    int64_t mono_diff = 0, real_diff = 0;
+    {
+        webs::IOManager iom(1, false, "coarse_clock");
+        iom.schedule([&]() {
+            webs::IOManager::GetThis()->addTimer(30, [&]() {
+                mono_diff = (int64_t)webs::GetMonotonicMS() - (int64_t)webs::CoarseClock::NowMS();
+                real_diff = (int64_t)time(0) - (int64_t)webs::CoarseClock::RealtimeSec();
+            });
+        });
+    }
+    WEBS_LOG_INFO(g_logger) << "coarse clock monotonic diff = " << mono_diff << "ms realtime diff = " << real_diff << "s";
+    WEBS_ASSERT(mono_diff >= -1 && mono_diff < 50);
+    WEBS_ASSERT(real_diff >= 0 && real_diff <= 1);
+}
+
+/* 一直有任务的线程不进入idle，粗粒度时钟由调度循环刷新，不会停在进入忙碌之前的时间 */
+static void BusyTask(int left, std::atomic<int64_t> &max_diff) {
+    uint64_t until = webs::GetMonotonicUS() + 1000;
+    while (webs::GetMonotonicUS() < until) {
+    }
+    int64_t diff = (int64_t)webs::GetMonotonicMS() - (int64_t)webs::CoarseClock::NowMS();
+    if (diff > max_diff) {
+        max_diff = diff;
+    }
+    if (left > 0) {
+        webs::IOManager::GetThis()->schedule([left, &max_diff]() { BusyTask(left - 1, max_diff); });
+    }
+}
+
+void test_coarse_clock_busy() {
+    std::atomic<int64_t> max_diff{0};
+    {
+        webs::IOManager iom(1, false, "coarse_busy");
+        iom.schedule([&]() {
+            // 先让线程进入一次idle，使用IOManager的缓存时钟
+            usleep(20 * 1000);
+            // 多条任务链保证队列一直不为空，线程不再进入idle
+            for (int i = 0; i < 8; ++i) {
+                webs::IOManager::GetThis()->schedule([&max_diff]() { BusyTask(40, max_diff); });
+            }
+        });
+    }
+    WEBS_LOG_INFO(g_logger) << "coarse clock busy max diff = " << max_diff << "ms";
+    // 每16个任务刷新一次，每个任务1ms
+    WEBS_ASSERT(max_diff < 50);
 }
 
 int main() {
+    WEBS_LOG_NAME("system")->setLevel(webs::LogLevel::ERROR);
     test_timer();
+    test_timer_wheel();
+    test_timer_per_thread();
+    test_timer_add_cancel();
+    test_timer_slack();
+    test_coarse_clock();
+    test_coarse_clock_busy();
     return 0;
-}
\ No newline at end of file
+}
@@ -45,7 +45,7 @@ void Config::LoadFromYaml(const YAML::Node &node) {
             continue;
         }
         ConfigVarBase::ptr val = LookupBase(key); // 查找key是否存在
-        if (!val) {
+        if (val) {
             if (i.second.IsScalar()) { // 使用基类指针调用虚函数。使用 Scalar()将node数据转化为string
                 val->fromString(i.second.Scalar());
             } else { // 非标量需要将 node 转为字符串
@@ -0,0 +1,58 @@
+#include "cancel_token.h"
+#include "fiber_local.h"
+
+namespace webs {
+
+// 当前协程绑定的取消标记；随协程在线程之间迁移
+static FiberLocal<CancelToken::ptr> s_current_token;
+
+void CancelToken::cancel() {
+    Task interrupt;
+    {
+        MutexType::Lock lock(m_mutex);
+        if (m_cancelled.exchange(true, std::memory_order_acq_rel)) {
+            return;
+        }
+        interrupt.swap(m_interrupt);
+    }
+    // 中断函数会调度协程或者触发IO事件，不在锁内执行
+    if (interrupt) {
+        interrupt();
+    }
+}
+
+bool CancelToken::setInterrupt(Task interrupt) {
+    MutexType::Lock lock(m_mutex);
+    if (isCancelled()) {
+        return false;
+    }
+    m_interrupt = std::move(interrupt);
+    return true;
+}
+
+void CancelToken::clearInterrupt() {
+    // 中断函数持有的对象在锁外释放
+    Task interrupt;
+    MutexType::Lock lock(m_mutex);
+    interrupt.swap(m_interrupt);
+}
+
+CancelToken *CancelToken::GetCurrent() {
+    CancelToken::ptr *token = s_current_token.peek();
+    return token ? token->get() : nullptr;
+}
+
+void CancelToken::SetCurrent(const CancelToken::ptr &token) {
+    if (token) {
+        s_current_token.set(token);
+    } else {
+        s_current_token.reset();
+    }
+}
+
+bool CancelToken::IsCancelled() {
+    CancelToken *token = GetCurrent();
+    return token && token->isCancelled();
+}
+
+} // namespace webs
@@ -0,0 +1,57 @@
+/**
+ * 协程的协作式取消
+ * 协程通过CancelToken::SetCurrent绑定一个取消标记；被取消后，hook的IO、sleep以及带超时的协程同步等待会立即返回
+ * IO返回-1且errno为ECANCELED；其余代码通过CancelToken::IsCancelled自行检查
+*/
+#ifndef __WEBS_CANCEL_TOKEN_H__
+#define __WEBS_CANCEL_TOKEN_H__
+
+#include <atomic>
+#include <memory>
+#include "task.h"
+#include "../util_module/mutex.h"
+#include "../util_module/Noncopyable.h"
+
+namespace webs {
+
+class CancelToken : Noncopyable {
+public:
+    typedef std::shared_ptr<CancelToken> ptr;
+    typedef Spinlock MutexType;
+
+    /* 取消；如果协程正阻塞在可以中断的等待中，执行登记的中断函数唤醒它 */
+    void cancel();
+
+    /* 是否已经取消 */
+    bool isCancelled() const {
+        return m_cancelled.load(std::memory_order_acquire);
+    }
+
+    /**
+     * 阻塞之前登记中断函数；已经取消返回false，不会登记
+     * 中断函数在cancel的线程中执行，最多执行一次
+     */
+    bool setInterrupt(Task interrupt);
+
+    /* 阻塞返回后清除中断函数 */
+    void clearInterrupt();
+
+    /* 当前协程绑定的取消标记；没有绑定返回nullptr */
+    static CancelToken *GetCurrent();
+
+    /* 为当前协程绑定取消标记；传入nullptr解除绑定 */
+    static void SetCurrent(const CancelToken::ptr &token);
+
+    /* 当前协程是否已经被取消 */
+    static bool IsCancelled();
+
+private:
+    MutexType m_mutex;
+    std::atomic<bool> m_cancelled = {false};
+    // 当前阻塞点的中断函数
+    Task m_interrupt;
+};
+
+} // namespace webs
+
+#endif
@@ -0,0 +1,112 @@
+#include "channel.h"
+
+namespace webs {
+
+void ChannelBase::close() {
+    MutexType::Lock lock(m_mutex);
+    m_closed = true;
+    m_sendWaiters.notifyAll();
+    m_recvWaiters.notifyAll();
+}
+
+bool ChannelBase::isClosed() {
+    MutexType::Lock lock(m_mutex);
+    return m_closed;
+}
+
+uint64_t ChannelBase::Deadline(uint64_t timeout_ms) {
+    if (timeout_ms == ~0ull) {
+        return ~0ull;
+    }
+    return webs::GetMonotonicMS() + timeout_ms;
+}
+
+uint64_t ChannelBase::Remaining(uint64_t deadline) {
+    if (deadline == ~0ull) {
+        return ~0ull;
+    }
+    uint64_t now = webs::GetMonotonicMS();
+    return now >= deadline ? 0 : deadline - now;
+}
+
+ChannelSelect::~ChannelSelect() {
+    for (auto &i : m_cases) {
+        delete i;
+    }
+}
+
+/**
+ * 依次在每个通道的锁下尝试操作，不能完成时把同一个等待者加入该通道的等待队列
+ * 所有操作都不能完成时挂起；任意一个通道唤醒后从所有队列中移除等待者，重新检查
+ */
+int ChannelSelect::select(uint64_t timeout_ms) {
+    size_t count = m_cases.size();
+    if (count == 0) {
+        return -1;
+    }
+    uint64_t deadline = ChannelBase::Deadline(timeout_ms);
+    size_t start = m_start++ % count;
+    bool woken = false;
+    while (true) {
+        uint64_t wait = ChannelBase::Remaining(deadline);
+        FiberWaitQueue::Waiter::ptr waiter;
+        for (size_t n = 0; n < count; ++n) {
+            size_t idx = (start + n) % count;
+            Case *c = m_cases[idx];
+            ChannelBase::MutexType::Lock lock(c->channel.m_mutex);
+            bool ok = false;
+            if (c->tryNolock(ok)) {
+                lock.unlock();
+                if (c->ok) {
+                    *c->ok = ok;
+                }
+                if (waiter) {
+                    removeWaiter(waiter);
+                }
+                if (woken) {
+                    passWakeup(idx);
+                }
+                return idx;
+            }
+            if (wait == 0) {
+                continue;
+            }
+            if (!waiter) {
+                waiter = FiberWaitQueue::CreateWaiter();
+            }
+            c->waiters().add(waiter);
+        }
+        if (!waiter) {
+            return -1;
+        }
+        bool rt = FiberWaitQueue::Park(waiter, wait);
+        removeWaiter(waiter);
+        if (!rt) {
+            // 超时之后再检查一次，不挂起
+            deadline = 0;
+        }
+        woken = rt;
+    }
+}
+
+void ChannelSelect::removeWaiter(const FiberWaitQueue::Waiter::ptr &waiter) {
+    for (auto &i : m_cases) {
+        ChannelBase::MutexType::Lock lock(i->channel.m_mutex);
+        i->waiters().remove(waiter);
+    }
+}
+
+void ChannelSelect::passWakeup(size_t chosen) {
+    for (size_t i = 0; i < m_cases.size(); ++i) {
+        if (i == chosen) {
+            continue;
+        }
+        Case *c = m_cases[i];
+        ChannelBase::MutexType::Lock lock(c->channel.m_mutex);
+        if (c->readyNolock()) {
+            c->waiters().notifyOne();
+        }
+    }
+}
+
+} // namespace webs
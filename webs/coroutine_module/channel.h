@@ -0,0 +1,357 @@
+/**
+ * 协程之间传递数据的通道(CSP)
+ * 通道满/空时挂起当前协程而不是线程；支持有界/无界容量、关闭、基于TimerManager的超时以及在多个通道上select
+ * 元素保存在环形缓冲区中，缓冲区有空间时push/pop只移动元素，不分配内存
+*/
+#ifndef __WEBS_CHANNEL_H__
+#define __WEBS_CHANNEL_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <memory>
+#include <utility>
+#include <vector>
+#include "fiber_sync.h"
+#include "../util_module/util.h"
+#include "../util_module/Noncopyable.h"
+
+namespace webs {
+
+class ChannelSelect;
+
+/* 通道中与元素类型无关的部分：锁、等待队列、关闭状态 */
+class ChannelBase : Noncopyable {
+    friend class ChannelSelect;
+
+public:
+    typedef FiberWaitQueue::MutexType MutexType;
+
+    /* 关闭通道；唤醒所有等待的协程。关闭后push失败，pop取完剩余元素后失败 */
+    void close();
+
+    /* 通道是否已经关闭 */
+    bool isClosed();
+
+protected:
+    /* 距离deadline剩余的毫秒数；deadline为~0ull表示一直等待 */
+    static uint64_t Remaining(uint64_t deadline);
+
+    /* 超时时间 --> 截止时间；使用单调时钟，系统时间调整不影响超时 */
+    static uint64_t Deadline(uint64_t timeout_ms);
+
+protected:
+    MutexType m_mutex;
+    // 等待缓冲区有空间的协程
+    FiberWaitQueue m_sendWaiters;
+    // 等待缓冲区有元素的协程
+    FiberWaitQueue m_recvWaiters;
+    // 是否已经关闭
+    bool m_closed = false;
+};
+
+/**
+ * 通道
+ * capacity > 0 为有界通道，缓冲区满时push挂起；capacity == 0 为无界通道，缓冲区满时按两倍扩容
+ */
+template <class T>
+class Channel : public ChannelBase {
+    friend class ChannelSelect;
+
+public:
+    typedef std::shared_ptr<Channel> ptr;
+
+    explicit Channel(size_t capacity = 0) :
+        m_bounded(capacity > 0) {
+        reserve(capacity > 0 ? capacity : 16);
+    }
+
+    ~Channel() {
+        while (m_size > 0) {
+            AllocTraits::destroy(m_alloc, m_buffer + m_head);
+            m_head = next(m_head);
+            --m_size;
+        }
+        m_alloc.deallocate(m_buffer, m_capacity);
+    }
+
+    /* 放入元素，缓冲区满时挂起；通道已关闭返回false */
+    bool push(T v) {
+        return pushFor(std::move(v), ~0ull);
+    }
+
+    /* 最多等待timeout_ms；超时或者通道已关闭返回false */
+    bool pushFor(T v, uint64_t timeout_ms) {
+        uint64_t deadline = Deadline(timeout_ms);
+        MutexType::Lock lock(m_mutex);
+        bool ok = false;
+        while (!tryPushNolock(v, ok)) {
+            uint64_t wait = Remaining(deadline);
+            if (wait == 0 || !m_sendWaiters.wait(lock, wait)) {
+                return tryPushNolock(v, ok) && ok;
+            }
+        }
+        return ok;
+    }
+
+    /* 不等待；缓冲区满或者通道已关闭返回false */
+    bool tryPush(T v) {
+        MutexType::Lock lock(m_mutex);
+        bool ok = false;
+        return tryPushNolock(v, ok) && ok;
+    }
+
+    /* 取出元素，缓冲区空时挂起；通道已关闭并且没有剩余元素返回false */
+    bool pop(T &v) {
+        return popFor(v, ~0ull);
+    }
+
+    /* 最多等待timeout_ms；超时或者通道已关闭并且没有剩余元素返回false */
+    bool popFor(T &v, uint64_t timeout_ms) {
+        uint64_t deadline = Deadline(timeout_ms);
+        MutexType::Lock lock(m_mutex);
+        bool ok = false;
+        while (!tryPopNolock(v, ok)) {
+            uint64_t wait = Remaining(deadline);
+            if (wait == 0 || !m_recvWaiters.wait(lock, wait)) {
+                return tryPopNolock(v, ok) && ok;
+            }
+        }
+        return ok;
+    }
+
+    /* 不等待；缓冲区空返回false */
+    bool tryPop(T &v) {
+        MutexType::Lock lock(m_mutex);
+        bool ok = false;
+        return tryPopNolock(v, ok) && ok;
+    }
+
+    /**
+     * 尝试放入元素，不能立即完成时把waiter加入等待队列(C++20协程的co_await使用)
+     * 返回true表示操作已经完成，ok表示是否放入；返回false表示已经加入等待队列，被唤醒后需要重试
+     */
+    bool tryPushOrWait(T &v, bool &ok, const FiberWaitQueue::Waiter::ptr &waiter) {
+        MutexType::Lock lock(m_mutex);
+        if (tryPushNolock(v, ok)) {
+            return true;
+        }
+        m_sendWaiters.add(waiter);
+        return false;
+    }
+
+    /* 尝试取出元素；返回值含义与tryPushOrWait相同 */
+    bool tryPopOrWait(T &v, bool &ok, const FiberWaitQueue::Waiter::ptr &waiter) {
+        MutexType::Lock lock(m_mutex);
+        if (tryPopNolock(v, ok)) {
+            return true;
+        }
+        m_recvWaiters.add(waiter);
+        return false;
+    }
+
+    /* 缓冲区中的元素数量 */
+    size_t size() {
+        MutexType::Lock lock(m_mutex);
+        return m_size;
+    }
+
+    /* 有界通道的容量；无界通道返回0 */
+    size_t capacity() const {
+        return m_bounded ? m_capacity : 0;
+    }
+
+private:
+    /**
+     * 尝试放入元素；调用者持有锁
+     * 返回true表示操作已经完成，ok表示是否放入(通道关闭时为false)；返回false表示需要等待
+     */
+    bool tryPushNolock(T &v, bool &ok) {
+        if (m_closed) {
+            ok = false;
+            return true;
+        }
+        if (m_size == m_capacity) {
+            if (m_bounded) {
+                return false;
+            }
+            reserve(m_capacity * 2);
+        }
+        AllocTraits::construct(m_alloc, m_buffer + m_tail, std::move(v));
+        m_tail = next(m_tail);
+        ++m_size;
+        ok = true;
+        m_recvWaiters.notifyOne();
+        return true;
+    }
+
+    /* 尝试取出元素；返回值含义与tryPushNolock相同 */
+    bool tryPopNolock(T &v, bool &ok) {
+        if (m_size > 0) {
+            v = std::move(m_buffer[m_head]);
+            AllocTraits::destroy(m_alloc, m_buffer + m_head);
+            m_head = next(m_head);
+            --m_size;
+            ok = true;
+            m_sendWaiters.notifyOne();
+            return true;
+        }
+        if (m_closed) {
+            ok = false;
+            return true;
+        }
+        return false;
+    }
+
+    /* 不执行操作，只判断是否可以立即完成；调用者持有锁 */
+    bool canPushNolock() const {
+        return m_closed || !m_bounded || m_size < m_capacity;
+    }
+
+    bool canPopNolock() const {
+        return m_closed || m_size > 0;
+    }
+
+    size_t next(size_t i) const {
+        return i + 1 == m_capacity ? 0 : i + 1;
+    }
+
+    /* 重新分配容量为capacity的缓冲区，按顺序移动已有的元素 */
+    void reserve(size_t capacity) {
+        T *buffer = m_alloc.allocate(capacity);
+        size_t i = m_head;
+        for (size_t n = 0; n < m_size; ++n) {
+            AllocTraits::construct(m_alloc, buffer + n, std::move(m_buffer[i]));
+            AllocTraits::destroy(m_alloc, m_buffer + i);
+            i = next(i);
+        }
+        if (m_buffer) {
+            m_alloc.deallocate(m_buffer, m_capacity);
+        }
+        m_buffer = buffer;
+        m_capacity = capacity;
+        m_head = 0;
+        m_tail = m_size == capacity ? 0 : m_size;
+    }
+
+private:
+    typedef std::allocator_traits<std::allocator<T>> AllocTraits;
+
+    std::allocator<T> m_alloc;
+    // 环形缓冲区
+    T *m_buffer = nullptr;
+    size_t m_capacity = 0;
+    // 第一个元素的位置
+    size_t m_head = 0;
+    // 下一个放入的位置
+    size_t m_tail = 0;
+    // 元素数量
+    size_t m_size = 0;
+    // 是否有界
+    bool m_bounded;
+};
+
+/**
+ * 在多个通道上等待，执行第一个可以完成的操作
+ * 用法：
+ *     ChannelSelect sel;
+ *     sel.recv(ch1, v1, &ok1);  // 返回0
+ *     sel.send(ch2, v2);        // 返回1
+ *     int idx = sel.select(100); // 完成的操作的下标；超时返回-1
+ * 关闭的通道上的操作视为可以完成，ok为false
+ */
+class ChannelSelect : Noncopyable {
+public:
+    ~ChannelSelect();
+
+    /* 添加一个接收操作；完成时元素写入v */
+    template <class T>
+    size_t recv(Channel<T> &ch, T &v, bool *ok = nullptr) {
+        m_cases.push_back(new RecvCase<T>(ch, v, ok));
+        return m_cases.size() - 1;
+    }
+
+    /* 添加一个发送操作；完成时v被移动到通道中 */
+    template <class T>
+    size_t send(Channel<T> &ch, T &v, bool *ok = nullptr) {
+        m_cases.push_back(new SendCase<T>(ch, v, ok));
+        return m_cases.size() - 1;
+    }
+
+    /* 等待任意一个操作完成，返回它的下标；timeout_ms为~0ull表示一直等待，超时返回-1 */
+    int select(uint64_t timeout_ms = ~0ull);
+
+    /* 不等待；没有可以立即完成的操作返回-1 */
+    int trySelect() {
+        return select(0);
+    }
+
+private:
+    /* 一个通道操作 */
+    struct Case {
+        Case(ChannelBase &c, bool *o) :
+            channel(c), ok(o) {
+        }
+        virtual ~Case() {
+        }
+        /* 尝试完成操作；调用者持有通道的锁 */
+        virtual bool tryNolock(bool &ok) = 0;
+        /* 是否可以立即完成；调用者持有通道的锁 */
+        virtual bool readyNolock() = 0;
+        /* 操作等待的队列 */
+        virtual FiberWaitQueue &waiters() = 0;
+
+        ChannelBase &channel;
+        bool *ok;
+    };
+
+    template <class T>
+    struct RecvCase : public Case {
+        RecvCase(Channel<T> &c, T &v, bool *o) :
+            Case(c, o), ch(c), value(v) {
+        }
+        bool tryNolock(bool &ok) override {
+            return ch.tryPopNolock(value, ok);
+        }
+        bool readyNolock() override {
+            return ch.canPopNolock();
+        }
+        FiberWaitQueue &waiters() override {
+            return ch.m_recvWaiters;
+        }
+        Channel<T> &ch;
+        T &value;
+    };
+
+    template <class T>
+    struct SendCase : public Case {
+        SendCase(Channel<T> &c, T &v, bool *o) :
+            Case(c, o), ch(c), value(v) {
+        }
+        bool tryNolock(bool &ok) override {
+            return ch.tryPushNolock(value, ok);
+        }
+        bool readyNolock() override {
+            return ch.canPushNolock();
+        }
+        FiberWaitQueue &waiters() override {
+            return ch.m_sendWaiters;
+        }
+        Channel<T> &ch;
+        T &value;
+    };
+
+    /* 从所有操作的等待队列中移除waiter */
+    void removeWaiter(const FiberWaitQueue::Waiter::ptr &waiter);
+
+    /* 被唤醒后选择了其他操作时，把可能被占用的唤醒传给同一队列中的其他协程 */
+    void passWakeup(size_t chosen);
+
+private:
+    std::vector<Case *> m_cases;
+    // 每次从不同的操作开始检查，避免总是偏向第一个通道
+    size_t m_start = 0;
+};
+
+} // namespace webs
+
+#endif
@@ -0,0 +1,577 @@
+/**
+ * C++20无栈协程前端
+ * CoTask<T>是惰性启动的协程，co_await时才开始执行，结束后通过对称转移直接恢复等待它的协程
+ * socket读写、accept、sleep以及Channel操作都基于IOManager::addEvent和TimerManager：挂起时登记回调，回调在调度器中恢复协程
+ * 协程恢复时运行在调度器的回调协程上，与有栈协程共用同一个调度器；CoInFiber把阻塞式代码交给有栈协程执行，CoSyncWait让有栈协程等待CoTask
+ * 只有在C++20下编译时可用；库本身仍按C++11编译，这里全部是头文件
+ * 注意：协程中不能调用hook的阻塞函数(会挂起承载它的有栈协程)，socket读写使用这里的Co*函数；协程不继承FiberLocal与CancelToken
+*/
+#ifndef __WEBS_CO_TASK_H__
+#define __WEBS_CO_TASK_H__
+
+#if __cplusplus >= 202002L && defined(__cpp_impl_coroutine)
+
+#include <errno.h>
+#include <stdint.h>
+#include <atomic>
+#include <coroutine>
+#include <exception>
+#include <memory>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include "scheduler.h"
+#include "hook.h"
+#include "fd_manager.h"
+#include "fiber_sync.h"
+#include "channel.h"
+#include "../io_module/iomanager.h"
+#include "../log_module/log.h"
+#include "../util_module/macro.h"
+
+namespace webs {
+
+template <class T = void>
+class CoTask;
+
+namespace co_detail {
+
+/* CoTask的promise中与结果类型无关的部分 */
+struct PromiseBase {
+    /* 结束时恢复等待者；没有等待者时停在final_suspend，由CoTask析构释放 */
+    struct FinalAwaiter {
+        bool await_ready() noexcept {
+            return false;
+        }
+        template <class P>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept {
+            std::coroutine_handle<> c = h.promise().continuation;
+            return c ? c : std::noop_coroutine();
+        }
+        void await_resume() noexcept {
+        }
+    };
+
+    std::suspend_always initial_suspend() noexcept {
+        return {};
+    }
+
+    FinalAwaiter final_suspend() noexcept {
+        return {};
+    }
+
+    void unhandled_exception() {
+        error = std::current_exception();
+    }
+
+    // co_await这个任务的协程
+    std::coroutine_handle<> continuation;
+    std::exception_ptr error;
+};
+
+template <class T>
+struct Promise : public PromiseBase {
+    CoTask<T> get_return_object();
+
+    template <class U>
+    void return_value(U &&v) {
+        value.emplace(std::forward<U>(v));
+    }
+
+    T take() {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+        return std::move(*value);
+    }
+
+    std::optional<T> value;
+};
+
+template <>
+struct Promise<void> : public PromiseBase {
+    CoTask<void> get_return_object();
+
+    void return_void() {
+    }
+
+    void take() {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+};
+
+/* 分离执行的协程：开始前挂起，结束后自行销毁 */
+struct Detached {
+    struct promise_type {
+        Detached get_return_object() {
+            return Detached{std::coroutine_handle<promise_type>::from_promise(*this)};
+        }
+        std::suspend_always initial_suspend() noexcept {
+            return {};
+        }
+        std::suspend_never final_suspend() noexcept {
+            return {};
+        }
+        void return_void() {
+        }
+        void unhandled_exception() {
+            std::terminate();
+        }
+    };
+
+    std::coroutine_handle<promise_type> handle;
+};
+
+} // namespace co_detail
+
+/**
+ * 协程任务
+ * 只能移动；co_await开始执行并取得结果(协程抛出的异常重新抛出)；没有被co_await的任务析构时直接销毁
+ */
+template <class T>
+class CoTask {
+public:
+    typedef co_detail::Promise<T> promise_type;
+    typedef std::coroutine_handle<promise_type> handle_type;
+
+    CoTask() {
+    }
+
+    explicit CoTask(handle_type h) :
+        m_handle(h) {
+    }
+
+    CoTask(CoTask &&other) noexcept :
+        m_handle(std::exchange(other.m_handle, nullptr)) {
+    }
+
+    CoTask &operator=(CoTask &&other) noexcept {
+        if (this != &other) {
+            if (m_handle) {
+                m_handle.destroy();
+            }
+            m_handle = std::exchange(other.m_handle, nullptr);
+        }
+        return *this;
+    }
+
+    CoTask(const CoTask &) = delete;
+    CoTask &operator=(const CoTask &) = delete;
+
+    ~CoTask() {
+        if (m_handle) {
+            m_handle.destroy();
+        }
+    }
+
+    bool valid() const {
+        return (bool)m_handle;
+    }
+
+    auto operator co_await() && noexcept {
+        struct Awaiter {
+            bool await_ready() noexcept {
+                return false;
+            }
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<> c) noexcept {
+                handle.promise().continuation = c;
+                return handle;
+            }
+            T await_resume() {
+                return handle.promise().take();
+            }
+            handle_type handle;
+        };
+        return Awaiter{m_handle};
+    }
+
+    auto operator co_await() & noexcept {
+        return std::move(*this).operator co_await();
+    }
+
+private:
+    handle_type m_handle;
+};
+
+namespace co_detail {
+
+template <class T>
+CoTask<T> Promise<T>::get_return_object() {
+    return CoTask<T>(std::coroutine_handle<Promise<T>>::from_promise(*this));
+}
+
+inline CoTask<void> Promise<void>::get_return_object() {
+    return CoTask<void>(std::coroutine_handle<Promise<void>>::from_promise(*this));
+}
+
+inline Detached RunDetached(CoTask<void> task) {
+    try {
+        co_await task;
+    } catch (std::exception &e) {
+        WEBS_LOG_ERROR(WEBS_LOG_NAME("system")) << "CoSpawn task except: " << e.what();
+    } catch (...) {
+        WEBS_LOG_ERROR(WEBS_LOG_NAME("system")) << "CoSpawn task except";
+    }
+}
+
+/**
+ * 定时器与IO事件之间共享的超时状态
+ * 事件登记之后才创建定时器；登记的线程、定时器、恢复的协程三方通过state竞争，先到的一方决定结果
+ */
+struct IoTimeoutInfo {
+    enum State {
+        // 事件已经登记，定时器还没有放入timer
+        REGISTERED = 0,
+        // 定时器已经放入timer
+        ARMED = 1,
+        // 定时器到期，取消了事件
+        TIMEOUT = 2,
+        // 协程已经恢复，定时器不再生效
+        DONE = 3,
+    };
+    std::atomic<int> state = {REGISTERED};
+    Timer::ptr timer;
+};
+
+} // namespace co_detail
+
+/* 在调度器中分离执行task；scheduler为nullptr时使用当前线程的调度器 */
+inline void CoSpawn(CoTask<void> task, Scheduler *scheduler = nullptr) {
+    if (!scheduler) {
+        scheduler = Scheduler::GetThis();
+    }
+    WEBS_ASSERT2(scheduler, "CoSpawn needs a scheduler");
+    std::coroutine_handle<> h = co_detail::RunDetached(std::move(task)).handle;
+    scheduler->schedule([h]() { h.resume(); });
+}
+
+/**
+ * 等待fd上的IO事件；必须在IOManager的线程中co_await
+ * 返回0表示事件就绪(或者事件被cancelEvent取消)，超时返回ETIMEDOUT，登记事件失败返回对应的errno
+ */
+class CoWaitEvent {
+public:
+    CoWaitEvent(int fd, IOManager::Event event, uint64_t timeout_ms = ~0ull) :
+        m_fd(fd), m_event(event), m_timeoutMs(timeout_ms) {
+    }
+
+    bool await_ready() noexcept {
+        return false;
+    }
+
+    bool await_suspend(std::coroutine_handle<> h) {
+        IOManager *iom = IOManager::GetThis();
+        WEBS_ASSERT2(iom, "co_await io event needs an IOManager");
+        // 事件一旦登记，协程可能已经在其他线程恢复，之后只能使用局部变量，不能再访问本对象
+        std::shared_ptr<co_detail::IoTimeoutInfo> info;
+        if (m_timeoutMs != ~0ull) {
+            info = m_info = std::make_shared<co_detail::IoTimeoutInfo>();
+        }
+        int fd = m_fd;
+        IOManager::Event event = m_event;
+        uint64_t timeout_ms = m_timeoutMs;
+        if (iom->addEvent(fd, event, [h]() { h.resume(); })) {
+            m_info.reset();
+            m_error = errno ? errno : EINVAL;
+            return false;
+        }
+        if (!info) {
+            return true;
+        }
+        // 在事件登记之后创建定时器，到期时取消的一定是本次登记的事件
+        std::weak_ptr<co_detail::IoTimeoutInfo> winfo(info);
+        info->timer = iom->addConditionTimer(
+            timeout_ms, [winfo, fd, event, iom]() {
+                auto t = winfo.lock();
+                if (!t) {
+                    return;
+                }
+                int state = t->state;
+                while (state == co_detail::IoTimeoutInfo::REGISTERED || state == co_detail::IoTimeoutInfo::ARMED) {
+                    if (t->state.compare_exchange_weak(state, co_detail::IoTimeoutInfo::TIMEOUT)) {
+                        iom->cancelEvent(fd, event);
+                        return;
+                    }
+                }
+            },
+            winfo);
+        int state = co_detail::IoTimeoutInfo::REGISTERED;
+        if (!info->state.compare_exchange_strong(state, co_detail::IoTimeoutInfo::ARMED)
+            && state == co_detail::IoTimeoutInfo::DONE) {
+            // 协程已经恢复，await_resume没有看到定时器
+            info->timer->cancel();
+        }
+        return true;
+    }
+
+    int await_resume() {
+        if (!m_info) {
+            return m_error;
+        }
+        int state = m_info->state.exchange(co_detail::IoTimeoutInfo::DONE);
+        if (state == co_detail::IoTimeoutInfo::TIMEOUT) {
+            return ETIMEDOUT;
+        }
+        if (state == co_detail::IoTimeoutInfo::ARMED) {
+            m_info->timer->cancel();
+        }
+        return m_error;
+    }
+
+private:
+    int m_fd;
+    IOManager::Event m_event;
+    uint64_t m_timeoutMs;
+    int m_error = 0;
+    std::shared_ptr<co_detail::IoTimeoutInfo> m_info;
+};
+
+/* 挂起ms毫秒；必须在IOManager的线程中co_await */
+class CoSleep {
+public:
+    explicit CoSleep(uint64_t ms) :
+        m_ms(ms) {
+    }
+
+    bool await_ready() noexcept {
+        return false;
+    }
+
+    void await_suspend(std::coroutine_handle<> h) {
+        IOManager *iom = IOManager::GetThis();
+        WEBS_ASSERT2(iom, "co_await CoSleep needs an IOManager");
+        iom->addTimer(m_ms, [h]() { h.resume(); });
+    }
+
+    void await_resume() noexcept {
+    }
+
+private:
+    uint64_t m_ms;
+};
+
+/**
+ * 读取socket；fd需要是非阻塞的(通过FdMgr登记过的socket)
+ * 返回值与read相同；超时返回-1，errno为ETIMEDOUT
+ */
+inline CoTask<ssize_t> CoRead(int fd, void *buf, size_t len, uint64_t timeout_ms = ~0ull) {
+    while (true) {
+        ssize_t n = read_f(fd, buf, len);
+        if (n >= 0 || errno != EAGAIN) {
+            if (n == -1 && errno == EINTR) {
+                continue;
+            }
+            co_return n;
+        }
+        int rt = co_await CoWaitEvent(fd, IOManager::READ, timeout_ms);
+        if (rt) {
+            errno = rt;
+            co_return -1;
+        }
+    }
+}
+
+/* 写入socket；返回值与write相同 */
+inline CoTask<ssize_t> CoWrite(int fd, const void *buf, size_t len, uint64_t timeout_ms = ~0ull) {
+    while (true) {
+        ssize_t n = write_f(fd, buf, len);
+        if (n >= 0 || errno != EAGAIN) {
+            if (n == -1 && errno == EINTR) {
+                continue;
+            }
+            co_return n;
+        }
+        int rt = co_await CoWaitEvent(fd, IOManager::WRITE, timeout_ms);
+        if (rt) {
+            errno = rt;
+            co_return -1;
+        }
+    }
+}
+
+/* 写入全部数据；返回写入的字节数，出错返回-1 */
+inline CoTask<ssize_t> CoWriteAll(int fd, const void *buf, size_t len, uint64_t timeout_ms = ~0ull) {
+    size_t offset = 0;
+    while (offset < len) {
+        ssize_t n = co_await CoWrite(fd, (const char *)buf + offset, len - offset, timeout_ms);
+        if (n <= 0) {
+            co_return n;
+        }
+        offset += n;
+    }
+    co_return (ssize_t)offset;
+}
+
+/* 接受连接；返回值与accept相同，新连接登记到FdMgr(设置为非阻塞) */
+inline CoTask<int> CoAccept(int fd, sockaddr *addr = nullptr, socklen_t *addrlen = nullptr, uint64_t timeout_ms = ~0ull) {
+    while (true) {
+        int client = accept_f(fd, addr, addrlen);
+        if (client >= 0) {
+            FdMgr::GetInstance()->get(client, true);
+            co_return client;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (errno != EAGAIN) {
+            co_return -1;
+        }
+        int rt = co_await CoWaitEvent(fd, IOManager::READ, timeout_ms);
+        if (rt) {
+            errno = rt;
+            co_return -1;
+        }
+    }
+}
+
+namespace co_detail {
+
+/* 一次通道操作；不能立即完成时以resume回调的形式进入等待队列，被唤醒后由调用者重试 */
+template <class T, bool Push>
+class ChannelAwaiter {
+public:
+    ChannelAwaiter(Channel<T> &ch, T &v, bool &ok) :
+        m_channel(ch), m_value(v), m_ok(ok) {
+    }
+
+    bool await_ready() noexcept {
+        return false;
+    }
+
+    bool await_suspend(std::coroutine_handle<> h) {
+        FiberWaitQueue::Waiter::ptr waiter(new FiberWaitQueue::Waiter);
+        waiter->scheduler = Scheduler::GetThis();
+        WEBS_ASSERT2(waiter->scheduler, "co_await channel needs a scheduler");
+        waiter->resume = [h]() { h.resume(); };
+        bool finished = Push ? m_channel.tryPushOrWait(m_value, m_ok, waiter)
+                             : m_channel.tryPopOrWait(m_value, m_ok, waiter);
+        if (finished) {
+            m_finished = true;
+            return false;
+        }
+        // 已经进入等待队列，可能已经被唤醒，不能再访问本对象
+        return true;
+    }
+
+    /* 操作是否已经完成；被唤醒返回false，需要重试 */
+    bool await_resume() noexcept {
+        return m_finished;
+    }
+
+private:
+    Channel<T> &m_channel;
+    T &m_value;
+    bool &m_ok;
+    bool m_finished = false;
+};
+
+} // namespace co_detail
+
+/* 放入元素，缓冲区满时挂起协程；通道已关闭返回false */
+template <class T>
+CoTask<bool> CoPush(Channel<T> &ch, T v) {
+    bool ok = false;
+    while (!co_await co_detail::ChannelAwaiter<T, true>(ch, v, ok)) {
+    }
+    co_return ok;
+}
+
+/* 取出元素，缓冲区空时挂起协程；通道已关闭并且没有剩余元素返回false */
+template <class T>
+CoTask<bool> CoPop(Channel<T> &ch, T &v) {
+    bool ok = false;
+    while (!co_await co_detail::ChannelAwaiter<T, false>(ch, v, ok)) {
+    }
+    co_return ok;
+}
+
+/**
+ * 在有栈协程中执行f(可以使用hook的阻塞IO与协程同步原语)，结束后恢复当前协程并返回f的结果
+ * f抛出的异常在co_await处重新抛出
+ */
+template <class F>
+class CoInFiber {
+public:
+    typedef typename std::invoke_result<F>::type result_type;
+
+    explicit CoInFiber(F f) :
+        m_func(std::move(f)) {
+    }
+
+    bool await_ready() noexcept {
+        return false;
+    }
+
+    void await_suspend(std::coroutine_handle<> h) {
+        Scheduler *scheduler = Scheduler::GetThis();
+        WEBS_ASSERT2(scheduler, "co_await CoInFiber needs a scheduler");
+        scheduler->schedule([this, h, scheduler]() {
+            try {
+                if constexpr (std::is_void<result_type>::value) {
+                    m_func();
+                } else {
+                    m_value.emplace(m_func());
+                }
+            } catch (...) {
+                m_error = std::current_exception();
+            }
+            scheduler->schedule([h]() { h.resume(); });
+        });
+    }
+
+    result_type await_resume() {
+        if (m_error) {
+            std::rethrow_exception(m_error);
+        }
+        if constexpr (!std::is_void<result_type>::value) {
+            return std::move(*m_value);
+        }
+    }
+
+private:
+    typedef typename std::conditional<std::is_void<result_type>::value, bool, result_type>::type value_type;
+
+    F m_func;
+    std::optional<value_type> m_value;
+    std::exception_ptr m_error;
+};
+
+/* 在有栈协程中执行task并等待它结束，返回结果；task抛出的异常重新抛出 */
+template <class T>
+T CoSyncWait(CoTask<T> task) {
+    // 状态由执行task的协程共同持有：notify返回之前等待方可能已经恢复并返回
+    struct State {
+        FiberSemaphore done;
+        std::optional<typename std::conditional<std::is_void<T>::value, bool, T>::type> value;
+        std::exception_ptr error;
+    };
+    std::shared_ptr<State> state(new State);
+    CoSpawn([](CoTask<T> t, std::shared_ptr<State> s) -> CoTask<void> {
+        try {
+            if constexpr (std::is_void<T>::value) {
+                co_await t;
+                s->value.emplace(true);
+            } else {
+                s->value.emplace(co_await t);
+            }
+        } catch (...) {
+            s->error = std::current_exception();
+        }
+        s->done.notify();
+    }(std::move(task), state));
+    state->done.wait();
+    if (state->error) {
+        std::rethrow_exception(state->error);
+    }
+    if constexpr (!std::is_void<T>::value) {
+        return std::move(*state->value);
+    }
+}
+
+} // namespace webs
+
+#endif
+
+#endif
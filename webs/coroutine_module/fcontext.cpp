@@ -0,0 +1,139 @@
+#include "fcontext.h"
+#include "../util_module/macro.h"
+
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * webs_switch_context(void **from_sp, void *to_sp)
+ * 只保存ABI规定由被调用者保存的寄存器；调用者保存的寄存器已经由编译器在调用点处理
+ */
+#if defined(__x86_64__)
+/**
+ * 栈布局(低地址 --> 高地址)：
+ * [mxcsr(4) | x87 cw(4)] r12 r13 r14 r15 rbx rbp 返回地址
+ */
+asm(R"(
+    .text
+    .globl webs_switch_context
+    .type webs_switch_context, @function
+    .align 16
+webs_switch_context:
+    pushq %rbp
+    pushq %rbx
+    pushq %r15
+    pushq %r14
+    pushq %r13
+    pushq %r12
+    subq $8, %rsp
+    stmxcsr (%rsp)
+    fnstcw 4(%rsp)
+    movq %rsp, (%rdi)
+    movq %rsi, %rsp
+    ldmxcsr (%rsp)
+    fldcw 4(%rsp)
+    addq $8, %rsp
+    popq %r12
+    popq %r13
+    popq %r14
+    popq %r15
+    popq %rbx
+    popq %rbp
+    ret
+    .size webs_switch_context, .-webs_switch_context
+)");
+#elif defined(__aarch64__)
+/**
+ * 栈布局(低地址 --> 高地址)：
+ * d8-d15 x19-x28 x29(fp) x30(lr)，共160字节
+ */
+asm(R"(
+    .text
+    .globl webs_switch_context
+    .type webs_switch_context, %function
+    .align 4
+webs_switch_context:
+    sub sp, sp, #160
+    stp d8, d9, [sp, #0]
+    stp d10, d11, [sp, #16]
+    stp d12, d13, [sp, #32]
+    stp d14, d15, [sp, #48]
+    stp x19, x20, [sp, #64]
+    stp x21, x22, [sp, #80]
+    stp x23, x24, [sp, #96]
+    stp x25, x26, [sp, #112]
+    stp x27, x28, [sp, #128]
+    stp x29, x30, [sp, #144]
+    mov x9, sp
+    str x9, [x0]
+    mov sp, x1
+    ldp d8, d9, [sp, #0]
+    ldp d10, d11, [sp, #16]
+    ldp d12, d13, [sp, #32]
+    ldp d14, d15, [sp, #48]
+    ldp x19, x20, [sp, #64]
+    ldp x21, x22, [sp, #80]
+    ldp x23, x24, [sp, #96]
+    ldp x25, x26, [sp, #112]
+    ldp x27, x28, [sp, #128]
+    ldp x29, x30, [sp, #144]
+    add sp, sp, #160
+    ret
+    .size webs_switch_context, .-webs_switch_context
+)");
+#endif
+
+namespace webs {
+
+#ifdef WEBS_HAS_ASM_CONTEXT
+/* 伪造一次webs_switch_context保存的现场，使得切换过来时"返回"到fn */
+void *MakeAsmContext(void *stack, size_t size, void (*fn)()) {
+    uintptr_t top = ((uintptr_t)stack + size) & ~(uintptr_t)15;
+#if defined(__x86_64__)
+    // ret之后rsp = top - 8，满足函数入口处 rsp % 16 == 8
+    uint64_t *sp = (uint64_t *)(top - 16);
+    sp[0] = (uint64_t)fn; // 返回地址
+    sp[1] = 0;
+    sp -= 7;
+    memset(sp, 0, 7 * sizeof(uint64_t));
+    // 默认的mxcsr与x87控制字
+    uint32_t *fpu = (uint32_t *)sp;
+    fpu[0] = 0x1F80;
+    fpu[1] = 0x037F;
+    return sp;
+#else
+    uint64_t *sp = (uint64_t *)(top - 160);
+    memset(sp, 0, 160);
+    sp[19] = (uint64_t)fn; // x30(lr)
+    return sp;
+#endif
+}
+#endif
+
+void MakeContext(FiberContext &ctx, void *stack, size_t size, void (*fn)()) {
+#ifdef WEBS_FIBER_ASM_CONTEXT
+    ctx.sp = MakeAsmContext(stack, size, fn);
+#else
+    if (getcontext(&ctx.uc)) {
+        WEBS_ASSERT2(false, "getcontext");
+    }
+    ctx.uc.uc_link = nullptr;
+    ctx.uc.uc_stack.ss_sp = stack;
+    ctx.uc.uc_stack.ss_size = size;
+    makecontext(&ctx.uc, fn, 0);
+#endif
+}
+
+const char *ContextBackendName() {
+#ifdef WEBS_FIBER_ASM_CONTEXT
+#if defined(__x86_64__)
+    return "asm-x86_64";
+#else
+    return "asm-aarch64";
+#endif
+#else
+    return "ucontext";
+#endif
+}
+
+} // namespace webs
@@ -0,0 +1,70 @@
+/**
+ * 协程上下文切换
+ * x86-64 / aarch64 默认使用手写汇编，只保存callee-saved寄存器，不会像swapcontext那样调用rt_sigprocmask
+ * 编译时打开 FIBER_USE_UCONTEXT(-DWEBS_FIBER_UCONTEXT) 或者在其他架构上，退回到ucontext实现
+*/
+#ifndef __WEBS_FCONTEXT_H__
+#define __WEBS_FCONTEXT_H__
+
+#include <stddef.h>
+#include <ucontext.h>
+
+#if defined(__x86_64__) || defined(__aarch64__)
+/* 当前架构有汇编实现(基准测试可以直接对比两种实现) */
+#define WEBS_HAS_ASM_CONTEXT 1
+#endif
+
+#if defined(WEBS_HAS_ASM_CONTEXT) && !defined(WEBS_FIBER_UCONTEXT)
+/* 协程使用汇编实现的上下文切换 */
+#define WEBS_FIBER_ASM_CONTEXT 1
+#endif
+
+#ifdef WEBS_HAS_ASM_CONTEXT
+extern "C" {
+/**
+ * 保存callee-saved寄存器到当前栈，将栈指针写入*from_sp，然后切换到to_sp继续执行
+ * 定义在fcontext.cpp中
+ */
+void webs_switch_context(void **from_sp, void *to_sp);
+}
+#endif
+
+namespace webs {
+
+#ifdef WEBS_HAS_ASM_CONTEXT
+/**
+ * 在[stack, stack + size)上构造一个初始上下文，返回栈指针
+ * 第一次切换到该上下文时从fn开始执行；fn不能返回
+ */
+void *MakeAsmContext(void *stack, size_t size, void (*fn)());
+#endif
+
+/* 协程上下文 */
+struct FiberContext {
+#ifdef WEBS_FIBER_ASM_CONTEXT
+    // 切出时保存的栈指针；寄存器保存在栈上
+    void *sp = nullptr;
+#else
+    ucontext_t uc;
+#endif
+};
+
+/* 在栈上构造一个从fn开始执行的上下文 */
+void MakeContext(FiberContext &ctx, void *stack, size_t size, void (*fn)());
+
+/* 保存当前上下文到from，切换到to；返回0表示成功 */
+inline int SwapContext(FiberContext &from, FiberContext &to) {
+#ifdef WEBS_FIBER_ASM_CONTEXT
+    webs_switch_context(&from.sp, to.sp);
+    return 0;
+#else
+    return swapcontext(&from.uc, &to.uc);
+#endif
+}
+
+/* 返回协程上下文切换的实现名称 */
+const char *ContextBackendName();
+
+} // namespace webs
+
+#endif
@@ -73,44 +73,36 @@ uint64_t FdCtx::getTimeout(int type) {
 }
 
 FdManager::FdManager() {
-    m_datas.resize(64);
 }
 
 FdCtx::ptr FdManager::get(int fd, bool auto_create) {
     if (fd < 0) {
         return nullptr;
     }
-
-    // 读锁读数据
-    RWMutexType::ReadLock lock(m_mutex);
-    if ((int)m_datas.size() <= fd) { // 强制转换的优先级 低于 .
-        if (!auto_create) {
-            return nullptr;
-        }
-    } else {
-        if (m_datas[fd] || !auto_create) { // 已经存在 或者 不存在并不用创建
-            return m_datas[fd];
-        }
+    FdCtx::ptr *slot = auto_create ? m_datas.getOrCreate(fd) : m_datas.get(fd);
+    if (!slot) {
+        return nullptr;
+    }
+    FdCtx::ptr ctx = std::atomic_load(slot);
+    if (ctx || !auto_create) { // 已经存在 或者 不存在并不用创建
+        return ctx;
     }
-    lock.unlock();
 
-    // 写锁写数据
-    RWMutexType::WriteLock lock1(m_mutex);
-    FdCtx::ptr ctx(new FdCtx(fd));
-    if (fd >= (int)m_datas.size()) {
-        m_datas.resize(fd * 1.5);
+    FdCtx::ptr new_ctx(new FdCtx(fd));
+    // 并发创建同一个fd时使用先放入的
+    if (std::atomic_compare_exchange_strong(slot, &ctx, new_ctx)) {
+        return new_ctx;
     }
-    m_datas[fd] = ctx;
     return ctx;
 }
 
 /* 删除文件描述符 */
 void FdManager::del(int fd) {
-    RWMutexType::WriteLock lock(m_mutex);
-    if ((int)m_datas.size() <= fd) {
+    FdCtx::ptr *slot = m_datas.get(fd);
+    if (!slot) {
         return;
     }
-    m_datas[fd].reset();
+    std::atomic_store(slot, FdCtx::ptr());
 }
 
 } // namespace webs
\ No newline at end of file
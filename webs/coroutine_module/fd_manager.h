@@ -4,6 +4,7 @@
 #include <memory>
 #include <vector>
 
+#include "../util_module/fd_table.h"
 #include "../util_module/mutex.h"
 #include "../util_module/singleton.h"
 
@@ -86,17 +87,15 @@ class FdManager {
 public:
     typedef RWMutex RWMutexType;
     FdManager();
-    /* 获取 / 创建文件描述符；如果不存在，auto_create = true，则自动创建 */
+    /* 获取 / 创建文件描述符；如果不存在，auto_create = true，则自动创建；不加锁 */
     FdCtx::ptr get(int fd, bool auto_create = false);
 
     /* 删除文件描述符 */
     void del(int fd);
 
 private:
-    // 读写锁
-    RWMutexType m_mutex;
-    // 文件描述符集合
-    std::vector<FdCtx::ptr> m_datas;
+    // 文件描述符集合；槽位通过shared_ptr的原子操作读写
+    FdTable<FdCtx::ptr> m_datas;
 };
 
 typedef Singleton<FdManager> FdMgr;
@@ -4,6 +4,10 @@
 #include "../util_module/macro.h"
 #include <atomic>
 #include "scheduler.h"
+#include "stack_allocator.h"
+#include <stdlib.h>
+#include <string.h>
+#include <new>
 namespace webs {
 
 // 创建日志信息
@@ -14,32 +18,47 @@ static std::atomic<uint64_t> s_fiber_count{0};
 // 创建线程的协程的智能指针对象和协程的指针
 static thread_local Fiber *t_fiber = nullptr;
 static thread_local Fiber::ptr t_threadFiber = nullptr;
+// 已经分配的协程局部变量槽位数量，以及每个槽位的析构函数；槽位不回收
+static std::atomic<size_t> s_local_count{0};
+static void (*s_local_dtors[Fiber::LOCAL_SLOTS])(void *);
 // 获取协程运行时栈大小的配置信息
 webs::ConfigVar<uint32_t>::ptr g_fiber_stack_size = Config::Lookup<uint32_t>("fiber.stack_size", 128 * 1024, "fiber stack size");
+// 共享栈模式下每个线程共享栈的大小
+static webs::ConfigVar<uint32_t>::ptr g_fiber_shared_stack_size =
+    Config::Lookup<uint32_t>("fiber.shared_stack_size", 1024 * 1024, "per thread shared fiber stack size");
 
-/* 动态分配内存的类 */
-class MallocStackAllocator {
-public:
-    static void *Alloc(size_t size) {
-        return malloc(size);
+/**
+ * 线程共享栈
+ * 同一时刻只有owner的栈内容在共享栈上，其他协程的栈内容保存在各自的缓冲区中
+ */
+struct Fiber::SharedStack {
+    StackAllocator *allocator;
+    size_t size;
+    char *stack;
+    // 当前栈内容在共享栈上的协程
+    std::atomic<Fiber *> owner = {nullptr};
+
+    SharedStack() :
+        allocator(StackAllocator::GetDefault()), size(g_fiber_shared_stack_size->getValue()) {
+        stack = (char *)allocator->alloc(size);
+    }
+
+    ~SharedStack() {
+        allocator->dealloc(stack, size);
     }
-    static void Dealloc(void *vp, size_t size) {
-        return free(vp);
+
+    /* 栈顶(16字节对齐) */
+    char *top() const {
+        return (char *)(((uintptr_t)stack + size) & ~(uintptr_t)15);
     }
 };
 
-// 重命名
-using StackAllocator = MallocStackAllocator;
-
 // 私有构造
 Fiber::Fiber() {
     // 修改状态，设置当前的线程的协程指针(t_fiber)
     m_state = EXEC;
     Fiber::SetThis(this);
-    // 保存当前协程的上下文
-    if (getcontext(&m_ctx)) {
-        WEBS_ASSERT2(false, "getcontext");
-    }
+    // 线程主协程的上下文在第一次切出时保存，不需要初始化
     // 增加协程计数
     ++s_fiber_count;
     // 将 "Fiber::Fiber main" 输出到debug日志
@@ -53,25 +72,28 @@ Fiber::Fiber() {
      * 
      * 问题：一：如何使用；二：协程调度的思路不清
      *  */
-Fiber::Fiber(std::function<void()> cb, size_t stacksize, bool use_caller) :
-    m_id(++s_fiber_id), m_cb(cb) {
+Fiber::Fiber(Task cb, size_t stacksize, bool use_caller, bool shared_stack) :
+    m_id(++s_fiber_id), m_cb(std::move(cb)) {
     ++s_fiber_count;
+#ifndef WEBS_FIBER_ASM_CONTEXT
+    // 共享栈需要知道切出时的栈指针，ucontext实现下退回到私有栈
+    shared_stack = false;
+#endif
+    if (shared_stack) {
+        m_sharedStack = true;
+        makeSharedContext(use_caller ? &Fiber::CallerMainFunc : &Fiber::MainFunc);
+        WEBS_LOG_DEBUG(g_logger) << "Fiber::Fiber shared stack id = " << m_id;
+        return;
+    }
     // 确定运行时栈的大小，并分配内存
     m_stacksize = stacksize ? stacksize : g_fiber_stack_size->getValue();
-    m_stack = StackAllocator::Alloc(m_stacksize);
-    // 保存协程上下文，并设置上下文属性
-    if (getcontext(&m_ctx)) {
-        WEBS_ASSERT2(false, "getcontext");
-    }
-
-    m_ctx.uc_link = nullptr;
-    m_ctx.uc_stack.ss_sp = m_stack;
-    m_ctx.uc_stack.ss_size = m_stacksize;
-    // 切换协程运行：一个是切换协程管理器的主协程，另一个是切换线程的主协程
+    m_allocator = StackAllocator::GetDefault();
+    m_stack = m_allocator->alloc(m_stacksize);
+    // 设置协程上下文：切换协程运行：一个是切换协程管理器的主协程，另一个是切换线程的主协程
     if (!use_caller) {
-        makecontext(&m_ctx, &Fiber::MainFunc, 0);
+        MakeContext(m_ctx, m_stack, m_stacksize, &Fiber::MainFunc);
     } else {
-        makecontext(&m_ctx, &Fiber::CallerMainFunc, 0);
+        MakeContext(m_ctx, m_stack, m_stacksize, &Fiber::CallerMainFunc);
     }
     // 输出日志信息
     WEBS_LOG_DEBUG(g_logger) << "Fiber::Fiber id = " << m_id;
@@ -80,11 +102,20 @@ Fiber::Fiber(std::function<void()> cb, size_t stacksize, bool use_caller) :
 /* 析构函数；如果是主协程，将当前协程指针置为空；如果是子协程，释放栈空间 */
 Fiber::~Fiber() {
     --s_fiber_count; // 有个疑问如果是主协程为什么也需要 --
-    if (m_stack) {
+    clearLocals();
+    if (m_sharedStack) {
+        // 共享栈子协程：共享栈上的内容已经没有用了
+        WEBS_ASSERT(m_state == INIT || m_state == TERM || m_state == EXCEPT);
+        if (m_shared) {
+            Fiber *self = this;
+            m_shared->owner.compare_exchange_strong(self, nullptr);
+        }
+        free(m_saveBuffer);
+    } else if (m_stack) {
         // 子协程
         // WEBS_ASSERT();
         WEBS_ASSERT(m_state == INIT || m_state == TERM || m_state == EXCEPT);
-        StackAllocator::Dealloc(m_stack, m_stacksize);
+        m_allocator->dealloc(m_stack, m_stacksize);
     } else {
         // 确认是否为主协程
         WEBS_ASSERT(!m_cb);
@@ -104,18 +135,17 @@ Fiber::~Fiber() {
      * 重置后状态为INIT
      * 为了充分利用内存，一个协程执行完，但是内存没有释放，此时可以重置内存，让其重新成为一个执行栈
      */
-void Fiber::reset(std::function<void()> cb) {
-    WEBS_ASSERT(m_stack);
+void Fiber::reset(Task cb) {
+    WEBS_ASSERT(m_stack || m_sharedStack);
     WEBS_ASSERT(m_state == INIT || m_state == TERM || m_state == EXCEPT);
-    m_cb = cb;
-    if (getcontext(&m_ctx)) {
-        WEBS_ASSERT2(false, "getcontext");
-    }
-    m_ctx.uc_link = nullptr;
+    clearLocals();
+    m_cb = std::move(cb);
     // 重置了上下文的栈起始地址
-    m_ctx.uc_stack.ss_sp = m_stack;
-    m_ctx.uc_stack.ss_size = m_stacksize;
-    makecontext(&m_ctx, &Fiber::MainFunc, 0);
+    if (m_sharedStack) {
+        makeSharedContext(&Fiber::MainFunc);
+    } else {
+        MakeContext(m_ctx, m_stack, m_stacksize, &Fiber::MainFunc);
+    }
     // 这里是可以执行的，make只是设置，并不会去执行函数
     m_state = INIT;
 }
@@ -126,10 +156,13 @@ void Fiber::reset(std::function<void()> cb) {
   * 当前状态 != EXEC
   */
 void Fiber::swapIn() {
+    if (m_sharedStack) {
+        switchInSharedStack();
+    }
     SetThis(this);
     WEBS_ASSERT(m_state != EXEC);
     m_state = EXEC;
-    if (swapcontext(&Scheduler::GetMainFiber()->m_ctx, &m_ctx)) {
+    if (SwapContext(Scheduler::GetMainFiber()->m_ctx, m_ctx)) {
         WEBS_ASSERT2(false, "swapcontext");
     }
 }
@@ -141,7 +174,7 @@ void Fiber::swapIn() {
 void Fiber::swapOut() {
     WEBS_LOG_DEBUG(g_logger) << "swapout ";
     SetThis(Scheduler::GetMainFiber());
-    if (swapcontext(&m_ctx, &Scheduler::GetMainFiber()->m_ctx)) {
+    if (SwapContext(m_ctx, Scheduler::GetMainFiber()->m_ctx)) {
         WEBS_ASSERT2(false, "swapcontext");
     }
 }
@@ -151,10 +184,13 @@ void Fiber::swapOut() {
   * 将上下文信息保存到线程的协程中，切换到当前协程的上下文继续执行
   */
 void Fiber::call() {
+    if (m_sharedStack) {
+        switchInSharedStack();
+    }
     SetThis(this);
     m_state = EXEC;
     // -> . 的优先级高于 &
-    if (swapcontext(&t_threadFiber->m_ctx, &m_ctx)) {
+    if (SwapContext(t_threadFiber->m_ctx, m_ctx)) {
         WEBS_ASSERT2(false, "swapcontext");
     }
 }
@@ -163,7 +199,7 @@ void Fiber::call() {
 void Fiber::back() {
     SetThis(t_threadFiber.get());
     // t_threadFiber->m_state = EXEC;
-    if (swapcontext(&m_ctx, &t_threadFiber->m_ctx)) {
+    if (SwapContext(m_ctx, t_threadFiber->m_ctx)) {
         WEBS_ASSERT2(false, "swapcontext");
     }
 }
@@ -173,6 +209,35 @@ void Fiber::SetThis(Fiber *f) {
     t_fiber = f;
 }
 
+Fiber *Fiber::CurrentRaw() {
+    return t_fiber;
+}
+
+size_t Fiber::AllocLocalSlot(void (*dtor)(void *)) {
+    size_t index = s_local_count++;
+    WEBS_ASSERT2(index < LOCAL_SLOTS, "too many FiberLocal, LOCAL_SLOTS = " << LOCAL_SLOTS);
+    s_local_dtors[index] = dtor;
+    return index;
+}
+
+/* 析构函数中可能再次设置其他局部变量，重复清理直到全部为空 */
+void Fiber::clearLocals() {
+    size_t count = s_local_count;
+    count = count < LOCAL_SLOTS ? count : LOCAL_SLOTS;
+    bool found = true;
+    while (found) {
+        found = false;
+        for (size_t i = 0; i < count; ++i) {
+            void *value = m_locals[i];
+            if (value) {
+                m_locals[i] = nullptr;
+                s_local_dtors[i](value);
+                found = true;
+            }
+        }
+    }
+}
+
 /* 返回当前线程的协程 */
 Fiber::ptr Fiber::GetThis() {
     if (t_fiber) {
@@ -230,6 +295,8 @@ void Fiber::MainFunc() {
                                  << "fiber_id = " << cur->getId() << std::endl
                                  << webs::BacktraceToString();
     }
+    // 协程结束时在自己的上下文中释放局部变量
+    cur->clearLocals();
     Fiber *arwcur = cur.get();
     // cur的计数至少是大于1的
     cur.reset();       // 如果没有reset，swapOut之后，cur没有释放，会导致最终协程无法释放
@@ -258,12 +325,90 @@ void Fiber::CallerMainFunc() {
                                  << " Fiber_id = " << cur->m_id << std::endl
                                  << webs::BacktraceToString();
     }
+    cur->clearLocals();
     Fiber *awrcur = cur.get();
     cur.reset();
     awrcur->back();
     WEBS_ASSERT2(false, "never reach fiber id = " + std::to_string(cur->getId()));
 }
 
+/**
+ * 初始现场与栈地址无关：先构造在临时空间中，作为"已保存的栈内容"
+ * 第一次运行时绑定当前线程的共享栈，再拷贝到共享栈顶
+ */
+void Fiber::makeSharedContext(void (*fn)()) {
+#ifdef WEBS_FIBER_ASM_CONTEXT
+    if (m_shared) {
+        Fiber *self = this;
+        m_shared->owner.compare_exchange_strong(self, nullptr);
+    }
+    m_shared.reset();
+    m_homeThread = -1;
+    m_ctx.sp = nullptr;
+
+    alignas(16) char frame[256];
+    char *sp = (char *)MakeAsmContext(frame, sizeof(frame), fn);
+    size_t size = frame + sizeof(frame) - sp;
+    reserveSaveBuffer(size);
+    memcpy(m_saveBuffer, sp, size);
+    m_saveSize = size;
+#endif
+}
+
+/* 共享栈上的其他协程换出到它的缓冲区；如果共享栈上就是自己的内容，不需要拷贝 */
+void Fiber::switchInSharedStack() {
+#ifdef WEBS_FIBER_ASM_CONTEXT
+    WEBS_ASSERT2(!t_fiber || !t_fiber->m_sharedStack, "cannot switch to shared stack fiber from shared stack fiber");
+    // 当前线程的共享栈；第一次使用时分配，线程和绑定的协程都释放之后才释放
+    static thread_local std::shared_ptr<SharedStack> s_shared_stack(new SharedStack);
+    SharedStack *ss = s_shared_stack.get();
+    if (!m_shared) {
+        m_shared = s_shared_stack;
+        m_homeThread = webs::GetThreadId();
+        m_ctx.sp = ss->top() - m_saveSize;
+    }
+    WEBS_ASSERT2(m_shared.get() == ss, "shared stack fiber resumed on another thread, fiber id = " + std::to_string(m_id));
+    Fiber *owner = ss->owner;
+    if (owner == this) {
+        return;
+    }
+    if (owner) {
+        owner->saveSharedStack();
+    }
+    memcpy(m_ctx.sp, m_saveBuffer, m_saveSize);
+    ss->owner = this;
+#endif
+}
+
+/* 只保存[sp, 栈顶)，执行结束的协程不需要保存 */
+void Fiber::saveSharedStack() {
+#ifdef WEBS_FIBER_ASM_CONTEXT
+    if (m_state == TERM || m_state == EXCEPT) {
+        m_saveSize = 0;
+        return;
+    }
+    size_t size = m_shared->top() - (char *)m_ctx.sp;
+    reserveSaveBuffer(size);
+    memcpy(m_saveBuffer, m_ctx.sp, size);
+    m_saveSize = size;
+#endif
+}
+
+/* 按512字节取整；缓冲区比需要的大一倍以上时重新分配，让挂起的协程只占用与实际栈深度相当的内存 */
+void Fiber::reserveSaveBuffer(size_t size) {
+    size_t capacity = (size + 511) & ~(size_t)511;
+    if (m_saveCapacity >= size && m_saveCapacity <= capacity * 2) {
+        return;
+    }
+    free(m_saveBuffer);
+    m_saveBuffer = (char *)malloc(capacity);
+    if (!m_saveBuffer) {
+        m_saveCapacity = 0;
+        throw std::bad_alloc();
+    }
+    m_saveCapacity = capacity;
+}
+
 /* 返回当前协程的id */
 uint64_t Fiber::GetFiberId() {
     if (t_fiber) {
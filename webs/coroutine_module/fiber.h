@@ -1,12 +1,16 @@
 #ifndef __WEBS_FIBER_H__
 #define __WEBS_FIBER_H__
 #include <memory>
-#include <ucontext.h>
+#include <atomic>
 #include <functional>
+#include "../util_module/mpsc_queue.h"
+#include "fcontext.h"
+#include "task.h"
 
 namespace webs {
 /* 协程调度类 */
 class Scheduler;
+class StackAllocator;
 
 class Fiber : public std::enable_shared_from_this<Fiber> {
     friend class Scheduler;
@@ -29,6 +33,23 @@ public:
         EXCEPT
     };
 
+    // 协程局部变量的槽位数量(FiberLocal的最大数量)
+    static const size_t LOCAL_SLOTS = 16;
+
+    /* 调度器收件箱的节点；fiber不为空表示节点内嵌在该协程中 */
+    struct InboxNode : public MpscNode {
+        // 节点所属的协程
+        Fiber *fiber = nullptr;
+        // 指定执行的线程id
+        int thread = -1;
+        // 调度的优先级类别
+        int priority = 1;
+        // 最晚开始执行的时间(微秒)，0表示没有
+        uint64_t deadline = 0;
+        // 入队时间(微秒)
+        uint64_t enqueueTime = 0;
+    };
+
 private:
     /* 每个线程第一个协程的构造 */
     Fiber();
@@ -39,8 +60,10 @@ public:
      * 协程执行函数
      * 协程栈大小
      * 是否在主协程上调度
+     * 是否运行在线程共享栈上：切出后只把用到的栈拷贝到私有缓冲区，适合大量长时间挂起的协程
+     * 共享栈协程第一次运行后绑定到该线程，之后只能在该线程上恢复执行
      *  */
-    Fiber(std::function<void()> cb, size_t stacksize = 0, bool use_call = false);
+    Fiber(Task cb, size_t stacksize = 0, bool use_call = false, bool shared_stack = false);
 
     /* 析构函数 */
     ~Fiber();
@@ -50,7 +73,7 @@ public:
      * 协程的状态：INIT EXCEPT TERM
      * 重置后状态为INIT
      */
-    void reset(std::function<void()> cb);
+    void reset(Task cb);
 
     /**
      * 将当前协程的状态切换为运行态
@@ -90,6 +113,35 @@ public:
         return m_state;
     }
 
+    /* 是否运行在线程共享栈上 */
+    bool isSharedStack() const {
+        return m_sharedStack;
+    }
+
+    /* 共享栈协程绑定的线程id；还没有运行过或者不是共享栈协程时返回-1 */
+    int getHomeThread() const {
+        return m_homeThread;
+    }
+
+    /* 共享栈协程切出后保存的栈大小 */
+    size_t getSavedStackSize() const {
+        return m_saveSize;
+    }
+
+    /* 调度的优先级类别(Scheduler::Priority)；之后被重新调度时沿用 */
+    int getPriority() const {
+        return m_priority;
+    }
+
+    void setPriority(int priority) {
+        m_priority = priority;
+    }
+
+    /* 等待的IO就绪的时间(单调时钟，微秒)；恢复执行时统计就绪到恢复的延迟，之后清零 */
+    void setReadyTime(uint64_t us) {
+        m_readyTime = us;
+    }
+
 public:
     /* 设置当前线程的运行协程 */
     static void SetThis(Fiber *f);
@@ -121,6 +173,52 @@ public:
     /* 返回当前协程的id */
     static uint64_t GetFiberId();
 
+    /* 当前协程是否使用共享栈；不增加引用计数 */
+    static bool InSharedStack() {
+        Fiber *cur = CurrentRaw();
+        return cur && cur->isSharedStack();
+    }
+
+    /* 分配一个协程局部变量槽位；dtor在协程结束或者reset时释放槽位中的值 */
+    static size_t AllocLocalSlot(void (*dtor)(void *));
+
+    /**
+     * 当前协程的局部变量槽位数组
+     * 线程还没有协程时：create为true创建主协程，否则返回nullptr
+     */
+    static void **GetLocals(bool create = true) {
+        Fiber *cur = CurrentRaw();
+        if (!cur) {
+            if (!create) {
+                return nullptr;
+            }
+            cur = GetThis().get();
+        }
+        return cur->m_locals;
+    }
+
+private:
+    /* 当前线程正在运行的协程，不增加引用计数 */
+    static Fiber *CurrentRaw();
+
+    /* 释放所有协程局部变量 */
+    void clearLocals();
+
+    /* 线程共享栈 */
+    struct SharedStack;
+
+    /* 在保存缓冲区中构造共享栈协程的初始现场 */
+    void makeSharedContext(void (*fn)());
+
+    /* 切换进共享栈协程之前，换出共享栈上的其他协程并恢复自己的栈内容 */
+    void switchInSharedStack();
+
+    /* 把共享栈上用到的部分拷贝到保存缓冲区 */
+    void saveSharedStack();
+
+    /* 保证保存缓冲区能容纳size字节 */
+    void reserveSaveBuffer(size_t size);
+
 private:
     // 协程id
     uint64_t m_id = 0;
@@ -129,11 +227,39 @@ private:
     // 协程状态
     State m_state = INIT;
     // 协程的上下文
-    ucontext_t m_ctx;
+    FiberContext m_ctx;
     // 协程运行栈指针
     void *m_stack = nullptr;
+    // 分配运行栈的分配器，释放时使用同一个
+    StackAllocator *m_allocator = nullptr;
     // 协程的可执行函数
-    std::function<void()> m_cb;
+    Task m_cb;
+    // 跨线程调度时使用的内嵌收件箱节点，避免为每次调度分配节点
+    InboxNode m_inboxNode;
+    // 协程在收件箱中时持有自身的引用，出队时释放
+    Fiber::ptr m_inboxRef;
+    // 内嵌节点是否正在收件箱中
+    std::atomic<bool> m_inboxQueued = {false};
+    // 是否运行在线程共享栈上
+    bool m_sharedStack = false;
+    // 共享栈模式下绑定的线程共享栈；第一次运行时绑定，协程持有引用，线程退出或跨线程析构时共享栈仍然有效
+    std::shared_ptr<SharedStack> m_shared;
+    // 共享栈模式下绑定的线程id
+    int m_homeThread = -1;
+    // 共享栈模式下切出后保存的栈内容
+    char *m_saveBuffer = nullptr;
+    // 保存的栈大小
+    size_t m_saveSize = 0;
+    // 保存缓冲区的容量
+    size_t m_saveCapacity = 0;
+    // 调度的优先级类别
+    int m_priority = 1;
+    // IO就绪的时间(单调时钟，微秒)；0表示不是由IO就绪唤醒
+    uint64_t m_readyTime = 0;
+    // 由调度器的协程池创建(默认栈大小)，结束后可以放回协程池
+    bool m_pooled = false;
+    // 协程局部变量，按FiberLocal的槽位下标访问
+    void *m_locals[LOCAL_SLOTS] = {};
 };
 } // namespace webs
 
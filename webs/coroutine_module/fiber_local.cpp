@@ -0,0 +1,18 @@
+#include "fiber_local.h"
+
+namespace webs {
+
+// 请求的追踪id；随协程在线程之间迁移
+static FiberLocal<std::string> s_trace_id;
+
+void SetTraceId(const std::string &id) {
+    s_trace_id.set(id);
+}
+
+const std::string &GetTraceId() {
+    static const std::string s_empty;
+    const std::string *id = s_trace_id.peek();
+    return id ? *id : s_empty;
+}
+
+} // namespace webs
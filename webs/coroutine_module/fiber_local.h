@@ -0,0 +1,91 @@
+/**
+ * 协程局部变量
+ * 值保存在Fiber内嵌的槽位数组中，按下标O(1)访问；协程被switchTo或者IO事件调度到其他线程后仍然能取到同一个值
+ * 协程结束或者reset复用时释放值。没有运行在协程中的线程使用线程的主协程
+*/
+#ifndef __WEBS_FIBER_LOCAL_H__
+#define __WEBS_FIBER_LOCAL_H__
+
+#include <string>
+#include <utility>
+#include "fiber.h"
+#include "../util_module/Noncopyable.h"
+
+namespace webs {
+
+/**
+ * 协程局部变量
+ * 每个FiberLocal占用一个槽位，槽位不回收，一般定义为全局或者静态变量；最多Fiber::LOCAL_SLOTS个
+ * 用法：
+ *     static FiberLocal<RequestContext> s_ctx;
+ *     s_ctx->user = "...";
+ */
+template <class T>
+class FiberLocal : Noncopyable {
+public:
+    FiberLocal() :
+        m_index(Fiber::AllocLocalSlot(&Destroy)) {
+    }
+
+    /* 当前协程的值；第一次访问时默认构造 */
+    T &get() {
+        void *&slot = Fiber::GetLocals()[m_index];
+        if (!slot) {
+            slot = new T();
+        }
+        return *(T *)slot;
+    }
+
+    /* 当前协程的值；没有设置过返回nullptr，不会创建 */
+    T *peek() const {
+        void **locals = Fiber::GetLocals(false);
+        return locals ? (T *)locals[m_index] : nullptr;
+    }
+
+    /* 设置当前协程的值 */
+    void set(T v) {
+        void *&slot = Fiber::GetLocals()[m_index];
+        if (slot) {
+            *(T *)slot = std::move(v);
+        } else {
+            slot = new T(std::move(v));
+        }
+    }
+
+    /* 释放当前协程的值 */
+    void reset() {
+        void **locals = Fiber::GetLocals(false);
+        if (locals && locals[m_index]) {
+            void *value = locals[m_index];
+            locals[m_index] = nullptr;
+            Destroy(value);
+        }
+    }
+
+    T &operator*() {
+        return get();
+    }
+
+    T *operator->() {
+        return &get();
+    }
+
+private:
+    static void Destroy(void *value) {
+        delete (T *)value;
+    }
+
+private:
+    // 在Fiber槽位数组中的下标
+    size_t m_index;
+};
+
+/* 设置当前协程的追踪id；日志格式中的%I输出该值 */
+void SetTraceId(const std::string &id);
+
+/* 当前协程的追踪id；没有设置返回空字符串 */
+const std::string &GetTraceId();
+
+} // namespace webs
+
+#endif
@@ -0,0 +1,267 @@
+#include "fiber_sync.h"
+#include "scheduler.h"
+#include "cancel_token.h"
+#include "../io_module/iomanager.h"
+#include "../util_module/macro.h"
+
+namespace webs {
+
+/* 唤醒方与超时定时器通过done竞争，只有先到的一方调度协程 */
+bool FiberWaitQueue::Waiter::wake() {
+    if (done.exchange(true)) {
+        return false;
+    }
+    if (fiber) {
+        Fiber::ptr f;
+        f.swap(fiber);
+        scheduler->schedule(f);
+    } else {
+        Task cb;
+        cb.swap(resume);
+        scheduler->schedule(std::move(cb));
+    }
+    return true;
+}
+
+FiberWaitQueue::Waiter::ptr FiberWaitQueue::CreateWaiter() {
+    WEBS_ASSERT2(Scheduler::GetThis(), "fiber sync primitive must be used in a scheduler fiber");
+    Waiter::ptr waiter(new Waiter);
+    waiter->scheduler = Scheduler::GetThis();
+    waiter->fiber = Fiber::GetThis();
+    WEBS_ASSERT2(waiter->fiber.get() != Scheduler::GetMainFiber(), "scheduler main fiber cannot wait");
+    return waiter;
+}
+
+/* 超时或者被取消：与唤醒方竞争，先到的一方调度协程 */
+static void ExpireWaiter(const std::weak_ptr<FiberWaitQueue::Waiter> &weak_waiter) {
+    FiberWaitQueue::Waiter::ptr w = weak_waiter.lock();
+    if (!w || w->done.exchange(true)) {
+        return;
+    }
+    w->timeout = true;
+    Fiber::ptr f;
+    f.swap(w->fiber);
+    w->scheduler->schedule(f);
+}
+
+/**
+ * 唤醒方可能在挂起之前就调度了该协程，调度器会跳过还处于EXEC状态的协程
+ * 带超时的等待可以被CancelToken中断，当作超时返回；一直等待的不会被中断(lock等调用者不处理失败)
+ */
+bool FiberWaitQueue::Park(const Waiter::ptr &waiter, uint64_t timeout_ms) {
+    Timer::ptr timer;
+    CancelToken *token = nullptr;
+    if (timeout_ms != ~0ull) {
+        IOManager *iom = IOManager::GetThis();
+        WEBS_ASSERT2(iom, "timed wait needs an IOManager");
+        std::weak_ptr<Waiter> weak_waiter(waiter);
+        timer = iom->addTimer(timeout_ms, [weak_waiter]() {
+            ExpireWaiter(weak_waiter);
+        });
+        token = CancelToken::GetCurrent();
+        if (token && !token->setInterrupt([weak_waiter]() { ExpireWaiter(weak_waiter); })) {
+            // 已经被取消
+            ExpireWaiter(weak_waiter);
+        }
+    }
+    Fiber::YieldToHold();
+    if (token) {
+        token->clearInterrupt();
+    }
+    if (timer) {
+        timer->cancel();
+    }
+    return !waiter->timeout;
+}
+
+/* 先入队再解锁并挂起；超时返回时如果还在队列中，需要自己出队 */
+bool FiberWaitQueue::wait(MutexType::Lock &lock, uint64_t timeout_ms) {
+    Waiter::ptr waiter = CreateWaiter();
+    add(waiter);
+    lock.unlock();
+    bool rt = Park(waiter, timeout_ms);
+    lock.lock();
+    if (!rt) {
+        remove(waiter);
+    }
+    return rt;
+}
+
+void FiberWaitQueue::remove(const Waiter::ptr &waiter) {
+    for (auto it = m_waiters.begin(); it != m_waiters.end(); ++it) {
+        if (*it == waiter) {
+            m_waiters.erase(it);
+            return;
+        }
+    }
+}
+
+bool FiberWaitQueue::notifyOne() {
+    while (!m_waiters.empty()) {
+        Waiter::ptr waiter = m_waiters.front();
+        m_waiters.pop_front();
+        if (waiter->wake()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+size_t FiberWaitQueue::notifyAll() {
+    size_t count = 0;
+    while (notifyOne()) {
+        ++count;
+    }
+    return count;
+}
+
+void FiberMutex::lock() {
+    FiberWaitQueue::MutexType::Lock lock(m_mutex);
+    if (!m_locked) {
+        m_locked = true;
+        return;
+    }
+    // 被唤醒时锁已经交给了当前协程
+    m_waiters.wait(lock);
+}
+
+bool FiberMutex::tryLock() {
+    FiberWaitQueue::MutexType::Lock lock(m_mutex);
+    if (m_locked) {
+        return false;
+    }
+    m_locked = true;
+    return true;
+}
+
+bool FiberMutex::tryLockFor(uint64_t timeout_ms) {
+    FiberWaitQueue::MutexType::Lock lock(m_mutex);
+    if (!m_locked) {
+        m_locked = true;
+        return true;
+    }
+    return m_waiters.wait(lock, timeout_ms);
+}
+
+/* 有等待者时直接把锁交给它，m_locked保持为true */
+void FiberMutex::unlock() {
+    FiberWaitQueue::MutexType::Lock lock(m_mutex);
+    WEBS_ASSERT(m_locked);
+    if (!m_waiters.notifyOne()) {
+        m_locked = false;
+    }
+}
+
+/* 持有条件变量的锁时释放mutex，notify不会在入队与挂起之间丢失 */
+void FiberCondVar::wait(FiberMutex &mutex) {
+    {
+        FiberWaitQueue::MutexType::Lock lock(m_mutex);
+        mutex.unlock();
+        m_waiters.wait(lock);
+    }
+    mutex.lock();
+}
+
+bool FiberCondVar::waitFor(FiberMutex &mutex, uint64_t timeout_ms) {
+    bool rt = false;
+    {
+        FiberWaitQueue::MutexType::Lock lock(m_mutex);
+        mutex.unlock();
+        rt = m_waiters.wait(lock, timeout_ms);
+    }
+    mutex.lock();
+    return rt;
+}
+
+void FiberCondVar::notifyOne() {
+    FiberWaitQueue::MutexType::Lock lock(m_mutex);
+    m_waiters.notifyOne();
+}
+
+void FiberCondVar::notifyAll() {
+    FiberWaitQueue::MutexType::Lock lock(m_mutex);
+    m_waiters.notifyAll();
+}
+
+FiberSemaphore::FiberSemaphore(uint32_t count) :
+    m_count(count) {
+}
+
+void FiberSemaphore::wait() {
+    FiberWaitQueue::MutexType::Lock lock(m_mutex);
+    if (m_count > 0) {
+        --m_count;
+        return;
+    }
+    // 被唤醒时计数已经交给了当前协程
+    m_waiters.wait(lock);
+}
+
+bool FiberSemaphore::tryWait() {
+    FiberWaitQueue::MutexType::Lock lock(m_mutex);
+    if (m_count > 0) {
+        --m_count;
+        return true;
+    }
+    return false;
+}
+
+bool FiberSemaphore::waitFor(uint64_t timeout_ms) {
+    FiberWaitQueue::MutexType::Lock lock(m_mutex);
+    if (m_count > 0) {
+        --m_count;
+        return true;
+    }
+    return m_waiters.wait(lock, timeout_ms);
+}
+
+void FiberSemaphore::notify(uint32_t count) {
+    FiberWaitQueue::MutexType::Lock lock(m_mutex);
+    for (uint32_t i = 0; i < count; ++i) {
+        if (!m_waiters.notifyOne()) {
+            m_count += count - i;
+            break;
+        }
+    }
+}
+
+uint32_t FiberSemaphore::getCount() {
+    FiberWaitQueue::MutexType::Lock lock(m_mutex);
+    return m_count;
+}
+
+void FiberWaitGroup::add(int64_t delta) {
+    FiberWaitQueue::MutexType::Lock lock(m_mutex);
+    m_count += delta;
+    WEBS_ASSERT2(m_count >= 0, "FiberWaitGroup count < 0");
+    if (m_count == 0) {
+        m_waiters.notifyAll();
+    }
+}
+
+void FiberWaitGroup::done() {
+    add(-1);
+}
+
+void FiberWaitGroup::wait() {
+    FiberWaitQueue::MutexType::Lock lock(m_mutex);
+    if (m_count == 0) {
+        return;
+    }
+    m_waiters.wait(lock);
+}
+
+bool FiberWaitGroup::waitFor(uint64_t timeout_ms) {
+    FiberWaitQueue::MutexType::Lock lock(m_mutex);
+    if (m_count == 0) {
+        return true;
+    }
+    return m_waiters.wait(lock, timeout_ms);
+}
+
+int64_t FiberWaitGroup::getCount() {
+    FiberWaitQueue::MutexType::Lock lock(m_mutex);
+    return m_count;
+}
+
+} // namespace webs
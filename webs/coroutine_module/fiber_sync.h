@@ -0,0 +1,182 @@
+/**
+ * 协程级别的同步原语：FiberMutex、FiberCondVar、FiberSemaphore、FiberWaitGroup
+ * 等待时通过Fiber::YieldToHold挂起当前协程，由唤醒方通过Scheduler::schedule重新调度，不会阻塞工作线程
+ * 带超时的等待基于当前线程的IOManager(TimerManager)，只能在IOManager调度的协程中使用；当前协程被CancelToken取消时当作超时返回
+*/
+#ifndef __WEBS_FIBER_SYNC_H__
+#define __WEBS_FIBER_SYNC_H__
+
+#include <stdint.h>
+#include <atomic>
+#include <list>
+#include <memory>
+#include "fiber.h"
+#include "../util_module/mutex.h"
+#include "../util_module/Noncopyable.h"
+
+namespace webs {
+
+/* 协程等待队列；各个同步原语在自己的自旋锁保护下使用 */
+class FiberWaitQueue : Noncopyable {
+public:
+    typedef Spinlock MutexType;
+
+    /* 等待中的协程；唤醒与超时只有一个生效。同一个等待者可以同时在多个队列中(select) */
+    struct Waiter {
+        typedef std::shared_ptr<Waiter> ptr;
+        // 协程所在的调度器
+        Scheduler *scheduler = nullptr;
+        // 等待的协程；唤醒时交给调度器
+        Fiber::ptr fiber;
+        // 没有协程时(C++20协程等待)，唤醒时把resume交给调度器
+        Task resume;
+        // 已经被唤醒或者已经超时
+        std::atomic<bool> done = {false};
+        // 是否因为超时被唤醒
+        bool timeout = false;
+
+        /* 唤醒协程；已经被唤醒或者已经超时返回false */
+        bool wake();
+    };
+
+    /* 创建代表当前协程的等待者 */
+    static Waiter::ptr CreateWaiter();
+
+    /**
+     * 挂起当前协程直到waiter被唤醒或者超时；调用前需要已经加入等待队列并释放队列的锁
+     * timeout_ms为~0ull表示一直等待；返回false表示超时(或者被取消)
+     */
+    static bool Park(const Waiter::ptr &waiter, uint64_t timeout_ms = ~0ull);
+
+    /**
+     * 当前协程进入等待队列，释放lock后挂起，返回前重新获取lock
+     * timeout_ms为~0ull表示一直等待；返回false表示超时
+     */
+    bool wait(MutexType::Lock &lock, uint64_t timeout_ms = ~0ull);
+
+    /* 加入等待队列；调用者持有锁 */
+    void add(const Waiter::ptr &waiter) {
+        m_waiters.push_back(waiter);
+    }
+
+    /* 从等待队列中移除；调用者持有锁 */
+    void remove(const Waiter::ptr &waiter);
+
+    /* 唤醒一个等待的协程；调用者持有锁；返回是否唤醒了协程 */
+    bool notifyOne();
+
+    /* 唤醒所有等待的协程；调用者持有锁；返回唤醒的数量 */
+    size_t notifyAll();
+
+    /* 是否没有等待的协程；调用者持有锁 */
+    bool empty() const {
+        return m_waiters.empty();
+    }
+
+private:
+    std::list<Waiter::ptr> m_waiters;
+};
+
+/**
+ * 协程互斥锁
+ * 解锁时如果有等待者，锁直接交给队首的协程，避免唤醒后再次竞争
+ */
+class FiberMutex : Noncopyable {
+public:
+    typedef ScopedLockImpl<FiberMutex> Lock;
+
+    /* 加锁；锁被占用时挂起当前协程 */
+    void lock();
+
+    /* 尝试加锁，不等待 */
+    bool tryLock();
+
+    /* 在timeout_ms内加锁；返回false表示超时 */
+    bool tryLockFor(uint64_t timeout_ms);
+
+    /* 解锁 */
+    void unlock();
+
+private:
+    FiberWaitQueue::MutexType m_mutex;
+    FiberWaitQueue m_waiters;
+    // 是否已经上锁
+    bool m_locked = false;
+};
+
+/* 协程条件变量；与FiberMutex配合使用 */
+class FiberCondVar : Noncopyable {
+public:
+    /* 释放mutex并等待通知，返回前重新获取mutex */
+    void wait(FiberMutex &mutex);
+
+    /* 最多等待timeout_ms；返回false表示超时。无论是否超时，返回前都会重新获取mutex */
+    bool waitFor(FiberMutex &mutex, uint64_t timeout_ms);
+
+    /* 唤醒一个等待的协程 */
+    void notifyOne();
+
+    /* 唤醒所有等待的协程 */
+    void notifyAll();
+
+private:
+    FiberWaitQueue::MutexType m_mutex;
+    FiberWaitQueue m_waiters;
+};
+
+/**
+ * 协程信号量
+ * notify时如果有等待者，计数直接交给队首的协程
+ */
+class FiberSemaphore : Noncopyable {
+public:
+    FiberSemaphore(uint32_t count = 0);
+
+    /* 获取信号量；计数为0时挂起当前协程 */
+    void wait();
+
+    /* 尝试获取信号量，不等待 */
+    bool tryWait();
+
+    /* 在timeout_ms内获取信号量；返回false表示超时 */
+    bool waitFor(uint64_t timeout_ms);
+
+    /* 释放count个信号量 */
+    void notify(uint32_t count = 1);
+
+    /* 当前可用的计数 */
+    uint32_t getCount();
+
+private:
+    FiberWaitQueue::MutexType m_mutex;
+    FiberWaitQueue m_waiters;
+    uint32_t m_count;
+};
+
+/* 等待一组任务完成：add增加计数，done减少计数，计数为0时唤醒所有wait的协程 */
+class FiberWaitGroup : Noncopyable {
+public:
+    /* 增加delta个任务；delta可以为负数，计数不能小于0 */
+    void add(int64_t delta = 1);
+
+    /* 完成一个任务 */
+    void done();
+
+    /* 等待计数变为0 */
+    void wait();
+
+    /* 最多等待timeout_ms；返回false表示超时 */
+    bool waitFor(uint64_t timeout_ms);
+
+    /* 当前未完成的任务数量 */
+    int64_t getCount();
+
+private:
+    FiberWaitQueue::MutexType m_mutex;
+    FiberWaitQueue m_waiters;
+    int64_t m_count = 0;
+};
+
+} // namespace webs
+
+#endif
@@ -1,8 +1,10 @@
 #include "hook.h"
 #include "fd_manager.h"
+#include "cancel_token.h"
 #include "../log_module/log.h"
 #include "../config_module/config.h"
 #include "../io_module/iomanager.h"
+#include "../io_module/io_uring.h"
 #include "../util_module/macro.h"
 
 #include <dlfcn.h>
@@ -82,16 +84,54 @@ bool is_hook_enable() {
 
 } // namespace webs
 
-struct timer_info {
-    int cancelled = 0;
-};
+// 没有io_uring头文件时操作码为0，isUringSupported始终返回false
+#ifdef WEBS_HAVE_IO_URING
+#define WEBS_URING_OP(op) IORING_OP_##op
+#else
+#define WEBS_URING_OP(op) 0
+#endif
+
+/**
+ * 通过io_uring等待并完成一次IO：提交后挂起，完成项到达后恢复；被取消时提交取消请求
+ * 返回false表示需要退回epoll(提交队列已满，或者内核对非阻塞fd返回了EAGAIN)
+ */
+static bool do_uring(webs::IOManager *iom, webs::IOManager::UringIo *io, uint64_t timeout_ms, webs::CancelToken *token, ssize_t &n) {
+    io->fiber = webs::Fiber::GetThis();
+    io->scheduler = webs::Scheduler::GetThis();
+    if (!iom->submitIo(io, timeout_ms)) {
+        io->fiber.reset();
+        return false;
+    }
+    // 已经取消时也要等到完成项到达，io在协程栈上
+    if (token && !token->setInterrupt([iom, io]() { iom->cancelIo(io); })) {
+        iom->cancelIo(io);
+    }
+    webs::Fiber::YieldToHold();
+    if (token) {
+        token->clearInterrupt();
+    }
+    if (io->result >= 0) {
+        n = io->result;
+        return true;
+    }
+    if (io->result == -EAGAIN) {
+        return false;
+    }
+    n = -1;
+    if (io->timeout) {
+        errno = ETIMEDOUT;
+    } else {
+        errno = -io->result;
+    }
+    return true;
+}
 
 /* 文件描述符、可调用对象、传入需要hook的函数名、
 IO_Event、超时时间的类型( SO_RCVTIMEO or SO_SNDTIMEO )，以及执行hook函数所需参数
 返回-1表示错误，其他的返回值与hook的函数一致
 */
 template <typename OriginFun, typename... Args>
-static ssize_t do_io(int fd, OriginFun fun, const char *hook_name, uint32_t event, int timeout_so, Args &&... args) {
+static ssize_t do_io(int fd, OriginFun fun, const char *hook_name, uint32_t event, int timeout_so, webs::IOManager::UringIo *uio, Args &&... args) {
     if (!webs::t_hook_enable) { // 非hook
         return fun(fd, std::forward<Args>(args)...);
     }
@@ -110,8 +150,8 @@ static ssize_t do_io(int fd, OriginFun fun, const char *hook_name, uint32_t even
 
     // 获取超时时间
     uint64_t to = ctx->getTimeout(timeout_so);
-    // 添加条件定时器
-    std::shared_ptr<timer_info> tinfo(new timer_info);
+    // 等待的序号；超时嵌入在IOManager的fd上下文中，等待期间不分配内存，结果也留在fd上下文中
+    uint32_t wait_seq = 0;
 
 retry:
     // fd为socket，且是非堵塞 --> 直接执行fun，如果出错，errno = EINTR --> 继续尝试执行fun -->
@@ -123,39 +163,51 @@ retry:
     // EAGAIN 错误通常表示非阻塞操作正在进行中，但是当前没有数据可供读取或者没有空间可供写入，需要等待一段时间后再次尝试。
     if (n == -1 && errno == EAGAIN) {
         webs::IOManager *iom = webs::IOManager::GetThis();
-        webs::Timer::ptr timer;
-        if (to != (uint64_t)-1) {
-            std::weak_ptr<timer_info> winfo(tinfo);
-            timer = iom->addConditionTimer(
-                to, [winfo, iom, fd, event]() {
-                    auto it = winfo.lock();
-                    if (!it || it->cancelled) { // 条件不存在 或者 已经设置了 ETIMEDOUT 错误
-                        return;
-                    }
-                    it->cancelled = ETIMEDOUT;
-                    iom->delEvent(fd, (webs::IOManager::Event)event); // 取消事件
-                },
-                winfo);
+        webs::CancelToken *token = webs::CancelToken::GetCurrent();
+        if (token && token->isCancelled()) { // 协程已经被取消，不再等待
+            errno = ECANCELED;
+            return -1;
         }
-        // 添加事件
-        int rt = iom->addEvent(fd, (webs::IOManager::Event)event);
+        // io_uring后端：直接提交IO，不需要epoll_ctl和重试的系统调用
+        // 请求、超时和缓冲区在协程栈上，完成之前内核和完成回调会读写它们；共享栈的协程切出后栈会被其他协程使用，只能使用epoll
+        if (uio && iom->isUringSupported(uio->opcode) && !webs::Fiber::InSharedStack()) {
+            ssize_t rt = -1;
+            if (do_uring(iom, uio, to, token, rt)) {
+                return rt;
+            }
+            // 内核对非阻塞fd返回EAGAIN时，本次调用之后都使用epoll
+            uio = nullptr;
+        }
+        // 添加事件；超时之后取消事件并唤醒协程
+        int rt = iom->addEvent(fd, (webs::IOManager::Event)event, to, &wait_seq);
         if (WEBS_UNLIKELY(rt)) {
             // 输出错误信息
             WEBS_LOG_ERROR(g_logger) << hook_name << " addEvent(" << fd << " , " << event << ") fail";
-            // 取消定时器
-            if (timer) {
-                timer->cancel();
-            }
             return -1;
         } else {
+            // 被取消时触发事件唤醒协程
+            if (token && !token->setInterrupt([iom, fd, event]() {
+                    iom->cancelEvent(fd, (webs::IOManager::Event)event);
+                })) {
+                if (!iom->delEvent(fd, (webs::IOManager::Event)event)) {
+                    // 事件已经触发(例如消费了就绪事件)，协程已经被调度，切出一次
+                    webs::Fiber::YieldToHold();
+                }
+                errno = ECANCELED;
+                return -1;
+            }
             webs::Fiber::YieldToHold(); // 让出自己的执行时间
             // 如果切回来表示有数据来了
-            // 从两个地方切回来：1、执行定时器任务之后 2、addEvent
-            if (timer) { // addEvent
-                timer->cancel();
+            // 从三个地方切回来：1、超时 2、addEvent 3、被取消
+            if (token) {
+                token->clearInterrupt();
+            }
+            if (iom->waitTimedOut(fd, (webs::IOManager::Event)event, wait_seq)) { // 超时之后
+                errno = ETIMEDOUT;
+                return -1;
             }
-            if (tinfo->cancelled) { // 执行定时器任务之后
-                errno = tinfo->cancelled;
+            if (token && token->isCancelled()) {
+                errno = ECANCELED;
                 return -1;
             }
             // 当前协程被唤醒，继续尝试读取数据
@@ -165,6 +217,35 @@ retry:
     return n; // 可能读到数据，也可能出了其他错误
 }
 
+/* 挂起当前协程ms毫秒；定时器到时后重新调度当前协程。被取消时提前返回false */
+static bool do_sleep(uint64_t ms) {
+    webs::IOManager *iom = webs::IOManager::GetThis();
+    webs::Fiber::ptr fiber = webs::Fiber::GetThis();
+    webs::CancelToken *token = webs::CancelToken::GetCurrent();
+    if (token && token->isCancelled()) {
+        return false;
+    }
+    // 定时器的任务是：到时间之后，执行当前协程的上下文
+    // webs::Scheduler:: 表示成员函数所属的类作用域
+    webs::Timer::ptr timer = iom->addTimer(ms, std::bind((void (webs::Scheduler::*)(webs::Fiber::ptr fc, int thread, webs::Scheduler::Priority priority, uint64_t deadline_ms)) & webs::IOManager::schedule, iom, fiber, -1, webs::Scheduler::PRIORITY_DEFAULT, 0));
+    // 被取消时：取消定时器成功的一方负责调度协程
+    if (token && !token->setInterrupt([iom, timer, fiber]() {
+            if (timer->cancel()) {
+                iom->schedule(fiber);
+            }
+        })) {
+        if (timer->cancel()) {
+            return false;
+        }
+    }
+    webs::Fiber::YieldToHold();
+    if (token) {
+        token->clearInterrupt();
+        return !token->isCancelled();
+    }
+    return true;
+}
+
 extern "C" {
 // 创建一个类型、一个变量
 #define XX(name) name##_fun name##_f = nullptr;
@@ -176,12 +257,7 @@ unsigned int sleep(unsigned int second) {
     if (!webs::t_hook_enable) {
         return sleep_f(second);
     }
-    webs::IOManager *iom = webs::IOManager::GetThis();
-    webs::Fiber::ptr fiber = webs::Fiber::GetThis();
-    // 定时器的任务是：到时间之后，执行当前协程的上下文
-    // webs::Scheduler:: 表示成员函数所属的类作用域
-    iom->addTimer(second * 1000, std::bind((void (webs::Scheduler::*)(webs::Fiber::ptr fc, int thread)) & webs::IOManager::schedule, iom, fiber, -1));
-    webs::Fiber::YieldToHold();
+    do_sleep(second * 1000);
     return 0;
 }
 
@@ -190,11 +266,10 @@ int usleep(useconds_t usec) {
     if (!webs::t_hook_enable) {
         return usleep_f(usec);
     }
-
-    webs::IOManager *iom = webs::IOManager::GetThis();
-    webs::Fiber::ptr fiber = webs::Fiber::GetThis();
-    iom->addTimer(usec / 1000, std::bind((void (webs::Scheduler::*)(webs::Fiber::ptr fc, int thread)) & webs::IOManager::schedule, iom, fiber, -1));
-    webs::Fiber::YieldToHold();
+    if (!do_sleep(usec / 1000)) {
+        errno = ECANCELED;
+        return -1;
+    }
     return 0;
 }
 
@@ -202,11 +277,11 @@ int nanosleep(const struct timespec *req, struct timespec *rem) {
     if (!webs::t_hook_enable) {
         return nanosleep_f(req, rem);
     }
-    webs::IOManager *iom = webs::IOManager::GetThis();
-    webs::Fiber::ptr fiber = webs::Fiber::GetThis();
     uint64_t ms = req->tv_sec * 1000 + req->tv_nsec / 1000 / 1000;
-    iom->addTimer(ms, std::bind((void (webs::Scheduler::*)(webs::Fiber::ptr fc, int thread)) & webs::IOManager::schedule, iom, fiber, -1));
-    webs::Fiber::YieldToHold();
+    if (!do_sleep(ms)) {
+        errno = ECANCELED;
+        return -1;
+    }
     return 0;
 }
 
@@ -245,36 +320,33 @@ int connect_with_timeout(int fd, const struct sockaddr *addr, socklen_t addrlen,
 
     // rt == -1  或者 errno == EINPROGRESS  ---> 添加定时器和事件
     webs::IOManager *iom = webs::IOManager::GetThis();
-    // 设置条件定时器
-    std::shared_ptr<timer_info> tinfo(new timer_info);
-    std::weak_ptr<timer_info> winfo(tinfo);
-    webs::Timer::ptr timer;
-    if (timeout_ms != (uint64_t)-1) {
-        timer = iom->addConditionTimer(
-            timeout_ms, [winfo, iom, fd]() {
-                auto it = winfo.lock();
-                if (!it || it->cancelled) {
-                    return;
-                }
-                it->cancelled = ETIMEDOUT;
-                iom->delEvent(fd, webs::IOManager::Event::WRITE);
-            },
-            winfo);
-    }
-    rt = iom->addEvent(fd, webs::IOManager::Event::WRITE);
+    // 超时之后取消事件并唤醒协程
+    uint32_t wait_seq = 0;
+    rt = iom->addEvent(fd, webs::IOManager::Event::WRITE, timeout_ms, &wait_seq);
     if (rt == 0) {
+        webs::CancelToken *token = webs::CancelToken::GetCurrent();
+        if (token && !token->setInterrupt([iom, fd]() {
+                iom->cancelEvent(fd, webs::IOManager::Event::WRITE);
+            })) {
+            if (!iom->delEvent(fd, webs::IOManager::Event::WRITE)) {
+                webs::Fiber::YieldToHold();
+            }
+            errno = ECANCELED;
+            return -1;
+        }
         webs::Fiber::YieldToHold();
-        if (timer) {
-            timer->cancel();
+        if (token) {
+            token->clearInterrupt();
         }
-        if (tinfo->cancelled) {
-            errno = tinfo->cancelled;
+        if (iom->waitTimedOut(fd, webs::IOManager::Event::WRITE, wait_seq)) {
+            errno = ETIMEDOUT;
             return -1;
         }
-    } else {
-        if (timer) {
-            timer->cancel();
+        if (token && token->isCancelled()) {
+            errno = ECANCELED;
+            return -1;
         }
+    } else {
         WEBS_LOG_ERROR(g_logger) << "connect addEvent( " << fd << ", WRITE) error";
     }
 
@@ -301,7 +373,8 @@ int connect(int sockfd, const struct sockaddr *addr, socklen_t addrlen) {
 返回值：-1表示错误，非负表示成功，值对应一个新的套接字文件描述符
  */
 int accept(int sockfd, struct sockaddr *addr, socklen_t *addrlen) {
-    int fd = do_io(sockfd, accept_f, "accept", webs::IOManager::Event::READ, SO_RCVTIMEO, addr, addrlen);
+    webs::IOManager::UringIo uio(WEBS_URING_OP(ACCEPT), sockfd, addr, 0, 0, addrlen);
+    int fd = do_io(sockfd, accept_f, "accept", webs::IOManager::Event::READ, SO_RCVTIMEO, &uio, addr, addrlen);
     if (fd >= 0) {
         webs::FdMgr::GetInstance()->get(fd, true); // 如果成功，将其添加到 fdmanager
     }
@@ -312,45 +385,53 @@ int accept(int sockfd, struct sockaddr *addr, socklen_t *addrlen) {
 返回值：-1表示错误，非负数表示读取的字符数
  */
 ssize_t read(int fd, void *buf, size_t count) {
-    return do_io(fd, read_f, "read", webs::IOManager::Event::READ, SO_RCVTIMEO, buf, count);
+    webs::IOManager::UringIo uio(WEBS_URING_OP(READ), fd, buf, count);
+    return do_io(fd, read_f, "read", webs::IOManager::Event::READ, SO_RCVTIMEO, &uio, buf, count);
 }
 
 ssize_t readv(int fd, const struct iovec *iov, int iovcnt) {
-    return do_io(fd, readv_f, "readv", webs::IOManager::Event::READ, SO_RCVTIMEO, iov, iovcnt);
+    webs::IOManager::UringIo uio(WEBS_URING_OP(READV), fd, iov, iovcnt);
+    return do_io(fd, readv_f, "readv", webs::IOManager::Event::READ, SO_RCVTIMEO, &uio, iov, iovcnt);
 }
 
 ssize_t recv(int sockfd, void *buf, size_t len, int flags) {
-    return do_io(sockfd, recv_f, "recv", webs::IOManager::Event::READ, SO_RCVTIMEO, buf, len, flags);
+    webs::IOManager::UringIo uio(WEBS_URING_OP(RECV), sockfd, buf, len, flags);
+    return do_io(sockfd, recv_f, "recv", webs::IOManager::Event::READ, SO_RCVTIMEO, &uio, buf, len, flags);
 }
 
 ssize_t recvfrom(int sockfd, void *buf, size_t len, int flags,
                  struct sockaddr *src_addr, socklen_t *addrlen) {
-    return do_io(sockfd, recvfrom_f, "recvfrom", webs::IOManager::Event::READ, SO_RCVTIMEO, buf, len, flags, src_addr, addrlen);
+    return do_io(sockfd, recvfrom_f, "recvfrom", webs::IOManager::Event::READ, SO_RCVTIMEO, nullptr, buf, len, flags, src_addr, addrlen);
 }
 
 ssize_t recvmsg(int sockfd, struct msghdr *msg, int flags) {
-    return do_io(sockfd, recvmsg_f, "recvmsg", webs::IOManager::Event::READ, SO_RCVTIMEO, msg, flags);
+    webs::IOManager::UringIo uio(WEBS_URING_OP(RECVMSG), sockfd, msg, 1, flags);
+    return do_io(sockfd, recvmsg_f, "recvmsg", webs::IOManager::Event::READ, SO_RCVTIMEO, &uio, msg, flags);
 }
 
 ssize_t write(int fd, const void *buf, size_t count) {
-    return do_io(fd, write_f, "write", webs::IOManager::Event::WRITE, SO_SNDTIMEO, buf, count);
+    webs::IOManager::UringIo uio(WEBS_URING_OP(WRITE), fd, buf, count);
+    return do_io(fd, write_f, "write", webs::IOManager::Event::WRITE, SO_SNDTIMEO, &uio, buf, count);
 }
 
 ssize_t writev(int fd, const struct iovec *iov, int iovcnt) {
-    return do_io(fd, writev_f, "writev", webs::IOManager::Event::WRITE, SO_SNDTIMEO, iov, iovcnt);
+    webs::IOManager::UringIo uio(WEBS_URING_OP(WRITEV), fd, iov, iovcnt);
+    return do_io(fd, writev_f, "writev", webs::IOManager::Event::WRITE, SO_SNDTIMEO, &uio, iov, iovcnt);
 }
 
 ssize_t send(int sockfd, const void *buf, size_t len, int flags) {
-    return do_io(sockfd, send_f, "send", webs::IOManager::Event::WRITE, SO_SNDTIMEO, buf, len, flags);
+    webs::IOManager::UringIo uio(WEBS_URING_OP(SEND), sockfd, buf, len, flags);
+    return do_io(sockfd, send_f, "send", webs::IOManager::Event::WRITE, SO_SNDTIMEO, &uio, buf, len, flags);
 }
 
 ssize_t sendto(int sockfd, const void *buf, size_t len, int flags,
                const struct sockaddr *dest_addr, socklen_t addrlen) {
-    return do_io(sockfd, sendto_f, "sendto", webs::IOManager::Event::WRITE, SO_SNDTIMEO, buf, len, flags, dest_addr, addrlen);
+    return do_io(sockfd, sendto_f, "sendto", webs::IOManager::Event::WRITE, SO_SNDTIMEO, nullptr, buf, len, flags, dest_addr, addrlen);
 }
 
 ssize_t sendmsg(int sockfd, const struct msghdr *msg, int flags) {
-    return do_io(sockfd, sendmsg_f, "sendmsg", webs::IOManager::Event::WRITE, SO_SNDTIMEO, msg, flags);
+    webs::IOManager::UringIo uio(WEBS_URING_OP(SENDMSG), sockfd, msg, 1, flags);
+    return do_io(sockfd, sendmsg_f, "sendmsg", webs::IOManager::Event::WRITE, SO_SNDTIMEO, &uio, msg, flags);
 }
 
 /* hook? fdmanager保存了fd? 如果保存了触发所有事件，并从fdmanager删除fd(实际上是对fd reset) */
@@ -359,11 +440,13 @@ int close(int fd) {
         return close_f(fd);
     }
     webs::FdCtx::ptr ctx = webs::FdMgr::GetInstance()->get(fd);
-    if (ctx) {                                             // 如果fdmanager保存了 fd
+    if (ctx) { // 如果fdmanager保存了 fd
         webs::IOManager *iom = webs::IOManager::GetThis(); // 这里在什么情况下为nullptr
         if (iom) {
             iom->cancelAll(fd); // 触发所有事件
         }
+        // fd在关闭之后可能被复用，所有IOManager都需要清除注册；在cancelAll之后，等待者回到原来的reactor
+        webs::IOManager::UnregisterAll(fd);
         webs::FdMgr::GetInstance()->del(fd); // 删除保存的fd
     }
     return close_f(fd);
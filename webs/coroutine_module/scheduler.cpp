@@ -1,6 +1,8 @@
 #include "scheduler.h"
 #include "../log_module/log.h"
+#include "../config_module/config.h"
 #include "../util_module/macro.h"
+#include "../thread_module/affinity.h"
 #include "hook.h"
 
 namespace webs {
@@ -10,11 +12,119 @@ static webs::Logger::ptr g_logger = WEBS_LOG_NAME("system");
 static thread_local Scheduler *t_scheduler = nullptr;
 // 调度器的主协程指针
 static thread_local Fiber *t_scheduler_fiber = nullptr;
+// 工作窃取模式下当前线程在调度器中的本地队列下标
+static thread_local int t_queue_index = -1;
+// 当前工作线程的id；设置t_queue_index时一起设置，避免每次调度都调用gettid
+static thread_local int t_worker_thread = -1;
+// 当前线程上次查找任务时的m_scheduleSeq
+static thread_local uint64_t t_scan_seq = 0;
+
+// 是否使用工作窃取模式
+static webs::ConfigVar<bool>::ptr g_scheduler_work_stealing =
+    webs::Config::Lookup("scheduler.work_stealing", false, "scheduler use per-thread run queues with work stealing");
+// 各优先级类别的权重：延迟敏感、普通、批处理
+static webs::ConfigVar<std::vector<int>>::ptr g_scheduler_priority_weights =
+    webs::Config::Lookup("scheduler.priority.weights", std::vector<int>{16, 4, 1}, "scheduler weights of latency/normal/batch queues");
+// 任务等待超过该时间后不再按权重，直接执行，防止低优先级任务饿死
+static webs::ConfigVar<uint32_t>::ptr g_scheduler_starvation_ms =
+    webs::Config::Lookup<uint32_t>("scheduler.priority.starvation_ms", 50, "max wait of a queued task before it bypasses the weights");
+// 按调度器名字配置工作线程绑定的CPU，如 worker: [0-7, 16]；第i个线程绑定第i个CPU(循环使用)
+static webs::ConfigVar<std::map<std::string, std::vector<std::string>>>::ptr g_scheduler_cpus =
+    webs::Config::Lookup("scheduler.cpus", std::map<std::string, std::vector<std::string>>(), "scheduler name --> cpus that its worker threads are pinned to");
+// 每个线程缓存的已结束协程的上限
+static webs::ConfigVar<uint32_t>::ptr g_fiber_pool_max =
+    webs::Config::Lookup<uint32_t>("scheduler.fiber_pool.max", 256, "max terminated fibers cached per thread");
+// 突发任务过后协程池保留的数量
+static webs::ConfigVar<uint32_t>::ptr g_fiber_pool_keep =
+    webs::Config::Lookup<uint32_t>("scheduler.fiber_pool.keep", 16, "cached fibers kept per thread after a burst");
+// 协程池超过该时间没有使用时，线程进入idle时释放到keep个
+static webs::ConfigVar<uint32_t>::ptr g_fiber_pool_idle_ms =
+    webs::Config::Lookup<uint32_t>("scheduler.fiber_pool.idle_ms", 1000, "shrink the fiber pool after it is unused for this long");
+
+static int s_priority_weights[Scheduler::PRIORITY_COUNT] = {16, 4, 1};
+static uint32_t s_fiber_pool_max = 256;
+static uint32_t s_fiber_pool_keep = 16;
+static uint32_t s_fiber_pool_idle_ms = 1000;
+// 当前线程缓存的已结束协程(带着栈)；后进先出，复用最近用过的栈
+static thread_local std::vector<Fiber::ptr> t_fiber_pool;
+// 当前线程上次进入idle时协程池被使用过的时间(单调时钟，ms)
+static thread_local uint64_t t_fiber_pool_used_ms = 0;
+// 当前线程上次进入idle之后是否从协程池取出过协程
+static thread_local bool t_fiber_pool_used = false;
+static uint64_t s_starvation_us = 50 * 1000;
+// 截止时间剩余不到该时间的任务优先执行(微秒)
+static const uint64_t DEADLINE_URGENT_US = 1000;
+// 执行多少个任务刷新一次当前线程的粗粒度时钟
+static const uint32_t COARSE_CLOCK_REFRESH_TASKS = 16;
+// 当前线程执行的任务数量，用于刷新粗粒度时钟
+static thread_local uint32_t t_clock_tasks = 0;
+// 按权重轮询时每个线程的当前值(平滑加权轮询)
+static thread_local int64_t t_wrr_current[Scheduler::PRIORITY_COUNT] = {0};
+
+/* 只由一个线程写入的计数，不需要原子的读改写 */
+static void Increase(std::atomic<uint64_t> &value) {
+    value.store(value.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+static void SetPriorityWeights(const std::vector<int> &weights) {
+    for (size_t i = 0; i < Scheduler::PRIORITY_COUNT; ++i) {
+        s_priority_weights[i] = i < weights.size() && weights[i] > 0 ? weights[i] : 1;
+    }
+}
+
+struct _SchedulerIniter {
+    _SchedulerIniter() {
+        SetPriorityWeights(g_scheduler_priority_weights->getValue());
+        s_starvation_us = g_scheduler_starvation_ms->getValue() * 1000ull;
+        g_scheduler_priority_weights->addListener([](const std::vector<int> &old_value, const std::vector<int> &new_value) {
+            SetPriorityWeights(new_value);
+        });
+        g_scheduler_starvation_ms->addListener([](const uint32_t &old_value, const uint32_t &new_value) {
+            s_starvation_us = new_value * 1000ull;
+        });
+        s_fiber_pool_max = g_fiber_pool_max->getValue();
+        s_fiber_pool_keep = g_fiber_pool_keep->getValue();
+        g_fiber_pool_max->addListener([](const uint32_t &old_value, const uint32_t &new_value) {
+            s_fiber_pool_max = new_value;
+        });
+        g_fiber_pool_keep->addListener([](const uint32_t &old_value, const uint32_t &new_value) {
+            s_fiber_pool_keep = new_value;
+        });
+        s_fiber_pool_idle_ms = g_fiber_pool_idle_ms->getValue();
+        g_fiber_pool_idle_ms->addListener([](const uint32_t &old_value, const uint32_t &new_value) {
+            s_fiber_pool_idle_ms = new_value;
+        });
+    }
+};
+
+static _SchedulerIniter s_scheduler_initer;
 
 /* 构造函数：线程的数量、是否将当前线程加入协程调度器、协程调度器的名字 */
 Scheduler::Scheduler(size_t threads, bool use_caller, const std::string &name) :
     m_name(name) {
     WEBS_ASSERT(threads > 0);
+    m_workStealing = g_scheduler_work_stealing->getValue();
+    auto cpus = g_scheduler_cpus->getValue();
+    auto it = cpus.find(name);
+    if (it != cpus.end()) {
+        m_cpus = ParseCpuList(it->second);
+    }
+    // 预留空间，避免start时扩容导致其他线程读取m_threadIds失效
+    m_threadIds.reserve(threads);
+    for (auto &i : m_queueDepth) {
+        i = 0;
+    }
+    m_workerCounters.resize(threads + 1);
+    for (auto &i : m_workerCounters) {
+        i = new WorkerCounters;
+    }
+    if (m_workStealing) {
+        // 每个参与调度的线程(包括use_caller的调用线程)一个本地队列
+        m_queues.resize(threads);
+        for (size_t i = 0; i < threads; ++i) {
+            m_queues[i] = new WorkerQueue;
+        }
+    }
     // 分为两种情况：一种是需要将当前线程加入到协程调度器中 use_caller = true
     if (use_caller) {
         // 给线程创建主协程
@@ -31,6 +141,12 @@ Scheduler::Scheduler(size_t threads, bool use_caller, const std::string &name) :
         // 获取当前线程id，可以用与区分use_caller和非use_caller模式
         m_rootThread = webs::GetThreadId();
         m_threadIds.push_back(m_rootThread);
+        t_queue_index = 0;
+        t_worker_thread = m_rootThread;
+        if (m_workStealing) {
+            m_queues[0]->node = GetThreadNode();
+            m_queues[0]->thread = m_rootThread;
+        }
         webs::Thread::SetName(m_name);
     } else {
         // 非use_caller模式，全部设置为-1
@@ -44,6 +160,14 @@ Scheduler::~Scheduler() {
     WEBS_ASSERT(m_stopping);
     if (GetThis() == this) { // 如果线程所指向的调度器与当前调度器相同
         t_scheduler = nullptr;
+        t_queue_index = -1;
+        t_worker_thread = -1;
+    }
+    for (auto &i : m_queues) {
+        delete i;
+    }
+    for (auto &i : m_workerCounters) {
+        delete i;
     }
 }
 
@@ -61,6 +185,17 @@ void Scheduler::tickle() {
                             << "_ " << tickleindex++;
 }
 
+/* 默认逐个通知 */
+void Scheduler::tickle(size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        tickle();
+    }
+}
+
+void Scheduler::tickleThread(int thread) {
+    tickle();
+}
+
 /* 协程无任务可以调度时，执行idle协程 */
 void Scheduler::idle() {
     WEBS_LOG_INFO(g_logger) << "idle";
@@ -87,7 +222,26 @@ void Scheduler::start() {
 
     m_threads.resize(m_threadCount);
     for (size_t i = 0; i < m_threadCount; ++i) {
-        m_threads[i].reset(new Thread(std::bind(&Scheduler::run, this), m_name + "_" + std::to_string(i)));
+        // 本地队列下标：use_caller模式下0号队列属于调用线程
+        int index = m_rootThread == -1 ? i : i + 1;
+        // 调用线程不属于调度器，不绑定
+        int cpu = m_cpus.empty() ? -1 : m_cpus[i % m_cpus.size()];
+        m_threads[i].reset(new Thread([this, index, cpu]() {
+                if (cpu != -1) {
+                    SetThreadAffinity(cpu);
+                }
+                t_queue_index = index;
+                t_worker_thread = GetThreadId();
+                if (m_workStealing) {
+                    m_queues[index]->node = GetThreadNode();
+                    // 在调度任务之前写入，本线程的id传给其他线程之后一定可以找到队列
+                    m_queues[index]->thread.store(t_worker_thread, std::memory_order_release);
+                }
+                run(); }, m_name + "_" + std::to_string(i)));
+        if (m_workStealing) {
+            // start返回之前所有线程的id都可以找到队列
+            m_queues[index]->thread.store(m_threads[i]->getId(), std::memory_order_release);
+        }
         m_threadIds.push_back(m_threads[i]->getId());
     }
     lock.unlock();
@@ -137,8 +291,414 @@ void Scheduler::stop() {
 
 /* 返回是否可以停止 */
 bool Scheduler::stopping() {
+    if (m_workStealing) {
+        return m_autoStop && m_stopping && m_taskCount == 0 && m_activeThreadCount == 0;
+    }
     MutexType::Lock lock(m_mutex);
-    return m_autoStop && m_stopping && m_fibers.empty() && m_activeThreadCount == 0;
+    return m_autoStop && m_stopping && m_fiberCount == 0 && m_activeThreadCount == 0;
+}
+
+bool Scheduler::scheduleNolock(FiberAndThread &ft) {
+    bool need_tickle = m_fiberCount == 0 || hasIdleThreads(); // 如果为空或者有空闲线程，唤醒线程
+    if (ft.cb || ft.fiber) { // 要么是协程，要么是函数指针
+        // 加入对应优先级的等待队列中
+        InsertTask(m_fibers[ft.priority], ft);
+        ++m_fiberCount;
+        ++m_queueDepth[ft.priority];
+        ++m_scheduleSeq;
+    }
+    return need_tickle; // true表示以前是没有任务的，现在任务来了，去唤醒线程。在从协程队列中取出协程
+}
+
+/**
+ * 批量调度
+ * 全局队列模式下一次加锁放入全部任务；工作窃取模式下逐个放入本地队列/收件箱(无锁)
+ * 最后按新任务的数量一次性唤醒线程，而不是每个任务唤醒一次
+ */
+void Scheduler::schedule(TaskBatch &batch) {
+    std::vector<FiberAndThread> &tasks = batch.m_tasks;
+    if (tasks.empty()) {
+        return;
+    }
+    size_t need_tickle = 0;
+    // 移走之后thread仍然有效；指定线程的任务单独唤醒
+    if (m_workStealing) {
+        for (auto &ft : tasks) {
+            need_tickle += scheduleLocal(ft) && ft.thread == -1;
+        }
+    } else {
+        MutexType::Lock lock(m_mutex);
+        for (auto &ft : tasks) {
+            need_tickle += scheduleNolock(ft) && ft.thread == -1;
+        }
+    }
+    // 指定当前线程的任务(例如IO事件恢复的协程)由当前线程之后执行，不需要唤醒
+    int self = GetThis() == this ? webs::GetThreadId() : -1;
+    for (auto &ft : tasks) {
+        if (ft.thread != -1 && ft.thread != self) {
+            tickleThread(ft.thread);
+        }
+    }
+    tasks.clear();
+    if (need_tickle) {
+        tickle(need_tickle);
+    }
+}
+
+int Scheduler::choosePriority(const FiberAndThread *const heads[PRIORITY_COUNT]) {
+    uint64_t now = GetMonotonicUS();
+    int chosen = -1;
+    // 截止时间快到的任务，选择最早到期的
+    for (int i = 0; i < PRIORITY_COUNT; ++i) {
+        const FiberAndThread *head = heads[i];
+        if (head && head->deadline && head->deadline <= now + DEADLINE_URGENT_US
+            && (chosen == -1 || head->deadline < heads[chosen]->deadline)) {
+            chosen = i;
+        }
+    }
+    if (chosen != -1) {
+        return chosen;
+    }
+    // 等待过久的任务，选择等待最久的
+    for (int i = 0; i < PRIORITY_COUNT; ++i) {
+        const FiberAndThread *head = heads[i];
+        if (head && head->enqueueTime + s_starvation_us <= now
+            && (chosen == -1 || head->enqueueTime < heads[chosen]->enqueueTime)) {
+            chosen = i;
+        }
+    }
+    if (chosen != -1) {
+        return chosen;
+    }
+    // 平滑加权轮询：非空队列的当前值加上权重，选择最大的，再减去总权重
+    int64_t total = 0;
+    for (int i = 0; i < PRIORITY_COUNT; ++i) {
+        if (!heads[i]) {
+            continue;
+        }
+        total += s_priority_weights[i];
+        t_wrr_current[i] += s_priority_weights[i];
+        if (chosen == -1 || t_wrr_current[i] > t_wrr_current[chosen]) {
+            chosen = i;
+        }
+    }
+    if (chosen != -1) {
+        t_wrr_current[chosen] -= total;
+    }
+    return chosen;
+}
+
+/**
+ * 全局队列模式下获取任务
+ * 按choosePriority选择类别，类别中没有当前线程可以执行的任务时，按优先级顺序查找其他类别
+ * 跳过指定了其他线程的任务和正在执行中的协程
+ */
+bool Scheduler::fetchGlobalNolock(FiberAndThread &ft, bool &tickle_me) {
+    if (m_fiberCount == 0) {
+        return false;
+    }
+    const FiberAndThread *heads[PRIORITY_COUNT];
+    for (int i = 0; i < PRIORITY_COUNT; ++i) {
+        heads[i] = m_fibers[i].empty() ? nullptr : &m_fibers[i].front();
+    }
+    int first = choosePriority(heads);
+    bool found = false;
+    for (int n = -1; n < PRIORITY_COUNT && !found; ++n) {
+        int prio = n == -1 ? first : n;
+        if (n == first) {
+            continue;
+        }
+        std::deque<FiberAndThread> &tasks = m_fibers[prio];
+        for (auto it = tasks.begin(); it != tasks.end(); ++it) {
+            // 如果工作任务指定的线程不是当前线程，通知其他线程执行，继续查找
+            if (it->thread != -1 && it->thread != webs::GetThreadId()) {
+                tickle_me = true;
+                continue;
+            }
+            // 找到可以执行任务；校验并设置任务
+            WEBS_ASSERT(it->cb || it->fiber);
+            if (it->fiber && it->fiber->getState() == Fiber::EXEC) {
+                continue;
+            }
+            ft = std::move(*it);
+            tasks.erase(it);
+            --m_fiberCount;
+            found = true;
+            break;
+        }
+    }
+    tickle_me |= m_fiberCount > 0; // 还有任务要执行
+    return found;
+}
+
+void Scheduler::onDispatch(const FiberAndThread &ft) {
+    --m_queueDepth[ft.priority];
+    WorkerCounters *stats = workerCounters();
+    uint64_t now = GetMonotonicUS();
+    stats->wait[ft.priority].record(now > ft.enqueueTime ? now - ft.enqueueTime : 0);
+    if (ft.fiber && ft.fiber->m_readyTime) {
+        uint64_t ready = ft.fiber->m_readyTime;
+        ft.fiber->m_readyTime = 0;
+        onFiberReady(now > ready ? now - ready : 0);
+    }
+}
+
+uint64_t Scheduler::getDispatchCount(Priority priority) const {
+    uint64_t count = 0;
+    for (auto i : m_workerCounters) {
+        count += i->wait[priority].count();
+    }
+    return count;
+}
+
+uint64_t Scheduler::getAvgWaitUs(Priority priority) const {
+    uint64_t count = 0;
+    uint64_t sum = 0;
+    for (auto i : m_workerCounters) {
+        count += i->wait[priority].count();
+        sum += i->wait[priority].sum();
+    }
+    return count ? sum / count : 0;
+}
+
+/* 汇总各线程的直方图之后计算百分位数 */
+uint64_t Scheduler::getWaitPercentileUs(Priority priority, double percent) const {
+    uint64_t buckets[Histogram::BUCKETS] = {0};
+    uint64_t total = 0;
+    for (auto i : m_workerCounters) {
+        for (size_t j = 0; j < Histogram::BUCKETS; ++j) {
+            uint64_t n = i->wait[priority].bucket(j);
+            buckets[j] += n;
+            total += n;
+        }
+    }
+    if (total == 0) {
+        return 0;
+    }
+    uint64_t target = (uint64_t)(total * percent / 100);
+    uint64_t count = 0;
+    for (size_t i = 0; i < Histogram::BUCKETS; ++i) {
+        count += buckets[i];
+        if (count > target || count == total) {
+            return 1ull << i;
+        }
+    }
+    return 1ull << (Histogram::BUCKETS - 1);
+}
+
+/* 返回线程id对应的本地队列下标；每个线程启动时把自己的id写入自己的队列，不读取start还在写入的m_threadIds */
+int Scheduler::queueIndexOf(int thread) const {
+    if (thread == t_worker_thread && GetThis() == this && t_queue_index != -1) {
+        return t_queue_index;
+    }
+    for (size_t i = 0; i < m_queues.size(); ++i) {
+        if (m_queues[i]->thread.load(std::memory_order_acquire) == thread) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * 工作窃取模式下的任务入队
+ * 指定了线程的任务放入该线程的队列；当前线程属于本调度器则放入自己的队列；否则轮询选择一个队列
+ * 协程任务和跨线程的任务走无锁收件箱；当前线程自己的function任务直接放入本地队列
+ * 返回true表示之前没有任务、是指定线程的任务或者有空闲线程可以窃取，需要唤醒线程
+ */
+bool Scheduler::scheduleLocal(FiberAndThread &ft) {
+    if (!ft.cb && !ft.fiber) {
+        return false;
+    }
+    int index = -1;
+    if (ft.thread != -1) {
+        index = queueIndexOf(ft.thread);
+        if (index == -1) {
+            // 线程不属于本调度器，当作普通任务处理
+            ft.thread = -1;
+        }
+    }
+    bool self = GetThis() == this && t_queue_index != -1;
+    if (index == -1) {
+        index = self ? t_queue_index : m_nextQueue++ % m_queues.size();
+    }
+    bool need_tickle = m_taskCount++ == 0 || ft.thread != -1 || hasIdleThreads();
+    ++m_queueDepth[ft.priority];
+    WorkerQueue *queue = m_queues[index];
+    if (ft.fiber || !self || index != t_queue_index) {
+        pushInbox(queue, ft);
+    } else {
+        WorkerQueue::MutexType::Lock lock(queue->mutex);
+        if (ft.thread != -1) {
+            queue->pinned.push_back(std::move(ft));
+        } else {
+            InsertTask(queue->tasks[ft.priority], ft);
+        }
+    }
+    ++m_scheduleSeq;
+    return need_tickle;
+}
+
+/* 协程在收件箱中时由m_inboxRef持有引用；同一个协程重复入队时退化为分配节点 */
+void Scheduler::pushInbox(WorkerQueue *queue, FiberAndThread &ft) {
+    Fiber::InboxNode *node = nullptr;
+    if (ft.fiber && !ft.fiber->m_inboxQueued.exchange(true, std::memory_order_acq_rel)) {
+        Fiber *fiber = ft.fiber.get();
+        node = &fiber->m_inboxNode;
+        node->fiber = fiber;
+        node->thread = ft.thread;
+        node->priority = ft.priority;
+        node->deadline = ft.deadline;
+        node->enqueueTime = ft.enqueueTime;
+        fiber->m_inboxRef.swap(ft.fiber);
+    } else {
+        TaskNode *task = new TaskNode;
+        task->ft = std::move(ft);
+        node = task;
+    }
+    queue->inbox.push(node);
+}
+
+/* 收件箱 --> 本地队列；指定了线程的任务放入pinned */
+void Scheduler::drainInbox(WorkerQueue *queue) {
+    MpscNode *n = nullptr;
+    while ((n = queue->inbox.pop()) != nullptr) {
+        Fiber::InboxNode *node = static_cast<Fiber::InboxNode *>(n);
+        FiberAndThread ft;
+        if (node->fiber) {
+            Fiber *fiber = node->fiber;
+            ft.fiber.swap(fiber->m_inboxRef);
+            ft.thread = node->thread;
+            ft.priority = node->priority;
+            ft.deadline = node->deadline;
+            ft.enqueueTime = node->enqueueTime;
+            fiber->m_inboxQueued.store(false, std::memory_order_release);
+        } else {
+            TaskNode *task = static_cast<TaskNode *>(node);
+            ft = std::move(task->ft);
+            delete task;
+        }
+        if (ft.thread != -1) {
+            queue->pinned.push_back(std::move(ft));
+        } else {
+            InsertTask(queue->tasks[ft.priority], ft);
+        }
+    }
+}
+
+/* 从队列中取出第一个可以执行的任务；正在执行中的协程(还没有切出)需要跳过 */
+bool Scheduler::popTask(std::deque<FiberAndThread> &tasks, FiberAndThread &ft) {
+    for (auto it = tasks.begin(); it != tasks.end(); ++it) {
+        WEBS_ASSERT(it->cb || it->fiber);
+        if (it->fiber && it->fiber->getState() == Fiber::EXEC) {
+            continue;
+        }
+        ft = std::move(*it);
+        tasks.erase(it);
+        return true;
+    }
+    return false;
+}
+
+/* 按choosePriority选择类别，类别中没有可以执行的任务时按优先级顺序查找其他类别；调用者持有queue->mutex */
+bool Scheduler::popPriorityTask(WorkerQueue *queue, FiberAndThread &ft) {
+    const FiberAndThread *heads[PRIORITY_COUNT];
+    for (int i = 0; i < PRIORITY_COUNT; ++i) {
+        heads[i] = queue->tasks[i].empty() ? nullptr : &queue->tasks[i].front();
+    }
+    int first = choosePriority(heads);
+    if (first == -1) {
+        return false;
+    }
+    if (popTask(queue->tasks[first], ft)) {
+        return true;
+    }
+    for (int i = 0; i < PRIORITY_COUNT; ++i) {
+        if (i != first && popTask(queue->tasks[i], ft)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * 从其他线程的本地队列窃取任务
+ * 只窃取tasks中的任务，每次最多窃取一半(高优先级优先)，第一个直接执行，其余放入自己的队列
+ * 其他线程有pinned任务时，设置tickle_me通知其他线程
+ */
+bool Scheduler::steal(size_t self, FiberAndThread &ft, bool &tickle_me) {
+    size_t count = m_queues.size();
+    int node = m_queues[self]->node;
+    std::vector<FiberAndThread> stolen;
+    // 先窃取同一个NUMA节点的线程，再窃取其他节点的线程
+    bool remote = false;
+    for (size_t i = 1; i < count * 2 && stolen.empty(); ++i) {
+        remote = i >= count;
+        WorkerQueue *victim = m_queues[(self + i) % count];
+        if (remote == (victim->node == node) || i == count) {
+            continue;
+        }
+        WorkerQueue::MutexType::Lock lock(victim->mutex);
+        drainInbox(victim);
+        tickle_me |= !victim->pinned.empty();
+        size_t total = 0;
+        for (auto &tasks : victim->tasks) {
+            total += tasks.size();
+        }
+        size_t n = (total + 1) / 2;
+        for (auto &tasks : victim->tasks) {
+            auto it = tasks.begin();
+            while (n > 0 && it != tasks.end()) {
+                if (it->fiber && it->fiber->getState() == Fiber::EXEC) {
+                    ++it;
+                    continue;
+                }
+                stolen.push_back(std::move(*it));
+                it = tasks.erase(it);
+                --n;
+            }
+            tickle_me |= !tasks.empty();
+        }
+    }
+    if (stolen.empty()) {
+        return false;
+    }
+    (remote ? m_remoteStealCount : m_localStealCount) += stolen.size();
+    ft = std::move(stolen[0]);
+    if (stolen.size() > 1) {
+        WorkerQueue *queue = m_queues[self];
+        WorkerQueue::MutexType::Lock lock(queue->mutex);
+        for (size_t i = 1; i < stolen.size(); ++i) {
+            InsertTask(queue->tasks[stolen[i].priority], stolen[i]);
+        }
+    }
+    return true;
+}
+
+/* 工作窃取模式下获取任务：先取自己的pinned队列，再取自己的普通队列，最后窃取其他线程的任务 */
+bool Scheduler::fetchLocal(FiberAndThread &ft, bool &tickle_me) {
+    if (m_taskCount == 0) {
+        return false;
+    }
+    WEBS_ASSERT(t_queue_index >= 0 && t_queue_index < (int)m_queues.size());
+    WorkerQueue *queue = m_queues[t_queue_index];
+    bool found = false;
+    {
+        WorkerQueue::MutexType::Lock lock(queue->mutex);
+        drainInbox(queue);
+        found = popTask(queue->pinned, ft) || popPriorityTask(queue, ft);
+        // 剩下的可能是还没有切出的协程，需要再次检查
+        tickle_me |= !queue->pinned.empty();
+        for (auto &tasks : queue->tasks) {
+            tickle_me |= !tasks.empty();
+        }
+    }
+    if (!found) {
+        found = steal(t_queue_index, ft, tickle_me);
+    }
+    if (found) {
+        --m_taskCount;
+    }
+    return found;
 }
 
 /**
@@ -153,19 +713,121 @@ void Scheduler::switchTo(int thread) {
             return;
         }
     }
-    schedule(webs::Fiber::GetThis(), thread);
+    Fiber::ptr cur = webs::Fiber::GetThis();
+    WEBS_ASSERT2(!cur->isSharedStack(), "shared stack fiber cannot switch to another thread");
+    schedule(cur, thread);
+    cur.reset();
     webs::Fiber::YieldToHold();
 }
 
+/* 优先从协程池中取出协程执行cb；池为空时创建新协程 */
+Fiber::ptr Scheduler::acquireFiber(Task &cb) {
+    bool shared_stack = m_sharedStack;
+    while (!t_fiber_pool.empty()) {
+        Fiber::ptr fiber = std::move(t_fiber_pool.back());
+        t_fiber_pool.pop_back();
+        // 共享栈设置改变之前缓存的协程直接释放
+        if (fiber->isSharedStack() == shared_stack) {
+            fiber->reset(std::move(cb));
+            Increase(workerCounters()->fiberPoolHits);
+            t_fiber_pool_used = true;
+            return fiber;
+        }
+    }
+    Increase(workerCounters()->fiberPoolMisses);
+    Fiber::ptr fiber(new Fiber(std::move(cb), 0, false, shared_stack));
+    fiber->m_pooled = true;
+    return fiber;
+}
+
+/* 协程池创建的、已结束且没有其他引用的协程放回协程池；用户创建的协程(栈大小可能不同)直接释放 */
+void Scheduler::releaseFiber(Fiber::ptr &fiber) {
+    if (fiber->m_pooled && fiber.use_count() == 1 && t_fiber_pool.size() < s_fiber_pool_max) {
+        fiber->reset(nullptr);
+        t_fiber_pool.push_back(std::move(fiber));
+    }
+    fiber.reset();
+}
+
+/* 线程进入idle时，协程池一段时间没有使用，释放突发任务期间多缓存的协程；只在这里读取时钟 */
+void Scheduler::TrimFiberPool() {
+    uint64_t now = CoarseClock::NowMS();
+    if (t_fiber_pool_used) {
+        t_fiber_pool_used = false;
+        t_fiber_pool_used_ms = now;
+    } else if (t_fiber_pool.size() > s_fiber_pool_keep && now - t_fiber_pool_used_ms >= s_fiber_pool_idle_ms) {
+        // 后面是最近放回的协程，栈还在缓存中；从前面释放最久没有使用的
+        t_fiber_pool.erase(t_fiber_pool.begin(), t_fiber_pool.end() - s_fiber_pool_keep);
+    }
+}
+
+uint64_t Scheduler::getFiberPoolHits() const {
+    uint64_t count = 0;
+    for (auto i : m_workerCounters) {
+        count += i->fiberPoolHits;
+    }
+    return count;
+}
+
+uint64_t Scheduler::getFiberPoolMisses() const {
+    uint64_t count = 0;
+    for (auto i : m_workerCounters) {
+        count += i->fiberPoolMisses;
+    }
+    return count;
+}
+
+Scheduler::WorkerCounters *Scheduler::workerCounters() const {
+    int index = getWorkerIndex();
+    return m_workerCounters[index == -1 ? m_workerCounters.size() - 1 : index];
+}
+
+bool Scheduler::hasNewTasks() const {
+    return m_scheduleSeq != t_scan_seq;
+}
+
+int Scheduler::getWorkerIndex() const {
+    return GetThis() == this ? t_queue_index : -1;
+}
+
 /* 输出协程的信息 */
 std::ostream &Scheduler::dump(std::ostream &os) {
     os << "[Scheduler name = " << m_name
        << " size = " << m_threadCount
        << " active_count = " << m_activeThreadCount
-       << " idle_count = " << m_activeThreadCount
+       << " idle_count = " << m_idleThreadCount
        << " stopping = " << m_stopping
-       << " ]" << std::endl
-       << "    ";
+       << " work_stealing = " << m_workStealing
+       << " shared_stack = " << m_sharedStack
+       << " tickles = " << m_tickleCount
+       << " empty_wakeups = " << m_emptyWakeupCount
+       << " local_steals = " << m_localStealCount
+       << " remote_steals = " << m_remoteStealCount
+       << " ]" << std::endl;
+    uint64_t hits = getFiberPoolHits();
+    uint64_t misses = getFiberPoolMisses();
+    os << "    [fiber_pool hits = " << hits
+       << " misses = " << misses
+       << " hit_rate = " << (hits + misses ? hits * 100.0 / (hits + misses) : 0) << "%"
+       << " ]" << std::endl;
+    static const char *s_priority_names[PRIORITY_COUNT] = {"latency", "normal", "batch"};
+    for (int i = 0; i < PRIORITY_COUNT; ++i) {
+        Priority prio = (Priority)i;
+        os << "    [" << s_priority_names[i]
+           << " depth = " << getQueueDepth(prio)
+           << " dispatched = " << getDispatchCount(prio)
+           << " avg_wait_us = " << getAvgWaitUs(prio)
+           << " p99_wait_us = " << getWaitPercentileUs(prio, 99)
+           << " ]" << std::endl;
+    }
+    if (!m_cpus.empty()) {
+        os << "    cpus = ";
+        for (size_t i = 0; i < m_cpus.size(); ++i) {
+            os << (i ? "," : "") << m_cpus[i];
+        }
+        os << std::endl;
+    }
+    os << "    ";
     for (size_t i = 0; i < m_threadIds.size(); ++i) {
         if (i) {
             os << ", ";
@@ -193,6 +855,8 @@ void Scheduler::run() {
 
     Fiber::ptr cb_fiber;
     FiberAndThread ft;
+    // 是否刚从idle返回
+    bool from_idle = false;
     // 根据线程id查找可以运行的工作任务
     while (true) {
         WEBS_LOG_DEBUG(g_logger) << m_name << " run   work";
@@ -202,38 +866,37 @@ void Scheduler::run() {
         bool tickle_me = false;
         // 是否有线程在工作。工作完需要数量减一
         bool is_active = false;
-        {
+        // 先记录序号再查找，之后加入的任务一定能被hasNewTasks发现
+        t_scan_seq = m_scheduleSeq;
+        if (m_workStealing) {
+            if (fetchLocal(ft, tickle_me)) {
+                ++m_activeThreadCount;
+                is_active = true;
+            }
+        } else {
             MutexType::Lock lock(m_mutex);
-            // 查找可以执行的任务
-            auto it = m_fibers.begin();
-            while (it != m_fibers.end()) {
-                // 如果工作任务指定的线程不是当前线程，通知其他线程执行，继续查找
-                if (it->thread != -1 && it->thread != webs::GetThreadId()) {
-                    ++it;
-                    tickle_me = true;
-                    continue;
-                }
-                // 找到可以执行任务；校验并设置任务
-                // 校验
-                WEBS_ASSERT(it->cb != nullptr || it->fiber != nullptr);
-                if (it->fiber && it->fiber->getState() == Fiber::EXEC) {
-                    ++it;
-                    continue;
-                }
-                // 设置任务
-                ft = *it;
-                it = m_fibers.erase(it);
+            // 按优先级查找可以执行的任务
+            if (fetchGlobalNolock(ft, tickle_me)) {
                 ++m_activeThreadCount;
                 is_active = true;
-                break;
             }
-            tickle_me |= it != m_fibers.end(); // it != m_fibers.end()表示：还有任务要执行
+        }
+        if (is_active) {
+            onDispatch(ft);
+            // 一直有任务的线程不会进入idle，每执行一批任务刷新一次粗粒度时钟
+            if (++t_clock_tasks % COARSE_CLOCK_REFRESH_TASKS == 0) {
+                CoarseClock::Refresh();
+            }
         }
 
         // 如果设置了tickle，通知一下其他线程
         if (tickle_me) {
             tickle();
         }
+        if (from_idle && !is_active) {
+            ++m_emptyWakeupCount;
+        }
+        from_idle = false;
         // 一：任务是协程，执行--> 执行完，根据工作状态执行不同的策略
         if (ft.fiber && ft.fiber->getState() != Fiber::TERM && ft.fiber->getState() != Fiber::EXCEPT) {
             ft.fiber->swapIn();
@@ -243,6 +906,9 @@ void Scheduler::run() {
                 schedule(ft.fiber);
             } else if (ft.fiber->getState() != Fiber::TERM && ft.fiber->getState() != Fiber::EXCEPT) {
                 ft.fiber->m_state = Fiber::HOLD;
+            } else {
+                // 让出过的function协程在这里结束，放回协程池
+                releaseFiber(ft.fiber);
             }
             ft.reset();
 
@@ -253,10 +919,14 @@ void Scheduler::run() {
             // WEBS_LOG_DEBUG(g_logger) << m_name << " run function";
 
             if (cb_fiber) {
-                cb_fiber->reset(ft.cb); // 重置上下文
+                // 重置上下文；复用上一个任务的协程，不经过协程池，不计入命中率
+                cb_fiber->reset(std::move(ft.cb));
             } else {
-                cb_fiber.reset(new Fiber(ft.cb));
+                // 上一个function协程让出了，从协程池中取一个
+                cb_fiber = acquireFiber(ft.cb);
             }
+            // 协程之后被重新调度时沿用任务的优先级
+            cb_fiber->setPriority(ft.priority);
             ft.reset();
             cb_fiber->swapIn();
             // 切回当前上下文执行
@@ -282,15 +952,19 @@ void Scheduler::run() {
             }
             if (idle_fiber->getState() == Fiber::TERM) {
                 WEBS_LOG_INFO(g_logger) << "idle fiber term";
+                // 在线程局部变量析构之前释放协程，协程栈还可以放回栈缓存
+                t_fiber_pool.clear();
                 break;
             }
 
             WEBS_LOG_DEBUG(g_logger) << m_name << " exec   idle ";
 
-            ++m_activeThreadCount;
+            TrimFiberPool();
+            ++m_idleThreadCount;
             idle_fiber->swapIn();
             WEBS_LOG_DEBUG(g_logger) << m_name << " end   exec   idle ";
-            --m_activeThreadCount;
+            --m_idleThreadCount;
+            from_idle = true;
             if (idle_fiber->getState() != Fiber::TERM && idle_fiber->getState() != Fiber::EXCEPT) {
                 idle_fiber->m_state = Fiber::HOLD;
             }
@@ -8,11 +8,15 @@
 */
 #ifndef __WEBS_SCHEDULER_H__
 #define __WEBS_SCHEDULER_H__
+#include <deque>
 #include <list>
 #include <memory>
 #include <vector>
 #include "../util_module/mutex.h"
+#include "../util_module/util.h"
+#include "../util_module/histogram.h"
 #include "fiber.h"
+#include "task.h"
 #include "../thread_module/thread.h"
 namespace webs {
 
@@ -25,6 +29,20 @@ public:
     typedef std::shared_ptr<Scheduler> ptr;
     typedef Mutex MutexType;
 
+    /* 任务的优先级类别；数值越小越优先 */
+    enum Priority {
+        // 延迟敏感(请求处理)
+        PRIORITY_LATENCY = 0,
+        // 普通
+        PRIORITY_NORMAL = 1,
+        // 批处理(后台任务)
+        PRIORITY_BATCH = 2,
+        // 类别数量
+        PRIORITY_COUNT = 3,
+        // 协程沿用自身的优先级，function使用PRIORITY_NORMAL
+        PRIORITY_DEFAULT = -1
+    };
+
     /* 构造函数：线程的数量、是否将当前线程加入协程调度器、协程调度器的名字 */
     Scheduler(size_t threads = 1, bool use_caller = true, const std::string &name = "");
 
@@ -48,42 +66,123 @@ public:
     /* 停止协程调度器 */
     void stop();
 
-    /* 调度协程，可以是function，也可以是协程 */
+    /**
+     * 调度协程，可以是function，也可以是协程
+     * priority：优先级类别；指定后协程之后被重新调度时沿用
+     * deadline_ms：希望在多少毫秒内开始执行，0表示没有；快到期的任务优先执行
+     */
     template <class FiberOrCb>
-    void schedule(FiberOrCb fc, int thread = -1) {
+    void schedule(FiberOrCb fc, int thread = -1, Priority priority = PRIORITY_DEFAULT, uint64_t deadline_ms = 0) {
         bool need_tickle = false;
-        {
+        FiberAndThread ft(std::move(fc), thread);
+        ft.prepare(priority, deadline_ms);
+        // 指定了线程的任务只唤醒该线程
+        int target = ft.thread;
+        if (m_workStealing) {
+            need_tickle = scheduleLocal(ft);
+        } else {
             MutexType::Lock lock(m_mutex);
-            need_tickle = scheduleNolock(fc, thread);
+            need_tickle = scheduleNolock(ft);
         }
         // 可以执行自定义的协程调度器的调度方法
         if (need_tickle) {
-            tickle();
+            if (target != -1) {
+                tickleThread(target);
+            } else {
+                tickle();
+            }
         }
     }
 
-    /* 批量调度协程 */
+    class TaskBatch;
+
+    /* 批量调度协程；元素(协程、std::function或者Task)被移走 */
     template <class InputIterator>
-    void schedule(InputIterator begin, InputIterator end) {
-        bool need_tickle = false;
-        {
-            MutexType::Lock lock(m_mutex);
-            while (begin != end) {
-                need_tickle = scheduleNolock(&*begin, -1) || need_tickle;
-                ++begin;
-            }
-        }
-        if (need_tickle) {
-            tickle();
-        }
-    }
+    void schedule(InputIterator begin, InputIterator end);
+
+    /* 批量调度：一次加锁放入队列，按新任务的数量唤醒线程；提交后batch为空，容量保留 */
+    void schedule(TaskBatch &batch);
     void switchTo(int thread = -1);
     std::ostream &dump(std::ostream &os);
 
+    /* 是否使用工作窃取模式(每个线程一个本地队列) */
+    bool isWorkStealing() const {
+        return m_workStealing;
+    }
+
+    /**
+     * 设置之后新创建的任务协程是否运行在线程共享栈上
+     * 共享栈协程挂起时只占用实际用到的栈大小，但只能在第一次运行的线程上恢复
+     */
+    void setSharedStack(bool v) {
+        m_sharedStack = v;
+    }
+
+    /* 任务协程是否运行在线程共享栈上 */
+    bool isSharedStack() const {
+        return m_sharedStack;
+    }
+
+    /* 真正发出的唤醒次数(系统调用) */
+    uint64_t getTickleCount() const {
+        return m_tickleCount;
+    }
+
+    /* 从idle返回后没有找到任务的次数 */
+    uint64_t getEmptyWakeupCount() const {
+        return m_emptyWakeupCount;
+    }
+
+    /* 工作线程绑定的CPU；由配置 scheduler.cpus.<name> 决定，为空表示不绑定 */
+    const std::vector<int> &getCpus() const {
+        return m_cpus;
+    }
+
+    /* 工作线程的id，第i个线程绑定getCpus()[i % size]；不包括use_caller的调用线程(只在stop时参与调度) */
+    std::vector<int> getWorkerThreadIds() const {
+        return std::vector<int>(m_threadIds.begin() + (m_rootThread != -1 ? 1 : 0), m_threadIds.end());
+    }
+
+    /* function任务复用已结束协程的次数(包括线程上一个结束的协程) */
+    uint64_t getFiberPoolHits() const;
+
+    /* function任务需要创建新协程的次数 */
+    uint64_t getFiberPoolMisses() const;
+
+    /* 从同一个NUMA节点的线程窃取的任务数量 */
+    uint64_t getLocalStealCount() const {
+        return m_localStealCount;
+    }
+
+    /* 从其他NUMA节点的线程窃取的任务数量 */
+    uint64_t getRemoteStealCount() const {
+        return m_remoteStealCount;
+    }
+
+    /* 优先级类别priority中等待执行的任务数量 */
+    size_t getQueueDepth(Priority priority) const {
+        return m_queueDepth[priority];
+    }
+
+    /* 优先级类别priority已经开始执行的任务数量 */
+    uint64_t getDispatchCount(Priority priority) const;
+
+    /* 优先级类别priority的任务在队列中等待的平均时间(微秒) */
+    uint64_t getAvgWaitUs(Priority priority) const;
+
+    /* 优先级类别priority的任务在队列中等待时间的百分位数(微秒，按2的幂取上界)；percent为0~100 */
+    uint64_t getWaitPercentileUs(Priority priority, double percent) const;
+
 protected:
     /* 通知协程调度器有任务了；可以自定义调度器的执行方式(如何调度) */
     virtual void tickle();
 
+    /* 有count个新任务，唤醒最多count个空闲线程 */
+    virtual void tickle(size_t count);
+
+    /* 有指定在thread执行的任务；默认与tickle()相同，各线程有自己的等待点时只唤醒该线程 */
+    virtual void tickleThread(int thread);
+
     /* 协程调度函数 */
     void run();
 
@@ -93,6 +192,10 @@ protected:
     /* 协程无任务可以调度时，执行idle协程 */
     virtual void idle();
 
+    /* 由IO就绪唤醒的协程开始执行；latency_us为就绪到恢复执行的时间，在执行协程的线程中调用 */
+    virtual void onFiberReady(uint64_t latency_us) {
+    }
+
     /* 设置当前的协程调度器 */
     void setThis();
 
@@ -101,45 +204,121 @@ protected:
         return m_idleThreadCount > 0;
     }
 
+    /* 当前线程上次查找任务之后是否有新的任务加入；idle在睡眠之前检查，避免错过唤醒 */
+    bool hasNewTasks() const;
+
+    /* 当前线程在本调度器中的下标(与m_threadIds一致)；不是本调度器的线程返回-1 */
+    int getWorkerIndex() const;
+
 private:
-    /* 协程调度器启动(无锁)，将协程或者function加入调度器 */
-    template <class FiberOrCb>
-    bool scheduleNolock(FiberOrCb fc, int thread = -1) {
-        bool need_tickle = m_fibers.empty(); // 如果为空，唤醒线程
-        FiberAndThread ft(fc, thread);
-        if (ft.cb || ft.fiber) {    // 要么是协程，要么是函数指针
-            m_fibers.push_back(ft); // 加入等待执行的协程队列中
+    struct FiberAndThread;
+    struct WorkerQueue;
+
+    /* 协程调度器启动(无锁)，将协程或者function加入对应优先级的队列；返回是否需要tickle */
+    bool scheduleNolock(FiberAndThread &ft);
+
+    /* 按截止时间插入队列：有截止时间的任务排在没有截止时间的任务前面，按截止时间先后排列 */
+    template <class Queue>
+    static void InsertTask(Queue &tasks, FiberAndThread &ft) {
+        if (!ft.deadline) {
+            tasks.push_back(std::move(ft));
+            return;
+        }
+        auto it = tasks.begin();
+        while (it != tasks.end() && it->deadline && it->deadline <= ft.deadline) {
+            ++it;
         }
-        return need_tickle; // true表示以前是没有任务的，现在任务来了，去唤醒线程。在从协程队列中取出协程
+        tasks.insert(it, std::move(ft));
     }
 
+    /**
+     * 选择下一个执行的优先级类别；heads为各类别的队首任务，空队列为nullptr
+     * 依次考虑：快到期的截止时间 --> 等待过久的任务(防止饿死) --> 按权重轮询
+     */
+    int choosePriority(const FiberAndThread *const heads[PRIORITY_COUNT]);
+
+    /* 全局队列模式：从各优先级队列中取出一个当前线程可以执行的任务；调用者持有m_mutex */
+    bool fetchGlobalNolock(FiberAndThread &ft, bool &tickle_me);
+
+    /* 任务开始执行：更新队列深度和等待时间的统计；由IO就绪唤醒的协程调用onFiberReady */
+    void onDispatch(const FiberAndThread &ft);
+
+    /* 工作窃取模式：将任务放入当前线程(或指定线程)的本地队列；返回是否需要tickle */
+    bool scheduleLocal(FiberAndThread &ft);
+
+    /* 将任务无锁地放入队列的收件箱；协程使用内嵌节点，function需要分配节点 */
+    void pushInbox(WorkerQueue *queue, FiberAndThread &ft);
+
+    /* 将收件箱中的任务转移到本地队列；调用者需要持有queue->mutex(保证只有一个消费者) */
+    void drainInbox(WorkerQueue *queue);
+
+    /* 工作窃取模式：从本地队列取任务，取不到则从其他线程窃取 */
+    bool fetchLocal(FiberAndThread &ft, bool &tickle_me);
+
+    /* 从指定队列中取出一个可以执行的任务(跳过正在执行中的协程) */
+    bool popTask(std::deque<FiberAndThread> &tasks, FiberAndThread &ft);
+
+    /* 按优先级从本地队列中取出一个可以执行的任务 */
+    bool popPriorityTask(WorkerQueue *queue, FiberAndThread &ft);
+
+    /* 从其他线程的本地队列窃取一半任务；指定了线程的任务不会被窃取 */
+    bool steal(size_t self, FiberAndThread &ft, bool &tickle_me);
+
+    /* 返回线程id对应的本地队列下标，不存在返回-1 */
+    int queueIndexOf(int thread) const;
+
+    /* 从当前线程的协程池取出协程执行cb；池为空时创建 */
+    Fiber::ptr acquireFiber(Task &cb);
+
+    /* 已结束的协程放回当前线程的协程池；fiber被置空 */
+    void releaseFiber(Fiber::ptr &fiber);
+
+    /* 协程池超过 scheduler.fiber_pool.idle_ms 没有使用时释放到 scheduler.fiber_pool.keep 个 */
+    static void TrimFiberPool();
+
 private:
     struct FiberAndThread {
         // 协程
         Fiber::ptr fiber;
         // 协程执行函数
-        std::function<void()> cb;
+        Task cb;
         // 线程id
         int thread;
+        // 优先级类别
+        int priority = PRIORITY_NORMAL;
+        // 最晚开始执行的时间(单调时钟，微秒)，0表示没有
+        uint64_t deadline = 0;
+        // 入队时间(单调时钟，微秒)
+        uint64_t enqueueTime = 0;
 
-        /* 协程智能指针对象与线程 */
+        /* 协程智能指针对象与线程；共享栈协程只能回到绑定的线程执行 */
         FiberAndThread(Fiber::ptr f, int thr) :
             fiber(f), thread(thr) {
+            if (thread == -1 && fiber) {
+                thread = fiber->getHomeThread();
+            }
         }
         /* 协程智能指针对象的指针与线程 */
         FiberAndThread(Fiber::ptr *f, int thr) :
             thread(thr) {
             // swap后引用计数不会增加
             fiber.swap(*f);
+            if (thread == -1 && fiber) {
+                thread = fiber->getHomeThread();
+            }
         }
-        /* function与线程 */
-        FiberAndThread(std::function<void()> f, int thr) :
-            cb(f), thread(thr) {
+        /* 可调用对象与线程 */
+        FiberAndThread(Task f, int thr) :
+            cb(std::move(f)), thread(thr) {
         }
-        /* function指针与线程 */
+        /* function指针与线程；function被移走 */
         FiberAndThread(std::function<void()> *f, int thr) :
-            thread(thr) {
-            cb.swap(*f);
+            cb(std::move(*f)), thread(thr) {
+            *f = nullptr;
+        }
+        /* Task指针与线程；Task被移走 */
+        FiberAndThread(Task *f, int thr) :
+            cb(std::move(*f)), thread(thr) {
         }
         /* 无参构造 */
         FiberAndThread() :
@@ -150,20 +329,77 @@ private:
             fiber = nullptr;
             cb = nullptr;
             thread = -1;
+            priority = PRIORITY_NORMAL;
+            deadline = 0;
+        }
+        /* 入队前确定优先级、截止时间和入队时间；协程显式指定的优先级记录在协程上 */
+        void prepare(Priority prio, uint64_t deadline_ms) {
+            if (prio == PRIORITY_DEFAULT) {
+                priority = fiber ? fiber->getPriority() : PRIORITY_NORMAL;
+            } else {
+                priority = prio;
+                if (fiber) {
+                    fiber->setPriority(prio);
+                }
+            }
+            enqueueTime = GetMonotonicUS();
+            deadline = deadline_ms ? enqueueTime + deadline_ms * 1000 : 0;
         }
     };
 
+    /* 收件箱中的function任务节点 */
+    struct TaskNode : public Fiber::InboxNode {
+        FiberAndThread ft;
+    };
+
+    /**
+     * 工作窃取模式下每个线程持有的本地任务队列
+     * 其他线程(以及IO事件、定时器)调度协程时无锁地放入inbox，由持有mutex的线程转移到tasks/pinned
+     */
+    struct WorkerQueue {
+        typedef Spinlock MutexType;
+        MutexType mutex;
+        // 多生产者单消费者的收件箱；消费者为持有mutex的线程
+        MpscQueue inbox;
+        // 可以被其他线程窃取的任务；每个优先级类别一个队列
+        std::deque<FiberAndThread> tasks[PRIORITY_COUNT];
+        // 指定在该线程执行的任务，不会被窃取
+        std::deque<FiberAndThread> pinned;
+        // 所属线程所在的NUMA节点；线程启动时设置
+        std::atomic<int> node = {0};
+        // 所属线程的id；线程启动时写入，没有启动时为-1
+        std::atomic<int> thread = {-1};
+    };
+
 private:
     // 互斥锁
     MutexType m_mutex;
     // 线程池
     std::vector<Thread::ptr> m_threads;
-    // 待执行的协程队列；可以是协程也可以是function函数
-    std::list<FiberAndThread> m_fibers;
+    // 待执行的协程队列；可以是协程也可以是function函数。每个优先级类别一个队列
+    std::deque<FiberAndThread> m_fibers[PRIORITY_COUNT];
+    // 全局队列中的任务总数；m_mutex保护
+    size_t m_fiberCount = 0;
     // use_caller为true时，有效；用于调度协程
     Fiber::ptr m_rootFiber;
     // 协程调度器的名字
     std::string m_name;
+    // 是否使用工作窃取模式；构造时从配置 scheduler.work_stealing 读取
+    bool m_workStealing = false;
+    // 工作窃取模式下每个线程的本地队列；下标与m_threadIds一致
+    std::vector<WorkerQueue *> m_queues;
+    // 工作窃取模式下所有本地队列中的任务总数
+    std::atomic<size_t> m_taskCount = {0};
+    // 外部线程调度任务时轮询选择的队列
+    std::atomic<size_t> m_nextQueue = {0};
+    // 任务协程是否运行在线程共享栈上
+    std::atomic<bool> m_sharedStack = {false};
+    // 工作线程依次绑定的CPU
+    std::vector<int> m_cpus;
+    // 同一个NUMA节点内窃取的任务数量
+    std::atomic<uint64_t> m_localStealCount = {0};
+    // 跨NUMA节点窃取的任务数量
+    std::atomic<uint64_t> m_remoteStealCount = {0};
 
 protected:
     // 协程调度器包含的线程id
@@ -180,8 +416,104 @@ protected:
     bool m_autoStop = false;
     // 主线程id (use_caller)
     int m_rootThread = 0;
+    // 每加入一个任务加一；与线程上次查找任务时的值比较，判断是否有新任务
+    std::atomic<uint64_t> m_scheduleSeq = {0};
+    // 真正发出的唤醒次数
+    std::atomic<uint64_t> m_tickleCount = {0};
+    // 从idle返回后没有找到任务的次数
+    std::atomic<uint64_t> m_emptyWakeupCount = {0};
+
+private:
+    // 每个优先级类别队列中的任务数量；任何线程都可以入队，所以是共享的计数
+    std::atomic<size_t> m_queueDepth[PRIORITY_COUNT];
+
+    /* 每个线程的统计；只由该线程写入，读取时汇总 */
+    struct WorkerCounters {
+        // 每个优先级类别的等待时间(微秒)
+        Histogram wait[PRIORITY_COUNT];
+        // 协程池命中次数
+        std::atomic<uint64_t> fiberPoolHits = {0};
+        // 协程池未命中(创建新协程)次数
+        std::atomic<uint64_t> fiberPoolMisses = {0};
+    };
+    // 下标与m_threadIds一致；最后一个给不属于本调度器的线程使用
+    std::vector<WorkerCounters *> m_workerCounters;
+
+    /* 当前线程的统计 */
+    WorkerCounters *workerCounters() const;
 };
 
+/**
+ * 批量提交的任务
+ * 先在调用方收集任务(不加锁)，再通过Scheduler::schedule(TaskBatch &)一次放入队列
+ * 反复使用同一个batch时，保存任务的数组不会重新分配
+ */
+class Scheduler::TaskBatch : Noncopyable {
+    friend class Scheduler;
+
+public:
+    /* scheduler为批量提交的目标调度器 */
+    explicit TaskBatch(Scheduler *scheduler = nullptr) :
+        m_scheduler(scheduler) {
+    }
+
+    Scheduler *getScheduler() const {
+        return m_scheduler;
+    }
+
+    /* 提交到构造时指定的调度器 */
+    void submit() {
+        m_scheduler->schedule(*this);
+    }
+
+    /* 加入一个可调用对象 */
+    void add(Task cb, int thread = -1, Priority priority = PRIORITY_DEFAULT) {
+        m_tasks.push_back(FiberAndThread(std::move(cb), thread));
+        m_tasks.back().prepare(priority, 0);
+    }
+
+    /* 加入一个协程 */
+    void add(Fiber::ptr fiber, int thread = -1, Priority priority = PRIORITY_DEFAULT) {
+        m_tasks.push_back(FiberAndThread(fiber, thread));
+        m_tasks.back().prepare(priority, 0);
+    }
+
+    /* 移入一个可调用对象；function被置空(与Scheduler::schedule(&cb)相同) */
+    void add(std::function<void()> *cb, int thread = -1) {
+        m_tasks.push_back(FiberAndThread(cb, thread));
+        m_tasks.back().prepare(PRIORITY_DEFAULT, 0);
+    }
+
+    /* 移入一个协程；指针被置空 */
+    void add(Fiber::ptr *fiber, int thread = -1) {
+        m_tasks.push_back(FiberAndThread(fiber, thread));
+        m_tasks.back().prepare(PRIORITY_DEFAULT, 0);
+    }
+
+    size_t size() const {
+        return m_tasks.size();
+    }
+
+    bool empty() const {
+        return m_tasks.empty();
+    }
+
+private:
+    Scheduler *m_scheduler;
+    std::vector<FiberAndThread> m_tasks;
+};
+
+template <class InputIterator>
+void Scheduler::schedule(InputIterator begin, InputIterator end) {
+    TaskBatch batch;
+    while (begin != end) {
+        batch.m_tasks.push_back(FiberAndThread(&*begin, -1));
+        batch.m_tasks.back().prepare(PRIORITY_DEFAULT, 0);
+        ++begin;
+    }
+    schedule(batch);
+}
+
 class SchedulerSwitcher : public Noncopyable {
 public:
     SchedulerSwitcher(Scheduler *target = nullptr);
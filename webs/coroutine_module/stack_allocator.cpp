@@ -0,0 +1,225 @@
+#include "stack_allocator.h"
+#include "../log_module/log.h"
+#include "../config_module/config.h"
+#include "../util_module/macro.h"
+#include "../thread_module/affinity.h"
+
+#include <sys/mman.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <new>
+#include <unordered_map>
+#include <vector>
+
+namespace webs {
+
+static webs::Logger::ptr g_logger = WEBS_LOG_NAME("system");
+
+// 默认使用的栈分配器
+static webs::ConfigVar<std::string>::ptr g_fiber_stack_allocator =
+    webs::Config::Lookup<std::string>("fiber.stack_allocator", "mmap_pool", "fiber stack allocator: malloc / mmap_pool");
+// 每个线程缓存的空闲栈数量上限；超过后释放到低水位
+static webs::ConfigVar<uint32_t>::ptr g_stack_pool_high_watermark =
+    webs::Config::Lookup<uint32_t>("fiber.stack_pool.high_watermark", 64, "max cached fiber stacks per thread");
+// 释放缓存时保留的空闲栈数量
+static webs::ConfigVar<uint32_t>::ptr g_stack_pool_low_watermark =
+    webs::Config::Lookup<uint32_t>("fiber.stack_pool.low_watermark", 16, "cached fiber stacks kept per thread after trim");
+
+static MallocStackAllocator s_malloc_allocator;
+static PooledStackAllocator s_pooled_allocator;
+static std::atomic<StackAllocator *> s_default_allocator = {nullptr};
+
+static std::atomic<uint32_t> s_high_watermark = {64};
+static std::atomic<uint32_t> s_low_watermark = {16};
+static std::atomic<uint64_t> s_pool_hits = {0};
+static std::atomic<uint64_t> s_pool_misses = {0};
+
+/* 根据名字返回内置的分配器 */
+static StackAllocator *AllocatorFromName(const std::string &name) {
+    if (name == "malloc") {
+        return &s_malloc_allocator;
+    }
+    if (name != "mmap_pool") {
+        WEBS_LOG_ERROR(g_logger) << "unknown fiber.stack_allocator = " << name << ", use mmap_pool";
+    }
+    return &s_pooled_allocator;
+}
+
+/* 在main之前读取配置并监听变化 */
+struct _StackAllocatorIniter {
+    _StackAllocatorIniter() {
+        s_default_allocator = AllocatorFromName(g_fiber_stack_allocator->getValue());
+        s_high_watermark = g_stack_pool_high_watermark->getValue();
+        s_low_watermark = g_stack_pool_low_watermark->getValue();
+        g_fiber_stack_allocator->addListener([](const std::string &old_value, const std::string &new_value) {
+            WEBS_LOG_INFO(g_logger) << "fiber stack allocator changed from " << old_value << " to " << new_value;
+            s_default_allocator = AllocatorFromName(new_value);
+        });
+        g_stack_pool_high_watermark->addListener([](const uint32_t &old_value, const uint32_t &new_value) {
+            s_high_watermark = new_value;
+        });
+        g_stack_pool_low_watermark->addListener([](const uint32_t &old_value, const uint32_t &new_value) {
+            s_low_watermark = new_value;
+        });
+    }
+};
+
+static _StackAllocatorIniter s_stack_allocator_initer;
+
+StackAllocator *StackAllocator::GetDefault() {
+    StackAllocator *allocator = s_default_allocator;
+    return allocator ? allocator : &s_pooled_allocator;
+}
+
+void StackAllocator::SetDefault(StackAllocator *allocator) {
+    s_default_allocator = allocator ? allocator : &s_pooled_allocator;
+}
+
+void *MallocStackAllocator::alloc(size_t size) {
+    void *vp = malloc(size);
+    if (!vp) {
+        throw std::bad_alloc();
+    }
+    return vp;
+}
+
+void MallocStackAllocator::dealloc(void *vp, size_t size) {
+    free(vp);
+}
+
+/* 页大小 */
+static size_t PageSize() {
+    static size_t s_page = sysconf(_SC_PAGESIZE);
+    return s_page;
+}
+
+/* 按页对齐 */
+static size_t RoundToPage(size_t size) {
+    size_t page = PageSize();
+    return (size + page - 1) / page * page;
+}
+
+/* 释放一个mmap栈(包括保护页) */
+static void UnmapStack(void *vp, size_t size) {
+    size_t page = PageSize();
+    if (munmap((char *)vp - page, size + page)) {
+        WEBS_LOG_ERROR(g_logger) << "munmap fiber stack fail errno = " << errno << " errstr = " << strerror(errno);
+    }
+}
+
+/* 线程缓存的空闲栈；线程退出时释放 */
+struct StackCache {
+    // 栈大小(按页对齐) --> 空闲栈
+    std::unordered_map<size_t, std::vector<void *>> stacks;
+    // 缓存的栈总数
+    size_t count = 0;
+
+    /* 释放缓存直到只剩keep个栈 */
+    void trim(size_t keep) {
+        for (auto &i : stacks) {
+            while (count > keep && !i.second.empty()) {
+                UnmapStack(i.second.back(), i.first);
+                i.second.pop_back();
+                --count;
+            }
+        }
+    }
+};
+
+/**
+ * 线程缓存放在堆上，指针本身没有析构函数
+ * 协程池、主协程等线程局部变量与缓存的析构顺序不确定，缓存释放之后归还的栈直接munmap
+ */
+static thread_local StackCache *t_stack_cache = nullptr;
+// 线程退出时缓存已经释放
+static thread_local bool t_stack_cache_released = false;
+
+/* 线程退出时释放缓存的栈 */
+struct StackCacheReleaser {
+    ~StackCacheReleaser() {
+        if (t_stack_cache) {
+            t_stack_cache->trim(0);
+            delete t_stack_cache;
+            t_stack_cache = nullptr;
+        }
+        t_stack_cache_released = true;
+    }
+};
+
+/* 返回当前线程的缓存；线程退出过程中返回nullptr */
+static StackCache *GetStackCache() {
+    if (!t_stack_cache && !t_stack_cache_released) {
+        static thread_local StackCacheReleaser s_releaser;
+        t_stack_cache = new StackCache;
+    }
+    return t_stack_cache;
+}
+
+/* 优先复用线程缓存中的栈；否则mmap一个新栈，并把最低的一页设置为保护页 */
+void *PooledStackAllocator::alloc(size_t size) {
+    size = RoundToPage(size);
+    StackCache *cache = GetStackCache();
+    if (cache) {
+        auto it = cache->stacks.find(size);
+        if (it != cache->stacks.end() && !it->second.empty()) {
+            void *vp = it->second.back();
+            it->second.pop_back();
+            --cache->count;
+            s_pool_hits.fetch_add(1, std::memory_order_relaxed);
+            return vp;
+        }
+    }
+    s_pool_misses.fetch_add(1, std::memory_order_relaxed);
+
+    size_t page = PageSize();
+    void *base = mmap(nullptr, size + page, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+    if (base == MAP_FAILED) {
+        WEBS_LOG_ERROR(g_logger) << "mmap fiber stack fail size = " << size
+                                 << " errno = " << errno << " errstr = " << strerror(errno);
+        throw std::bad_alloc();
+    }
+    // 线程缓存的栈只在本线程复用，从当前线程所在的NUMA节点分配
+    BindMemoryToNode(base, size + page, GetThreadNode());
+    // 栈向低地址增长，保护页放在最低地址
+    if (mprotect(base, page, PROT_NONE)) {
+        WEBS_LOG_ERROR(g_logger) << "mprotect guard page fail errno = " << errno << " errstr = " << strerror(errno);
+        munmap(base, size + page);
+        throw std::bad_alloc();
+    }
+    return (char *)base + page;
+}
+
+/* 放回线程缓存；超过高水位时释放到低水位 */
+void PooledStackAllocator::dealloc(void *vp, size_t size) {
+    size = RoundToPage(size);
+    StackCache *cache = GetStackCache();
+    if (!cache) {
+        UnmapStack(vp, size);
+        return;
+    }
+    cache->stacks[size].push_back(vp);
+    ++cache->count;
+    uint32_t high = s_high_watermark;
+    if (cache->count > high) {
+        uint32_t low = s_low_watermark;
+        cache->trim(low < high ? low : high);
+    }
+}
+
+uint64_t PooledStackAllocator::GetHits() {
+    return s_pool_hits;
+}
+
+uint64_t PooledStackAllocator::GetMisses() {
+    return s_pool_misses;
+}
+
+void PooledStackAllocator::Trim() {
+    if (t_stack_cache) {
+        t_stack_cache->trim(0);
+    }
+}
+
+} // namespace webs
@@ -0,0 +1,72 @@
+/**
+ * 协程运行栈的分配器
+ * 默认使用带保护页的mmap栈，并在每个线程缓存释放的栈，避免频繁创建/销毁协程时反复申请内存
+*/
+#ifndef __WEBS_STACK_ALLOCATOR_H__
+#define __WEBS_STACK_ALLOCATOR_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <string>
+
+namespace webs {
+
+/* 协程栈分配器接口；可以通过SetDefault替换为自定义的实现 */
+class StackAllocator {
+public:
+    virtual ~StackAllocator() {
+    }
+
+    /* 分配size大小的栈，返回栈的低地址 */
+    virtual void *alloc(size_t size) = 0;
+
+    /* 释放栈；size与alloc时相同 */
+    virtual void dealloc(void *vp, size_t size) = 0;
+
+    /* 分配器的名字 */
+    virtual const char *getName() const = 0;
+
+    /* 返回当前默认的栈分配器；由配置 fiber.stack_allocator 决定(malloc / mmap_pool) */
+    static StackAllocator *GetDefault();
+
+    /* 设置默认的栈分配器；分配器的生命周期需要由调用者保证 */
+    static void SetDefault(StackAllocator *allocator);
+};
+
+/* 使用malloc分配栈，没有保护页 */
+class MallocStackAllocator : public StackAllocator {
+public:
+    void *alloc(size_t size) override;
+    void dealloc(void *vp, size_t size) override;
+    const char *getName() const override {
+        return "malloc";
+    }
+};
+
+/**
+ * mmap分配的栈 + 每个线程的空闲栈缓存
+ * 每个栈的最低地址有一个PROT_NONE的保护页，栈溢出时直接触发SIGSEGV，而不是悄悄写坏堆内存
+ * 线程缓存的栈数量超过高水位(fiber.stack_pool.high_watermark)时，释放到低水位(fiber.stack_pool.low_watermark)
+ */
+class PooledStackAllocator : public StackAllocator {
+public:
+    void *alloc(size_t size) override;
+    void dealloc(void *vp, size_t size) override;
+    const char *getName() const override {
+        return "mmap_pool";
+    }
+
+    /* 从线程缓存中分配的次数 */
+    static uint64_t GetHits();
+
+    /* 需要mmap新栈的次数 */
+    static uint64_t GetMisses();
+
+    /* 释放当前线程缓存的所有栈 */
+    static void Trim();
+};
+
+} // namespace webs
+
+#endif
@@ -0,0 +1,186 @@
+/**
+ * 调度器中保存的可调用对象
+ * 与std::function<void()>相比只能移动不能拷贝；不超过INLINE_SIZE的可调用对象直接保存在对象内部，不分配内存
+ * 移动进调度队列、从队列移动到协程都不会分配内存
+*/
+#ifndef __WEBS_TASK_H__
+#define __WEBS_TASK_H__
+
+#include <stddef.h>
+#include <cstddef>
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace webs {
+
+class Task {
+public:
+    // 内部缓冲区大小；可以放下std::function以及捕获了几个指针的lambda
+    static const size_t INLINE_SIZE = 48;
+
+    Task() noexcept {
+    }
+
+    Task(std::nullptr_t) noexcept {
+    }
+
+    /* 可以以f()方式调用的对象；空的std::function和空函数指针得到空任务 */
+    template <class F,
+              class Fn = typename std::decay<F>::type,
+              class = typename std::enable_if<!std::is_same<Fn, Task>::value>::type,
+              class = decltype(std::declval<Fn &>()())>
+    Task(F &&f) {
+        if (IsEmpty(f)) {
+            return;
+        }
+        init<Fn>(std::forward<F>(f), std::integral_constant<bool, IsInline<Fn>()>());
+    }
+
+    Task(Task &&other) noexcept {
+        moveFrom(other);
+    }
+
+    Task &operator=(Task &&other) noexcept {
+        if (this != &other) {
+            clear();
+            moveFrom(other);
+        }
+        return *this;
+    }
+
+    Task &operator=(std::nullptr_t) noexcept {
+        clear();
+        return *this;
+    }
+
+    Task(const Task &) = delete;
+    Task &operator=(const Task &) = delete;
+
+    ~Task() {
+        clear();
+    }
+
+    void operator()() {
+        m_ops->invoke(m_buffer);
+    }
+
+    explicit operator bool() const {
+        return m_ops != nullptr;
+    }
+
+    void swap(Task &other) noexcept {
+        Task tmp(std::move(other));
+        other = std::move(*this);
+        *this = std::move(tmp);
+    }
+
+    /* 是否保存在内部缓冲区中(没有分配内存) */
+    bool isInline() const {
+        return m_ops && m_ops->inlined;
+    }
+
+private:
+    /* 可调用对象的操作表 */
+    struct Ops {
+        void (*invoke)(void *buf);
+        // 从src移动到dst，并析构src中的对象
+        void (*relocate)(void *dst, void *src);
+        void (*destroy)(void *buf);
+        bool inlined;
+    };
+
+    template <class Fn>
+    static constexpr bool IsInline() {
+        return sizeof(Fn) <= INLINE_SIZE && alignof(Fn) <= alignof(std::max_align_t)
+               && std::is_nothrow_move_constructible<Fn>::value;
+    }
+
+    template <class Fn>
+    static bool IsEmpty(const Fn &) {
+        return false;
+    }
+
+    static bool IsEmpty(const std::function<void()> &f) {
+        return !f;
+    }
+
+    template <class R, class... Args>
+    static bool IsEmpty(R (*const &f)(Args...)) {
+        return f == nullptr;
+    }
+
+    /* 保存在内部缓冲区 */
+    template <class Fn>
+    struct InlineOps {
+        static void Invoke(void *buf) {
+            (*(Fn *)buf)();
+        }
+        static void Relocate(void *dst, void *src) {
+            new (dst) Fn(std::move(*(Fn *)src));
+            ((Fn *)src)->~Fn();
+        }
+        static void Destroy(void *buf) {
+            ((Fn *)buf)->~Fn();
+        }
+        static const Ops *Get() {
+            static const Ops s_ops = {&Invoke, &Relocate, &Destroy, true};
+            return &s_ops;
+        }
+    };
+
+    /* 内部缓冲区放不下，分配在堆上，缓冲区中保存指针 */
+    template <class Fn>
+    struct HeapOps {
+        static void Invoke(void *buf) {
+            (**(Fn **)buf)();
+        }
+        static void Relocate(void *dst, void *src) {
+            *(Fn **)dst = *(Fn **)src;
+        }
+        static void Destroy(void *buf) {
+            delete *(Fn **)buf;
+        }
+        static const Ops *Get() {
+            static const Ops s_ops = {&Invoke, &Relocate, &Destroy, false};
+            return &s_ops;
+        }
+    };
+
+    template <class Fn, class F>
+    void init(F &&f, std::true_type) {
+        new (m_buffer) Fn(std::forward<F>(f));
+        m_ops = InlineOps<Fn>::Get();
+    }
+
+    template <class Fn, class F>
+    void init(F &&f, std::false_type) {
+        *(Fn **)m_buffer = new Fn(std::forward<F>(f));
+        m_ops = HeapOps<Fn>::Get();
+    }
+
+    void moveFrom(Task &other) noexcept {
+        if (other.m_ops) {
+            other.m_ops->relocate(m_buffer, other.m_buffer);
+            m_ops = other.m_ops;
+            other.m_ops = nullptr;
+        }
+    }
+
+    void clear() noexcept {
+        if (m_ops) {
+            const Ops *ops = m_ops;
+            m_ops = nullptr;
+            ops->destroy(m_buffer);
+        }
+    }
+
+private:
+    const Ops *m_ops = nullptr;
+    alignas(std::max_align_t) unsigned char m_buffer[INLINE_SIZE];
+};
+
+} // namespace webs
+
+#endif
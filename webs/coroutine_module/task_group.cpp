@@ -0,0 +1,214 @@
+#include "task_group.h"
+#include "../log_module/log.h"
+#include "../util_module/macro.h"
+#include "../util_module/util.h"
+
+#include <deque>
+#include <vector>
+
+namespace webs {
+
+static webs::Logger::ptr g_logger = WEBS_LOG_NAME("system");
+
+/* TaskGroup与其中的任务共享的状态 */
+class TaskGroupState {
+public:
+    FiberWaitQueue::MutexType mutex;
+    // 等待joinAll/joinAny的协程
+    FiberWaitQueue waiters;
+    std::vector<TaskState::ptr> tasks;
+    // 已经结束的任务数量
+    size_t finished = 0;
+    // 已经结束、还没有被joinAny返回的任务下标，按完成顺序
+    std::deque<size_t> completed;
+    // 第一个异常
+    std::exception_ptr error;
+    bool cancelled = false;
+    bool cancelOnError = true;
+};
+
+/* 是否是任务被取消产生的异常 */
+static bool IsCancelled(const std::exception_ptr &error) {
+    try {
+        std::rethrow_exception(error);
+    } catch (const TaskCancelled &) {
+        return true;
+    } catch (...) {
+        return false;
+    }
+}
+
+/* 取消组内所有任务；在锁外调用中断函数 */
+static void CancelGroup(TaskGroupState &group) {
+    std::vector<TaskState::ptr> tasks;
+    {
+        FiberWaitQueue::MutexType::Lock lock(group.mutex);
+        group.cancelled = true;
+        tasks = group.tasks;
+    }
+    for (auto &i : tasks) {
+        i->cancel();
+    }
+}
+
+/* 等待直到pred成立；timeout_ms为~0ull表示一直等待，超时返回false。调用者持有锁 */
+template <class Pred>
+static bool WaitUntil(TaskGroupState &group, FiberWaitQueue::MutexType::Lock &lock, uint64_t timeout_ms, Pred pred) {
+    uint64_t deadline = timeout_ms == ~0ull ? ~0ull : GetMonotonicMS() + timeout_ms;
+    while (!pred()) {
+        uint64_t wait = ~0ull;
+        if (deadline != ~0ull) {
+            uint64_t now = GetMonotonicMS();
+            if (now >= deadline) {
+                return false;
+            }
+            wait = deadline - now;
+        }
+        group.waiters.wait(lock, wait);
+    }
+    return true;
+}
+
+TaskState::TaskState() :
+    m_token(new CancelToken) {
+}
+
+bool TaskState::isDone() {
+    FiberWaitQueue::MutexType::Lock lock(m_mutex);
+    return m_done;
+}
+
+void TaskState::wait() {
+    FiberWaitQueue::MutexType::Lock lock(m_mutex);
+    while (!m_done) {
+        m_waiters.wait(lock);
+    }
+}
+
+bool TaskState::waitFor(uint64_t timeout_ms) {
+    FiberWaitQueue::MutexType::Lock lock(m_mutex);
+    if (!m_done) {
+        m_waiters.wait(lock, timeout_ms);
+    }
+    return m_done;
+}
+
+std::exception_ptr TaskState::getError() {
+    FiberWaitQueue::MutexType::Lock lock(m_mutex);
+    return m_error;
+}
+
+/* 先唤醒等待该任务的协程，再通知TaskGroup；第一个异常按配置取消其他任务 */
+void TaskState::finish(std::exception_ptr error) {
+    {
+        FiberWaitQueue::MutexType::Lock lock(m_mutex);
+        m_done = true;
+        m_error = error;
+        m_waiters.notifyAll();
+    }
+    std::shared_ptr<TaskGroupState> group = m_group.lock();
+    if (!group) {
+        return;
+    }
+    bool cancel_others = false;
+    {
+        FiberWaitQueue::MutexType::Lock lock(group->mutex);
+        ++group->finished;
+        group->completed.push_back(m_index);
+        if (error && !group->error && !IsCancelled(error)) {
+            group->error = error;
+            cancel_others = group->cancelOnError && !group->cancelled;
+        }
+        group->waiters.notifyAll();
+    }
+    if (cancel_others) {
+        CancelGroup(*group);
+    }
+}
+
+TaskGroup::TaskGroup(Scheduler *scheduler, bool cancel_on_error) :
+    m_scheduler(scheduler ? scheduler : Scheduler::GetThis()),
+    m_state(new TaskGroupState) {
+    WEBS_ASSERT2(m_scheduler, "TaskGroup needs a scheduler");
+    m_state->cancelOnError = cancel_on_error;
+}
+
+/* 协程中取消并等待；不在调度器的协程中无法挂起，取消之后分离，任务结束时通过weak_ptr发现TaskGroup已经释放 */
+TaskGroup::~TaskGroup() {
+    cancel();
+    if (!Scheduler::GetThis() || Fiber::GetThis().get() == Scheduler::GetMainFiber()) {
+        size_t running = size() - getFinishedCount();
+        if (running) {
+            WEBS_LOG_WARN(g_logger) << "TaskGroup destroyed outside a scheduler fiber, detach " << running << " running tasks";
+        }
+        return;
+    }
+    joinAllFor(~0ull);
+}
+
+void TaskGroup::add(const TaskState::ptr &state) {
+    FiberWaitQueue::MutexType::Lock lock(m_state->mutex);
+    state->m_group = m_state;
+    state->m_index = m_state->tasks.size();
+    m_state->tasks.push_back(state);
+    if (m_state->cancelled) {
+        state->cancel();
+    }
+}
+
+void TaskGroup::joinAll() {
+    joinAllFor(~0ull);
+    std::exception_ptr error = getError();
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+bool TaskGroup::joinAllFor(uint64_t timeout_ms) {
+    TaskGroupState &group = *m_state;
+    FiberWaitQueue::MutexType::Lock lock(group.mutex);
+    return WaitUntil(group, lock, timeout_ms, [&group]() {
+        return group.finished == group.tasks.size();
+    });
+}
+
+int TaskGroup::joinAny(uint64_t timeout_ms) {
+    TaskGroupState &group = *m_state;
+    FiberWaitQueue::MutexType::Lock lock(group.mutex);
+    // 有结束的任务，或者所有任务都已经返回过
+    bool rt = WaitUntil(group, lock, timeout_ms, [&group]() {
+        return !group.completed.empty() || group.finished == group.tasks.size();
+    });
+    if (!rt || group.completed.empty()) {
+        return -1;
+    }
+    size_t index = group.completed.front();
+    group.completed.pop_front();
+    return (int)index;
+}
+
+void TaskGroup::cancel() {
+    CancelGroup(*m_state);
+}
+
+bool TaskGroup::isCancelled() {
+    FiberWaitQueue::MutexType::Lock lock(m_state->mutex);
+    return m_state->cancelled;
+}
+
+size_t TaskGroup::size() {
+    FiberWaitQueue::MutexType::Lock lock(m_state->mutex);
+    return m_state->tasks.size();
+}
+
+size_t TaskGroup::getFinishedCount() {
+    FiberWaitQueue::MutexType::Lock lock(m_state->mutex);
+    return m_state->finished;
+}
+
+std::exception_ptr TaskGroup::getError() {
+    FiberWaitQueue::MutexType::Lock lock(m_state->mutex);
+    return m_state->error;
+}
+
+} // namespace webs
@@ -0,0 +1,242 @@
+/**
+ * 结构化并发：TaskGroup与Future
+ * TaskGroup::spawn在调度器中启动一个任务协程并返回Future；joinAll等待全部完成，joinAny按完成顺序逐个返回
+ * 取消是协作式的：任务协程绑定了CancelToken，被取消后阻塞在hook的IO、sleep、带超时的同步等待中会立即返回(ECANCELED)
+ * 不带超时的Channel push/pop、FiberMutex::lock等等待不会被取消打断，任务需要等到它们返回之后才能结束
+ * TaskGroup在协程中析构时取消并等待所有任务，任务不会比TaskGroup活得更久；在协程之外析构时只取消，不等待(任务被分离)
+ * 等待操作会挂起当前协程，只能在调度器的协程中使用；带超时的等待需要IOManager
+*/
+#ifndef __WEBS_TASK_GROUP_H__
+#define __WEBS_TASK_GROUP_H__
+
+#include <stdint.h>
+#include <exception>
+#include <memory>
+#include <stdexcept>
+#include <type_traits>
+#include "scheduler.h"
+#include "fiber_sync.h"
+#include "cancel_token.h"
+#include "../util_module/Noncopyable.h"
+
+namespace webs {
+
+/* 任务在开始执行之前被取消，Future::get抛出该异常 */
+class TaskCancelled : public std::runtime_error {
+public:
+    TaskCancelled() :
+        std::runtime_error("task cancelled") {
+    }
+};
+
+class TaskGroupState;
+
+/* 任务的状态中与结果类型无关的部分 */
+class TaskState : Noncopyable {
+    friend class TaskGroup;
+
+public:
+    typedef std::shared_ptr<TaskState> ptr;
+
+    TaskState();
+
+    virtual ~TaskState() {
+    }
+
+    /* 任务是否已经结束(正常返回、抛出异常或者被取消) */
+    bool isDone();
+
+    /* 等待任务结束 */
+    void wait();
+
+    /* 最多等待timeout_ms；返回false表示超时 */
+    bool waitFor(uint64_t timeout_ms);
+
+    /* 取消任务 */
+    void cancel() {
+        m_token->cancel();
+    }
+
+    /* 任务抛出的异常；没有异常返回空 */
+    std::exception_ptr getError();
+
+protected:
+    /* 在任务协程中执行f：绑定取消标记、捕获异常、结束后唤醒等待者并通知所属的TaskGroup */
+    template <class F>
+    void run(F &f) {
+        CancelToken::SetCurrent(m_token);
+        std::exception_ptr error;
+        if (m_token->isCancelled()) {
+            error = std::make_exception_ptr(TaskCancelled());
+        } else {
+            try {
+                f();
+            } catch (...) {
+                error = std::current_exception();
+            }
+        }
+        CancelToken::SetCurrent(nullptr);
+        finish(error);
+    }
+
+private:
+    void finish(std::exception_ptr error);
+
+private:
+    FiberWaitQueue::MutexType m_mutex;
+    FiberWaitQueue m_waiters;
+    bool m_done = false;
+    std::exception_ptr m_error;
+    CancelToken::ptr m_token;
+    // 所属的TaskGroup以及在其中的下标；TaskGroup析构时等待所有任务，不会先于任务释放
+    std::weak_ptr<TaskGroupState> m_group;
+    size_t m_index = 0;
+};
+
+/* 保存类型为T的结果 */
+template <class T>
+class FutureState : public TaskState {
+public:
+    typedef std::shared_ptr<FutureState> ptr;
+
+    /* 在任务协程中执行f并保存结果 */
+    template <class F>
+    void start(F &f) {
+        auto cb = [this, &f]() {
+            m_value.reset(new T(f()));
+        };
+        run(cb);
+    }
+
+    T &get() {
+        return *m_value;
+    }
+
+private:
+    std::unique_ptr<T> m_value;
+};
+
+template <>
+class FutureState<void> : public TaskState {
+public:
+    typedef std::shared_ptr<FutureState> ptr;
+
+    template <class F>
+    void start(F &f) {
+        run(f);
+    }
+
+    void get() {
+    }
+};
+
+/* 任务的结果；可以拷贝，多个Future共享同一个状态 */
+template <class T>
+class Future {
+public:
+    Future() {
+    }
+
+    explicit Future(typename FutureState<T>::ptr state) :
+        m_state(state) {
+    }
+
+    bool valid() const {
+        return m_state != nullptr;
+    }
+
+    bool isDone() {
+        return m_state->isDone();
+    }
+
+    void wait() {
+        m_state->wait();
+    }
+
+    bool waitFor(uint64_t timeout_ms) {
+        return m_state->waitFor(timeout_ms);
+    }
+
+    void cancel() {
+        m_state->cancel();
+    }
+
+    /* 等待任务结束并返回结果；任务抛出了异常(或者被取消没有执行)时重新抛出 */
+    typename std::add_lvalue_reference<T>::type get() {
+        m_state->wait();
+        std::exception_ptr error = m_state->getError();
+        if (error) {
+            std::rethrow_exception(error);
+        }
+        return m_state->get();
+    }
+
+private:
+    typename FutureState<T>::ptr m_state;
+};
+
+/**
+ * 一组任务
+ * cancel_on_error为true时，第一个任务抛出异常后取消其他任务(扇出请求时不再浪费后端资源)
+ */
+class TaskGroup : Noncopyable {
+public:
+    /* scheduler为nullptr时使用当前线程的调度器 */
+    explicit TaskGroup(Scheduler *scheduler = nullptr, bool cancel_on_error = true);
+
+    /**
+     * 取消并等待还没有结束的任务；阻塞在不可取消的等待上的任务会让析构一直等待
+     * 不在调度器的协程中时无法等待，取消之后分离还没有结束的任务
+     */
+    ~TaskGroup();
+
+    /* 在调度器中启动一个任务协程；TaskGroup已经取消时任务不会执行 */
+    template <class F>
+    Future<typename std::result_of<F()>::type> spawn(F f) {
+        typedef typename std::result_of<F()>::type R;
+        typename FutureState<R>::ptr state(new FutureState<R>);
+        add(state);
+        m_scheduler->schedule([state, f]() mutable {
+            state->start(f);
+        });
+        return Future<R>(state);
+    }
+
+    /* 等待所有任务结束；有任务抛出异常时重新抛出第一个异常 */
+    void joinAll();
+
+    /* 最多等待timeout_ms；返回false表示超时。不抛出异常，通过getError获取 */
+    bool joinAllFor(uint64_t timeout_ms);
+
+    /**
+     * 按完成顺序返回一个已经结束、还没有被joinAny返回过的任务下标(spawn的顺序，从0开始)
+     * 没有这样的任务时等待；所有任务都已经返回过或者超时返回-1
+     */
+    int joinAny(uint64_t timeout_ms = ~0ull);
+
+    /* 取消所有任务，之后spawn的任务也不会执行 */
+    void cancel();
+
+    /* 是否已经取消 */
+    bool isCancelled();
+
+    /* spawn的任务数量 */
+    size_t size();
+
+    /* 已经结束的任务数量 */
+    size_t getFinishedCount();
+
+    /* 第一个抛出的异常(不包括TaskCancelled)；没有返回空 */
+    std::exception_ptr getError();
+
+private:
+    void add(const TaskState::ptr &state);
+
+private:
+    Scheduler *m_scheduler;
+    std::shared_ptr<TaskGroupState> m_state;
+};
+
+} // namespace webs
+
+#endif
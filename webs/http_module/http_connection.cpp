@@ -301,7 +301,7 @@ HttpConnectionPool::ptr HttpConnectionPool::Create(const std::string &uri, const
 /* 检查连接池中是否有可重用的连接 -- 找到一个处于连接状态的h_connection -- 释放已经关闭连接的指针 -- ptr如果不存在 -- 重新建立连接 -- 返回连接对象 */
 HttpConnection::ptr HttpConnectionPool::getConnection() {
     std::vector<HttpConnection *> invalid_connect;
-    uint64_t ms = webs::GetCurrentMS();
+    uint64_t ms = webs::CoarseClock::NowMS();
     Mutex::Lock lock(m_mutex);
     HttpConnection *connect_tmp = nullptr;
     while (!m_conns.empty()) {
@@ -344,6 +344,7 @@ HttpConnection::ptr HttpConnectionPool::getConnection() {
             return nullptr;
         }
         connect_tmp = new HttpConnection(socket);
+        connect_tmp->m_createTime = webs::CoarseClock::NowMS();
         ++m_total;
     }
     // 绑定一个接受 HttpConnection * 参数的 动态对象释放函数
@@ -354,7 +355,7 @@ HttpConnection::ptr HttpConnectionPool::getConnection() {
 
 void HttpConnectionPool::ReleasePtr(HttpConnection *ptr, HttpConnectionPool *pool) {
     ++ptr->m_request;
-    if (!ptr->isConnected() || (ptr->m_createTime + pool->m_maxAliveTime) < webs::GetCurrentMS() || ptr->m_request > pool->m_maxRequest) {
+    if (!ptr->isConnected() || (ptr->m_createTime + pool->m_maxAliveTime) < webs::CoarseClock::NowMS() || ptr->m_request > pool->m_maxRequest) {
         delete ptr;
         --pool->m_total;
         return;
@@ -0,0 +1,175 @@
+#include "io_uring.h"
+
+#ifdef WEBS_HAVE_IO_URING
+
+#include "../log_module/log.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <vector>
+
+namespace webs {
+
+static webs::Logger::ptr g_logger = WEBS_LOG_NAME("system");
+
+IoUring::IoUring() {
+    memset(m_supported, 0, sizeof(m_supported));
+}
+
+IoUring::~IoUring() {
+    if (m_sqes) {
+        munmap(m_sqes, m_sqesSize);
+    }
+    if (m_cqRing && m_cqRing != m_sqRing) {
+        munmap(m_cqRing, m_cqRingSize);
+    }
+    if (m_sqRing) {
+        munmap(m_sqRing, m_sqRingSize);
+    }
+    if (m_fd >= 0) {
+        close(m_fd);
+    }
+}
+
+bool IoUring::init(uint32_t entries) {
+#ifdef __NR_io_uring_setup
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CLAMP;
+    m_fd = syscall(__NR_io_uring_setup, entries, &params);
+    if (m_fd < 0) {
+        WEBS_LOG_INFO(g_logger) << "io_uring_setup(" << entries << ") fail, errno = " << errno
+                                << " errstr = " << strerror(errno);
+        return false;
+    }
+    // 需要sockets的内部poll(FAST_POLL，5.7)与完成队列不丢弃(NODROP)
+    uint32_t need = IORING_FEAT_FAST_POLL | IORING_FEAT_NODROP;
+    if ((params.features & need) != need) {
+        WEBS_LOG_INFO(g_logger) << "io_uring features = " << params.features << " lack FAST_POLL or NODROP";
+        return false;
+    }
+
+    m_sqRingSize = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+    m_cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single && m_cqRingSize > m_sqRingSize) {
+        m_sqRingSize = m_cqRingSize;
+    }
+    m_sqRing = mmap(nullptr, m_sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING);
+    if (m_sqRing == MAP_FAILED) {
+        m_sqRing = nullptr;
+        return false;
+    }
+    if (single) {
+        m_cqRing = m_sqRing;
+        m_cqRingSize = m_sqRingSize;
+    } else {
+        m_cqRing = mmap(nullptr, m_cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_CQ_RING);
+        if (m_cqRing == MAP_FAILED) {
+            m_cqRing = nullptr;
+            return false;
+        }
+    }
+    m_sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    m_sqes = (io_uring_sqe *)mmap(nullptr, m_sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQES);
+    if (m_sqes == MAP_FAILED) {
+        m_sqes = nullptr;
+        return false;
+    }
+
+    char *sq = (char *)m_sqRing;
+    m_sqHead = (uint32_t *)(sq + params.sq_off.head);
+    m_sqTail = (uint32_t *)(sq + params.sq_off.tail);
+    m_sqArray = (uint32_t *)(sq + params.sq_off.array);
+    m_sqMask = *(uint32_t *)(sq + params.sq_off.ring_mask);
+    m_sqEntries = *(uint32_t *)(sq + params.sq_off.ring_entries);
+    char *cq = (char *)m_cqRing;
+    m_cqHead = (uint32_t *)(cq + params.cq_off.head);
+    m_cqTail = (uint32_t *)(cq + params.cq_off.tail);
+    m_cqes = (io_uring_cqe *)(cq + params.cq_off.cqes);
+    m_cqMask = *(uint32_t *)(cq + params.cq_off.ring_mask);
+
+    // 查询支持的操作(PROBE，5.6)
+    std::vector<char> buf(sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op), 0);
+    io_uring_probe *probe = (io_uring_probe *)&buf[0];
+    if (syscall(__NR_io_uring_register, m_fd, IORING_REGISTER_PROBE, probe, 256) < 0) {
+        WEBS_LOG_INFO(g_logger) << "io_uring probe fail, errno = " << errno << " errstr = " << strerror(errno);
+        return false;
+    }
+    for (uint32_t i = 0; i < probe->ops_len && i < 256; ++i) {
+        m_supported[probe->ops[i].op] = probe->ops[i].flags & IO_URING_OP_SUPPORTED;
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool IoUring::registerEventfd(int fd) {
+    return syscall(__NR_io_uring_register, m_fd, IORING_REGISTER_EVENTFD, &fd, 1) == 0;
+}
+
+int IoUring::enter(uint32_t to_submit) {
+    while (true) {
+        int rt = syscall(__NR_io_uring_enter, m_fd, to_submit, 0, 0, nullptr, 0);
+        if (rt >= 0) {
+            return rt;
+        }
+        if (errno != EINTR) {
+            return -errno;
+        }
+    }
+}
+
+uint32_t IoUring::unsubmitted() const {
+    return *m_sqTail - __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE);
+}
+
+bool IoUring::submit(const io_uring_sqe *sqes, uint32_t count) {
+    MutexType::Lock lock(m_sqMutex);
+    uint32_t pending = unsubmitted();
+    if (m_sqEntries - pending < count) {
+        return false;
+    }
+    uint32_t tail = *m_sqTail;
+    for (uint32_t i = 0; i < count; ++i) {
+        uint32_t idx = tail & m_sqMask;
+        m_sqes[idx] = sqes[i];
+        m_sqArray[idx] = idx;
+        ++tail;
+    }
+    __atomic_store_n(m_sqTail, tail, __ATOMIC_RELEASE);
+    int rt = enter(pending + count);
+    if (rt < 0 && rt != -EAGAIN && rt != -EBUSY) {
+        WEBS_LOG_ERROR(g_logger) << "io_uring_enter fail, errno = " << -rt << " errstr = " << strerror(-rt);
+    }
+    return true;
+}
+
+void IoUring::flush() {
+    MutexType::Lock lock(m_sqMutex);
+    uint32_t pending = unsubmitted();
+    if (pending) {
+        enter(pending);
+    }
+}
+
+size_t IoUring::reap(io_uring_cqe *cqes, size_t max) {
+    MutexType::Lock lock(m_cqMutex);
+    uint32_t head = *m_cqHead;
+    uint32_t tail = __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE);
+    size_t n = 0;
+    while (head != tail && n < max) {
+        cqes[n++] = m_cqes[head & m_cqMask];
+        ++head;
+    }
+    __atomic_store_n(m_cqHead, head, __ATOMIC_RELEASE);
+    return n;
+}
+
+} // namespace webs
+
+#endif
@@ -0,0 +1,96 @@
+/**
+ * io_uring的最小封装：直接使用系统调用和mmap的环形队列，不依赖liburing
+ * 提交队列、完成队列各自由自旋锁保护，任意线程都可以提交，空闲线程收割完成项
+ * 编译环境没有<linux/io_uring.h>时不定义WEBS_HAVE_IO_URING，IOManager只使用epoll
+*/
+#ifndef __WEBS_IO_URING_H__
+#define __WEBS_IO_URING_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include "../util_module/mutex.h"
+#include "../util_module/Noncopyable.h"
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define WEBS_HAVE_IO_URING 1
+#endif
+#endif
+
+#ifdef WEBS_HAVE_IO_URING
+
+namespace webs {
+
+class IoUring : Noncopyable {
+public:
+    typedef Spinlock MutexType;
+
+    IoUring();
+
+    ~IoUring();
+
+    /**
+     * 创建最多entries个提交项的ring
+     * 内核不支持io_uring(或者缺少FAST_POLL、NODROP、PROBE，即5.7之前的内核)返回false
+     */
+    bool init(uint32_t entries);
+
+    /* 内核是否支持opcode(IORING_OP_*) */
+    bool isSupported(uint8_t opcode) const {
+        return m_supported[opcode];
+    }
+
+    /* 完成项写入完成队列时通知eventfd */
+    bool registerEventfd(int fd);
+
+    /**
+     * 放入count个提交项并提交给内核；提交队列空间不足返回false，一个都不放入
+     * 内核暂时无法接收时(EAGAIN/EBUSY)提交项留在队列中，由flush再次提交
+     */
+    bool submit(const io_uring_sqe *sqes, uint32_t count);
+
+    /* 再次提交之前没有被内核接收的提交项 */
+    void flush();
+
+    /* 取出最多max个完成项；返回取出的数量 */
+    size_t reap(io_uring_cqe *cqes, size_t max);
+
+private:
+    /* 提交to_submit个提交项；返回内核接收的数量，失败返回-errno */
+    int enter(uint32_t to_submit);
+
+    /* 已经放入队列、还没有被内核接收的提交项数量；调用者持有m_sqMutex */
+    uint32_t unsubmitted() const;
+
+private:
+    int m_fd = -1;
+    MutexType m_sqMutex;
+    MutexType m_cqMutex;
+    // mmap的区域
+    void *m_sqRing = nullptr;
+    size_t m_sqRingSize = 0;
+    void *m_cqRing = nullptr;
+    size_t m_cqRingSize = 0;
+    io_uring_sqe *m_sqes = nullptr;
+    size_t m_sqesSize = 0;
+    // 提交队列
+    uint32_t *m_sqHead = nullptr;
+    uint32_t *m_sqTail = nullptr;
+    uint32_t *m_sqArray = nullptr;
+    uint32_t m_sqMask = 0;
+    uint32_t m_sqEntries = 0;
+    // 完成队列
+    uint32_t *m_cqHead = nullptr;
+    uint32_t *m_cqTail = nullptr;
+    io_uring_cqe *m_cqes = nullptr;
+    uint32_t m_cqMask = 0;
+    // 按opcode记录内核是否支持
+    bool m_supported[256];
+};
+
+} // namespace webs
+
+#endif
+
+#endif
@@ -1,14 +1,127 @@
 #include "iomanager.h"
+#include "io_uring.h"
 #include "../util_module/macro.h"
+#include "../config_module/config.h"
 
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <string.h>
+#include <algorithm>
+#include <set>
 namespace webs {
 
 static webs::Logger::ptr g_logger = WEBS_LOG_NAME("system");
 
+static webs::ConfigVar<uint32_t>::ptr g_idle_spin_us =
+    webs::Config::Lookup<uint32_t>("iomanager.idle_spin_us", 50, "idle thread spins on the run queue before epoll_wait, 0 = no spin");
+
+static webs::ConfigVar<std::string>::ptr g_backend =
+    webs::Config::Lookup<std::string>("iomanager.backend", "epoll", "io backend: epoll or io_uring(falls back to epoll when the kernel lacks it)");
+
+static webs::ConfigVar<uint32_t>::ptr g_uring_entries =
+    webs::Config::Lookup<uint32_t>("iomanager.uring_entries", 4096, "io_uring submission queue entries");
+
+static webs::ConfigVar<bool>::ptr g_epoll_persistent =
+    webs::Config::Lookup<bool>("iomanager.epoll_persistent", false, "opt-in: register each fd once with EPOLLIN|EPOLLOUT|EPOLLET and keep readiness in user space; fds must be closed through the hooked close, false = epoll_ctl on every wait");
+
+static uint32_t s_idle_spin_us = 50;
+static std::string s_backend = "epoll";
+static uint32_t s_uring_entries = 4096;
+static webs::ConfigVar<bool>::ptr g_multi_reactor =
+    webs::Config::Lookup<bool>("iomanager.multi_reactor", false, "one epoll per worker thread, each fd is served by its home thread");
+
+static webs::ConfigVar<std::string>::ptr g_reactor_assign =
+    webs::Config::Lookup<std::string>("iomanager.reactor_assign", "round_robin", "how a fd picks its home reactor: round_robin or incoming_cpu(SO_INCOMING_CPU, falls back to round_robin)");
+
+static webs::ConfigVar<bool>::ptr g_timer_per_thread =
+    webs::Config::Lookup<bool>("iomanager.timer_per_thread", false, "each worker thread keeps its own timer wheel for the timers it adds");
+
+static webs::ConfigVar<uint32_t>::ptr g_epoll_batch_min =
+    webs::Config::Lookup<uint32_t>("iomanager.epoll_batch_min", 32, "smallest epoll_wait batch; the batch grows while wakeups fill it and shrinks back when load drops");
+
+static webs::ConfigVar<uint32_t>::ptr g_epoll_batch_max =
+    webs::Config::Lookup<uint32_t>("iomanager.epoll_batch_max", 256, "largest epoll_wait batch, equal to epoll_batch_min = fixed size");
+
+static bool s_epoll_persistent = false;
+static bool s_multi_reactor = false;
+static bool s_timer_per_thread = false;
+static std::string s_reactor_assign = "round_robin";
+static uint32_t s_epoll_batch_min = 32;
+static uint32_t s_epoll_batch_max = 256;
+
+struct _IOManagerIniter {
+    _IOManagerIniter() {
+        s_idle_spin_us = g_idle_spin_us->getValue();
+        g_idle_spin_us->addListener([](const uint32_t &old_value, const uint32_t &new_value) {
+            s_idle_spin_us = new_value;
+        });
+        // 后端在IOManager构造时选择，修改只影响之后创建的IOManager
+        s_backend = g_backend->getValue();
+        g_backend->addListener([](const std::string &old_value, const std::string &new_value) {
+            s_backend = new_value;
+        });
+        s_uring_entries = g_uring_entries->getValue();
+        g_uring_entries->addListener([](const uint32_t &old_value, const uint32_t &new_value) {
+            s_uring_entries = new_value;
+        });
+        s_epoll_persistent = g_epoll_persistent->getValue();
+        g_epoll_persistent->addListener([](const bool &old_value, const bool &new_value) {
+            s_epoll_persistent = new_value;
+        });
+        s_multi_reactor = g_multi_reactor->getValue();
+        g_multi_reactor->addListener([](const bool &old_value, const bool &new_value) {
+            s_multi_reactor = new_value;
+        });
+        s_timer_per_thread = g_timer_per_thread->getValue();
+        g_timer_per_thread->addListener([](const bool &old_value, const bool &new_value) {
+            s_timer_per_thread = new_value;
+        });
+        s_reactor_assign = g_reactor_assign->getValue();
+        g_reactor_assign->addListener([](const std::string &old_value, const std::string &new_value) {
+            s_reactor_assign = new_value;
+        });
+        // 批量大小在IOManager构造时确定
+        s_epoll_batch_min = g_epoll_batch_min->getValue();
+        g_epoll_batch_min->addListener([](const uint32_t &old_value, const uint32_t &new_value) {
+            s_epoll_batch_min = new_value;
+        });
+        s_epoll_batch_max = g_epoll_batch_max->getValue();
+        g_epoll_batch_max->addListener([](const uint32_t &old_value, const uint32_t &new_value) {
+            s_epoll_batch_max = new_value;
+        });
+    }
+};
+
+static _IOManagerIniter s_iomanager_initer;
+
+// 存活的IOManager；fd关闭时清除每一个IOManager中的持久注册
+static RWMutex &GetIOManagersMutex() {
+    static RWMutex s_mutex;
+    return s_mutex;
+}
+
+static std::set<IOManager *> &GetIOManagers() {
+    static std::set<IOManager *> s_iomanagers;
+    return s_iomanagers;
+}
+
+/* IO超时允许推迟的时间：与内核估算select/poll超时精度的方式一致，0.1%，最多100ms */
+static inline uint64_t IoTimeoutSlack(uint64_t timeout_ms) {
+    return std::min<uint64_t>(timeout_ms / 1000, 100);
+}
+
+/* 自旋等待时降低CPU占用 */
+static inline void CpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield" ::: "memory");
+#endif
+}
+
 // 声明一个空枚举；强转为该类型进行输出
 enum EpollCtop {};
 
@@ -74,23 +187,47 @@ IOManager::FdContext::EventContext &IOManager::FdContext::getContext(IOManager::
 
 /* 重置事件上下文类 */
 void IOManager::FdContext::resetContext(EventContext &ctx) {
+    disarmTimeout(ctx);
     ctx.scheduler = nullptr;
     ctx.fiber.reset();
     ctx.cb = nullptr;
 }
 
+void IOManager::FdContext::disarmTimeout(EventContext &ctx) {
+    if (ctx.timeout.armed) {
+        ctx.timeout.armed = false;
+        // 已经到期的由onIoTimeout根据armed忽略
+        ctx.timeout.iom->cancelTimerNode(&ctx.timeout);
+    }
+}
+
 /* 设置触发事件 */
 /* 校验socket_fd事件 --> 重新设置socket_fd事件 --> 获取事件的上下文并执行 -->重置调度器 */
-void IOManager::FdContext::triggerEvent(Event event) {
+void IOManager::FdContext::triggerEvent(Event event, Scheduler::TaskBatch *batch, int thread, uint64_t ready_us) {
     // 外部已经加锁了
     WEBS_ASSERT(events & event);
     events = (Event)(events & (~event));
     EventContext &ctx = getContext(event);
-    if (ctx.cb) {
+    disarmTimeout(ctx);
+    if (ready_us && ctx.fiber) {
+        ctx.fiber->setReadyTime(ready_us);
+    }
+    if (ctx.fiber && ctx.fiber->getHomeThread() != -1) {
+        // 共享栈协程只能回到自己的线程
+        thread = -1;
+    }
+    if (batch && ctx.scheduler == batch->getScheduler()) {
+        // 同一个调度器的事件先收集起来，由调用者一次提交
+        if (ctx.cb) {
+            batch->add(&ctx.cb, thread);
+        } else {
+            batch->add(&ctx.fiber, thread);
+        }
+    } else if (ctx.cb) {
         // 这里使用的是function对象的地址，ctx.cb在执行FiberAndThread(std::function<void()>*, int)构造函数的时候会被swap为nullptr
-        ctx.scheduler->schedule(&ctx.cb);
+        ctx.scheduler->schedule(&ctx.cb, thread);
     } else {
-        ctx.scheduler->schedule(&ctx.fiber);
+        ctx.scheduler->schedule(&ctx.fiber, thread);
     }
     ctx.scheduler = nullptr; // 在添加事件的时候会重新赋一个调度器
     return;
@@ -98,25 +235,92 @@ void IOManager::FdContext::triggerEvent(Event event) {
 /* 构造函数；线程数量、是否将调用线程包含进去、调度器的名称 */
 /* 创建epoll_fd  --> 设置m_ticklefd  --> 设置监听事件  --> 注册事件 --> 设置文件描述符容器的属性 -->启动IO管理器 */
 IOManager::IOManager(size_t threads, bool use_caller, const std::string &name) :
-    Scheduler(threads, use_caller, name) {
+    Scheduler(threads, use_caller, name),
+    m_persistent(s_epoll_persistent),
+    m_fdContexts([](FdContext &ctx, int fd) {
+        ctx.fd = fd;
+        ctx.read.timeout.fdCtx = &ctx;
+        ctx.read.timeout.event = READ;
+        ctx.write.timeout.fdCtx = &ctx;
+        ctx.write.timeout.event = WRITE;
+    }) {
     m_epfd = epoll_create(5000);
     WEBS_ASSERT(m_epfd > 0);
 
-    int rt = pipe(m_tickleFds);
-    WEBS_ASSERT(!rt);
+    // 同一个epfd上的epoll_wait是互斥等待，每次写入eventfd只唤醒一个线程
+    m_tickleFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    WEBS_ASSERT(m_tickleFd >= 0);
 
     epoll_event event;
     memset(&event, 0, sizeof(epoll_event));
     event.events = EPOLLIN | EPOLLET;
-    event.data.fd = m_tickleFds[0];
+    event.data.fd = m_tickleFd;
 
-    rt = fcntl(m_tickleFds[0], F_SETFL, O_NONBLOCK);
+    int rt = epoll_ctl(m_epfd, EPOLL_CTL_ADD, m_tickleFd, &event);
     WEBS_ASSERT(!rt);
 
-    rt = epoll_ctl(m_epfd, EPOLL_CTL_ADD, m_tickleFds[0], &event);
-    WEBS_ASSERT(!rt);
+    if (s_timer_per_thread) {
+        // 每个调度线程一个时间轮；use_caller的调用线程使用共享的时间轮
+        initTimerWheels(m_threadCount + (m_rootThread != -1 ? 1 : 0));
+    }
 
-    contextResize(32);
+    m_batchMax = std::max<uint32_t>(s_epoll_batch_max, 1);
+    m_batchMin = std::min(std::max<uint32_t>(s_epoll_batch_min, 1), m_batchMax);
+    for (size_t i = 0; i < m_threadCount + (m_rootThread != -1 ? 1 : 0); ++i) {
+        m_workerStats.push_back(new WorkerStats);
+        m_workerStats.back()->batchSize = m_batchMin;
+    }
+
+    if (s_multi_reactor) {
+        // 每个线程(包括use_caller的调用线程)一个epoll；0号沿用m_epfd
+        size_t count = m_threadCount + (m_rootThread != -1 ? 1 : 0);
+        for (size_t i = 0; i < count; ++i) {
+            Reactor *reactor = new Reactor;
+            if (i == 0) {
+                reactor->epfd = m_epfd;
+                reactor->tickleFd = m_tickleFd;
+            } else {
+                reactor->epfd = epoll_create(5000);
+                WEBS_ASSERT(reactor->epfd > 0);
+                reactor->tickleFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+                WEBS_ASSERT(reactor->tickleFd >= 0);
+                event.data.fd = reactor->tickleFd;
+                rt = epoll_ctl(reactor->epfd, EPOLL_CTL_ADD, reactor->tickleFd, &event);
+                WEBS_ASSERT(!rt);
+            }
+            m_reactors.push_back(reactor);
+        }
+    }
+
+#ifdef WEBS_HAVE_IO_URING
+    // io_uring的完成通过eventfd通知，与IO事件一起在epoll_wait中等待
+    if (s_backend == "io_uring") {
+        IoUring *uring = new IoUring;
+        m_uringFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        event.data.fd = m_uringFd;
+        if (m_uringFd >= 0 && uring->init(s_uring_entries) && uring->registerEventfd(m_uringFd)
+            && epoll_ctl(m_epfd, EPOLL_CTL_ADD, m_uringFd, &event) == 0) {
+            m_uring = uring;
+            // 多reactor：每个epoll都等待完成通知，EPOLLEXCLUSIVE保证每次只唤醒其中一个
+            event.events = EPOLLIN | EPOLLET | EPOLLEXCLUSIVE;
+            for (size_t i = 1; i < m_reactors.size(); ++i) {
+                epoll_ctl(m_reactors[i]->epfd, EPOLL_CTL_ADD, m_uringFd, &event);
+            }
+        } else {
+            WEBS_LOG_WARN(g_logger) << "name = " << name << " io_uring unavailable, fall back to epoll";
+            delete uring;
+            if (m_uringFd >= 0) {
+                close(m_uringFd);
+                m_uringFd = -1;
+            }
+        }
+    }
+#endif
+
+    {
+        RWMutex::WriteLock lock(GetIOManagersMutex());
+        GetIOManagers().insert(this);
+    }
 
     start();
 }
@@ -125,41 +329,57 @@ IOManager::IOManager(size_t threads, bool use_caller, const std::string &name) :
 IOManager::~IOManager() {
     stop();
 
-    close(m_epfd);
-    close(m_tickleFds[0]);
-    close(m_tickleFds[1]);
-
-    for (size_t i = 0; i != m_fdContexts.size(); ++i) {
-        if (m_fdContexts[i]) {
-            delete (m_fdContexts[i]);
-        }
+    {
+        RWMutex::WriteLock lock(GetIOManagersMutex());
+        GetIOManagers().erase(this);
     }
-}
 
-/* 重置socket事件上下文容器的大小 */
-void IOManager::contextResize(size_t size) {
-    m_fdContexts.resize(size); //只是改变容器的大小，并不进行初始化
-    for (size_t i = 0; i != size; ++i) {
-        if (!m_fdContexts[i]) { // 上下文不存在才会被重置
-            m_fdContexts[i] = new FdContext;
-            m_fdContexts[i]->fd = i;
+    close(m_epfd);
+    close(m_tickleFd);
+    for (size_t i = 0; i < m_reactors.size(); ++i) {
+        if (i > 0) {
+            close(m_reactors[i]->epfd);
+            close(m_reactors[i]->tickleFd);
         }
+        delete m_reactors[i];
+    }
+    for (auto i : m_workerStats) {
+        delete i;
     }
+#ifdef WEBS_HAVE_IO_URING
+    if (m_uring) {
+        delete m_uring;
+        close(m_uringFd);
+    }
+#endif
 }
 
 /* 添加事件；成功返回0，失败返回-1 或者 程序中断 */
 /* 获取fd对应的socket_fd上下文 --> 校验socket_fd是否已存在当前event  --> 添加epoll监听事件 --> 设置socket_fd属性 */
 int IOManager::addEvent(int fd, Event event, std::function<void()> cb) {
-    FdContext *fd_ctx = nullptr;
-    RWMutexType::ReadLock lock(m_mutex);
-    if ((int)m_fdContexts.size() > fd) {
-        fd_ctx = m_fdContexts[fd];
-        lock.unlock();
-    } else {
-        lock.unlock();
-        RWMutexType::WriteLock lock2(m_mutex);
-        contextResize(fd * 1.5); // 当前文件描述符容器不够，先扩容再添加
-        fd_ctx = m_fdContexts[fd];
+    return doAddEvent(fd, event, cb, ~0ull, nullptr);
+}
+
+int IOManager::addEvent(int fd, Event event, uint64_t timeout_ms, uint32_t *wait_seq) {
+    std::function<void()> cb;
+    return doAddEvent(fd, event, cb, timeout_ms, wait_seq);
+}
+
+bool IOManager::waitTimedOut(int fd, Event event, uint32_t wait_seq) {
+    FdContext *fd_ctx = m_fdContexts.get(fd);
+    if (!fd_ctx) {
+        return false;
+    }
+    FdContext::MutexType::Lock lock(fd_ctx->mutex);
+    IoTimeout &timeout = fd_ctx->getContext(event).timeout;
+    return timeout.seq == wait_seq && timeout.fired;
+}
+
+int IOManager::doAddEvent(int fd, Event event, std::function<void()> &cb, uint64_t timeout_ms, uint32_t *wait_seq) {
+    FdContext *fd_ctx = getFdContext(fd);
+    if (WEBS_UNLIKELY(!fd_ctx)) {
+        WEBS_LOG_ERROR(g_logger) << "addEvent fd = " << fd << " out of range";
+        return -1;
     }
 
     FdContext::MutexType::Lock lock1(fd_ctx->mutex);
@@ -171,19 +391,39 @@ int IOManager::addEvent(int fd, Event event, std::function<void()> cb) {
         WEBS_ASSERT(!(fd_ctx->events & event));
     }
 
-    int op = fd_ctx->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD; // 查看是添加还是修改
-    epoll_event events;
-    events.events = EPOLLET | fd_ctx->events | event;
-    events.data.ptr = fd_ctx; // 存放在数据字段，意味着可以在回调的时候通过该字段判断从哪一个ft_ctx触发的
+    if (!m_reactors.empty() && fd_ctx->home == -1) {
+        // 第一次等待时确定fd所属的reactor，之后该fd的事件都由这个线程处理
+        fd_ctx->home = chooseReactor(fd);
+    }
+    // 持久注册：只在第一次等待时加入epoll，之后等待不需要epoll_ctl
+    if (!m_persistent || !fd_ctx->registered) {
+        int epfd = epfdOf(fd_ctx);
+        int op = fd_ctx->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD; // 查看是添加还是修改
+        epoll_event events;
+        events.events = m_persistent ? (EPOLLET | EPOLLIN | EPOLLOUT) : (EPOLLET | fd_ctx->events | event);
+        events.data.ptr = fd_ctx; // 存放在数据字段，意味着可以在回调的时候通过该字段判断从哪一个ft_ctx触发的
 
-    int rt = epoll_ctl(m_epfd, op, fd, &events);
-    if (rt) {
-        WEBS_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", "
-                                 << (EpollCtop)op << ", " << fd << ", " << (EPOLL_EVENTS)events.events << ", "
-                                 << rt
-                                 << "( " << errno << ") (" << strerror(errno) << ") fd_ctx->events = "
-                                 << (EPOLL_EVENTS)fd_ctx->events;
-        return -1;
+        int rt = epoll_ctl(epfd, op, fd, &events);
+        ++m_epollCtlCount;
+        if (rt && m_persistent && errno == EEXIST) {
+            // 没有经过close的复用(dup2等)，沿用已有的注册
+            rt = epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &events);
+            ++m_epollCtlCount;
+        } else if (rt && op == EPOLL_CTL_MOD && errno == ENOENT) {
+            // fd绕过hook关闭(系统调用、dup2等)，内核已经删除了注册，重新添加
+            op = EPOLL_CTL_ADD;
+            rt = epoll_ctl(epfd, op, fd, &events);
+            ++m_epollCtlCount;
+        }
+        if (rt) {
+            WEBS_LOG_ERROR(g_logger) << "epoll_ctl(" << epfd << ", "
+                                     << (EpollCtop)op << ", " << fd << ", " << (EPOLL_EVENTS)events.events << ", "
+                                     << rt
+                                     << "( " << errno << ") (" << strerror(errno) << ") fd_ctx->events = "
+                                     << (EPOLL_EVENTS)fd_ctx->events;
+            return -1;
+        }
+        fd_ctx->registered = m_persistent;
     }
 
     ++m_pendingEventCount;
@@ -199,35 +439,54 @@ int IOManager::addEvent(int fd, Event event, std::function<void()> cb) {
         ctx.fiber = Fiber::GetThis(); // 这里的协程应该是正在执行中的
         WEBS_ASSERT2(ctx.fiber->getState() == Fiber::EXEC, "state = " << ctx.fiber->getState());
     }
+    if (wait_seq) {
+        // 开始新的一次等待；之前等待的结果作废
+        ++ctx.timeout.seq;
+        ctx.timeout.fired = false;
+        *wait_seq = ctx.timeout.seq;
+    }
+    if (fd_ctx->ready & event) {
+        // 等待之前已经就绪：消费就绪事件并直接触发；协程切出之后才会被执行
+        fd_ctx->ready = (Event)(fd_ctx->ready & ~event);
+        fd_ctx->triggerEvent(event, nullptr, homeThreadOf(fd_ctx));
+        --m_pendingEventCount;
+    } else if (wait_seq && timeout_ms != ~0ull) {
+        // 超时链入时间轮；到期的回调在持有fd的锁之后才生效
+        IoTimeout &timeout = ctx.timeout;
+        timeout.iom = this;
+        timeout.armed = true;
+        addTimerNode(&timeout, timeout_ms, IoTimeoutSlack(timeout_ms));
+    }
     return 0;
 }
 
 /* 删除事件 */
 /* 获取fd对应的socket_fd上下文 --> 校验socket_fd是否已存在当前event  --> 删除event后，重新添加epoll监听事件 --> 设置socket_fd属性 */
 bool IOManager::delEvent(int fd, Event event) {
-    RWMutexType::ReadLock lock(m_mutex);
-    if ((int)m_fdContexts.size() <= fd) {
+    FdContext *fd_ctx = m_fdContexts.get(fd);
+    if (!fd_ctx) {
         return false;
     }
-    FdContext *fd_ctx = m_fdContexts[fd];
-    lock.unlock();
 
     FdContext::MutexType::Lock lock2(fd_ctx->mutex);
     if (!(fd_ctx->events & event)) {
         return false;
     }
     Event new_events = (Event)(fd_ctx->events & ~event);
-    int op = new_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
-    epoll_event epevent;
-    epevent.events = EPOLLET | new_events;
-    epevent.data.ptr = fd_ctx;
-
-    int rt = epoll_ctl(m_epfd, op, fd, &epevent);
-    if (rt) {
-        WEBS_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", "
-                                 << (EpollCtop)op << ", " << fd << ", " << (EPOLL_EVENTS)epevent.events << "): "
-                                 << rt << " (" << errno << ") (" << strerror(errno) << ")";
-        return false;
+    if (!m_persistent) { // 持久注册时epoll中的注册不变
+        int op = new_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
+        epoll_event epevent;
+        epevent.events = EPOLLET | new_events;
+        epevent.data.ptr = fd_ctx;
+
+        int rt = epoll_ctl(epfdOf(fd_ctx), op, fd, &epevent);
+        ++m_epollCtlCount;
+        if (rt) {
+            WEBS_LOG_ERROR(g_logger) << "epoll_ctl(" << epfdOf(fd_ctx) << ", "
+                                     << (EpollCtop)op << ", " << fd << ", " << (EPOLL_EVENTS)epevent.events << "): "
+                                     << rt << " (" << errno << ") (" << strerror(errno) << ")";
+            return false;
+        }
     }
 
     --m_pendingEventCount;
@@ -239,74 +498,359 @@ bool IOManager::delEvent(int fd, Event event) {
 
 /* 取消事件 */
 bool IOManager::cancelEvent(int fd, Event event) {
-    RWMutexType::ReadLock lock(m_mutex);
-    if ((int)m_fdContexts.size() <= fd) {
+    FdContext *fd_ctx = m_fdContexts.get(fd);
+    if (!fd_ctx) {
         return false;
     }
-    FdContext *fd_ctx = m_fdContexts[fd];
-    lock.unlock();
 
     FdContext::MutexType::Lock lock2(fd_ctx->mutex);
+    return cancelEventNolock(fd_ctx, event);
+}
+
+bool IOManager::cancelEventNolock(FdContext *fd_ctx, Event event) {
+    int fd = fd_ctx->fd;
     if (!(fd_ctx->events & event)) {
         return false;
     }
     Event new_events = (Event)(fd_ctx->events & ~event);
-    int op = new_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
-    epoll_event epevent;
-    epevent.events = EPOLLET | new_events;
-    epevent.data.ptr = fd_ctx;
-
-    int rt = epoll_ctl(m_epfd, op, fd, &epevent);
-    if (rt) {
-        WEBS_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", "
-                                 << (EpollCtop)op << ", " << fd << ", " << (EPOLL_EVENTS)epevent.events << "): "
-                                 << rt << " (" << errno << ") (" << strerror(errno) << ")";
-        return false;
+    if (!m_persistent) { // 持久注册时epoll中的注册不变
+        int op = new_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
+        epoll_event epevent;
+        epevent.events = EPOLLET | new_events;
+        epevent.data.ptr = fd_ctx;
+
+        int rt = epoll_ctl(epfdOf(fd_ctx), op, fd, &epevent);
+        ++m_epollCtlCount;
+        if (rt) {
+            WEBS_LOG_ERROR(g_logger) << "epoll_ctl(" << epfdOf(fd_ctx) << ", "
+                                     << (EpollCtop)op << ", " << fd << ", " << (EPOLL_EVENTS)epevent.events << "): "
+                                     << rt << " (" << errno << ") (" << strerror(errno) << ")";
+            return false;
+        }
     }
 
-    fd_ctx->triggerEvent(event); // 触发事件
+    fd_ctx->triggerEvent(event, nullptr, homeThreadOf(fd_ctx)); // 触发事件
     --m_pendingEventCount;
     return true;
 }
 
 /* 取消所有事件 -- 触发所有事件 */
 bool IOManager::cancelAll(int fd) {
-    RWMutexType::ReadLock lock(m_mutex);
-    if ((int)m_fdContexts.size() <= fd) {
+    FdContext *fd_ctx = m_fdContexts.get(fd);
+    if (!fd_ctx) {
         return false;
     }
-    FdContext *fd_ctx = m_fdContexts[fd];
-    lock.unlock();
+
+    // io_uring的请求持有文件的引用，关闭之前需要取消
+    if (fd_ctx->uringPending > 0) {
+        cancelUringFd(fd);
+    }
 
     MutexType::Lock lock2(fd_ctx->mutex);
+    // unregister会清除所属的reactor，等待者仍然回到原来的线程
+    int home_thread = homeThreadOf(fd_ctx);
+    if (m_persistent) {
+        // fd即将关闭，之后复用相同的fd需要重新注册
+        unregister(fd_ctx);
+    }
     if (!(fd_ctx->events)) {
         return false;
     }
 
-    int op = EPOLL_CTL_DEL;
-    epoll_event epevent;
-    epevent.events = 0;
-    epevent.data.ptr = fd_ctx;
-
-    int rt = epoll_ctl(m_epfd, op, fd, &epevent);
-    if (rt) {
-        WEBS_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", "
-                                 << (EpollCtop)op << ", " << fd << ", " << (EPOLL_EVENTS)epevent.events << "): "
-                                 << rt << " (" << errno << ") (" << strerror(errno) << ")";
-        return false;
+    if (!m_persistent) {
+        int op = EPOLL_CTL_DEL;
+        epoll_event epevent;
+        epevent.events = 0;
+        epevent.data.ptr = fd_ctx;
+
+        int rt = epoll_ctl(epfdOf(fd_ctx), op, fd, &epevent);
+        ++m_epollCtlCount;
+        if (rt) {
+            WEBS_LOG_ERROR(g_logger) << "epoll_ctl(" << epfdOf(fd_ctx) << ", "
+                                     << (EpollCtop)op << ", " << fd << ", " << (EPOLL_EVENTS)epevent.events << "): "
+                                     << rt << " (" << errno << ") (" << strerror(errno) << ")";
+            return false;
+        }
     }
     if (fd_ctx->events & READ) {
-        fd_ctx->triggerEvent(READ); // 触发事件
+        fd_ctx->triggerEvent(READ, nullptr, home_thread); // 触发事件
         --m_pendingEventCount;
     }
     if (fd_ctx->events & WRITE) {
-        fd_ctx->triggerEvent(WRITE); // 触发事件
+        fd_ctx->triggerEvent(WRITE, nullptr, home_thread); // 触发事件
         --m_pendingEventCount;
     }
     WEBS_ASSERT(fd_ctx->events == 0);
     return true;
 }
 
+void IOManager::unregister(FdContext *fd_ctx) {
+    fd_ctx->ready = NONE;
+    int epfd = epfdOf(fd_ctx);
+    // 复用相同fd的新连接重新选择reactor
+    fd_ctx->home = -1;
+    if (!fd_ctx->registered) {
+        return;
+    }
+    fd_ctx->registered = false;
+    // 关闭会自动从epoll中删除；dup出来的fd还引用同一个文件时需要主动删除
+    epoll_event epevent;
+    memset(&epevent, 0, sizeof(epevent));
+    epoll_ctl(epfd, EPOLL_CTL_DEL, fd_ctx->fd, &epevent);
+    ++m_epollCtlCount;
+}
+
+void IOManager::UnregisterAll(int fd) {
+    RWMutex::ReadLock lock(GetIOManagersMutex());
+    for (IOManager *iom : GetIOManagers()) {
+        FdContext *fd_ctx = iom->m_fdContexts.get(fd);
+        if (!fd_ctx) {
+            continue;
+        }
+        FdContext::MutexType::Lock lock2(fd_ctx->mutex);
+        iom->unregister(fd_ctx);
+    }
+}
+
+bool IOManager::attachToLocalReactor(int fd) {
+    int index = getWorkerIndex();
+    if (m_reactors.empty() || index < 0) {
+        return false;
+    }
+    FdContext *fd_ctx = getFdContext(fd);
+    if (!fd_ctx) {
+        return false;
+    }
+    FdContext::MutexType::Lock lock(fd_ctx->mutex);
+    if (fd_ctx->home == -1) {
+        fd_ctx->home = index;
+    }
+    return fd_ctx->home == index;
+}
+
+IOManager::FdContext *IOManager::getFdContext(int fd) {
+    return m_fdContexts.getOrCreate(fd);
+}
+
+int IOManager::getTimerWheelIndex() const {
+    int index = getWorkerIndex();
+    // use_caller的调用线程只在stop时进入idle
+    return (m_rootThread != -1 && index == 0) ? -1 : index;
+}
+
+void IOManager::OnIoTimeout(TimerNode *node, std::vector<std::function<void()>> &cbs) {
+    IoTimeout *timeout = static_cast<IoTimeout *>(node);
+    uint32_t seq = timeout->seq;
+    // 只捕获两个字段，std::function不需要分配内存
+    cbs.push_back([timeout, seq]() { timeout->iom->onIoTimeout(timeout, seq); });
+}
+
+void IOManager::onIoTimeout(IoTimeout *timeout, uint32_t seq) {
+    FdContext *fd_ctx = timeout->fdCtx;
+    FdContext::MutexType::Lock lock(fd_ctx->mutex);
+    // 等待已经结束(事件触发、被取消)，或者已经开始了新的等待
+    if (timeout->seq != seq || !timeout->armed) {
+        return;
+    }
+    timeout->armed = false;
+    timeout->fired = true;
+    cancelEventNolock(fd_ctx, timeout->event);
+}
+
+int IOManager::epfdOf(FdContext *fd_ctx) const {
+    if (m_reactors.empty() || fd_ctx->home == -1) {
+        return m_epfd;
+    }
+    return m_reactors[fd_ctx->home]->epfd;
+}
+
+int IOManager::homeThreadOf(FdContext *fd_ctx) const {
+    if (m_reactors.empty() || fd_ctx->home == -1) {
+        return -1;
+    }
+    // reactor的线程还没有进入过idle时为-1，任意线程都可以恢复
+    return m_reactors[fd_ctx->home]->thread;
+}
+
+int IOManager::chooseReactor(int fd) {
+    // use_caller的调用线程只在stop时参与调度，不分配fd
+    size_t first = (m_rootThread != -1 && m_reactors.size() > 1) ? 1 : 0;
+    size_t count = m_reactors.size() - first;
+#ifdef SO_INCOMING_CPU
+    if (s_reactor_assign == "incoming_cpu") {
+        // 由处理该连接网卡队列中断的CPU上的线程处理，数据留在同一个CPU的缓存中
+        int cpu = -1;
+        socklen_t len = sizeof(cpu);
+        if (getsockopt(fd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, &len) == 0 && cpu >= 0) {
+            const std::vector<int> &cpus = getCpus();
+            if (cpus.empty()) {
+                return first + cpu % count;
+            }
+            for (size_t i = 0; i < count; ++i) {
+                if (cpus[i % cpus.size()] == cpu) {
+                    return first + i;
+                }
+            }
+        }
+    }
+#endif
+    return first + m_nextReactor++ % count;
+}
+
+#ifdef WEBS_HAVE_IO_URING
+
+bool IOManager::isUringSupported(uint8_t opcode) const {
+    return m_uring && m_uring->isSupported(opcode);
+}
+
+/* 用户数据为UringIo的地址；最低位为1表示链接的超时，为0的地址表示不需要处理的完成项(取消请求) */
+bool IOManager::submitIo(UringIo *io, uint64_t timeout_ms) {
+    io_uring_sqe sqes[2];
+    memset(sqes, 0, sizeof(sqes));
+    io_uring_sqe &sqe = sqes[0];
+    sqe.opcode = io->opcode;
+    sqe.fd = io->fd;
+    sqe.addr = (uint64_t)(uintptr_t)io->addr;
+    sqe.len = io->len;
+    sqe.user_data = (uint64_t)(uintptr_t)io;
+    switch (io->opcode) {
+    case IORING_OP_READ:
+    case IORING_OP_WRITE:
+    case IORING_OP_READV:
+    case IORING_OP_WRITEV:
+        // 不可定位的文件(socket)使用当前位置
+        sqe.off = (uint64_t)-1;
+        break;
+    case IORING_OP_ACCEPT:
+        sqe.addr2 = (uint64_t)(uintptr_t)io->addr2;
+        sqe.accept_flags = io->flags;
+        break;
+    default:
+        sqe.msg_flags = io->flags;
+        break;
+    }
+    uint32_t count = 1;
+    io->result = 0;
+    io->timeout = false;
+    if (timeout_ms != ~0ull) {
+        sqe.flags |= IOSQE_IO_LINK;
+        io->ts[0] = timeout_ms / 1000;
+        io->ts[1] = (timeout_ms % 1000) * 1000000;
+        io_uring_sqe &tsqe = sqes[1];
+        tsqe.opcode = IORING_OP_LINK_TIMEOUT;
+        tsqe.fd = -1;
+        tsqe.addr = (uint64_t)(uintptr_t)io->ts;
+        tsqe.len = 1;
+        tsqe.user_data = (uint64_t)(uintptr_t)io | 1;
+        count = 2;
+    }
+    io->pending = count;
+
+    FdContext *fd_ctx = getFdContext(io->fd);
+    if (!fd_ctx) {
+        return false;
+    }
+    ++fd_ctx->uringPending;
+    ++m_pendingEventCount;
+    if (!m_uring->submit(sqes, count)) {
+        --fd_ctx->uringPending;
+        --m_pendingEventCount;
+        return false;
+    }
+    m_uringSubmitCount.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+void IOManager::cancelIo(UringIo *io) {
+    io_uring_sqe sqe;
+    memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode = IORING_OP_ASYNC_CANCEL;
+    sqe.fd = -1;
+    sqe.addr = (uint64_t)(uintptr_t)io;
+    if (!m_uring->submit(&sqe, 1)) {
+        WEBS_LOG_ERROR(g_logger) << "io_uring cancel fd = " << io->fd << " fail, submission queue full";
+    }
+}
+
+void IOManager::cancelUringFd(int fd) {
+    io_uring_sqe sqe;
+    memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode = IORING_OP_ASYNC_CANCEL;
+    sqe.fd = fd;
+#ifdef IORING_ASYNC_CANCEL_FD
+    sqe.cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+#endif
+    if (!m_uring->submit(&sqe, 1)) {
+        WEBS_LOG_ERROR(g_logger) << "io_uring cancel fd = " << fd << " fail, submission queue full";
+    }
+}
+
+/* 先读eventfd再收割：收割之后到达的完成项一定会再次触发eventfd */
+void IOManager::onUringEvent(TaskBatch &batch) {
+    uint64_t value = 0;
+    int len = read(m_uringFd, &value, sizeof(value));
+    (void)len;
+    const size_t MAX_CQES = 256;
+    io_uring_cqe cqes[MAX_CQES];
+    size_t n = 0;
+    uint64_t completed = 0;
+    do {
+        n = m_uring->reap(cqes, MAX_CQES);
+        for (size_t i = 0; i < n; ++i) {
+            uint64_t data = cqes[i].user_data;
+            if (data == 0) {
+                continue;
+            }
+            UringIo *io = (UringIo *)(uintptr_t)(data & ~1ull);
+            if (data & 1) {
+                // 超时先到时，被取消的IO以-ECANCELED完成
+                if (cqes[i].res == -ETIME) {
+                    io->timeout = true;
+                }
+            } else {
+                io->result = cqes[i].res;
+            }
+            if (--io->pending > 0) {
+                continue;
+            }
+            // 协程恢复后io就失效了，先取出需要的字段
+            FdContext *fd_ctx = getFdContext(io->fd);
+            --fd_ctx->uringPending;
+            --m_pendingEventCount;
+            ++completed;
+            if (io->scheduler == this) {
+                batch.add(&io->fiber);
+            } else {
+                io->scheduler->schedule(&io->fiber);
+            }
+        }
+    } while (n == MAX_CQES);
+    if (completed) {
+        m_uringCompleteCount.fetch_add(completed, std::memory_order_relaxed);
+    }
+}
+
+#else
+
+bool IOManager::isUringSupported(uint8_t opcode) const {
+    return false;
+}
+
+bool IOManager::submitIo(UringIo *io, uint64_t timeout_ms) {
+    return false;
+}
+
+void IOManager::cancelIo(UringIo *io) {
+}
+
+void IOManager::cancelUringFd(int fd) {
+}
+
+void IOManager::onUringEvent(TaskBatch &batch) {
+}
+
+#endif
+
 /* 返回当前的IOManager */
 IOManager *IOManager::GetThis() {
     return dynamic_cast<IOManager *>(Scheduler::GetThis());
@@ -315,7 +859,8 @@ IOManager *IOManager::GetThis() {
 /* 返回是否可以停止 */
 bool IOManager::stopping(uint64_t &timeout) {
     timeout = getNextTimer();
-    return timeout == ~0ull && m_pendingEventCount == 0 && Scheduler::stopping();
+    // 每个线程一个时间轮时，getNextTimer看不到其他线程的定时器
+    return timeout == ~0ull && !hasTimer() && m_pendingEventCount == 0 && Scheduler::stopping();
 }
 
 bool IOManager::stopping() {
@@ -324,14 +869,146 @@ bool IOManager::stopping() {
 }
 
 /* 当有消息来临的时候就发消息 ---> 唤醒线程执行任务 */
+/* 只唤醒一个睡眠的线程；自旋中的线程通过hasNewTasks发现任务。被唤醒的线程取到任务后如果还有剩余，会继续tickle下一个 */
 void IOManager::tickle() {
-    if (!hasIdleThreads()) {
+    tickle(1);
+}
+
+void IOManager::tickle(size_t count) {
+    if (!m_reactors.empty()) {
+        // 每个reactor有自己的eventfd，从不同的位置开始找睡眠中的线程
+        size_t size = m_reactors.size();
+        size_t start = m_nextWake++;
+        for (size_t i = 0; i < size && count > 0; ++i) {
+            if (wakeReactor(m_reactors[(start + i) % size])) {
+                --count;
+            }
+        }
+        return;
+    }
+    size_t sleeping = m_sleepingCount;
+    if (sleeping == 0 || count == 0) {
+        return;
+    }
+    // 已经在唤醒的数量足够时不需要再写入
+    size_t pending = m_pendingWakeups;
+    size_t target = 0;
+    do {
+        if (pending >= sleeping) {
+            return;
+        }
+        target = std::min(pending + count, sleeping);
+    } while (!m_pendingWakeups.compare_exchange_weak(pending, target));
+    // 只有0 --> 非0时写入；其余的由被唤醒的线程接力
+    if (pending == 0) {
+        wakeOne();
+    }
+}
+
+void IOManager::tickleThread(int thread) {
+    if (m_reactors.empty()) {
+        tickle();
         return;
     }
-    // WEBS_LOG_INFO(g_logger) << "IOManager::tickle ";
-    // 向管道中发送一个消息，通知线程执行任务
-    int rt = write(m_tickleFds[1], "T", 1);
-    WEBS_ASSERT(rt == 1);
+    for (Reactor *reactor : m_reactors) {
+        if (reactor->thread == thread) {
+            // 线程没有睡眠时会在下一轮检查任务队列
+            wakeReactor(reactor);
+            return;
+        }
+    }
+    tickle();
+}
+
+bool IOManager::wakeReactor(Reactor *reactor) {
+    if (!reactor->sleeping || !reactor->sleeping.exchange(false)) {
+        return false;
+    }
+    uint64_t one = 1;
+    int rt = write(reactor->tickleFd, &one, sizeof(one));
+    WEBS_ASSERT(rt == sizeof(one));
+    ++m_tickleCount;
+    return true;
+}
+
+void IOManager::wakeOne() {
+    uint64_t one = 1;
+    int rt = write(m_tickleFd, &one, sizeof(one));
+    WEBS_ASSERT(rt == sizeof(one));
+    ++m_tickleCount;
+}
+
+/* 读取eventfd后，还有需要唤醒的线程时唤醒下一个 */
+void IOManager::onWakeup() {
+    uint64_t value = 0;
+    int len = read(m_tickleFd, &value, sizeof(value));
+    (void)len;
+    size_t pending = m_pendingWakeups;
+    size_t next = 0;
+    do {
+        next = pending > 0 ? pending - 1 : 0;
+        // 没有线程在睡眠，剩余的唤醒作废；之后睡眠的线程会先检查任务队列
+        if (next > 0 && m_sleepingCount == 0) {
+            next = 0;
+        }
+    } while (!m_pendingWakeups.compare_exchange_weak(pending, next));
+    if (next > 0) {
+        wakeOne();
+    }
+}
+
+void IOManager::dispatchEvent(FdContext *ctx, uint32_t events, int epfd, TaskBatch &batch, int self, uint64_t ready_us,
+                              uint64_t tag) {
+    FdContext::MutexType::Lock lock(ctx->mutex);
+    if (events & (EPOLLERR | EPOLLHUP)) {
+        // 将监听事件设置为socket的读或者写事件；持久注册时读写都视为就绪
+        events |= (EPOLLIN | EPOLLOUT) & (m_persistent ? (EPOLLIN | EPOLLOUT) : ctx->events);
+    }
+    int real_events = NONE;
+    if (events & EPOLLIN) {
+        real_events |= READ;
+    }
+    if (events & EPOLLOUT) {
+        real_events |= WRITE;
+    }
+    if (m_persistent) {
+        // 没有等待者的就绪事件保存起来，由下一次addEvent消费
+        ctx->ready = (Event)(ctx->ready | (real_events & ~ctx->events));
+    }
+    real_events &= ctx->events;
+    // 校验事件
+    if (real_events == NONE) {
+        return;
+    }
+
+    if (!m_persistent) {
+        // 重新设置监听事件
+        Event new_event = (Event)(ctx->events & (~events));
+        int op = new_event ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
+        epoll_event event;
+        event.events = EPOLLET | new_event;
+        event.data.ptr = ctx;
+        int res = epoll_ctl(epfd, op, ctx->fd, &event);
+        ++m_epollCtlCount;
+        if (res) {
+            WEBS_LOG_ERROR(g_logger) << "epoll_ctl(" << epfd << ", "
+                                     << (EpollCtop)op << ", " << ctx->fd << ", "
+                                     << (EPOLL_EVENTS)event.events << "): " << res
+                                     << "( " << errno << strerror(errno) << ")";
+            return;
+        }
+    }
+
+    ctx->lastDispatch.store(tag, std::memory_order_relaxed);
+    // 触发事件；读写同时就绪时两个都要触发
+    if (real_events & READ) {
+        ctx->triggerEvent(READ, &batch, self, ready_us);
+        --m_pendingEventCount;
+    }
+    if (real_events & WRITE) {
+        ctx->triggerEvent(WRITE, &batch, self, ready_us);
+        --m_pendingEventCount;
+    }
 }
 
 /* 协程无任务可以调度时，执行idle协程 */
@@ -341,104 +1018,158 @@ void IOManager::tickle() {
 void IOManager::idle() {
     // 设置epoll事件数组
     WEBS_LOG_DEBUG(g_logger) << " idle";
-    const uint64_t MAX_EVENTS = 256;
-    epoll_event *events = new epoll_event[MAX_EVENTS]();
+    // 按最大批量分配，实际每次取出的数量在[m_batchMin, m_batchMax]之间调整
+    epoll_event *events = new epoll_event[m_batchMax]();
     std::shared_ptr<epoll_event> shared_events(events, [](epoll_event *ptr) { delete[] ptr; });
+    WorkerStats &stats = *m_workerStats[getWorkerIndex()];
+    uint32_t batch_size = m_batchMin;
+    // 连续取不满四分之一的次数
+    uint32_t low_rounds = 0;
+    // 每轮epoll_wait触发的任务；反复使用，不重新分配
+    TaskBatch batch(this);
+    std::vector<std::function<void()>> cbs;
+    // 多reactor模式下只等待本线程的epoll，事件在本线程恢复
+    Reactor *reactor = m_reactors.empty() ? nullptr : m_reactors[getWorkerIndex()];
+    int epfd = reactor ? reactor->epfd : m_epfd;
+    int self = reactor ? GetThreadId() : -1;
+    if (reactor) {
+        reactor->thread = self;
+    }
+    // 本线程的日志、连接池读取缓存的时间，每次epoll_wait返回时更新
+    CoarseClock::SetThis(&m_clock);
 
     while (true) {
         // 是否已经停止
         uint64_t next_timeout = 0;
         if (WEBS_UNLIKELY(stopping(next_timeout))) {
             WEBS_LOG_INFO(g_logger) << "name = " << getName()
-                                    << " idle stopping exit";
+                                    << " idle stopping exit, avoided wakeups = " << getAvoidedWakeups();
+            // 每次只唤醒一个线程，由退出的线程依次唤醒下一个
+            tickle();
+            CoarseClock::SetThis(nullptr);
             break;
         }
 
+        // 先在任务队列上自旋一小段时间，任务很快到来时不需要睡眠和唤醒的系统调用
+        bool has_task = hasNewTasks();
+        if (!has_task && s_idle_spin_us > 0 && next_timeout != 0) {
+            uint64_t deadline = GetMonotonicUS() + s_idle_spin_us;
+            do {
+                for (int i = 0; i < 64 && !has_task; ++i) {
+                    CpuRelax();
+                    has_task = hasNewTasks();
+                }
+            } while (!has_task && GetMonotonicUS() < deadline);
+        }
+
         // 设置超时等待的epoll_wait函数
         int rt = 0;
         do {
+            // 先登记为睡眠再检查任务和定时器，保证之后的tickle一定会写eventfd
+            if (reactor) {
+                reactor->sleeping = true;
+            } else {
+                ++m_sleepingCount;
+            }
+            next_timeout = getNextTimer();
             // 最大超时时间
             static const int MAX_TIMEOUT = 3000;
-            if (next_timeout != ~0ull) {
+            if (has_task || hasNewTasks() || (reactor && stopping())) {
+                // 有任务时只检查一下IO事件，不阻塞
+                next_timeout = 0;
+            } else if (next_timeout != ~0ull) {
                 next_timeout = (int)next_timeout > MAX_TIMEOUT ? MAX_TIMEOUT : next_timeout;
             } else {
                 next_timeout = MAX_TIMEOUT;
             }
             WEBS_LOG_DEBUG(g_logger) << " epoll_wait time " << next_timeout;
 
-            rt = epoll_wait(m_epfd, events, MAX_EVENTS, (int)next_timeout);
+            uint64_t wait_start = GetMonotonicUS();
+            rt = epoll_wait(epfd, events, batch_size, (int)next_timeout);
+            stats.epollWaitUs.record(GetMonotonicUS() - wait_start);
+            if (reactor) {
+                reactor->sleeping = false;
+            } else {
+                --m_sleepingCount;
+            }
             if (rt < 0 && errno == EINTR) {
             } else {
                 break;
             }
         } while (true);
+        m_clock.update();
+        uint64_t ready_us = GetMonotonicUS();
+        // 序号只在本线程内递增，和线程下标一起标记分发的fd，不在线程之间共享计数器
+        uint64_t tag = (++stats.wakeupSeq << 16) | (getWorkerIndex() & 0xffff);
 
         WEBS_LOG_DEBUG(g_logger) << " epoll_wait rt " << rt;
+        if (rt >= 0) {
+            stats.eventsPerWakeup.record(rt);
+            // 取满说明内核中还有就绪事件，扩大批量；负载下降后逐步缩小，共用epoll时把事件留给其他线程
+            if ((uint32_t)rt == batch_size && batch_size < m_batchMax) {
+                batch_size = std::min(batch_size * 2, m_batchMax);
+                low_rounds = 0;
+            } else if ((uint32_t)rt < batch_size / 4 && batch_size > m_batchMin) {
+                if (++low_rounds >= 16) {
+                    batch_size = std::max(batch_size / 2, m_batchMin);
+                    low_rounds = 0;
+                }
+            } else {
+                low_rounds = 0;
+            }
+            stats.batchSize.store(batch_size, std::memory_order_relaxed);
+        }
 
-        // 处理定时器的回调函数；如果有的话
-        std::vector<std::function<void()>> cbs;
+        // 处理定时器的回调函数；如果有的话，和IO事件一起批量调度
         listExpiredCb(cbs);
-
-        if (!cbs.empty()) {
-            // for (auto &i : cbs) {
-            //     schedule(i);
-            // }
-            schedule(cbs.begin(), cbs.end());
-            cbs.clear();
+        for (auto &i : cbs) {
+            batch.add(&i);
         }
+        cbs.clear();
 
-        // 处理事件
+        // 处理事件：先分发上一轮没有就绪的fd，连续就绪的热点fd(繁忙的监听fd、连接)排在后面，不能总是占据队列的前面
+        // 热点fd只在本批内排到后面，仍然在本次唤醒中分发，不会推迟到下一次唤醒；
+        // 热点由同一个线程的上一次唤醒判断，共用epoll时在线程之间轮转的fd不会被识别
+        int hot = 0;
+        uint64_t prev_tag = tag - (1ull << 16);
         for (int i = 0; i < rt; ++i) {
             epoll_event &event = events[i];
             // 检查事件是否是唤醒线程的事件
-            if (event.data.fd == m_tickleFds[0]) {
-                uint8_t buf[256];
-                while (read(m_tickleFds[0], buf, sizeof(buf)) > 0)
-                    ;
+            if (reactor && event.data.fd == reactor->tickleFd) {
+                uint64_t value = 0;
+                int len = read(reactor->tickleFd, &value, sizeof(value));
+                (void)len;
                 continue;
             }
-
-            // 确定事件
-            FdContext *ctx = (FdContext *)event.data.ptr;
-            FdContext::MutexType::Lock lock(ctx->mutex);
-            if (event.events & (EPOLLERR | EPOLLHUP)) {
-                event.events |= (EPOLLIN | EPOLLOUT) & ctx->events; // 将监听事件设置为socket的读或者写事件
-            }
-            int real_events = NONE;
-            if (event.events & EPOLLIN) {
-                real_events |= READ;
-            }
-            if (event.events & EPOLLOUT) {
-                real_events |= WRITE;
-            }
-            // 校验事件
-            if ((ctx->events & real_events) == NONE) {
+            if (event.data.fd == m_tickleFd) {
+                onWakeup();
                 continue;
             }
-
-            // 重新设置监听事件
-            Event new_event = (Event)(ctx->events & (~event.events));
-            int op = new_event ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
-            event.events = EPOLLET | new_event;
-            int res = epoll_ctl(m_epfd, op, ctx->fd, &event);
-            if (res) {
-                WEBS_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", "
-                                         << (EpollCtop)op << ", " << ctx->fd << ", "
-                                         << (EPOLL_EVENTS)event.events << "): " << res
-                                         << "( " << errno << strerror(errno) << ")";
+            if (m_uring && event.data.fd == m_uringFd) {
+                onUringEvent(batch);
                 continue;
             }
 
-            // 触发事件
-            if (real_events == READ) {
-                ctx->triggerEvent(READ);
-                --m_pendingEventCount;
-            }
-            if (real_events == WRITE) {
-                ctx->triggerEvent(WRITE);
-                --m_pendingEventCount;
+            FdContext *ctx = (FdContext *)event.data.ptr;
+            uint64_t last = ctx->lastDispatch.load(std::memory_order_relaxed);
+            if (last && last == prev_tag) {
+                // 已经处理过的位置可以复用
+                events[hot++] = event;
+                continue;
             }
+            dispatchEvent(ctx, event.events, epfd, batch, self, ready_us, tag);
+        }
+        for (int i = 0; i < hot; ++i) {
+            dispatchEvent((FdContext *)events[i].data.ptr, events[i].events, epfd, batch, self, ready_us, tag);
+        }
+#ifdef WEBS_HAVE_IO_URING
+        if (m_uring) {
+            // 之前内核繁忙没有接收的提交项
+            m_uring->flush();
         }
+#endif
+        // 一次放入队列，按任务数量唤醒线程
+        batch.submit();
         // 切换其他上下文执行，不能直接使用swapout
         Fiber::ptr fiber = Fiber::GetThis();
         auto raw = fiber.get();
@@ -452,4 +1183,11 @@ void IOManager::onTimerInsertedAtFront() {
     tickle();
 }
 
+void IOManager::onFiberReady(uint64_t latency_us) {
+    int index = getWorkerIndex();
+    if (index >= 0 && index < (int)m_workerStats.size()) {
+        m_workerStats[index]->readyToResumeUs.record(latency_us);
+    }
+}
+
 } // namespace webs
\ No newline at end of file
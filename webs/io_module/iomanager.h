@@ -3,8 +3,13 @@
 #include "../coroutine_module/scheduler.h"
 #include "../log_module/log.h"
 #include "../io_module/timer.h"
+#include "../util_module/fd_table.h"
+#include "../util_module/histogram.h"
 
 namespace webs {
+
+class IoUring;
+
 // 每一个类的继承权限都是单独的；public不可省
 class IOManager : public Scheduler, public TimerManager {
 public:
@@ -21,6 +26,25 @@ public:
 
 private:
     // Socket事件上下文类
+    struct FdContext;
+
+    /* IO等待的超时；嵌入在事件上下文中，等待时链入时间轮，不分配内存 */
+    struct IoTimeout : public TimerNode {
+        IoTimeout() :
+            TimerNode(&IOManager::OnIoTimeout) {
+        }
+        IOManager *iom = nullptr;
+        // 所属的fd上下文与事件；fd上下文创建时设置
+        FdContext *fdCtx = nullptr;
+        Event event = NONE;
+        // 每次带超时的等待加一；已经到期但是还没有执行的回调据此忽略之前的等待
+        uint32_t seq = 0;
+        // 是否链入了时间轮
+        bool armed = false;
+        // 第seq次等待是否因为超时结束；结果留在这里由等待者加锁读取，不写等待者的栈(共享栈的协程切出后栈会被其他协程使用)
+        bool fired = false;
+    };
+
     struct FdContext {
         typedef Mutex MutexType;
         // 事件上下文类
@@ -31,6 +55,8 @@ private:
             Fiber::ptr fiber;
             // 事件的回调函数
             std::function<void()> cb;
+            // 等待的超时
+            IoTimeout timeout;
         };
 
         /* 获取事件上下文类 */
@@ -39,8 +65,11 @@ private:
         /* 重置事件上下文类 */
         void resetContext(EventContext &ctx);
 
-        /* 设置触发事件 */
-        void triggerEvent(Event event);
+        /* 等待结束：取消还没有到期的超时 */
+        void disarmTimeout(EventContext &ctx);
+
+        /* 设置触发事件；thread为恢复协程的线程，-1表示任意线程；ready_us为epoll返回就绪的时间，0表示不统计延迟 */
+        void triggerEvent(Event event, Scheduler::TaskBatch *batch = nullptr, int thread = -1, uint64_t ready_us = 0);
 
         // 读事件上下文
         EventContext read;
@@ -51,6 +80,72 @@ private:
         // 当前的事件
         Event events = NONE;
         MutexType mutex;
+        // 还没有完成的io_uring请求数量；close时需要取消
+        std::atomic<int> uringPending = {0};
+        // 持久注册：是否已经以EPOLLIN|EPOLLOUT|EPOLLET加入epoll
+        bool registered = false;
+        // 持久注册：没有等待者时到达的就绪事件，下一次addEvent直接消费
+        Event ready = NONE;
+        // 多reactor：fd所属的reactor下标，-1表示还没有分配
+        int home = -1;
+        // 最近一次分发就绪事件的线程和它的唤醒序号(序号<<16|工作线程下标)；用于识别连续就绪的热点fd
+        std::atomic<uint64_t> lastDispatch = {0};
+    };
+
+    /* 多reactor模式下每个线程独占的epoll */
+    struct Reactor {
+        // epoll的文件描述符
+        int epfd = -1;
+        // 唤醒该线程的eventfd
+        int tickleFd = -1;
+        // 所属线程；线程第一次进入idle时设置
+        std::atomic<int> thread = {-1};
+        // 是否阻塞在epoll_wait中
+        std::atomic<bool> sleeping = {false};
+    };
+
+public:
+    /**
+     * 通过io_uring执行的一次IO；放在发起IO的协程栈上，完成之前协程不会恢复。
+     * 栈在完成之前必须一直有效，共享栈的协程不使用io_uring(切出后栈会被其他协程使用)
+     * addr/len/addr2/flags的含义与IORING_OP_*对应：缓冲区或iovec/msghdr、长度或iovec数量、accept的addrlen、recv/send/accept的flags
+     */
+    struct UringIo {
+        UringIo(uint8_t op, int f, const void *a, uint32_t l, uint32_t fl = 0, void *a2 = nullptr) :
+            opcode(op), fd(f), addr((void *)a), len(l), flags(fl), addr2(a2) {
+        }
+
+        uint8_t opcode;
+        int fd;
+        void *addr;
+        uint32_t len;
+        uint32_t flags;
+        void *addr2;
+        // 结果；负数为-errno
+        int32_t result = 0;
+        // 是否因为超时被取消
+        bool timeout = false;
+        // 还没有收到的完成项数量(IO以及链接的超时)
+        std::atomic<int> pending = {0};
+        // 链接超时的时间(__kernel_timespec)；内核可能在submit返回之后才读取
+        int64_t ts[2] = {0, 0};
+        // 完成后调度的协程与调度器
+        Fiber::ptr fiber;
+        Scheduler *scheduler = nullptr;
+    };
+
+    /* 每个线程的epoll统计；只由该线程写入 */
+    struct WorkerStats {
+        // 每次epoll_wait返回的事件数
+        Histogram eventsPerWakeup;
+        // 每次epoll_wait的耗时(微秒)
+        Histogram epollWaitUs;
+        // IO就绪到等待的协程恢复执行的时间(微秒)
+        Histogram readyToResumeUs;
+        // 当前的epoll_wait批量大小
+        std::atomic<uint32_t> batchSize = {0};
+        // 本线程epoll_wait返回的次数；只由本线程读写
+        uint64_t wakeupSeq = 0;
     };
 
 public:
@@ -62,6 +157,12 @@ public:
     /* 添加事件 */
     int addEvent(int fd, Event event, std::function<void()> cb = nullptr);
 
+    /* 当前协程等待事件；timeout_ms之后还没有触发时取消等待。*wait_seq返回本次等待的序号，恢复之后用waitTimedOut查询结果。超时嵌入在fd上下文中，不分配内存 */
+    int addEvent(int fd, Event event, uint64_t timeout_ms, uint32_t *wait_seq);
+
+    /* 序号为wait_seq的等待是否因为超时结束 */
+    bool waitTimedOut(int fd, Event event, uint32_t wait_seq);
+
     /* 删除事件 */
     bool delEvent(int fd, Event event);
 
@@ -71,9 +172,62 @@ public:
     /* 取消所有事件 */
     bool cancelAll(int fd);
 
+    /* 是否使用io_uring后端，并且内核支持opcode(IORING_OP_*) */
+    bool isUringSupported(uint8_t opcode) const;
+
+    /**
+     * 提交io，全部完成项到达后调度io->fiber；timeout_ms为~0ull表示不超时
+     * 提交队列已满返回false，调用者退回epoll
+     */
+    bool submitIo(UringIo *io, uint64_t timeout_ms = ~0ull);
+
+    /* 取消还没有完成的io；io仍然会完成，结果为-ECANCELED或者已经完成的结果 */
+    void cancelIo(UringIo *io);
+
+    /* 通过io_uring提交的io数量；退回epoll的io不计入 */
+    uint64_t getUringSubmitCount() const {
+        return m_uringSubmitCount.load(std::memory_order_relaxed);
+    }
+
+    /* 通过io_uring完成的io数量 */
+    uint64_t getUringCompleteCount() const {
+        return m_uringCompleteCount.load(std::memory_order_relaxed);
+    }
+
+    /* 多reactor模式下，把还没有分配reactor的fd分配给当前线程；返回fd是否由当前线程处理 */
+    bool attachToLocalReactor(int fd);
+
+    /* 是否每个线程一个epoll(iomanager.multi_reactor) */
+    bool isMultiReactor() const {
+        return !m_reactors.empty();
+    }
+
+    /* 统计的线程数量；use_caller模式包括调用线程，下标与m_threadIds一致 */
+    size_t getWorkerCount() const {
+        return m_workerStats.size();
+    }
+
+    /* 第worker个线程的epoll统计 */
+    const WorkerStats &getWorkerStats(size_t worker) const {
+        return *m_workerStats[worker];
+    }
+
+    /* 调用epoll_ctl的次数 */
+    uint64_t getEpollCtlCount() const {
+        return m_epollCtlCount;
+    }
+
+    /* 缓存的粗粒度时钟；idle线程每次从epoll_wait返回时更新 */
+    const CoarseClock &getClock() const {
+        return m_clock;
+    }
+
     /* 返回当前的IOManager */
     static IOManager *GetThis();
 
+    /* fd关闭之前调用：清除所有IOManager中fd的持久注册和所属的reactor，之后复用相同的fd时重新注册、重新选择reactor */
+    static void UnregisterAll(int fd);
+
 protected:
     /* 返回是否可以停止 */
     bool stopping() override;
@@ -84,26 +238,106 @@ protected:
     /* 通知协程调度器有任务了；可以自定义调度器的执行方式(如何调度) */
     void tickle() override;
 
+    /* 唤醒count个阻塞在epoll_wait中的线程；只写一次eventfd，被唤醒的线程依次唤醒下一个 */
+    void tickle(size_t count) override;
+
+    /* 多reactor模式下只唤醒thread */
+    void tickleThread(int thread) override;
+
     /* 当有新的定时器插入到定时器的首部,执行该函数 */
     void onTimerInsertedAtFront() override;
 
-    /* 重置socket事件上下文容器的大小 */
-    void contextResize(size_t size);
+    /* 记录就绪到恢复执行的延迟 */
+    void onFiberReady(uint64_t latency_us) override;
+
+    /* 当前线程的时间轮下标(iomanager.timer_per_thread) */
+    int getTimerWheelIndex() const override;
 
     /* 判断是否可以停止 */
     bool stopping(uint64_t &timeout);
 
+    /* 写eventfd唤醒一个睡眠线程 */
+    void wakeOne();
+
+    /* 处理eventfd可读事件 */
+    void onWakeup();
+
+    /* 收割io_uring的完成项，完成的IO放入batch */
+    void onUringEvent(TaskBatch &batch);
+
+    /* 分发一个fd的就绪事件：保存没有等待者的就绪事件，触发等待的事件放入batch；tag为本线程本次唤醒的标记 */
+    void dispatchEvent(FdContext *ctx, uint32_t events, int epfd, TaskBatch &batch, int self, uint64_t ready_us,
+                       uint64_t tag);
+
+    /* 取消fd上所有还没有完成的io_uring请求 */
+    void cancelUringFd(int fd);
+
+    /* 获取fd的事件上下文，不存在时创建；fd超出范围返回nullptr */
+    FdContext *getFdContext(int fd);
+
+    /* 添加事件的实现；wait_seq不为空时等待timeout_ms */
+    int doAddEvent(int fd, Event event, std::function<void()> &cb, uint64_t timeout_ms, uint32_t *wait_seq);
+
+    /* 取消事件；调用者持有fd_ctx->mutex */
+    bool cancelEventNolock(FdContext *fd_ctx, Event event);
+
+    /* IO超时的到期函数：只放入一个回调，回调中取消等待 */
+    static void OnIoTimeout(TimerNode *node, std::vector<std::function<void()>> &cbs);
+
+    /* IO超时：等待还没有结束时设置超时标记并取消事件 */
+    void onIoTimeout(IoTimeout *timeout, uint32_t seq);
+
+    /* 清除fd的持久注册、就绪事件与所属reactor；调用者持有fd_ctx->mutex */
+    void unregister(FdContext *fd_ctx);
+
+    /* fd所在的epoll；多reactor模式下为fd所属reactor的epoll */
+    int epfdOf(FdContext *fd_ctx) const;
+
+    /* 恢复fd上等待者的线程；多reactor模式下为fd所属reactor的线程，否则为-1 */
+    int homeThreadOf(FdContext *fd_ctx) const;
+
+    /* 为新的fd选择reactor：SO_INCOMING_CPU(iomanager.reactor_assign = incoming_cpu)或者轮询 */
+    int chooseReactor(int fd);
+
+    /* 多reactor模式下唤醒一个睡眠中的reactor；返回是否写入了eventfd */
+    bool wakeReactor(Reactor *reactor);
+
 private:
     // epoll的文件描述符
     int m_epfd = 0;
-    // pipe 文件描述符
-    int m_tickleFds[2];
+    // 唤醒idle线程的eventfd
+    int m_tickleFd = -1;
+    // 阻塞在epoll_wait中的线程数量；为0时tickle不需要系统调用
+    std::atomic<size_t> m_sleepingCount = {0};
+    // 还需要唤醒的线程数量；不超过睡眠的线程数，期间的tickle合并
+    std::atomic<size_t> m_pendingWakeups = {0};
     // 用于创建原子对象；当前等待执行的事件数量
     std::atomic<size_t> m_pendingEventCount = {0};
-    // 读写锁
-    RWMutexType m_mutex;
-    // socket事件上下文的容器
-    std::vector<FdContext *> m_fdContexts;
+    // epoll_ctl的调用次数
+    std::atomic<uint64_t> m_epollCtlCount = {0};
+    // fd只注册一次，就绪事件保存在FdContext中(iomanager.epoll_persistent，默认关闭)
+    bool m_persistent = false;
+    // 多reactor模式下每个线程的epoll，下标与m_threadIds一致；为空表示所有线程共用m_epfd
+    std::vector<Reactor *> m_reactors;
+    // 轮询分配fd、唤醒线程的起始位置
+    std::atomic<size_t> m_nextReactor = {0};
+    std::atomic<size_t> m_nextWake = {0};
+    // socket事件上下文；按fd分段分配，指针不会失效，查找与扩容都不加锁
+    FdTable<FdContext> m_fdContexts;
+    // io_uring后端；配置为epoll或者内核不支持时为nullptr
+    IoUring *m_uring = nullptr;
+    // io_uring完成时通知的eventfd，加入epoll
+    int m_uringFd = -1;
+    // io_uring提交/完成的io数量
+    std::atomic<uint64_t> m_uringSubmitCount = {0};
+    std::atomic<uint64_t> m_uringCompleteCount = {0};
+    // 缓存的时间
+    CoarseClock m_clock;
+    // 每个线程的epoll统计
+    std::vector<WorkerStats *> m_workerStats;
+    // epoll_wait批量大小的范围(iomanager.epoll_batch_min/max)
+    uint32_t m_batchMin = 32;
+    uint32_t m_batchMax = 256;
 };
 } // namespace webs
 
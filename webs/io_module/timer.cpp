@@ -1,54 +1,50 @@
 #include "timer.h"
 #include "../util_module/util.h"
+#include "../util_module/macro.h"
 #include "../log_module/log.h"
 
+#include <string.h>
+
 namespace webs {
 
 static webs::Logger::ptr g_logger = WEBS_LOG_NAME("system");
 
-/* 定时器的比较仿函数 */
-
-/* 比较两个定时器智能指针的大小 */
-bool Timer::Comparator::operator()(const Timer::ptr &lhs, const Timer::ptr &rhs) const {
-    if (!lhs && !rhs) {
-        return false;
-    }
-    if (!lhs) {
-        return true;
-    }
-    if (!rhs) {
-        return false;
-    }
-    if (lhs->m_next < rhs->m_next) {
-        return true;
-    }
-    if (rhs->m_next < lhs->m_next) {
-        return false;
+/* words中下标不小于from的第一个置位；没有返回-1 */
+static int FindBit(const uint64_t *words, size_t size, size_t from) {
+    for (size_t i = from >> 6; i < size; ++i) {
+        uint64_t bits = words[i];
+        if (i == (from >> 6)) {
+            bits &= ~0ull << (from & 63);
+        }
+        if (bits) {
+            return (int)(i * 64 + __builtin_ctzll(bits));
+        }
     }
-    return lhs.get() < rhs.get();
+    return -1;
 }
 
 /* 构造函数；定时器执行时间间隔、回调函数、是否循环、定时器管理 */
-Timer::Timer(uint64_t ms, std::function<void()> cb, bool recurring, TimerManager *manage) :
+Timer::Timer(uint64_t ms, std::function<void()> cb, bool recurring, TimerManager *manage, uint64_t slack_ms) :
     m_recurring(recurring),
     m_ms(ms),
     m_cb(cb),
     m_manager(manage) {
-    m_next = webs::GetCurrentMS() + ms;
+    m_next = webs::GetMonotonicMS() + ms;
+    m_slack = slack_ms;
 }
 
-/* 构造函数；执行的时间戳 */
-Timer::Timer(uint64_t next) :
-    m_next(next) {
-}
-
-/* 取消定时器; cb置空、IOManager删除对应定时器 */
+/* 取消定时器; cb置空、从时间轮中移除 */
 bool Timer::cancel() {
-    TimerManager::RWMutexType::WriteLock lock(m_manager->m_mutex);
+    // 在锁释放之后才释放时间轮持有的引用
+    Timer::ptr self;
+    TimerWheel::MutexType::Lock lock(m_wheel->mutex);
     if (m_cb) {
         m_cb = nullptr;
-        auto it = m_manager->m_timers.find(shared_from_this());
-        m_manager->m_timers.erase(it);
+        if (m_level != -1) {
+            m_wheel->remove(this);
+            self.swap(m_self);
+            --m_manager->m_timerCount;
+        }
         return true;
     }
     return false;
@@ -56,17 +52,13 @@ bool Timer::cancel() {
 
 /* 刷新定时器；要先删除再添加 */
 bool Timer::refresh() {
-    TimerManager::RWMutexType::WriteLock lock(m_manager->m_mutex);
-    if (!m_cb) {
+    TimerWheel::MutexType::Lock lock(m_wheel->mutex);
+    if (!m_cb || m_level == -1) {
         return false;
     }
-    auto it = m_manager->m_timers.find(shared_from_this());
-    if (it == m_manager->m_timers.end()) {
-        return false;
-    }
-    m_manager->m_timers.erase(it);
-    m_next = webs::GetCurrentMS() + m_ms;
-    m_manager->m_timers.insert(shared_from_this());
+    m_wheel->remove(this);
+    m_next = m_wheel->coalesce(webs::GetMonotonicMS() + m_ms, m_slack);
+    m_wheel->insert(this);
     return true;
 }
 
@@ -75,40 +67,242 @@ bool Timer::reset(uint64_t ms, bool from_now) {
     if (ms == m_ms && !from_now) {
         return true;
     }
-    TimerManager::RWMutexType::WriteLock lock(m_manager->m_mutex);
-    if (!m_cb) {
-        return false;
-    }
-    auto it = m_manager->m_timers.find(shared_from_this());
-    if (it == m_manager->m_timers.end()) {
+    TimerWheel::MutexType::Lock lock(m_wheel->mutex);
+    if (!m_cb || m_level == -1) {
         return false;
     }
-    m_manager->m_timers.erase(it); // 先移除再添加
+    m_wheel->remove(this); // 先移除再添加
     uint64_t starttime;
     if (from_now) {
-        starttime = webs::GetCurrentMS();
+        starttime = webs::GetMonotonicMS();
     } else {
         starttime = m_next - m_ms;
     }
-    m_next = starttime + ms;
+    m_next = m_wheel->coalesce(starttime + ms, m_slack);
     m_ms = ms;
-    m_manager->addTimer(shared_from_this(), lock);
+    m_wheel->insert(this);
     return true;
 }
 
+TimerWheel::TimerWheel(uint64_t now) :
+    m_current(now) {
+    memset(m_slots, 0, sizeof(m_slots));
+    memset(m_bits, 0, sizeof(m_bits));
+}
+
+uint64_t TimerWheel::coalesce(uint64_t next, uint64_t slack) const {
+    if (slack == 0) {
+        return next;
+    }
+    if (hint != ~0ull && hint >= next && hint - next <= slack) {
+        return hint;
+    }
+    uint64_t grain = 1ull << (63 - __builtin_clzll(slack));
+    return (next + grain - 1) & ~(grain - 1);
+}
+
+/* 按照到期时间与当前tick的距离选择层：距离越远层越高 */
+void TimerWheel::insert(TimerNode *timer) {
+    uint64_t expires = timer->m_next < m_current ? m_current : timer->m_next;
+    uint64_t delta = expires - m_current;
+    int level = 0;
+    // 第level层能容纳的距离上限正好是上一层槽的位移
+    while (level + 1 < LEVELS && delta >= ((uint64_t)1 << shiftOf(level + 1))) {
+        ++level;
+    }
+    if (level == LEVELS - 1) {
+        // 超出范围的放在最高层能到达的最远位置，下放时按真实的到期时间重新放置
+        uint64_t max_delta = ((uint64_t)1 << (shiftOf(level) + LEVEL_BITS)) - 1;
+        if (delta > max_delta) {
+            expires = m_current + max_delta;
+        }
+    }
+    size_t slot = (expires >> shiftOf(level)) & ((level == 0 ? ROOT_SIZE : LEVEL_SIZE) - 1);
+
+    TimerNode *&head = m_slots[level][slot];
+    timer->m_prev = nullptr;
+    timer->m_succ = head;
+    if (head) {
+        head->m_prev = timer;
+    }
+    head = timer;
+    timer->m_level = level;
+    timer->m_slot = (int)slot;
+    m_bits[level][slot >> 6] |= 1ull << (slot & 63);
+    ++m_count;
+}
+
+void TimerWheel::remove(TimerNode *timer) {
+    if (timer->m_prev) {
+        timer->m_prev->m_succ = timer->m_succ;
+    } else {
+        m_slots[timer->m_level][timer->m_slot] = timer->m_succ;
+        if (!timer->m_succ) {
+            m_bits[timer->m_level][timer->m_slot >> 6] &= ~(1ull << (timer->m_slot & 63));
+        }
+    }
+    if (timer->m_succ) {
+        timer->m_succ->m_prev = timer->m_prev;
+    }
+    timer->m_prev = timer->m_succ = nullptr;
+    timer->m_level = timer->m_slot = -1;
+    --m_count;
+}
+
+TimerNode *TimerWheel::takeSlot(int level, size_t slot) {
+    TimerNode *list = m_slots[level][slot];
+    m_slots[level][slot] = nullptr;
+    m_bits[level][slot >> 6] &= ~(1ull << (slot & 63));
+    for (TimerNode *i = list; i; i = i->m_succ) {
+        i->m_level = i->m_slot = -1;
+        --m_count;
+    }
+    return list;
+}
+
+/* m_current位于第0层一圈的起点：下放第1层当前的槽；第1层也转完一圈时继续下放第2层，依此类推 */
+void TimerWheel::cascade() {
+    for (int level = 1; level < LEVELS; ++level) {
+        size_t slot = (m_current >> shiftOf(level)) & (LEVEL_SIZE - 1);
+        TimerNode *list = takeSlot(level, slot);
+        while (list) {
+            TimerNode *next = list->m_succ;
+            insert(list);
+            list = next;
+        }
+        if (slot != 0) {
+            break;
+        }
+    }
+}
+
+uint64_t TimerWheel::nextExpire() const {
+    if (m_count == 0) {
+        return ~0ull;
+    }
+    uint64_t next = ~0ull;
+    // 第0层的槽中都是一圈之内的定时器，槽的位置就是准确的到期时间
+    size_t index = m_current & (ROOT_SIZE - 1);
+    int slot = FindBit(m_bits[0], ROOT_SIZE / 64, index);
+    if (slot == -1) {
+        slot = FindBit(m_bits[0], ROOT_SIZE / 64, 0);
+    }
+    if (slot != -1) {
+        next = m_current + ((slot - index) & (ROOT_SIZE - 1));
+    }
+    // 上层的槽只知道下放的时间
+    for (int level = 1; level < LEVELS; ++level) {
+        int shift = shiftOf(level);
+        uint64_t block = m_current >> shift;
+        size_t current = block & (LEVEL_SIZE - 1);
+        int found = FindBit(m_bits[level], 1, current);
+        if (found == -1) {
+            found = FindBit(m_bits[level], 1, 0);
+        }
+        if (found == -1) {
+            continue;
+        }
+        uint64_t distance = (found - current) & (LEVEL_SIZE - 1);
+        if (distance == 0 && (m_current & (((uint64_t)1 << shift) - 1)) != 0) {
+            // 当前块已经下放过，要等转完一圈
+            distance = LEVEL_SIZE;
+        }
+        uint64_t when = (block + distance) << shift;
+        if (when < next) {
+            next = when;
+        }
+    }
+    return next;
+}
+
+TimerNode *TimerWheel::expire(uint64_t now) {
+    TimerNode *expired = nullptr;
+    while (m_current <= now) {
+        if (m_count == 0) {
+            m_current = now + 1;
+            break;
+        }
+        size_t index = m_current & (ROOT_SIZE - 1);
+        if (index == 0) {
+            cascade();
+        }
+        TimerNode *list = takeSlot(0, index);
+        while (list) {
+            TimerNode *next = list->m_succ;
+            list->m_prev = nullptr;
+            list->m_succ = expired;
+            expired = list;
+            list = next;
+        }
+        // 跳过空槽：直接到下一个非空槽，或者本圈结束(需要下放)
+        int slot = FindBit(m_bits[0], ROOT_SIZE / 64, index + 1);
+        uint64_t step = slot == -1 ? ROOT_SIZE - index : slot - index;
+        m_current = std::min(m_current + step, now + 1);
+    }
+    return expired;
+}
+
+TimerNode *TimerWheel::takeAll() {
+    TimerNode *expired = nullptr;
+    for (int level = 0; level < LEVELS; ++level) {
+        for (size_t slot = 0; slot < ROOT_SIZE; ++slot) {
+            TimerNode *list = takeSlot(level, slot);
+            while (list) {
+                TimerNode *next = list->m_succ;
+                list->m_prev = nullptr;
+                list->m_succ = expired;
+                expired = list;
+                list = next;
+            }
+        }
+    }
+    return expired;
+}
+
 /* 构造函数 */
-TimerManager::TimerManager() :
-    m_previousTime(webs::GetCurrentMS()) {
+TimerManager::TimerManager() {
+    m_wheels.push_back(new TimerWheel(webs::GetMonotonicMS()));
 }
 
 TimerManager::~TimerManager() {
+    // 时间轮中的Timer持有自己，需要主动释放；嵌入式节点由持有者管理
+    for (auto wheel : m_wheels) {
+        TimerNode *list = wheel->takeAll();
+        while (list) {
+            TimerNode *next = list->m_succ;
+            list->m_succ = nullptr;
+            if (!list->m_onExpire) {
+                static_cast<Timer *>(list)->m_self.reset();
+            }
+            list = next;
+        }
+        delete wheel;
+    }
+}
+
+void TimerManager::initTimerWheels(size_t threads) {
+    WEBS_ASSERT(m_timerCount == 0 && m_wheels.size() == 1);
+    for (size_t i = 0; i < threads; ++i) {
+        m_wheels.insert(m_wheels.end() - 1, new TimerWheel(webs::GetMonotonicMS()));
+    }
+}
+
+TimerWheel *TimerManager::getLocalWheel() const {
+    if (m_wheels.size() == 1) {
+        return nullptr;
+    }
+    int index = getTimerWheelIndex();
+    if (index < 0 || index >= (int)m_wheels.size() - 1) {
+        return nullptr;
+    }
+    return m_wheels[index];
 }
 
 // 添加定时器
-Timer::ptr TimerManager::addTimer(uint64_t ms, std::function<void()> cb, bool recurring) {
-    Timer::ptr newTimer(new Timer(ms, cb, recurring, this));
-    RWMutexType::WriteLock lock(m_mutex);
-    addTimer(newTimer, lock);
+Timer::ptr TimerManager::addTimer(uint64_t ms, std::function<void()> cb, bool recurring, uint64_t slack_ms) {
+    Timer::ptr newTimer(new Timer(ms, cb, recurring, this, slack_ms));
+    TimerWheel *wheel = getLocalWheel();
+    addTimer(newTimer, wheel ? wheel : m_wheels.back());
     return newTimer;
 }
 
@@ -119,12 +313,52 @@ static void OnTime(std::function<void()> cb, std::weak_ptr<void> weak_cond) {
     }
 }
 
-// 插入定时器 --> 如果是队首，判断是否需要执行对应的函数
-void TimerManager::addTimer(Timer::ptr val, RWMutexType::WriteLock &lock) {
-    auto it = m_timers.insert(val).first;
-    bool at_front = it == m_timers.begin() && !m_tickled;
+// 插入定时器；时间轮持有定时器直到到期或者取消
+void TimerManager::addTimer(Timer::ptr val, TimerWheel *wheel) {
+    val->m_self = val;
+    insertNode(val.get(), wheel);
+}
+
+void TimerManager::addTimerNode(TimerNode *node, uint64_t ms, uint64_t slack_ms) {
+    TimerWheel *wheel = getLocalWheel();
+    node->m_next = webs::GetMonotonicMS() + ms;
+    node->m_slack = slack_ms;
+    insertNode(node, wheel ? wheel : m_wheels.back());
+}
+
+bool TimerManager::cancelTimerNode(TimerNode *node) {
+    TimerWheel *wheel = node->m_wheel;
+    if (!wheel) {
+        return false;
+    }
+    TimerWheel::MutexType::Lock lock(wheel->mutex);
+    if (!node->isLinked()) {
+        return false;
+    }
+    wheel->remove(node);
+    --m_timerCount;
+    return true;
+}
+
+// 按slack合并执行时间 --> 插入节点 --> 早于睡眠线程的唤醒时间时，判断是否需要执行对应的函数
+void TimerManager::insertNode(TimerNode *node, TimerWheel *wheel) {
+    node->m_wheel = wheel;
+    TimerWheel::MutexType::Lock lock(wheel->mutex);
+    uint64_t next = node->m_next;
+    node->m_next = wheel->coalesce(next, node->m_slack);
+    if (next < wheel->hint && node->m_next >= wheel->hint) {
+        // 本来需要提前唤醒，跟随已经安排好的唤醒即可
+        ++m_avoidedWakeups;
+    }
+    wheel->insert(node);
+    ++m_timerCount;
+    // 线程自己的时间轮只由自己添加，线程正在运行，不需要唤醒
+    bool at_front = wheel == m_wheels.back() && node->m_next < wheel->hint && !wheel->tickled;
+    if (node->m_next < wheel->hint) {
+        wheel->hint = node->m_next;
+    }
     if (at_front) {
-        m_tickled = true;
+        wheel->tickled = true;
     }
     lock.unlock();
     if (at_front) {
@@ -133,84 +367,94 @@ void TimerManager::addTimer(Timer::ptr val, RWMutexType::WriteLock &lock) {
 }
 
 // 添加带条件的定时器
-Timer::ptr TimerManager::addConditionTimer(uint64_t ms, std::function<void()> cb, std::weak_ptr<void> weak_cond, bool recurring) {
-    return addTimer(ms, std::bind(&OnTime, cb, weak_cond), recurring);
+Timer::ptr TimerManager::addConditionTimer(uint64_t ms, std::function<void()> cb, std::weak_ptr<void> weak_cond, bool recurring,
+                                           uint64_t slack_ms) {
+    return addTimer(ms, std::bind(&OnTime, cb, weak_cond), recurring, slack_ms);
 }
 
-/* 到最近一个定时器执行的时间间隔 */
+/* 到最近一个定时器执行的时间间隔；包括当前线程自己的时间轮与共享的时间轮 */
 uint64_t TimerManager::getNextTimer() {
-    RWMutexType::ReadLock lock(m_mutex);
-    m_tickled = false;
-    if (m_timers.empty()) {
+    TimerWheel *wheels[2] = {m_wheels.back(), getLocalWheel()};
+    uint64_t next = ~0ull;
+    for (auto wheel : wheels) {
+        if (!wheel) {
+            continue;
+        }
+        TimerWheel::MutexType::Lock lock(wheel->mutex);
+        wheel->tickled = false;
+        wheel->hint = wheel->nextExpire();
+        next = std::min(next, wheel->hint);
+    }
+    if (next == ~0ull) {
         return ~0ull; // 返回特定值
     }
-    const Timer::ptr &next = *m_timers.begin();
-    uint64_t nowtime = webs::GetCurrentMS();
-    if (nowtime >= next->m_next) {
+    uint64_t nowtime = webs::GetMonotonicMS();
+    if (nowtime >= next) {
         return 0; // 本来应该执行的定时器不知道什么原因没有执行
     } else {
-        return next->m_next - nowtime; // 还剩多少时间
+        return next - nowtime; // 还剩多少时间
     }
 }
 
 /* 获取需要执行的定时器的回调函数列表 */
 /**
- * 双重检查 --> 回拨检查 --> 确定需要执行的函数对象 --> 删除原对象 --> 传出cbs所需参数，并检查是否存在循环
+ * 推进时间轮，取出到期的定时器 --> 传出cbs所需参数，并检查是否存在循环
 */
 void TimerManager::listExpiredCb(std::vector<std::function<void()>> &cbs) {
-    std::vector<Timer::ptr> expired;
-    // 双重检查：读锁的开销比写锁小。因此先使用读锁检查，避免不必要的写锁
-    {
-        RWMutexType::ReadLock lock(m_mutex);
-        if (m_timers.empty()) {
-            return;
-        }
-    }
-    RWMutexType::WriteLock lock(m_mutex);
-    if (m_timers.empty()) {
+    if (m_timerCount == 0) {
         return;
     }
-
-    uint64_t nowtime = webs::GetCurrentMS();
-    bool rollback = detectClockRollover(nowtime);
-    if (!rollback && (*m_timers.begin())->m_next > nowtime) {
-        return;
+    TimerWheel *wheels[2] = {m_wheels.back(), getLocalWheel()};
+    size_t count = 0, slacked = 0;
+    for (auto wheel : wheels) {
+        if (!wheel) {
+            continue;
+        }
+        TimerWheel::MutexType::Lock lock(wheel->mutex);
+        if (wheel->size() == 0) {
+            continue;
+        }
+        // 单调时钟不会回拨，不需要检测系统时间的调整
+        uint64_t nowtime = webs::GetMonotonicMS();
+        onExpired(wheel, wheel->expire(nowtime), nowtime, cbs, count, slacked);
     }
-
-    Timer::ptr now_timer(new Timer(nowtime));
-    auto it = rollback ? m_timers.end() : m_timers.lower_bound(now_timer);
-    while (it != m_timers.end() && (*it)->m_next == nowtime) {
-        ++it;
+    // 带slack的定时器与其他定时器一起到期，省去了各自的唤醒
+    if (slacked > 0 && count > 1) {
+        m_avoidedWakeups += std::min(slacked, count - 1);
     }
+}
 
-    expired.insert(expired.begin(), m_timers.begin(), it);
-    m_timers.erase(m_timers.begin(), it);
-    cbs.reserve(expired.size());
-    for (auto &i : expired) {
-        cbs.push_back(i->m_cb);
-        if (i->m_recurring) {
-            i->m_next = nowtime + i->m_ms;
-            m_timers.insert(i);
+void TimerManager::onExpired(TimerWheel *wheel, TimerNode *list, uint64_t now, std::vector<std::function<void()>> &cbs,
+                             size_t &count, size_t &slacked) {
+    while (list) {
+        TimerNode *node = list;
+        list = list->m_succ;
+        node->m_succ = nullptr;
+        --m_timerCount;
+        ++count;
+        slacked += node->m_slack > 0;
+        if (node->m_onExpire) {
+            node->m_onExpire(node, cbs);
+            continue;
+        }
+        Timer *timer = static_cast<Timer *>(node);
+        if (timer->m_recurring) {
+            cbs.push_back(timer->m_cb);
+            timer->m_next = wheel->coalesce(now + timer->m_ms, timer->m_slack);
+            wheel->insert(timer);
+            ++m_timerCount;
         } else {
-            i->m_cb = nullptr;
+            cbs.push_back(std::move(timer->m_cb));
+            timer->m_cb = nullptr;
+            // 可能是最后一个引用
+            Timer::ptr self = std::move(timer->m_self);
         }
     }
 }
 
-/* 检测服务器时间是否发生了回拨；并更新上次执行时间 */
-bool TimerManager::detectClockRollover(uint64_t now_ms) {
-    bool rollover = false;
-    if (now_ms < (m_previousTime - 60 * 1000 * 1000)) {
-        rollover = true;
-    }
-    m_previousTime = now_ms;
-    return rollover;
-}
-
 /* 是否有定时器 */
 bool TimerManager::hasTimer() {
-    RWMutexType::ReadLock lock(m_mutex);
-    return !m_timers.empty();
+    return m_timerCount > 0;
 }
 
-} // namespace webs
\ No newline at end of file
+} // namespace webs
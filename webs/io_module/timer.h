@@ -3,13 +3,55 @@
 #include <memory>
 #include <vector>
 #include <functional>
-#include <set>
+#include <atomic>
 #include "../util_module/mutex.h"
 
 namespace webs {
 class TimerManager;
-class Timer : public std::enable_shared_from_this<Timer> {
+class TimerWheel;
+
+/**
+ * 时间轮中的节点；Timer与嵌入在其他对象中的定时器(例如IO超时)共用
+ * 嵌入式的节点由持有者管理生命周期，到期时在时间轮的锁内调用到期函数，不分配内存
+ */
+class TimerNode {
+    friend class TimerManager;
+    friend class TimerWheel;
+
+public:
+    /* 到期函数；在时间轮的锁内调用，只应该把需要执行的回调放入cbs */
+    typedef void (*ExpireFunc)(TimerNode *node, std::vector<std::function<void()>> &cbs);
+
+    /* on_expire为nullptr表示是Timer */
+    explicit TimerNode(ExpireFunc on_expire = nullptr) :
+        m_onExpire(on_expire) {
+    }
+
+    /* 是否在时间轮中 */
+    bool isLinked() const {
+        return m_level != -1;
+    }
+
+protected:
+    // 精确的执行时间；单调时钟(GetMonotonicMS)
+    uint64_t m_next = 0;
+    // 允许推迟执行的时间(ms)；窗口内的定时器合并为一次唤醒
+    uint64_t m_slack = 0;
+    // 到期函数
+    ExpireFunc m_onExpire = nullptr;
+    // 所属的时间轮
+    TimerWheel *m_wheel = nullptr;
+    // 所在的层与槽；不在时间轮中时为-1
+    int m_level = -1;
+    int m_slot = -1;
+    // 槽内的双向链表
+    TimerNode *m_prev = nullptr;
+    TimerNode *m_succ = nullptr;
+};
+
+class Timer : public TimerNode, public std::enable_shared_from_this<Timer> {
     friend class TimerManager;
+    friend class TimerWheel;
 
 public:
     typedef std::shared_ptr<Timer> ptr;
@@ -24,49 +66,113 @@ public:
     bool reset(uint64_t ms, bool from_now);
 
 private:
-    /* 构造函数；定时器执行时间间隔、回调函数、是否循环、定时器管理 */
-    Timer(uint64_t ms, std::function<void()> cb, bool recurring, TimerManager *manage);
-
-    /* 构造函数；执行的时间戳 */
-    Timer(uint64_t next);
+    /* 构造函数；定时器执行时间间隔、回调函数、是否循环、定时器管理、允许推迟的时间 */
+    Timer(uint64_t ms, std::function<void()> cb, bool recurring, TimerManager *manage, uint64_t slack_ms);
 
 private:
     // 是否循环定时器
     bool m_recurring = false;
     // 执行周期
     uint64_t m_ms = 0;
-    // 精确的执行时间
-    uint64_t m_next = 0;
     // 回调函数
     std::function<void()> m_cb;
     // 定时器管理器
     TimerManager *m_manager = nullptr;
+    // 在时间轮中时持有自己，链表只保存裸指针
+    Timer::ptr m_self;
+};
+
+/**
+ * 分层时间轮；精度1ms，插入、删除O(1)
+ *     第0层256个槽，每个槽1ms；第1~3层各64个槽，每个槽覆盖下一层一整圈
+ *     上层的槽在下一层转完一圈时下放(cascade)，超过最大范围(约18.6小时)的定时器放在最高层，下放时重新计算
+ *     每层一个位图，查找下一个非空槽只需要几次ctz
+ * 不加锁，由TimerManager在mutex保护下使用
+ */
+class TimerWheel {
+public:
+    typedef Mutex MutexType;
+
+    static const int LEVELS = 4;
+    static const int ROOT_BITS = 8;
+    static const int LEVEL_BITS = 6;
+    static const size_t ROOT_SIZE = (size_t)1 << ROOT_BITS;
+    static const size_t LEVEL_SIZE = (size_t)1 << LEVEL_BITS;
+
+    /* now为时间轮的起始时间 */
+    explicit TimerWheel(uint64_t now);
+
+    /* 加入节点；到期时间早于当前时间的放在下一个tick */
+    void insert(TimerNode *node);
+
+    /* 移出节点 */
+    void remove(TimerNode *node);
+
+    /* 最近的到期时间(绝对时间)；只在上层有定时器时返回下放的时间，是到期时间的下界。没有定时器返回~0ull */
+    uint64_t nextExpire() const;
+
+    /* 推进到now，返回到期的节点(按m_succ串成单链表) */
+    TimerNode *expire(uint64_t now);
+
+    /* 移出所有节点，返回单链表 */
+    TimerNode *takeAll();
+
+    /**
+     * 在[next, next + slack]中选择实际的执行时间
+     *     窗口包含hint时跟随已经安排好的唤醒；否则对齐到不超过slack的最大2的幂，相近的定时器落在同一个tick
+     */
+    uint64_t coalesce(uint64_t next, uint64_t slack) const;
+
+    /* 定时器数量 */
+    size_t size() const {
+        return m_count;
+    }
+
+public:
+    MutexType mutex;
+    // 睡眠中的线程预计醒来的时间；早于它的定时器需要唤醒
+    uint64_t hint = ~0ull;
+    // 是否触发了onTimerInsertedAtFront，getNextTimer之后重置
+    bool tickled = false;
 
 private:
-    /* 定时器的比较仿函数 */
-    struct Comparator {
-        /* 比较两个定时器智能指针的大小 */
-        bool operator()(const Timer::ptr &lhs, const Timer::ptr &rhs) const;
-    };
+    /* 下放level层当前的槽 */
+    void cascade();
+
+    /* 取出一个槽的链表 */
+    TimerNode *takeSlot(int level, size_t slot);
+
+    /* 第level层每个槽对应的位移 */
+    static int shiftOf(int level) {
+        return level == 0 ? 0 : ROOT_BITS + (level - 1) * LEVEL_BITS;
+    }
+
+private:
+    // 下一个要处理的tick(ms)
+    uint64_t m_current = 0;
+    size_t m_count = 0;
+    // 每层的槽；第1~3层只使用前LEVEL_SIZE个
+    TimerNode *m_slots[LEVELS][ROOT_SIZE];
+    // 每层非空槽的位图
+    uint64_t m_bits[LEVELS][ROOT_SIZE / 64];
 };
 
 class TimerManager {
     friend class Timer;
 
 public:
-    typedef RWMutex RWMutexType;
-
     /* 构造函数 */
     TimerManager();
 
     /* 虚析构函数 */
     virtual ~TimerManager();
 
-    // 添加定时器
-    Timer::ptr addTimer(uint64_t ms, std::function<void()> cb, bool recurring = false);
+    // 添加定时器；slack_ms为允许推迟执行的时间，不需要精确的定时器(空闲超时、过期检查)可以与其他定时器合并唤醒
+    Timer::ptr addTimer(uint64_t ms, std::function<void()> cb, bool recurring = false, uint64_t slack_ms = 0);
 
     // 添加带条件的定时器
-    Timer::ptr addConditionTimer(uint64_t ms, std::function<void()> cb, std::weak_ptr<void> weak_cond, bool recurring = false);
+    Timer::ptr addConditionTimer(uint64_t ms, std::function<void()> cb, std::weak_ptr<void> weak_cond, bool recurring = false,
+                                 uint64_t slack_ms = 0);
 
     /* 到最近一个定时器执行的时间间隔 */
     uint64_t getNextTimer();
@@ -77,27 +183,54 @@ public:
     /* 是否有定时器 */
     bool hasTimer();
 
+    /* 因为slack合并而省去的唤醒次数：插入时不需要唤醒睡眠的线程，或者与其他定时器在同一次唤醒中到期 */
+    uint64_t getAvoidedWakeups() const {
+        return m_avoidedWakeups;
+    }
+
 protected:
     /* 当有新的定时器插入到定时器的首部，执行该函数 */
     virtual void onTimerInsertedAtFront() = 0;
 
-    /* 将定时器添加到管理器中 */
-    void addTimer(Timer::ptr val, RWMutexType::WriteLock &lock);
+    /* 当前线程自己的时间轮下标；-1表示使用共享的时间轮 */
+    virtual int getTimerWheelIndex() const {
+        return -1;
+    }
+
+    /* 每个线程一个时间轮(另外加一个共享的)；只能在添加定时器之前调用 */
+    void initTimerWheels(size_t threads);
+
+    /* 将定时器添加到时间轮中 */
+    void addTimer(Timer::ptr val, TimerWheel *wheel);
+
+    /* 加入嵌入式节点，ms之后到期，最多推迟slack_ms；节点到期或者取消之前必须保持有效 */
+    void addTimerNode(TimerNode *node, uint64_t ms, uint64_t slack_ms = 0);
+
+    /* 移除还没有到期的嵌入式节点；返回是否移除 */
+    bool cancelTimerNode(TimerNode *node);
 
 private:
-    /* 检测服务器时间是否发生了回拨 */
-    /* 时间回拨可能会导致定时器的准确性 */
-    bool detectClockRollover(uint64_t now_ms);
+    /* 当前线程的时间轮；没有时返回nullptr */
+    TimerWheel *getLocalWheel() const;
+
+    /* 将节点加入时间轮；早于睡眠线程的唤醒时间时唤醒 */
+    void insertNode(TimerNode *node, TimerWheel *wheel);
+
+    /**
+     * 处理到期的节点：Timer取出回调，嵌入式节点调用到期函数；调用者持有wheel->mutex
+     * count、slacked累加到期的节点数与其中带slack的节点数
+     */
+    void onExpired(TimerWheel *wheel, TimerNode *list, uint64_t now, std::vector<std::function<void()>> &cbs,
+                   size_t &count, size_t &slacked);
 
 private:
-    RWMutexType m_mutex;
-    // 定时器集合
-    std::set<Timer::ptr, Timer::Comparator> m_timers;
-    // 是否触发了onTimerInsertedAtFront -->不是用户设计的，取决于addTimer函数
-    bool m_tickled = false;
-    // 上次执行时间
-    uint64_t m_previousTime = 0;
+    // 时间轮；最后一个由所有线程共享，其余的属于各个线程
+    std::vector<TimerWheel *> m_wheels;
+    // 所有时间轮中的定时器数量
+    std::atomic<size_t> m_timerCount = {0};
+    // 省去的唤醒次数
+    std::atomic<uint64_t> m_avoidedWakeups = {0};
 };
 } // namespace webs
 
-#endif
\ No newline at end of file
+#endif
@@ -6,6 +6,7 @@
 #include <tuple>
 #include "../util_module/util.h"
 #include "../config_module/config.h"
+#include "../coroutine_module/fiber_local.h"
 #include <yaml-cpp/yaml.h>
 
 namespace webs {
@@ -53,7 +54,7 @@ LogLevel::Level LogLevel::FromString(const std::string &str) {
 LogEvent::LogEvent(const char *file, int32_t line, uint32_t elapse, uint32_t thread_id, uint32_t fiber_id, uint64_t time,
                    const std::string &thread_name, std::shared_ptr<Logger> logger, LogLevel::Level level) :
     m_file(file),
-    m_line(line), m_elapse(elapse), m_threadId(thread_id), m_fiberId(fiber_id), m_time(time), m_threadName(thread_name), m_logger(logger), m_level(level) {
+    m_line(line), m_elapse(elapse), m_threadId(thread_id), m_fiberId(fiber_id), m_time(time), m_threadName(thread_name), m_traceId(GetTraceId()), m_logger(logger), m_level(level) {
 }
 /* 格式化写入日志内容 */
 void LogEvent::format(const char *fmt, ...) {
@@ -146,6 +147,16 @@ public:
     }
 };
 
+class TraceIdFormatItem : public LogFormatter::FormatItem {
+public:
+    TraceIdFormatItem(const std::string &str = "") {
+    }
+    void format(std::ostream &os, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) override {
+        /* 将协程的追踪id输出到输出流中 */
+        os << event->getTraceId();
+    }
+};
+
 class ThreadNameFormatItem : public LogFormatter::FormatItem {
 public:
     ThreadNameFormatItem(const std::string &str) {
@@ -349,6 +360,7 @@ void LogFormatter::init() {
         XX(T, TabFormatItem),        // T: Tab
         XX(F, FiberIdFormatItem),    // F: 协程id
         XX(N, ThreadNameFormatItem), // N: 线程名称
+        XX(I, TraceIdFormatItem),    // I: 协程的追踪id
 #undef XX
     };
 
@@ -22,7 +22,7 @@
 #define WEBS_LOG_LEVEL(logger, level)                                                                                         \
     if (logger->getLevel() <= level)                                                                                          \
     webs::LogEventWrap(webs::LogEvent::ptr(new webs::LogEvent(__FILE__, __LINE__, 0, webs::GetThreadId(), webs::GetFiberId(), \
-                                                              time(0), webs::Thread::GetName(), logger, level)))              \
+                                                              webs::CoarseClock::RealtimeSec(), webs::Thread::GetName(), logger, level)))              \
         .getSS()
 
 /* 以流的方式将 DEBUG 级别的日志写入到logger */
@@ -44,7 +44,7 @@
 #define WEBS_LOG_FMT_LEVEL(logger, level, fmt, ...)                                                                                  \
     if (logger->getLevel() <= level)                                                                                                 \
     webs::LogEventWrap(webs::LogEvent::ptr(new webs::LogEvent(__FILE__, __LINE__, 0, webs::GetThreadId(),                            \
-                                                              webs::GetFiberId(), time(0), webs::Thread::GetName(), logger, level))) \
+                                                              webs::GetFiberId(), webs::CoarseClock::RealtimeSec(), webs::Thread::GetName(), logger, level))) \
         .getEvent()                                                                                                                  \
         ->format(fmt, __VA_ARGS__)
 
@@ -132,6 +132,10 @@ public:
     const std::string &getThreadName() const {
         return m_threadName;
     }
+    /* 返回协程的追踪id */
+    const std::string &getTraceId() const {
+        return m_traceId;
+    }
     /* 返回日志流的内容 */
     std::string getContent() const {
         return m_ss.str();
@@ -168,6 +172,8 @@ private:
     uint64_t m_time = 0;
     /// 线程名称
     std::string m_threadName;
+    /// 协程的追踪id；拷贝一份，事件可以交给其他协程输出，协程结束或者SetTraceId之后仍然有效
+    std::string m_traceId;
     /// 日志内容流
     std::stringstream m_ss;
     /// 日志器
@@ -211,6 +217,7 @@ public:
          * %T   制表符
          * %F   协程id
          * %N   线程名称
+         * %I   协程的追踪id
          *
          * 默认格式："%d{%Y-%m-%d %H:%M:%S}%T%t%T%N%T%F%T[%p]%T[%c]%T%f:%l%T%m%n"
          */
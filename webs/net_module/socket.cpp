@@ -136,6 +136,17 @@ bool Socket::setOption(int level, int optname, const void *optval, socklen_t opt
 /* socketfd是否有效 --> sock的协议与地址协议是否一致 -->
     是否是unix域地址，如果是需要检验是否地址已经被绑定(直接connect--》成功说明已绑定) -->  连接失败，先删除路径(防止未释放) 
  ---> 将socketfd 与 地址 */
+bool Socket::setReusePort() {
+    if (!isVaild()) {
+        newSock();
+        if (WEBS_UNLIKELY(!isVaild())) {
+            return false;
+        }
+    }
+    int val = 1;
+    return setOption(SOL_SOCKET, SO_REUSEPORT, val);
+}
+
 bool Socket::bind(webs::Address::ptr addr) {
     if (!isVaild()) { // m_sock 无效
         newSock();    // 创建socketfd
@@ -90,6 +90,14 @@ public:
         return setOption(level, optname, &optval, sizeof(T));
     }
 
+    /**
+     * @brief 允许多个socket绑定同一个地址(SO_REUSEPORT)，由内核在它们之间分配新连接
+     *  需要在bind之前调用；socket还没有创建时先创建
+     * @return true 
+     * @return false 
+     */
+    bool setReusePort();
+
     /**
      * @brief 绑定监听套接字的地址
      * 
@@ -1,5 +1,6 @@
 #include "tcp_server.h"
 #include <functional>
+#include <linux/filter.h>
 
 namespace webs {
 // 日志
@@ -8,6 +9,34 @@ static webs::Logger::ptr g_logger = WEBS_LOG_NAME("system");
 // read_timeout 配置 信息
 static webs::ConfigVar<uint64_t>::ptr g_tcp_server_read_timeout = webs::Config::Lookup("tcp_server.read_timeout", (uint64_t)(60 * 1000 * 2), "tcp server read timeout");
 
+// SO_REUSEPORT 按CPU分配连接的配置
+static webs::ConfigVar<bool>::ptr g_tcp_server_reuseport_cbpf = webs::Config::Lookup("tcp_server.reuseport_cbpf", false, "steer each reuseport connection to the listener of the io thread bound to the cpu that received it (SO_ATTACH_REUSEPORT_CBPF)");
+
+/**
+ * 给SO_REUSEPORT组挂上按CPU选择监听socket的cBPF程序
+ * 第i个监听socket属于绑定cpus[i % cpus.size()]的线程；收到连接的CPU没有对应线程时按CPU取模
+ */
+static bool AttachReusePortCpuFilter(int fd, const std::vector<int> &cpus, size_t count) {
+#ifdef SO_ATTACH_REUSEPORT_CBPF
+    std::vector<sock_filter> code;
+    code.push_back(BPF_STMT(BPF_LD | BPF_W | BPF_ABS, (uint32_t)(SKF_AD_OFF + SKF_AD_CPU)));
+    for (size_t i = 0; i < count && !cpus.empty(); ++i) {
+        code.push_back(BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, (uint32_t)cpus[i % cpus.size()], 0, 1));
+        code.push_back(BPF_STMT(BPF_RET | BPF_K, (uint32_t)i));
+    }
+    code.push_back(BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, (uint32_t)count));
+    code.push_back(BPF_STMT(BPF_RET | BPF_A, 0));
+    sock_fprog prog;
+    prog.len = (unsigned short)code.size();
+    prog.filter = &code[0];
+    if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) == 0) {
+        return true;
+    }
+    WEBS_LOG_WARN(g_logger) << "SO_ATTACH_REUSEPORT_CBPF fail errno = " << errno << " errstr = " << strerror(errno);
+#endif
+    return false;
+}
+
 TcpServer::TcpServer(webs::IOManager *worker, webs::IOManager *io_worker, webs::IOManager *accept_worker) :
     m_worker(worker),
     m_ioWorker(io_worker),
@@ -24,34 +53,63 @@ TcpServer::~TcpServer() {
     m_socks.clear(); // 清空vector -- 这里应该会自动清理
 }
 
-bool TcpServer::bind(webs::Address::ptr address, bool ssl) {
+bool TcpServer::bind(webs::Address::ptr address, bool ssl, bool reuse_port) {
     std::vector<webs::Address::ptr> addr{address};
     std::vector<webs::Address::ptr> fails;
-    return bind(addr, fails, ssl);
+    return bind(addr, fails, ssl, reuse_port);
 }
 
 /* 将一个地址(服务器的ip和指定端口)绑定到socketfd -- 创建socket -- 绑定 -- 加入监听队列 -- 输出日志  */
-bool TcpServer::bind(const std::vector<webs::Address::ptr> &addrs, std::vector<webs::Address::ptr> &fails, bool ssl) {
+bool TcpServer::bind(const std::vector<webs::Address::ptr> &addrs, std::vector<webs::Address::ptr> &fails, bool ssl,
+                     bool reuse_port) {
     m_ssl = ssl;
-    for (auto &addr : addrs) {
-        Socket::ptr sock = ssl ? webs::SSLSocket::CreateTCP(addr) : webs::Socket::CreateTCP(addr);
-        if (!sock->bind(addr)) {
-            WEBS_LOG_ERROR(g_logger) << "bind fail errno = " << errno << "errstr = " << strerror(errno)
-                                     << " addr = [" << addr->toString() << "]";
-            fails.push_back(addr);
-            continue;
+    m_reusePort = reuse_port;
+    // 每个io线程一个监听socket
+    std::vector<int> threads;
+    if (reuse_port) {
+        threads = m_ioWorker->getWorkerThreadIds();
+        if (!m_ioWorker->isMultiReactor()) {
+            WEBS_LOG_WARN(g_logger) << "reuseport without iomanager.multi_reactor, connections may still move between threads";
         }
-        if (!sock->listen()) {
-            WEBS_LOG_ERROR(g_logger) << "listen fail errno = " << errno << "errstr = " << strerror(errno)
-                                     << " addr = [" << addr->toString() << "]";
-            fails.push_back(addr);
-            continue;
+    }
+    for (auto &addr : addrs) {
+        size_t count = reuse_port ? threads.size() : 1;
+        webs::Address::ptr bind_addr = addr;
+        for (size_t i = 0; i < count; ++i) {
+            Socket::ptr sock = ssl ? webs::SSLSocket::CreateTCP(addr) : webs::Socket::CreateTCP(addr);
+            if (reuse_port && !sock->setReusePort()) {
+                WEBS_LOG_ERROR(g_logger) << "SO_REUSEPORT fail errno = " << errno << "errstr = " << strerror(errno)
+                                         << " addr = [" << addr->toString() << "]";
+                fails.push_back(addr);
+                break;
+            }
+            if (!sock->bind(bind_addr)) {
+                WEBS_LOG_ERROR(g_logger) << "bind fail errno = " << errno << "errstr = " << strerror(errno)
+                                         << " addr = [" << addr->toString() << "]";
+                fails.push_back(addr);
+                break;
+            }
+            if (!sock->listen()) {
+                WEBS_LOG_ERROR(g_logger) << "listen fail errno = " << errno << "errstr = " << strerror(errno)
+                                         << " addr = [" << addr->toString() << "]";
+                fails.push_back(addr);
+                break;
+            }
+            if (reuse_port && i == 0) {
+                // 端口为0时由系统分配；其余的监听socket绑定同一个端口
+                bind_addr = sock->getLocalAddress();
+                if (g_tcp_server_reuseport_cbpf->getValue()) {
+                    AttachReusePortCpuFilter(sock->getSocket(), m_ioWorker->getCpus(), count);
+                }
+            }
+            m_socks.push_back(sock);
+            m_sockThreads.push_back(reuse_port ? threads[i] : -1);
         }
-        m_socks.push_back(sock);
     }
 
     if (!fails.empty()) { // 如果失败，清除已经连接的socketfd
         m_socks.clear();
+        m_sockThreads.clear();
         return false;
     }
 
@@ -68,8 +126,13 @@ bool TcpServer::start() {
         return false; // 返回false表示服务器已经在运行
     }
     m_isStop = false;
-    for (auto &sock : m_socks) {
-        m_acceptWorker->schedule(std::bind(&TcpServer::startAccept, shared_from_this(), sock));
+    for (size_t i = 0; i < m_socks.size(); ++i) {
+        if (m_sockThreads[i] != -1) {
+            // SO_REUSEPORT：在所属的io线程中accept
+            m_ioWorker->schedule(std::bind(&TcpServer::startAccept, shared_from_this(), m_socks[i]), m_sockThreads[i]);
+        } else {
+            m_acceptWorker->schedule(std::bind(&TcpServer::startAccept, shared_from_this(), m_socks[i]));
+        }
     }
     return true;
 }
@@ -89,6 +152,7 @@ void TcpServer::stop() {
             sock->close();
         }
         m_socks.clear();
+        m_sockThreads.clear();
     });
 }
 
@@ -102,13 +166,26 @@ void TcpServer::handleClient(Socket::ptr client) {
 
 /* 该函数与sock接受一个新连接的处理逻辑相同: 接受连接 -- 将工作任务加入调度器中 */
 void TcpServer::startAccept(Socket::ptr sock) {
+    // SO_REUSEPORT：监听socket与接收的连接都留在当前线程的reactor，不需要跨线程转交
+    bool local = m_reusePort && IOManager::GetThis() == m_ioWorker;
+    if (local) {
+        m_ioWorker->attachToLocalReactor(sock->getSocket());
+    }
     while (!m_isStop) {
         Socket::ptr client = sock->accept();
         if (client) {
             client->setRecvTimeout(m_recvTimeout);
             // handleClient处理客户端请求的工作任务 -- 派生类需要重载的函数
             // shared_from_this(): 获取调用该成员函数的对象的 std::shared_ptr；增加了引用计数，保证了不会发生执行工作函数时对象不存在的情况
+            if (local) {
+                m_ioWorker->attachToLocalReactor(client->getSocket());
+                m_ioWorker->schedule(std::bind(&TcpServer::handleClient, shared_from_this(), client), webs::GetThreadId());
+                continue;
+            }
             m_ioWorker->schedule(std::bind(&TcpServer::handleClient, shared_from_this(), client));
+        } else if (m_isStop || errno == EBADF || errno == ECANCELED) {
+            // 停止服务器时监听socket被取消或者关闭，直接退出
+            break;
         } else {
             WEBS_LOG_ERROR(g_logger) << "accept errno = " << errno << " errstr = " << strerror(errno);
         }
@@ -134,6 +211,7 @@ std::string TcpServer::toString(const std::string &prefix) {
     ss << prefix << "[type = " << m_type << ", name = " << m_name
        << ", worker = " << (m_worker ? m_worker->getName() : "")
        << ", ssl = " << m_ssl
+       << ", reuseport = " << m_reusePort
        << ", io_worker = " << (m_ioWorker ? m_ioWorker->getName() : "")
        << ", accept_worker = " << (m_acceptWorker ? m_acceptWorker->getName() : "")
        << ", recv_timeout = " << m_recvTimeout << "]" << std::endl;
@@ -115,21 +115,25 @@ public:
      * 
      * @param address 
      * @param ssl 是否是ssl
+     * @param reuse_port 是否每个io线程一个SO_REUSEPORT监听socket
      * @return true 
      * @return false 
      */
-    virtual bool bind(webs::Address::ptr address, bool ssl = false);
+    virtual bool bind(webs::Address::ptr address, bool ssl = false, bool reuse_port = false);
 
     /**
      * @brief 创建socketfd，并绑定地址(服务器的ip和端口)
-     * 
+     *  reuse_port为true时，每个地址为m_ioWorker的每个工作线程创建一个SO_REUSEPORT监听socket，
+     *  由内核把新连接分配给各个线程；每个线程在本线程accept并处理连接，配合iomanager.multi_reactor时连接不会跨线程
      * @param addr 需要绑定的地址数组
      * @param fails 绑定失败的地址
      * @param ssl 
+     * @param reuse_port 
      * @return true 
      * @return false 
      */
-    virtual bool bind(const std::vector<webs::Address::ptr> &addr, std::vector<webs::Address::ptr> &fails, bool ssl = false);
+    virtual bool bind(const std::vector<webs::Address::ptr> &addr, std::vector<webs::Address::ptr> &fails, bool ssl = false,
+                      bool reuse_port = false);
 
     /**
      * @brief 启动服务
@@ -250,6 +254,10 @@ protected:
     // 服务器是否停止
     bool m_isStop;
     bool m_ssl;
+    // 是否每个io线程一个SO_REUSEPORT监听socket
+    bool m_reusePort = false;
+    // 每个监听socket执行accept的线程；-1表示在m_acceptWorker中执行
+    std::vector<int> m_sockThreads;
     // 配置信息
     TcpServerConf::ptr m_conf;
 };
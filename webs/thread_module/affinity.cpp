@@ -0,0 +1,160 @@
+#include "affinity.h"
+#include "../log_module/log.h"
+
+#include <sched.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <sys/syscall.h>
+#include <algorithm>
+#include <fstream>
+
+#ifndef MPOL_PREFERRED
+#define MPOL_PREFERRED 1
+#endif
+
+namespace webs {
+
+static webs::Logger::ptr g_logger = WEBS_LOG_NAME("system");
+
+// 当前线程绑定的CPU所在的节点；没有绑定为-1
+static thread_local int t_thread_node = -1;
+
+/* CPU --> NUMA节点 */
+struct NumaTopology {
+    std::vector<int> cpuNode;
+    int nodeCount = 1;
+
+    NumaTopology() {
+        DIR *dir = opendir("/sys/devices/system/node");
+        if (!dir) {
+            return;
+        }
+        int max_node = 0;
+        struct dirent *dp = nullptr;
+        while ((dp = readdir(dir)) != nullptr) {
+            if (strncmp(dp->d_name, "node", 4) != 0 || !isdigit(dp->d_name[4])) {
+                continue;
+            }
+            int node = atoi(dp->d_name + 4);
+            std::ifstream ifs(std::string("/sys/devices/system/node/") + dp->d_name + "/cpulist");
+            std::string list;
+            std::getline(ifs, list);
+            for (int cpu : ParseCpuList(list)) {
+                if ((size_t)cpu >= cpuNode.size()) {
+                    cpuNode.resize(cpu + 1, 0);
+                }
+                cpuNode[cpu] = node;
+            }
+            max_node = std::max(max_node, node);
+        }
+        closedir(dir);
+        nodeCount = max_node + 1;
+    }
+};
+
+static const NumaTopology &GetTopology() {
+    static NumaTopology s_topology;
+    return s_topology;
+}
+
+/* 解析 "a" 或者 "a-b"，加入cpus */
+static bool ParseCpuRange(const std::string &item, std::vector<int> &cpus) {
+    char *end = nullptr;
+    long first = strtol(item.c_str(), &end, 10);
+    if (end == item.c_str() || first < 0) {
+        return false;
+    }
+    long last = first;
+    if (*end == '-') {
+        const char *begin = end + 1;
+        last = strtol(begin, &end, 10);
+        if (end == begin || last < first) {
+            return false;
+        }
+    }
+    if (*end != '\0') {
+        return false;
+    }
+    for (long i = first; i <= last; ++i) {
+        cpus.push_back((int)i);
+    }
+    return true;
+}
+
+std::vector<int> ParseCpuList(const std::vector<std::string> &list) {
+    std::vector<int> cpus;
+    for (auto &i : list) {
+        if (!ParseCpuRange(i, cpus)) {
+            WEBS_LOG_ERROR(g_logger) << "invalid cpu list item: " << i;
+        }
+    }
+    return cpus;
+}
+
+std::vector<int> ParseCpuList(const std::string &list) {
+    std::vector<std::string> items;
+    size_t pos = 0;
+    while (pos < list.size()) {
+        size_t end = list.find(',', pos);
+        if (end == std::string::npos) {
+            end = list.size();
+        }
+        if (end > pos) {
+            items.push_back(list.substr(pos, end - pos));
+        }
+        pos = end + 1;
+    }
+    return ParseCpuList(items);
+}
+
+bool SetThreadAffinity(int cpu) {
+    if (cpu < 0 || cpu >= CPU_SETSIZE) {
+        return false;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    int rt = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (rt) {
+        WEBS_LOG_ERROR(g_logger) << "pthread_setaffinity_np cpu = " << cpu << " rt = " << rt
+                                 << " errstr = " << strerror(rt);
+        return false;
+    }
+    t_thread_node = GetCpuNode(cpu);
+    return true;
+}
+
+int GetNumaNodeCount() {
+    return GetTopology().nodeCount;
+}
+
+int GetCpuNode(int cpu) {
+    const NumaTopology &topo = GetTopology();
+    return cpu >= 0 && (size_t)cpu < topo.cpuNode.size() ? topo.cpuNode[cpu] : 0;
+}
+
+int GetThreadNode() {
+    if (t_thread_node != -1) {
+        return t_thread_node;
+    }
+    return GetCpuNode(sched_getcpu());
+}
+
+bool BindMemoryToNode(void *addr, size_t len, int node) {
+    if (GetNumaNodeCount() <= 1 || node < 0 || node >= (int)(sizeof(unsigned long) * 8)) {
+        return false;
+    }
+    unsigned long mask = 1ul << node;
+    if (syscall(SYS_mbind, addr, len, MPOL_PREFERRED, &mask, sizeof(mask) * 8, 0)) {
+        WEBS_LOG_ERROR(g_logger) << "mbind node = " << node << " errno = " << errno
+                                 << " errstr = " << strerror(errno);
+        return false;
+    }
+    return true;
+}
+
+} // namespace webs
@@ -0,0 +1,37 @@
+/**
+ * 线程的CPU亲和性与NUMA拓扑
+ * 拓扑从 /sys/devices/system/node 读取，没有NUMA信息的机器当作只有一个节点
+*/
+#ifndef __WEBS_AFFINITY_H__
+#define __WEBS_AFFINITY_H__
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+namespace webs {
+
+/* 解析CPU列表，每项为单个CPU或者范围，如 {"0-7", "16"}；非法的项忽略 */
+std::vector<int> ParseCpuList(const std::vector<std::string> &list);
+
+/* 解析内核格式的CPU列表，如 "0-3,8-11" */
+std::vector<int> ParseCpuList(const std::string &list);
+
+/* 将当前线程绑定到cpu；成功返回true */
+bool SetThreadAffinity(int cpu);
+
+/* NUMA节点的数量；至少为1 */
+int GetNumaNodeCount();
+
+/* cpu所在的NUMA节点；未知返回0 */
+int GetCpuNode(int cpu);
+
+/* 当前线程所在的NUMA节点：绑定了CPU的线程返回绑定CPU的节点，否则返回当前运行CPU的节点 */
+int GetThreadNode();
+
+/* 内存优先从node分配(MPOL_PREFERRED)；只有一个节点时什么也不做 */
+bool BindMemoryToNode(void *addr, size_t len, int node);
+
+} // namespace webs
+
+#endif
@@ -0,0 +1,77 @@
+#ifndef __WEBS_FD_TABLE_H__
+#define __WEBS_FD_TABLE_H__
+
+#include <stddef.h>
+#include <atomic>
+
+#include "Noncopyable.h"
+
+namespace webs {
+/**
+ * 按文件描述符索引的分段表；IOManager的事件上下文与FdManager共用
+ * 顶层是固定大小的段指针数组，段在第一次访问时通过CAS分配，之后不会移动也不会释放
+ *     查找：两次数组访问，不加锁
+ *     扩容：只分配新的段，不需要全局写锁，正在进行的IO不受影响
+ * 槽位本身的并发访问由调用者负责(例如槽位中的锁或者原子操作)
+ * 超出 MaxSegments << SegmentShift 的fd返回nullptr
+ */
+template <class T, size_t SegmentShift = 10, size_t MaxSegments = 4096>
+class FdTable : Noncopyable {
+public:
+    // 段创建后对每个槽位调用一次，参数为槽位与对应的fd
+    typedef void (*InitFunc)(T &slot, int fd);
+
+    static const size_t SEGMENT_SIZE = (size_t)1 << SegmentShift;
+
+    explicit FdTable(InitFunc init = nullptr) :
+        m_init(init) {
+        for (size_t i = 0; i < MaxSegments; ++i) {
+            m_segments[i].store(nullptr, std::memory_order_relaxed);
+        }
+    }
+
+    ~FdTable() {
+        for (size_t i = 0; i < MaxSegments; ++i) {
+            delete[] m_segments[i].load(std::memory_order_relaxed);
+        }
+    }
+
+    /* 返回fd的槽位；所在的段还没有分配时返回nullptr */
+    T *get(int fd) const {
+        if (fd < 0 || (size_t)fd >= MaxSegments * SEGMENT_SIZE) {
+            return nullptr;
+        }
+        T *segment = m_segments[fd >> SegmentShift].load(std::memory_order_acquire);
+        return segment ? &segment[fd & (SEGMENT_SIZE - 1)] : nullptr;
+    }
+
+    /* 返回fd的槽位，所在的段不存在时分配；fd超出范围返回nullptr */
+    T *getOrCreate(int fd) {
+        T *slot = get(fd);
+        if (slot || fd < 0 || (size_t)fd >= MaxSegments * SEGMENT_SIZE) {
+            return slot;
+        }
+        size_t index = fd >> SegmentShift;
+        T *segment = new T[SEGMENT_SIZE];
+        if (m_init) {
+            for (size_t i = 0; i < SEGMENT_SIZE; ++i) {
+                m_init(segment[i], (int)(index * SEGMENT_SIZE + i));
+            }
+        }
+        T *expected = nullptr;
+        // 多个线程同时分配同一个段时只保留一个
+        if (!m_segments[index].compare_exchange_strong(expected, segment, std::memory_order_acq_rel)) {
+            delete[] segment;
+            segment = expected;
+        }
+        return &segment[fd & (SEGMENT_SIZE - 1)];
+    }
+
+private:
+    InitFunc m_init;
+    std::atomic<T *> m_segments[MaxSegments];
+};
+
+} // namespace webs
+
+#endif
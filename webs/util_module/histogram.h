@@ -0,0 +1,89 @@
+#ifndef __WEBS_HISTOGRAM_H__
+#define __WEBS_HISTOGRAM_H__
+
+#include <atomic>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "Noncopyable.h"
+
+namespace webs {
+/**
+ * 按2的幂分桶的直方图；第i个桶统计小于2^i的值，最后一个桶统计其余的值
+ * 只由一个线程写入，其他线程随时可以读取；写入不需要原子的读改写
+ */
+class Histogram : Noncopyable {
+public:
+    static const size_t BUCKETS = 32;
+
+    Histogram() {
+        for (auto &i : m_buckets) {
+            i = 0;
+        }
+    }
+
+    /* 记录一个值；只能由写入线程调用 */
+    void record(uint64_t value) {
+        size_t bucket = value == 0 ? 0 : 64 - __builtin_clzll(value);
+        if (bucket >= BUCKETS) {
+            bucket = BUCKETS - 1;
+        }
+        Add(m_buckets[bucket], 1);
+        Add(m_count, 1);
+        Add(m_sum, value);
+    }
+
+    /* 记录的次数 */
+    uint64_t count() const {
+        return m_count.load(std::memory_order_relaxed);
+    }
+
+    /* 所有值的和 */
+    uint64_t sum() const {
+        return m_sum.load(std::memory_order_relaxed);
+    }
+
+    /* 平均值 */
+    uint64_t avg() const {
+        uint64_t count = this->count();
+        return count ? m_sum.load(std::memory_order_relaxed) / count : 0;
+    }
+
+    /* 第i个桶的次数 */
+    uint64_t bucket(size_t i) const {
+        return m_buckets[i].load(std::memory_order_relaxed);
+    }
+
+    /* 百分位数(按2的幂取上界)；percent为0~100，没有记录时返回0 */
+    uint64_t percentile(double percent) const {
+        uint64_t total = 0;
+        for (size_t i = 0; i < BUCKETS; ++i) {
+            total += bucket(i);
+        }
+        if (total == 0) {
+            return 0;
+        }
+        uint64_t target = (uint64_t)(total * percent / 100);
+        uint64_t count = 0;
+        for (size_t i = 0; i < BUCKETS; ++i) {
+            count += bucket(i);
+            if (count > target || count == total) {
+                return 1ull << i;
+            }
+        }
+        return 1ull << (BUCKETS - 1);
+    }
+
+private:
+    static void Add(std::atomic<uint64_t> &value, uint64_t delta) {
+        value.store(value.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<uint64_t> m_buckets[BUCKETS];
+    std::atomic<uint64_t> m_count = {0};
+    std::atomic<uint64_t> m_sum = {0};
+};
+} // namespace webs
+
+#endif
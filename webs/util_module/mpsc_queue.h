@@ -0,0 +1,75 @@
+#ifndef __WEBS_MPSC_QUEUE_H__
+#define __WEBS_MPSC_QUEUE_H__
+
+#include <atomic>
+
+#include "Noncopyable.h"
+
+namespace webs {
+/* 侵入式MPSC队列的节点；需要入队的对象继承(或内嵌)该节点，入队时不需要额外分配内存 */
+struct MpscNode {
+    std::atomic<MpscNode *> next = {nullptr};
+};
+
+/**
+ * 无锁的多生产者单消费者队列(Vyukov intrusive MPSC)
+ * push可以被任意线程并发调用，只需要一次原子交换；pop同一时刻只能有一个消费者调用
+ * 节点的内存由调用者管理，队列本身不分配内存
+ */
+class MpscQueue : Noncopyable {
+public:
+    MpscQueue() :
+        m_head(&m_stub), m_tail(&m_stub) {
+    }
+
+    /* 入队；任意线程调用 */
+    void push(MpscNode *node) {
+        node->next.store(nullptr, std::memory_order_relaxed);
+        MpscNode *prev = m_head.exchange(node, std::memory_order_acq_rel);
+        // 在这一步完成之前，消费者看不到node以及之后入队的节点
+        prev->next.store(node, std::memory_order_release);
+    }
+
+    /**
+     * 出队；只能由消费者调用
+     * 返回nullptr表示队列为空，或者有生产者正在入队(稍后重试即可)
+     */
+    MpscNode *pop() {
+        MpscNode *tail = m_tail;
+        MpscNode *next = tail->next.load(std::memory_order_acquire);
+        if (tail == &m_stub) {
+            if (!next) {
+                return nullptr;
+            }
+            m_tail = next;
+            tail = next;
+            next = next->next.load(std::memory_order_acquire);
+        }
+        if (next) {
+            m_tail = next;
+            return tail;
+        }
+        if (tail != m_head.load(std::memory_order_acquire)) {
+            return nullptr;
+        }
+        // tail是最后一个节点，放回stub之后才能把tail取出
+        push(&m_stub);
+        next = tail->next.load(std::memory_order_acquire);
+        if (next) {
+            m_tail = next;
+            return tail;
+        }
+        return nullptr;
+    }
+
+private:
+    // 生产者入队的位置
+    std::atomic<MpscNode *> m_head;
+    // 消费者出队的位置
+    MpscNode *m_tail;
+    // 哨兵节点
+    MpscNode m_stub;
+};
+}; // namespace webs
+
+#endif
@@ -257,7 +257,7 @@ private:
     volatile std::atomic_flag m_lock;
 };
 
-/// 还有协程锁没有写
+/// 协程锁见 coroutine_module/fiber_sync.h
 }; // namespace webs
 
 #endif
\ No newline at end of file
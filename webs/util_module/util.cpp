@@ -1,4 +1,5 @@
 #include <sys/time.h>
+#include <time.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
@@ -29,6 +30,13 @@ namespace webs
         return webs::Fiber::GetFiberId();
     }
 
+    uint64_t GetCurrentUS()
+    {
+        struct timeval val;
+        gettimeofday(&val, NULL);
+        return val.tv_sec * 1000000ul + val.tv_usec;
+    }
+
     uint64_t GetCurrentMS()
     {
         struct timeval val;
@@ -36,6 +44,60 @@ namespace webs
         return val.tv_sec * 1000ul + val.tv_usec / 1000;
     }
 
+    static uint64_t ClockMS(clockid_t id)
+    {
+        struct timespec ts;
+        clock_gettime(id, &ts);
+        return ts.tv_sec * 1000ul + ts.tv_nsec / 1000000;
+    }
+
+    uint64_t GetMonotonicMS()
+    {
+        return ClockMS(CLOCK_MONOTONIC);
+    }
+
+    uint64_t GetMonotonicUS()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1000000ul + ts.tv_nsec / 1000;
+    }
+
+    static thread_local CoarseClock *t_coarse_clock = nullptr;
+
+    void CoarseClock::update()
+    {
+        uint64_t now = ClockMS(CLOCK_MONOTONIC_COARSE);
+        uint64_t old = m_monotonicMS.load(std::memory_order_relaxed);
+        while (old < now && !m_monotonicMS.compare_exchange_weak(old, now, std::memory_order_relaxed))
+        {
+        }
+        m_realtimeMS.store(ClockMS(CLOCK_REALTIME_COARSE), std::memory_order_relaxed);
+    }
+
+    void CoarseClock::SetThis(CoarseClock *clock)
+    {
+        t_coarse_clock = clock;
+    }
+
+    void CoarseClock::Refresh()
+    {
+        if (t_coarse_clock)
+        {
+            t_coarse_clock->update();
+        }
+    }
+
+    uint64_t CoarseClock::NowMS()
+    {
+        return t_coarse_clock ? t_coarse_clock->monotonicMS() : ClockMS(CLOCK_MONOTONIC_COARSE);
+    }
+
+    uint64_t CoarseClock::RealtimeMS()
+    {
+        return t_coarse_clock ? t_coarse_clock->realtimeMS() : ClockMS(CLOCK_REALTIME_COARSE);
+    }
+
     /* 查找指定路径下的后缀为subfix的所有常规文件路径；files是传出参数 */
     void FSUtil::ListAllFile(std::vector<std::string> &files,
                              const std::string &path, const std::string &subfix)
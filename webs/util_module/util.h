@@ -3,6 +3,7 @@
 
 #include <vector>
 #include <string>
+#include <atomic>
 #include <iostream>
 #include <cxxabi.h>
 #include <json/json.h>
@@ -28,6 +29,59 @@ uint64_t GetCurrentUS();
 
 uint64_t GetCurrentMS();
 
+/* 单调时钟(ms)，CLOCK_MONOTONIC；不受系统时间调整的影响，定时器使用 */
+uint64_t GetMonotonicMS();
+
+/* 单调时钟(us)；统计排队、调度延迟等时间间隔使用 */
+uint64_t GetMonotonicUS();
+
+/**
+ * 缓存的粗粒度时钟；每个IOManager一个，idle每轮从CLOCK_MONOTONIC_COARSE/CLOCK_REALTIME_COARSE更新一次
+ * 一直有任务、不进入idle的线程由调度循环每执行一批任务刷新一次
+ * IOManager的线程读取自己调度器的缓存，只需要一次load；其他线程直接读取粗粒度时钟
+ * 精度为一个tick加上距离上次idle的时间，适合日志、连接过期这类不需要精确时间的场合
+ */
+class CoarseClock {
+public:
+    CoarseClock() {
+        update();
+    }
+
+    /* 重新读取时钟；多个线程同时更新时单调时间不会回退 */
+    void update();
+
+    /* 单调时间(ms) */
+    uint64_t monotonicMS() const {
+        return m_monotonicMS.load(std::memory_order_relaxed);
+    }
+
+    /* 墙上时间(ms) */
+    uint64_t realtimeMS() const {
+        return m_realtimeMS.load(std::memory_order_relaxed);
+    }
+
+    /* 设置当前线程使用的缓存；nullptr表示直接读取时钟 */
+    static void SetThis(CoarseClock *clock);
+
+    /* 更新当前线程使用的缓存；没有设置缓存时什么都不做 */
+    static void Refresh();
+
+    /* 当前线程的单调时间(ms) */
+    static uint64_t NowMS();
+
+    /* 当前线程的墙上时间(ms) */
+    static uint64_t RealtimeMS();
+
+    /* 当前线程的墙上时间(s)；代替time(0) */
+    static time_t RealtimeSec() {
+        return RealtimeMS() / 1000;
+    }
+
+private:
+    std::atomic<uint64_t> m_monotonicMS = {0};
+    std::atomic<uint64_t> m_realtimeMS = {0};
+};
+
 std::string Time2Str(time_t ts = time(0), const std::string &format = "%Y-%m-%d %H:%M:%S");
 class FSUtil {
 public:
@@ -6,10 +6,19 @@
 #include "./config_module/env.h"
 
 // coroutine_module
+#include "./coroutine_module/cancel_token.h"
+#include "./coroutine_module/channel.h"
+#include "./coroutine_module/co_task.h"
+#include "./coroutine_module/fcontext.h"
 #include "./coroutine_module/fiber.h"
+#include "./coroutine_module/fiber_local.h"
+#include "./coroutine_module/fiber_sync.h"
 #include "./coroutine_module/hook.h"
 #include "./coroutine_module/scheduler.h"
 #include "./coroutine_module/fd_manager.h"
+#include "./coroutine_module/stack_allocator.h"
+#include "./coroutine_module/task.h"
+#include "./coroutine_module/task_group.h"
 
 // http_module
 #include "./http_module/servlet.h"
@@ -28,6 +37,7 @@
 #include "./log_module/log.h"
 
 // thread_module
+#include "./thread_module/affinity.h"
 #include "./thread_module/thread.h"
 
 // util_module
@@ -38,6 +48,9 @@
 #include "./util_module/util.h"
 #include "./util_module/bytearray.h"
 #include "./util_module/endian.h"
+#include "./util_module/mpsc_queue.h"
+#include "./util_module/fd_table.h"
+#include "./util_module/histogram.h"
 
 // io_module
 #include "./io_module/timer.h"